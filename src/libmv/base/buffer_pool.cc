@@ -0,0 +1,254 @@
+// Copyright (c) 2020 libmv authors.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#include "libmv/base/buffer_pool.h"
+
+#include <atomic>
+#include <cassert>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include "libmv/base/aligned_malloc.h"
+
+namespace libmv {
+
+namespace {
+
+// Stored in front of every buffer, the buffer starts at the next multiple of
+// the alignment.
+struct BufferHeader {
+  // Usable size of the buffer.
+  size_t size;
+
+  // Index of the size class, or -1 for buffers which are not pooled.
+  int size_class;
+};
+
+static_assert(sizeof(BufferHeader) <= kBufferPoolAlignment,
+              "Buffer header does not fit in front of the buffer");
+
+// Four classes for every power of two.
+const int kNumSizeClasses = 4 * 64;
+
+std::atomic<int64_t> hits(0);
+std::atomic<int64_t> misses(0);
+std::atomic<int64_t> bytes_in_use(0);
+std::atomic<int64_t> bytes_pooled(0);
+std::atomic<size_t> max_pooled_bytes(256 * 1024 * 1024);
+
+// Index of the smallest size class which fits size, and the size of the
+// class.
+int SizeClass(size_t size, size_t* class_size) {
+  int exponent = 0;
+  while ((size_t(1) << (exponent + 1)) <= size) {
+    exponent++;
+  }
+  const size_t power = size_t(1) << exponent;
+  const size_t quarter = power / 4;
+  int step = (size - power + quarter - 1) / quarter;
+  if (step == 4) {
+    exponent++;
+    step = 0;
+  }
+  *class_size = (size_t(1) << exponent) + step * ((size_t(1) << exponent) / 4);
+  return 4 * exponent + step;
+}
+
+BufferHeader* HeaderOf(void* buffer) {
+  return reinterpret_cast<BufferHeader*>(static_cast<char*>(buffer) -
+                                         kBufferPoolAlignment);
+}
+
+void* AllocateBuffer(size_t size, int size_class) {
+  char* memory = static_cast<char*>(
+      aligned_malloc(kBufferPoolAlignment + size, kBufferPoolAlignment));
+  if (memory == NULL) {
+    return NULL;
+  }
+  BufferHeader* header = reinterpret_cast<BufferHeader*>(memory);
+  header->size = size;
+  header->size_class = size_class;
+  return memory + kBufferPoolAlignment;
+}
+
+void FreeBuffer(void* buffer) { aligned_free(HeaderOf(buffer)); }
+
+class ThreadBufferPool;
+
+// Pools of all the live threads, so they can be released from any thread.
+// The set is never destroyed, threads can exit after the static destructors
+// have run.
+std::mutex pools_mutex;
+std::set<ThreadBufferPool*>* pools = new std::set<ThreadBufferPool*>();
+
+// Reserve size bytes of the global high-water mark for a free buffer.
+bool ReservePooledBytes(size_t size) {
+  int64_t pooled = bytes_pooled;
+  do {
+    if (static_cast<size_t>(pooled) + size > max_pooled_bytes) {
+      return false;
+    }
+  } while (!bytes_pooled.compare_exchange_weak(pooled, pooled + size));
+  return true;
+}
+
+class ThreadBufferPool {
+ public:
+  explicit ThreadBufferPool(bool* destroyed) : destroyed_(destroyed) {
+    std::lock_guard<std::mutex> lock(pools_mutex);
+    pools->insert(this);
+  }
+
+  ~ThreadBufferPool() {
+    {
+      std::lock_guard<std::mutex> lock(pools_mutex);
+      pools->erase(this);
+    }
+    Release();
+    *destroyed_ = true;
+  }
+
+  void* Take(int size_class) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<void*>& free_list = free_lists_[size_class];
+    if (free_list.empty()) {
+      return NULL;
+    }
+    void* buffer = free_list.back();
+    free_list.pop_back();
+    bytes_pooled -= HeaderOf(buffer)->size;
+    return buffer;
+  }
+
+  // Returns false when the buffer would make the free buffers of all the
+  // threads larger than the high-water mark.
+  bool Put(void* buffer) {
+    const BufferHeader* header = HeaderOf(buffer);
+    if (!ReservePooledBytes(header->size)) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_lists_[header->size_class].push_back(buffer);
+    return true;
+  }
+
+  void Release() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int i = 0; i < kNumSizeClasses; ++i) {
+      for (int j = 0; j < free_lists_[i].size(); ++j) {
+        bytes_pooled -= HeaderOf(free_lists_[i][j])->size;
+        FreeBuffer(free_lists_[i][j]);
+      }
+      free_lists_[i].clear();
+    }
+  }
+
+ private:
+  // Only contended when another thread releases all the pools.
+  std::mutex mutex_;
+  std::vector<void*> free_lists_[kNumSizeClasses];
+  bool* destroyed_;
+};
+
+// Pool of the calling thread, or NULL when the thread is exiting and its pool
+// was already destroyed, which happens for the images destroyed at exit.
+ThreadBufferPool* CurrentThreadPool() {
+  static thread_local bool destroyed = false;
+  if (destroyed) {
+    return NULL;
+  }
+  static thread_local ThreadBufferPool pool(&destroyed);
+  return &pool;
+}
+
+}  // namespace
+
+void* BufferPoolAllocate(size_t size) {
+  if (size < kBufferPoolMinPooledSize) {
+    void* buffer = AllocateBuffer(size, -1);
+    bytes_in_use += size;
+    return buffer;
+  }
+
+  size_t class_size;
+  const int size_class = SizeClass(size, &class_size);
+  assert(size_class < kNumSizeClasses);
+
+  ThreadBufferPool* pool = CurrentThreadPool();
+  void* buffer = pool ? pool->Take(size_class) : NULL;
+  if (buffer) {
+    hits++;
+  } else {
+    misses++;
+    buffer = AllocateBuffer(class_size, size_class);
+    if (buffer == NULL) {
+      return NULL;
+    }
+  }
+  bytes_in_use += class_size;
+  return buffer;
+}
+
+void BufferPoolFree(void* buffer) {
+  if (buffer == NULL) {
+    return;
+  }
+  const BufferHeader* header = HeaderOf(buffer);
+  bytes_in_use -= header->size;
+  if (header->size_class >= 0) {
+    ThreadBufferPool* pool = CurrentThreadPool();
+    if (pool && pool->Put(buffer)) {
+      return;
+    }
+  }
+  FreeBuffer(buffer);
+}
+
+void SetBufferPoolMaxPooledBytes(size_t bytes) { max_pooled_bytes = bytes; }
+
+size_t GetBufferPoolMaxPooledBytes() { return max_pooled_bytes; }
+
+BufferPoolStats GetBufferPoolStats() {
+  BufferPoolStats stats;
+  stats.hits = hits;
+  stats.misses = misses;
+  stats.bytes_in_use = bytes_in_use;
+  stats.bytes_pooled = bytes_pooled;
+  return stats;
+}
+
+void ReleaseBufferPool() {
+  ThreadBufferPool* pool = CurrentThreadPool();
+  if (pool) {
+    pool->Release();
+  }
+}
+
+void ReleaseAllBufferPools() {
+  std::lock_guard<std::mutex> lock(pools_mutex);
+  for (std::set<ThreadBufferPool*>::iterator it = pools->begin();
+       it != pools->end();
+       ++it) {
+    (*it)->Release();
+  }
+}
+
+}  // namespace libmv
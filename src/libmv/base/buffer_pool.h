@@ -0,0 +1,89 @@
+// Copyright (c) 2020 libmv authors.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#ifndef LIBMV_BASE_BUFFER_POOL_H_
+#define LIBMV_BASE_BUFFER_POOL_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace libmv {
+
+// Pool of memory buffers for the images.
+//
+// Tracking and detection allocate and free many temporary images of the
+// size of the frame. Freeing such large buffers returns the memory to the
+// system, and the next allocation has to fault the pages in again. Instead,
+// freed buffers are kept in free lists of the thread which freed them, and
+// are reused by the next allocation of the same size class on that thread.
+//
+// Sizes of the classes grow by a quarter of the power of two, so a buffer
+// wastes at most 25% of its size. Small buffers are not pooled, malloc
+// handles them well.
+
+// Alignment of all the buffers, in bytes.
+const int kBufferPoolAlignment = 64;
+
+// Buffers smaller than this are not pooled.
+const size_t kBufferPoolMinPooledSize = 64 * 1024;
+
+struct BufferPoolStats {
+  // Allocations of pooled sizes which reused a free buffer, and which had to
+  // allocate new memory.
+  int64_t hits;
+  int64_t misses;
+
+  // Bytes of the buffers which are allocated and not freed, including the
+  // ones which are not pooled.
+  int64_t bytes_in_use;
+
+  // Bytes of the free buffers kept by all threads.
+  int64_t bytes_pooled;
+};
+
+// Allocate a buffer of at least size bytes, aligned to kBufferPoolAlignment.
+// The memory is not initialized.
+void* BufferPoolAllocate(size_t size);
+
+// Free buffer allocated by BufferPoolAllocate(). The buffer is kept in the
+// free list of the calling thread, unless this would make the free buffers
+// of all the threads larger than the high-water mark. NULL is ignored.
+void BufferPoolFree(void* buffer);
+
+// High-water mark of the bytes of free buffers kept by all the threads
+// together. The default is 256 MB. Setting it to zero disables the pooling,
+// lowering it does not free the buffers which are already pooled.
+void SetBufferPoolMaxPooledBytes(size_t max_pooled_bytes);
+size_t GetBufferPoolMaxPooledBytes();
+
+// Statistics summed over all threads.
+BufferPoolStats GetBufferPoolStats();
+
+// Free all buffers kept by the calling thread. Buffers of a thread are also
+// freed when the thread exits.
+void ReleaseBufferPool();
+
+// Free all buffers kept by all the threads, for example to trim the memory
+// after the worker threads are done with a sequence.
+void ReleaseAllBufferPools();
+
+}  // namespace libmv
+
+#endif  // LIBMV_BASE_BUFFER_POOL_H_
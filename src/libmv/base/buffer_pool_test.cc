@@ -0,0 +1,179 @@
+// Copyright (c) 2009 libmv authors.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#include "libmv/base/buffer_pool.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include "testing/testing.h"
+
+namespace libmv {
+namespace {
+
+const size_t kPooledSize = 1024 * 1024;
+
+TEST(BufferPool, BuffersAreAligned) {
+  const size_t sizes[] = {1, 100, kPooledSize, kPooledSize + 3};
+  for (int i = 0; i < 4; ++i) {
+    void* buffer = BufferPoolAllocate(sizes[i]);
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(buffer) % kBufferPoolAlignment);
+    BufferPoolFree(buffer);
+  }
+  ReleaseBufferPool();
+}
+
+TEST(BufferPool, FreedBufferIsReused) {
+  void* buffer = BufferPoolAllocate(kPooledSize);
+  BufferPoolFree(buffer);
+
+  BufferPoolStats stats = GetBufferPoolStats();
+  // Slightly smaller size falls into the same size class.
+  void* reused = BufferPoolAllocate(kPooledSize - 100);
+  EXPECT_EQ(buffer, reused);
+  EXPECT_EQ(stats.hits + 1, GetBufferPoolStats().hits);
+  EXPECT_EQ(stats.misses, GetBufferPoolStats().misses);
+
+  BufferPoolFree(reused);
+  ReleaseBufferPool();
+}
+
+TEST(BufferPool, SmallBuffersAreNotPooled) {
+  BufferPoolStats stats = GetBufferPoolStats();
+  void* buffer = BufferPoolAllocate(kBufferPoolMinPooledSize - 1);
+  EXPECT_EQ(stats.bytes_in_use + kBufferPoolMinPooledSize - 1,
+            GetBufferPoolStats().bytes_in_use);
+  BufferPoolFree(buffer);
+  EXPECT_EQ(stats.bytes_in_use, GetBufferPoolStats().bytes_in_use);
+  EXPECT_EQ(stats.bytes_pooled, GetBufferPoolStats().bytes_pooled);
+  EXPECT_EQ(stats.hits, GetBufferPoolStats().hits);
+  EXPECT_EQ(stats.misses, GetBufferPoolStats().misses);
+}
+
+TEST(BufferPool, Stats) {
+  BufferPoolStats stats = GetBufferPoolStats();
+  void* buffer = BufferPoolAllocate(kPooledSize);
+  EXPECT_EQ(stats.misses + 1, GetBufferPoolStats().misses);
+  EXPECT_EQ(stats.bytes_in_use + kPooledSize,
+            GetBufferPoolStats().bytes_in_use);
+
+  BufferPoolFree(buffer);
+  EXPECT_EQ(stats.bytes_in_use, GetBufferPoolStats().bytes_in_use);
+  EXPECT_EQ(stats.bytes_pooled + kPooledSize,
+            GetBufferPoolStats().bytes_pooled);
+
+  ReleaseBufferPool();
+  EXPECT_EQ(stats.bytes_pooled, GetBufferPoolStats().bytes_pooled);
+}
+
+TEST(BufferPool, SizeClassesWasteAtMostAQuarter) {
+  const size_t sizes[] = {kPooledSize + 1,
+                          kPooledSize * 5 / 4 + 1,
+                          kPooledSize * 3 / 2 + 1,
+                          kPooledSize * 7 / 4 + 1};
+  for (int i = 0; i < 4; ++i) {
+    BufferPoolStats stats = GetBufferPoolStats();
+    void* buffer = BufferPoolAllocate(sizes[i]);
+    const int64_t size = GetBufferPoolStats().bytes_in_use - stats.bytes_in_use;
+    EXPECT_LE(sizes[i], size);
+    EXPECT_LE(size, sizes[i] * 5 / 4);
+    BufferPoolFree(buffer);
+  }
+  ReleaseBufferPool();
+}
+
+TEST(BufferPool, MaxPooledBytes) {
+  const size_t max_pooled_bytes = GetBufferPoolMaxPooledBytes();
+
+  SetBufferPoolMaxPooledBytes(0);
+  BufferPoolStats stats = GetBufferPoolStats();
+  BufferPoolFree(BufferPoolAllocate(kPooledSize));
+  EXPECT_EQ(stats.bytes_pooled, GetBufferPoolStats().bytes_pooled);
+  BufferPoolFree(BufferPoolAllocate(kPooledSize));
+  EXPECT_EQ(stats.misses + 2, GetBufferPoolStats().misses);
+
+  // Only one of the buffers fits in the pool.
+  SetBufferPoolMaxPooledBytes(kPooledSize);
+  void* first = BufferPoolAllocate(kPooledSize);
+  void* second = BufferPoolAllocate(kPooledSize);
+  BufferPoolFree(first);
+  BufferPoolFree(second);
+  EXPECT_EQ(stats.bytes_pooled + kPooledSize,
+            GetBufferPoolStats().bytes_pooled);
+
+  ReleaseBufferPool();
+  SetBufferPoolMaxPooledBytes(max_pooled_bytes);
+}
+
+TEST(BufferPool, MaxPooledBytesIsSharedByThreads) {
+  const size_t max_pooled_bytes = GetBufferPoolMaxPooledBytes();
+  SetBufferPoolMaxPooledBytes(kPooledSize);
+  BufferPoolStats stats = GetBufferPoolStats();
+
+  // The pool of this thread is full, so the buffer freed by the other
+  // thread does not fit in its pool.
+  BufferPoolFree(BufferPoolAllocate(kPooledSize));
+  std::thread thread([] { BufferPoolFree(BufferPoolAllocate(kPooledSize)); });
+  thread.join();
+  EXPECT_EQ(stats.bytes_pooled + kPooledSize,
+            GetBufferPoolStats().bytes_pooled);
+
+  ReleaseBufferPool();
+  SetBufferPoolMaxPooledBytes(max_pooled_bytes);
+}
+
+TEST(BufferPool, ReleaseAllBufferPools) {
+  BufferPoolStats stats = GetBufferPoolStats();
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  bool freed = false, released = false;
+
+  // The buffer stays in the pool of the other thread until it exits.
+  std::thread thread([&] {
+    BufferPoolFree(BufferPoolAllocate(kPooledSize));
+    std::unique_lock<std::mutex> lock(mutex);
+    freed = true;
+    condition.notify_all();
+    condition.wait(lock, [&] { return released; });
+  });
+  BufferPoolFree(BufferPoolAllocate(kPooledSize));
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [&] { return freed; });
+  }
+  EXPECT_EQ(stats.bytes_pooled + 2 * kPooledSize,
+            GetBufferPoolStats().bytes_pooled);
+
+  ReleaseAllBufferPools();
+  EXPECT_EQ(stats.bytes_pooled, GetBufferPoolStats().bytes_pooled);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    released = true;
+    condition.notify_all();
+  }
+  thread.join();
+}
+
+}  // namespace
+}  // namespace libmv
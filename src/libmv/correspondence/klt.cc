@@ -178,8 +178,18 @@ bool KLTContext::TrackFeature(ImagePyramid* pyramid1,
     position1(1) = feature1.coords(1) / pow(2., i);
     position2 *= 2;
 
-    bool succeeded = TrackFeatureOneLevel(
-        pyramid1->Level(i), position1, pyramid2->Level(i), &position2);
+    // Levels of pyramids stored as half floats are sampled directly, so the
+    // pyramids do not keep float copies of them.
+    const HalfImage* half_level1 = pyramid1->HalfLevel(i);
+    const HalfImage* half_level2 = pyramid2->HalfLevel(i);
+    bool succeeded;
+    if (half_level1 && half_level2) {
+      succeeded = TrackFeatureOneLevel(
+          *half_level1, position1, *half_level2, &position2);
+    } else {
+      succeeded = TrackFeatureOneLevel(
+          pyramid1->Level(i), position1, pyramid2->Level(i), &position2);
+    }
     if (i == 0 && !succeeded) {
       // Only fail on the highest-resolution level, because a failure on a
       // coarse level does not mean failure at a lower level (consider
@@ -193,8 +203,9 @@ bool KLTContext::TrackFeature(ImagePyramid* pyramid1,
 
 // Compute the gradient matrix noted by Z and the error vector e.
 // See Good Features to Track.
-static void ComputeTrackingEquation(const Array3Df& image_and_gradient1,
-                                    const Array3Df& image_and_gradient2,
+template <typename Image>
+static void ComputeTrackingEquation(const Image& image_and_gradient1,
+                                    const Image& image_and_gradient2,
                                     const Vec2& position1,
                                     const Vec2& position2,
                                     int half_width,
@@ -253,20 +264,27 @@ static bool SolveTrackingEquation(float gxx,
   return true;
 }
 
-bool KLTContext::TrackFeatureOneLevel(const Array3Df& image_and_gradient1,
-                                      const Vec2& position1,
-                                      const Array3Df& image_and_gradient2,
-                                      Vec2* position2) {
+// Iterate the tracking equation at one pyramid level. Levels stored as floats
+// and as half floats are sampled the same way, see SampleLinear().
+template <typename Image>
+static bool TrackOneLevel(const Image& image_and_gradient1,
+                          const Vec2& position1,
+                          const Image& image_and_gradient2,
+                          int half_window_size,
+                          int max_iterations,
+                          float min_determinant,
+                          double min_update_squared_distance,
+                          Vec2* position2) {
   int i;
   float dx = 0, dy = 0;
-  for (i = 0; i < max_iterations_; ++i) {
+  for (i = 0; i < max_iterations; ++i) {
     // Compute gradient matrix and error vector.
     float gxx, gxy, gyy, ex, ey;
     ComputeTrackingEquation(image_and_gradient1,
                             image_and_gradient2,
                             position1,
                             *position2,
-                            HalfWindowSize(),
+                            half_window_size,
                             &gxx,
                             &gxy,
                             &gyy,
@@ -274,7 +292,7 @@ bool KLTContext::TrackFeatureOneLevel(const Array3Df& image_and_gradient1,
                             &ey);
     // Solve the linear system for deltad.
     if (!SolveTrackingEquation(
-            gxx, gxy, gyy, ex, ey, min_determinant_, &dx, &dy)) {
+            gxx, gxy, gyy, ex, ey, min_determinant, &dx, &dy)) {
       return false;
     }
 
@@ -285,15 +303,43 @@ bool KLTContext::TrackFeatureOneLevel(const Array3Df& image_and_gradient1,
     // TODO(keir): Handle other tracking failure conditions and pass the
     // reasons out to the caller. For example, for pyramid tracking a failure
     // at a coarse level suggests trying again at a finer level.
-    if (Square(dx) + Square(dy) < min_update_squared_distance_) {
+    if (Square(dx) + Square(dy) < min_update_squared_distance) {
       break;
     }
   }
 
-  if (i == max_iterations_) {
+  if (i == max_iterations) {
     // TODO(keir): Somehow indicate that we hit max iterations.
   }
   return true;
 }
 
+bool KLTContext::TrackFeatureOneLevel(const Array3Df& image_and_gradient1,
+                                      const Vec2& position1,
+                                      const Array3Df& image_and_gradient2,
+                                      Vec2* position2) {
+  return TrackOneLevel(image_and_gradient1,
+                       position1,
+                       image_and_gradient2,
+                       HalfWindowSize(),
+                       max_iterations_,
+                       min_determinant_,
+                       min_update_squared_distance_,
+                       position2);
+}
+
+bool KLTContext::TrackFeatureOneLevel(const HalfImage& image_and_gradient1,
+                                      const Vec2& position1,
+                                      const HalfImage& image_and_gradient2,
+                                      Vec2* position2) {
+  return TrackOneLevel(image_and_gradient1,
+                       position1,
+                       image_and_gradient2,
+                       HalfWindowSize(),
+                       max_iterations_,
+                       min_determinant_,
+                       min_update_squared_distance_,
+                       position2);
+}
+
 }  // namespace libmv
@@ -71,6 +71,12 @@ class KLTContext {
                             const FloatImage &image_and_gradient2,
                             Vec2 *position2);
 
+  // Same as above for levels of pyramids stored as half floats.
+  bool TrackFeatureOneLevel(const HalfImage &image_and_gradient1,
+                            const Vec2 &position1,
+                            const HalfImage &image_and_gradient2,
+                            Vec2 *position2);
+
   int HalfWindowSize() { return half_window_size_; }
   int WindowSize() { return 2 * HalfWindowSize() + 1; }
 
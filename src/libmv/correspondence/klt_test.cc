@@ -100,4 +100,63 @@ TEST(KLTContext, TrackFeature) {
   delete pyramid2;
 }
 
+// Pyramid which counts the calls of Level() of the pyramid it wraps.
+class LevelCountingPyramid : public ImagePyramid {
+ public:
+  explicit LevelCountingPyramid(ImagePyramid* pyramid)
+      : num_level_calls(0), pyramid_(pyramid) {}
+  virtual ~LevelCountingPyramid() { delete pyramid_; }
+
+  virtual const FloatImage& Level(int i) {
+    num_level_calls++;
+    return pyramid_->Level(i);
+  }
+  virtual const HalfImage* HalfLevel(int i) {
+    return pyramid_->HalfLevel(i);
+  }
+  virtual const FloatImage& DownsampledImage(int i) {
+    return pyramid_->DownsampledImage(i);
+  }
+  virtual int NumLevels() const { return pyramid_->NumLevels(); }
+  virtual int MemorySizeInBytes() const {
+    return pyramid_->MemorySizeInBytes();
+  }
+
+  int num_level_calls;
+
+ private:
+  ImagePyramid* pyramid_;
+};
+
+TEST(KLTContext, TrackFeatureOnHalfPyramids) {
+  Array3Df image1(128, 64);
+  image1.Fill(0);
+  Array3Df image2(128, 64);
+  image2.Fill(0);
+
+  int x0 = 32, y0 = 64;
+  int dx = 3, dy = 5;
+  image1(y0, x0) = 1.0f;
+  image2(y0 + dy, x0 + dx) = 1.0f;
+
+  int pyramid_levels = 3;
+  LevelCountingPyramid pyramid1(
+      MakeImagePyramid(image1, pyramid_levels, 0.9, PYRAMID_HALF));
+  LevelCountingPyramid pyramid2(
+      MakeImagePyramid(image2, pyramid_levels, 0.9, PYRAMID_HALF));
+
+  KLTContext klt;
+  KLTPointFeature feature1, feature2;
+  feature1.coords << x0, y0;
+  feature2.coords << x0, y0;
+  EXPECT_TRUE(klt.TrackFeature(&pyramid1, feature1, &pyramid2, &feature2));
+
+  EXPECT_NEAR(feature2.coords(0), x0 + dx, 0.01);
+  EXPECT_NEAR(feature2.coords(1), y0 + dy, 0.01);
+
+  // The half levels are sampled, no float copies of them are made.
+  EXPECT_EQ(0, pyramid1.num_level_calls);
+  EXPECT_EQ(0, pyramid2.num_level_calls);
+}
+
 }  // namespace
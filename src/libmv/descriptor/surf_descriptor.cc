@@ -166,7 +166,7 @@ class SurfDescriber : public Describer {
     // TODO(keir): Make the descriptor data the SURF detector integral image.
     (void)detector_data;
 
-    Matu integral_image;
+    Array3D<int64_t> integral_image;
     IntegralImage(*(image.AsArray3Du()), &integral_image);
 
     descriptors->resize(features.size());
@@ -41,7 +41,7 @@ class SurfDetector : public Detector {
     ByteImage* byte_image = image.AsArray3Du();
     // TODO(pmoulon) Assert that byte_image is valid.
 
-    Matu integral_image;
+    Array3D<int64_t> integral_image;
     IntegralImage(*byte_image, &integral_image);
 
     libmv::vector<PointFeature> detections;
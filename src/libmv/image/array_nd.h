@@ -21,16 +21,38 @@
 #ifndef LIBMV_IMAGE_ARRAY_ND_H
 #define LIBMV_IMAGE_ARRAY_ND_H
 
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <cstring>
+#include <type_traits>
 
+#include "libmv/base/buffer_pool.h"
 #include "libmv/image/tuple.h"
 
 namespace libmv {
 
 class BaseArray {};
 
+/// How the elements of an array are laid out in the memory.
+enum ArrayStorage {
+  /// Elements are densely packed one after another.
+  DENSE_STORAGE,
+
+  /// Stride of the first axis (rows of the images) is padded to a multiple
+  /// of kArrayAlignment bytes. Data is aligned to it as well, so every row
+  /// starts at a new cache line, so vector instructions can use aligned
+  /// loads and rows do not share cache lines. Such arrays are not
+  /// contiguous, the elements have to be accessed using the strides.
+  ///
+  /// Only for types which do not need a constructor, the memory is not
+  /// initialized.
+  ALIGNED_STORAGE,
+};
+
+/// Alignment of the data and rows of arrays with ALIGNED_STORAGE, in bytes.
+const int kArrayAlignment = 64;
+
 /// A multidimensional array class.
 template <typename T, int N>
 class ArrayND : public BaseArray {
@@ -41,35 +63,83 @@ class ArrayND : public BaseArray {
   typedef Tuple<int, N> Index;
 
   /// Create an empty array.
-  ArrayND() : data_(NULL), own_data_(true) { Resize(Index(0)); }
+  ArrayND() : data_(NULL), own_data_(true), storage_(DENSE_STORAGE) {
+    Resize(Index(0));
+  }
+
+  /// Create an empty array which uses the given storage once resized.
+  explicit ArrayND(ArrayStorage storage)
+      : data_(NULL), own_data_(true), storage_(storage) {
+    Resize(Index(0));
+  }
 
   /// Create an array with the specified shape.
-  ArrayND(const Index& shape) : data_(NULL), own_data_(true) { Resize(shape); }
+  ArrayND(const Index& shape)
+      : data_(NULL), own_data_(true), storage_(DENSE_STORAGE) {
+    Resize(shape);
+  }
 
   /// Create an array with the specified shape.
-  ArrayND(int* shape) : data_(NULL), own_data_(true) { Resize(shape); }
+  ArrayND(int* shape) : data_(NULL), own_data_(true), storage_(DENSE_STORAGE) {
+    Resize(shape);
+  }
 
-  /// Copy constructor.
-  ArrayND(const ArrayND<T, N>& b) : data_(NULL), own_data_(true) {
+  /// Copy constructor. The copy owns its data and uses the same storage as b.
+  /// Copies of views are contiguous.
+  ArrayND(const ArrayND<T, N>& b)
+      : data_(NULL), own_data_(true), storage_(b.storage_) {
     ResizeLike(b);
-    std::memcpy(Data(), b.Data(), sizeof(T) * Size());
+    CopyElements(b);
+  }
+
+  /// Move constructor takes the data of b, which is left empty. Moving a view
+  /// gives a view of the same data.
+  ArrayND(ArrayND<T, N>&& b) noexcept
+      : shape_(b.shape_),
+        strides_(b.strides_),
+        data_(b.data_),
+        own_data_(b.own_data_),
+        storage_(b.storage_) {
+    b.shape_.Reset(0);
+    b.strides_.Reset(0);
+    b.data_ = NULL;
+    b.own_data_ = true;
   }
 
-  ArrayND(int s0) : data_(NULL), own_data_(true) { Resize(s0); }
-  ArrayND(int s0, int s1) : data_(NULL), own_data_(true) { Resize(s0, s1); }
-  ArrayND(int s0, int s1, int s2) : data_(NULL), own_data_(true) {
+  ArrayND(int s0) : data_(NULL), own_data_(true), storage_(DENSE_STORAGE) {
+    Resize(s0);
+  }
+  ArrayND(int s0, int s1)
+      : data_(NULL), own_data_(true), storage_(DENSE_STORAGE) {
+    Resize(s0, s1);
+  }
+  ArrayND(int s0, int s1, int s2)
+      : data_(NULL), own_data_(true), storage_(DENSE_STORAGE) {
     Resize(s0, s1, s2);
   }
 
   ArrayND(T* data, int s0, int s1, int s2)
-      : shape_(0), strides_(0), data_(data), own_data_(false) {
+      : shape_(0),
+        strides_(0),
+        data_(data),
+        own_data_(false),
+        storage_(DENSE_STORAGE) {
     Resize(s0, s1, s2);
   }
 
+  /// Create a view of the data with the given shape and strides, which are in
+  /// elements. The data is not copied and needs to outlive the array.
+  ArrayND(T* data, const Index& shape, const Index& strides)
+      : shape_(shape),
+        strides_(strides),
+        data_(data),
+        own_data_(false),
+        storage_(DENSE_STORAGE) {}
+
   /// Destructor deletes pixel data.
   ~ArrayND() {
     if (own_data_) {
-      delete[] data_;
+      FreeData();
     }
   }
 
@@ -77,7 +147,28 @@ class ArrayND : public BaseArray {
   ArrayND& operator=(const ArrayND<T, N>& b) {
     assert(this != &b);
     ResizeLike(b);
-    std::memcpy(Data(), b.Data(), sizeof(T) * Size());
+    CopyElements(b);
+    return *this;
+  }
+
+  /// Move assignment frees the data of this array and takes the data of b,
+  /// which is left empty. Assigning to a view makes it refer to the data of
+  /// b, nothing is written to the data of the view.
+  ArrayND& operator=(ArrayND<T, N>&& b) noexcept {
+    if (this != &b) {
+      if (own_data_) {
+        FreeData();
+      }
+      shape_ = b.shape_;
+      strides_ = b.strides_;
+      data_ = b.data_;
+      own_data_ = b.own_data_;
+      storage_ = b.storage_;
+      b.shape_.Reset(0);
+      b.strides_.Reset(0);
+      b.data_ = NULL;
+      b.own_data_ = true;
+    }
     return *this;
   }
 
@@ -97,14 +188,35 @@ class ArrayND : public BaseArray {
       strides_(i - 1) = strides_(i) * shape_(i);
     }
     if (own_data_) {
-      delete[] data_;
+      if (storage_ == ALIGNED_STORAGE && N > 1) {
+        // Pad the rows to the alignment.
+        const int elements_per_line = kArrayAlignment / sizeof(T);
+        strides_(0) = (strides_(0) + elements_per_line - 1) /
+                      elements_per_line * elements_per_line;
+      }
+      FreeData();
       data_ = NULL;
       if (Size() > 0) {
-        data_ = new T[Size()];
+        AllocateData(Shape(0) * Stride(0));
       }
     }
   }
 
+  /// Storage used by the array. Views use DENSE_STORAGE, and have the layout
+  /// given by their strides.
+  ArrayStorage Storage() const { return storage_; }
+
+  /// Change the storage of the array, the array becomes empty when the
+  /// storage changes. Has no effect for views.
+  void SetStorage(ArrayStorage storage) {
+    if (own_data_ && storage != storage_) {
+      FreeData();
+      data_ = NULL;
+      storage_ = storage;
+      Resize(Index(0));
+    }
+  }
+
   template <typename D>
   void ResizeLike(const ArrayND<D, N>& other) {
     Resize(other.Shape());
@@ -142,25 +254,28 @@ class ArrayND : public BaseArray {
   template <typename D>
   void CopyFrom(const ArrayND<D, N>& other) {
     ResizeLike(other);
-    T* data = Data();
-    const D* other_data = other.Data();
-    for (int i = 0; i < Size(); ++i) {
-      data[i] = T(other_data[i]);
+    const int run = std::min(ContiguousLength(), other.ContiguousLength());
+    for (int i = 0; i < Size(); i += run) {
+      T* data = Data() + ElementOffset(i);
+      const D* other_data = other.Data() + other.ElementOffset(i);
+      for (int j = 0; j < run; ++j) {
+        data[j] = T(other_data[j]);
+      }
     }
   }
 
   void Fill(T value) {
-    for (int i = 0; i < Size(); ++i) {
-      Data()[i] = value;
+    const int run = ContiguousLength();
+    for (int i = 0; i < Size(); i += run) {
+      T* data = Data() + ElementOffset(i);
+      for (int j = 0; j < run; ++j) {
+        data[j] = value;
+      }
     }
   }
 
   // Match Eigen's API.
-  void fill(T value) {
-    for (int i = 0; i < Size(); ++i) {
-      Data()[i] = value;
-    }
-  }
+  void fill(T value) { Fill(value); }
 
   /// Return a tuple containing the length of each axis.
   const Index& Shape() const { return shape_; }
@@ -180,7 +295,34 @@ class ArrayND : public BaseArray {
   }
 
   /// Return the total amount of memory used by the array.
-  int MemorySizeInBytes() const { return sizeof(*this) + Size() * sizeof(T); }
+  int MemorySizeInBytes() const {
+    // Padding of the rows is included.
+    const int size = own_data_ && Size() > 0 ? Shape(0) * Stride(0) : Size();
+    return sizeof(*this) + size * sizeof(T);
+  }
+
+  /// True if the array owns its data, false for views.
+  bool OwnsData() const { return own_data_; }
+
+  /// True if the elements are stored one after another without gaps, in the
+  /// row-major order. Views of a part of an array and arrays with padded rows
+  /// are usually not.
+  bool IsContiguous() const { return ContiguousLength() == Size(); }
+
+  /// Number of elements which are stored one after another, starting at
+  /// every multiple of it in the row-major order. This is Size() for
+  /// contiguous arrays, the size of the row for padded rows and cropped
+  /// images, and 1 when the last axis is strided.
+  int ContiguousLength() const {
+    int length = 1;
+    for (int i = N - 1; i >= 0; --i) {
+      if (Shape(i) > 1 && Stride(i) != length) {
+        break;
+      }
+      length *= Shape(i);
+    }
+    return std::max(length, 1);
+  }
 
   /// Pointer to the first element of the array.
   T* Data() { return data_; }
@@ -214,6 +356,17 @@ class ArrayND : public BaseArray {
     return i0 * Stride(0) + i1 * Stride(1) + i2 * Stride(2);
   }
 
+  /// Distance between the first element and the i-th element in the
+  /// row-major order, which is i for contiguous arrays.
+  int ElementOffset(int i) const {
+    int offset = 0;
+    for (int axis = N - 1; axis >= 0; --axis) {
+      offset += (i % Shape(axis)) * Stride(axis);
+      i /= Shape(axis);
+    }
+    return offset;
+  }
+
   /// Return a reference to the element at position index.
   T& operator()(const Index& index) {
     // TODO(pau) Boundary checking in debug mode.
@@ -283,11 +436,14 @@ class ArrayND : public BaseArray {
   bool operator==(const ArrayND<T, N>& other) const {
     if (shape_ != other.shape_)
       return false;
-    if (strides_ != other.strides_)
-      return false;
-    for (int i = 0; i < Size(); ++i) {
-      if (this->Data()[i] != other.Data()[i])
-        return false;
+    const int run = std::min(ContiguousLength(), other.ContiguousLength());
+    for (int i = 0; i < Size(); i += run) {
+      const T* data = Data() + ElementOffset(i);
+      const T* other_data = other.Data() + other.ElementOffset(i);
+      for (int j = 0; j < run; ++j) {
+        if (data[j] != other_data[j])
+          return false;
+      }
     }
     return true;
   }
@@ -301,12 +457,42 @@ class ArrayND : public BaseArray {
     ArrayND<T, N> res;
     res.ResizeLike(*this);
     for (int i = 0; i < res.Size(); ++i) {
-      res.Data()[i] = Data()[i] * other.Data()[i];
+      res.Data()[i] =
+          Data()[ElementOffset(i)] * other.Data()[other.ElementOffset(i)];
     }
     return res;
   }
 
  protected:
+  /// Copy elements of an array of the same shape.
+  void CopyElements(const ArrayND<T, N>& b) {
+    const int run = std::min(ContiguousLength(), b.ContiguousLength());
+    for (int i = 0; i < Size(); i += run) {
+      std::memcpy(Data() + ElementOffset(i),
+                  b.Data() + b.ElementOffset(i),
+                  sizeof(T) * run);
+    }
+  }
+
+  /// Elements which do not need a constructor are allocated from the buffer
+  /// pool, so the temporary images of the same size reuse memory. Such data
+  /// is aligned to kBufferPoolAlignment for both storages.
+  void AllocateData(int size) {
+    if (std::is_trivial<T>::value) {
+      data_ = static_cast<T*>(BufferPoolAllocate(sizeof(T) * size));
+    } else {
+      data_ = new T[size];
+    }
+  }
+
+  void FreeData() {
+    if (std::is_trivial<T>::value) {
+      BufferPoolFree(data_);
+    } else {
+      delete[] data_;
+    }
+  }
+
   /// The number of element in each dimension.
   Index shape_;
 
@@ -318,6 +504,9 @@ class ArrayND : public BaseArray {
 
   /// Flag if this Array either own or reference the data
   bool own_data_;
+
+  /// Layout of the owned data.
+  ArrayStorage storage_;
 };
 
 /// 3D array (row, column, channel).
@@ -327,9 +516,18 @@ class Array3D : public ArrayND<T, 3> {
 
  public:
   Array3D() : Base() {}
+  explicit Array3D(ArrayStorage storage) : Base(storage) {}
   Array3D(int height, int width, int depth = 1) : Base(height, width, depth) {}
+  Array3D(int height, int width, int depth, ArrayStorage storage)
+      : Base(storage) {
+    Resize(height, width, depth);
+  }
   Array3D(T* data, int height, int width, int depth = 1)
       : Base(data, height, width, depth) {}
+  Array3D(T* data,
+          const typename Base::Index& shape,
+          const typename Base::Index& strides)
+      : Base(data, shape, strides) {}
 
   void Resize(int height, int width, int depth = 1) {
     Base::Resize(height, width, depth);
@@ -347,6 +545,42 @@ class Array3D : public ArrayND<T, 3> {
 
   int Get_Step() const { return Width() * Depth(); }
 
+  /// Views of a part of the array, which refer to the data of this array
+  /// instead of copying it. The array needs to outlive its views, and must
+  /// not be resized while they are used.
+  ///
+  /// Views are strided, so they can be passed to the functions which access
+  /// the pixels using the strides or the parenthesis operator. Copying a view
+  /// copies the pixels to a new contiguous array.
+
+  /// View of the rectangle with the top-left corner at (y, x).
+  Array3D<T> Crop(int y, int x, int height, int width) {
+    assert(0 <= y && y + height <= Height());
+    assert(0 <= x && x + width <= Width());
+    return View(Base::Offset(y, x, 0), height, width, Depth(), Base::Stride(2));
+  }
+  const Array3D<T> Crop(int y, int x, int height, int width) const {
+    return const_cast<Array3D<T>*>(this)->Crop(y, x, height, width);
+  }
+
+  /// View of a single channel.
+  Array3D<T> Channel(int channel) {
+    assert(0 <= channel && channel < Depth());
+    return View(Base::Offset(0, 0, channel), Height(), Width(), 1, 1);
+  }
+  const Array3D<T> Channel(int channel) const {
+    return const_cast<Array3D<T>*>(this)->Channel(channel);
+  }
+
+  /// View of the rows [begin, end).
+  Array3D<T> Rows(int begin, int end) {
+    assert(0 <= begin && begin <= end && end <= Height());
+    return Crop(begin, 0, end - begin, Width());
+  }
+  const Array3D<T> Rows(int begin, int end) const {
+    return const_cast<Array3D<T>*>(this)->Rows(begin, end);
+  }
+
   /// Enable accessing with 2 indices for grayscale images.
   T& operator()(int i0, int i1, int i2 = 0) {
     assert(0 <= i0 && i0 < Height());
@@ -358,6 +592,16 @@ class Array3D : public ArrayND<T, 3> {
     assert(0 <= i1 && i1 < Width());
     return Base::operator()(i0, i1, i2);
   }
+
+ private:
+  Array3D<T> View(
+      int offset, int height, int width, int depth, int channel_stride) {
+    int shape[] = {height, width, depth};
+    int strides[] = {Base::Stride(0), Base::Stride(1), channel_stride};
+    return Array3D<T>(Base::Data() + offset,
+                      typename Base::Index(shape),
+                      typename Base::Index(strides));
+  }
 };
 
 typedef Array3D<unsigned char> Array3Du;
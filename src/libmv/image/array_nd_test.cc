@@ -19,6 +19,9 @@
 // IN THE SOFTWARE.
 
 #include "libmv/image/array_nd.h"
+
+#include <utility>
+
 #include "testing/testing.h"
 
 using libmv::Array3D;
@@ -321,4 +324,178 @@ TEST(ArrayND, MultiplyElementsGeneric) {
           }
 }
 
+TEST(ArrayND, MoveConstructor) {
+  ArrayND<int, 3> a(2, 3, 4);
+  a(1, 2, 3) = 5;
+  const int* data = a.Data();
+  ArrayND<int, 3> b(std::move(a));
+  EXPECT_EQ(data, b.Data());
+  EXPECT_EQ(2, b.Shape(0));
+  EXPECT_EQ(3, b.Shape(1));
+  EXPECT_EQ(4, b.Shape(2));
+  EXPECT_EQ(5, b(1, 2, 3));
+  EXPECT_EQ(0, a.Size());
+  EXPECT_TRUE(a.Data() == NULL);
+}
+
+TEST(ArrayND, MoveAssignment) {
+  ArrayND<int, 3> a(2, 3, 4);
+  a(1, 2, 3) = 5;
+  const int* data = a.Data();
+  ArrayND<int, 3> b(7, 1, 1);
+  b = std::move(a);
+  EXPECT_EQ(data, b.Data());
+  EXPECT_EQ(5, b(1, 2, 3));
+  EXPECT_EQ(0, a.Size());
+
+  // Moved from array can be used again.
+  a.Resize(1, 2, 3);
+  a.Fill(1);
+  EXPECT_EQ(1, a(0, 1, 2));
+}
+
+Array3D<int> CreateNumberedArray(int height, int width, int depth) {
+  Array3D<int> array(height, width, depth);
+  for (int i = 0; i < array.Size(); ++i) {
+    array.Data()[i] = i;
+  }
+  return array;
+}
+
+TEST(Array3D, Crop) {
+  Array3D<int> array = CreateNumberedArray(5, 6, 2);
+  Array3D<int> crop = array.Crop(1, 2, 3, 4);
+  EXPECT_EQ(3, crop.Height());
+  EXPECT_EQ(4, crop.Width());
+  EXPECT_EQ(2, crop.Depth());
+  EXPECT_FALSE(crop.OwnsData());
+  EXPECT_FALSE(crop.IsContiguous());
+  for (int y = 0; y < 3; ++y) {
+    for (int x = 0; x < 4; ++x) {
+      for (int d = 0; d < 2; ++d) {
+        EXPECT_EQ(array(y + 1, x + 2, d), crop(y, x, d));
+      }
+    }
+  }
+
+  // Views write to the data of the array.
+  crop(2, 3, 1) = -1;
+  EXPECT_EQ(-1, array(3, 5, 1));
+  crop.Fill(-2);
+  EXPECT_EQ(-2, array(1, 2, 0));
+  EXPECT_EQ(-2, array(3, 5, 1));
+  EXPECT_EQ(array.Offset(0, 2, 0), array(0, 2, 0));
+  EXPECT_EQ(array.Offset(1, 1, 1), array(1, 1, 1));
+  EXPECT_EQ(array.Offset(4, 2, 0), array(4, 2, 0));
+}
+
+TEST(Array3D, CopyOfViewIsContiguous) {
+  const Array3D<int> array = CreateNumberedArray(5, 6, 2);
+  const Array3D<int> crop = array.Crop(1, 2, 3, 4);
+  Array3D<int> copy(crop);
+  EXPECT_TRUE(copy.OwnsData());
+  EXPECT_TRUE(copy.IsContiguous());
+  EXPECT_TRUE(copy == crop);
+
+  Array3D<int> assigned;
+  assigned = crop;
+  EXPECT_TRUE(assigned.IsContiguous());
+  EXPECT_TRUE(assigned == crop);
+
+  copy(0, 0, 0) = -1;
+  EXPECT_FALSE(copy == crop);
+  EXPECT_EQ(array.Offset(1, 2, 0), crop(0, 0, 0));
+}
+
+TEST(Array3D, Channel) {
+  Array3D<int> array = CreateNumberedArray(3, 4, 3);
+  Array3D<int> channel = array.Channel(1);
+  EXPECT_EQ(3, channel.Height());
+  EXPECT_EQ(4, channel.Width());
+  EXPECT_EQ(1, channel.Depth());
+  EXPECT_FALSE(channel.IsContiguous());
+  for (int y = 0; y < 3; ++y) {
+    for (int x = 0; x < 4; ++x) {
+      EXPECT_EQ(array(y, x, 1), channel(y, x));
+    }
+  }
+
+  Array3Df float_channel;
+  float_channel.CopyFrom(channel);
+  EXPECT_EQ(array(2, 3, 1), float_channel(2, 3));
+}
+
+TEST(Array3D, Rows) {
+  Array3D<int> array = CreateNumberedArray(5, 4, 2);
+  Array3D<int> rows = array.Rows(2, 4);
+  EXPECT_EQ(2, rows.Height());
+  EXPECT_EQ(4, rows.Width());
+  EXPECT_TRUE(rows.IsContiguous());
+  EXPECT_EQ(array.Data() + array.Offset(2, 0, 0), rows.Data());
+  EXPECT_EQ(array(3, 1, 1), rows(1, 1, 1));
+}
+
+TEST(Array3D, MoveView) {
+  Array3D<int> array = CreateNumberedArray(5, 4, 2);
+  Array3D<int> view;
+  view = array.Crop(1, 1, 2, 2);
+  EXPECT_FALSE(view.OwnsData());
+  view(0, 0, 0) = -1;
+  EXPECT_EQ(-1, array(1, 1, 0));
+}
+
+TEST(Array3D, AlignedStorage) {
+  Array3Df array(5, 7, 3, libmv::ALIGNED_STORAGE);
+  EXPECT_EQ(libmv::ALIGNED_STORAGE, array.Storage());
+  EXPECT_EQ(5, array.Height());
+  EXPECT_EQ(7, array.Width());
+  EXPECT_EQ(3, array.Depth());
+  EXPECT_EQ(3, array.Stride(1));
+  EXPECT_EQ(1, array.Stride(2));
+
+  // Rows are padded to the alignment.
+  EXPECT_EQ(32, array.Stride(0));
+  EXPECT_FALSE(array.IsContiguous());
+  EXPECT_EQ(21, array.ContiguousLength());
+  for (int y = 0; y < array.Height(); ++y) {
+    size_t address = reinterpret_cast<size_t>(&array(y, 0, 0));
+    EXPECT_EQ(0, address % libmv::kArrayAlignment);
+  }
+
+  array.Fill(2.0f);
+  array(4, 6, 2) = 3.0f;
+  EXPECT_EQ(2.0f, array(0, 0, 0));
+  EXPECT_EQ(2.0f, array(4, 6, 1));
+
+  // Copies keep the storage, assignment keeps the storage of the destination.
+  Array3Df copy(array);
+  EXPECT_EQ(libmv::ALIGNED_STORAGE, copy.Storage());
+  EXPECT_EQ(32, copy.Stride(0));
+  EXPECT_TRUE(copy == array);
+
+  Array3Df dense;
+  dense = array;
+  EXPECT_EQ(libmv::DENSE_STORAGE, dense.Storage());
+  EXPECT_TRUE(dense.IsContiguous());
+  EXPECT_TRUE(dense == array);
+  EXPECT_EQ(3.0f, dense(4, 6, 2));
+
+  Array3D<int> converted(libmv::ALIGNED_STORAGE);
+  converted.CopyFrom(dense);
+  EXPECT_EQ(32, converted.Stride(0));
+  EXPECT_EQ(3, converted(4, 6, 2));
+  EXPECT_EQ(2, converted(4, 6, 1));
+}
+
+TEST(Array3D, SetStorage) {
+  Array3Df array(3, 4);
+  array.SetStorage(libmv::ALIGNED_STORAGE);
+  EXPECT_EQ(0, array.Size());
+  array.Resize(3, 4);
+  EXPECT_EQ(16, array.Stride(0));
+  array.SetStorage(libmv::DENSE_STORAGE);
+  array.Resize(3, 4);
+  EXPECT_EQ(4, array.Stride(0));
+}
+
 }  // namespace
@@ -21,23 +21,54 @@
 #ifndef LIBMV_IMAGE_CACHED_IMAGE_SEQUENCE_H_
 #define LIBMV_IMAGE_CACHED_IMAGE_SEQUENCE_H_
 
+#include "libmv/base/scoped_ptr.h"
+#include "libmv/image/compressed_image_cache.h"
+#include "libmv/image/concurrent_lru_cache.h"
 #include "libmv/image/image.h"
-#include "libmv/image/lru_cache.h"
 #include "libmv/image/image_sequence.h"
 
 namespace libmv {
 
-// A key for a shared image cache. Typically the void * will be a pointer to
-// the image sequence that is using the cache.
-typedef std::pair<void *, int> TaggedImageKey;
-
 // A image cache that is shared among many image sequences (or anything that
-// produces images).
-class ImageCache : public LRUCache<TaggedImageKey, Image> {
+// produces images), which can be used by many threads at once.
+//
+// With a non-zero max_compressed_size, images evicted from the cache are
+// kept compressed in a second tier of that size, and Restore() returns them
+// for a fraction of the cost of loading them again.
+class ImageCache : public ConcurrentLRUCache<TaggedImageKey, Image> {
  public:
-  typedef LRUCache<TaggedImageKey, Image> Base;
-  ImageCache() : Base(10*1024*1024) {}
-  ImageCache(int max_cache_size_in_bytes) : Base(max_cache_size_in_bytes) {}
+  typedef ConcurrentLRUCache<TaggedImageKey, Image> Base;
+  ImageCache() : Base(10*1024*1024), compressed_(NULL) {}
+  ImageCache(size_t max_cache_size_in_bytes,
+             int num_shards = 0,
+             size_t max_compressed_size = 0)
+      : Base(max_cache_size_in_bytes, num_shards), compressed_(NULL) {
+    if (max_compressed_size > 0) {
+      compressed_.reset(new CompressedImageCache(max_compressed_size));
+    }
+  }
+
+  // The compressed tier, or NULL if it is disabled.
+  CompressedImageCache *CompressedTier() {
+    return compressed_.get();
+  }
+
+  // Decompressed copy of an evicted image, owned by the caller, or NULL if
+  // the compressed tier does not have it.
+  Image *Restore(const TaggedImageKey &key) {
+    return compressed_.get() ? compressed_->Fetch(key) : NULL;
+  }
+
+ protected:
+  virtual void Evicted(const TaggedImageKey &key, Image *image) {
+    if (compressed_.get()) {
+      compressed_->Store(key, *image);
+    }
+    delete image;
+  }
+
+ private:
+  scoped_ptr<CompressedImageCache> compressed_;
 };
 
 class CachedImageSequence : public ImageSequence {
@@ -50,11 +81,17 @@ class CachedImageSequence : public ImageSequence {
     Image *image;
     TaggedImageKey cache_key(this, i);
     if (!cache_->FetchAndPin(cache_key, &image)) {
-      image = LoadImage(i);
+      image = cache_->Restore(cache_key);
+      if (!image) {
+        image = LoadImage(i);
+      }
       if (!image) {
         return 0;
       }
-      cache_->StoreAndPinSized(cache_key, image, image->MemorySizeInBytes());
+      // Another thread might have loaded the same image meanwhile, then its
+      // image is used.
+      image =
+          cache_->InsertAndPin(cache_key, image, image->MemorySizeInBytes());
     }
     return image;
   }
@@ -0,0 +1,139 @@
+// Copyright (c) 2020 libmv authors.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#include "libmv/image/compact_image.h"
+
+#include <algorithm>
+#include <cmath>
+
+// F16C code is compiled using target attributes and is only used when the
+// CPU reports support for it.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define LIBMV_COMPACT_IMAGE_F16C
+#  include <immintrin.h>
+#endif
+
+namespace libmv {
+
+namespace {
+
+#ifdef LIBMV_COMPACT_IMAGE_F16C
+bool HasF16C() {
+  static const bool has_f16c = [] {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("f16c");
+  }();
+  return has_f16c;
+}
+
+__attribute__((target("avx,f16c"))) int ConvertFloatToHalfF16C(
+    const float* src, int size, Half* dst) {
+  int i = 0;
+  for (; i + 8 <= size; i += 8) {
+    const __m128i half = _mm256_cvtps_ph(_mm256_loadu_ps(src + i),
+                                         _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), half);
+  }
+  return i;
+}
+
+__attribute__((target("avx,f16c"))) int ConvertHalfToFloatF16C(
+    const Half* src, int size, float* dst) {
+  int i = 0;
+  for (; i + 8 <= size; i += 8) {
+    const __m128i half =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(half));
+  }
+  return i;
+}
+#endif  // LIBMV_COMPACT_IMAGE_F16C
+
+// Call function(src, n, dst) for the runs of contiguous elements of the two
+// arrays of the same shape.
+template <typename S, typename D, typename Function>
+void ForEachRun(const Array3D<S>& src, Array3D<D>* dst, Function function) {
+  const int run = std::min(src.ContiguousLength(), dst->ContiguousLength());
+  for (int i = 0; i < src.Size(); i += run) {
+    function(src.Data() + src.ElementOffset(i),
+             run,
+             dst->Data() + dst->ElementOffset(i));
+  }
+}
+
+}  // namespace
+
+void ConvertFloatToHalf(const float* src, int size, Half* dst) {
+  int i = 0;
+#ifdef LIBMV_COMPACT_IMAGE_F16C
+  if (HasF16C()) {
+    i = ConvertFloatToHalfF16C(src, size, dst);
+  }
+#endif
+  for (; i < size; ++i) {
+    dst[i] = FloatToHalf(src[i]);
+  }
+}
+
+void ConvertHalfToFloat(const Half* src, int size, float* dst) {
+  int i = 0;
+#ifdef LIBMV_COMPACT_IMAGE_F16C
+  if (HasF16C()) {
+    i = ConvertHalfToFloatF16C(src, size, dst);
+  }
+#endif
+  for (; i < size; ++i) {
+    dst[i] = HalfToFloat(src[i]);
+  }
+}
+
+void FloatImageToHalf(const Array3Df& in, HalfImage* out) {
+  out->Resize(in.Height(), in.Width(), in.Depth());
+  ForEachRun(in, out, ConvertFloatToHalf);
+}
+
+void HalfImageToFloat(const HalfImage& in, Array3Df* out) {
+  out->Resize(in.Height(), in.Width(), in.Depth());
+  ForEachRun(in, out, ConvertHalfToFloat);
+}
+
+void FloatImageToUShort(const Array3Df& in, float scale, UShortImage* out) {
+  out->Resize(in.Height(), in.Width(), in.Depth());
+  ForEachRun(in, out, [scale](const float* src, int size, uint16_t* dst) {
+    for (int i = 0; i < size; ++i) {
+      const float value = std::min(std::max(src[i] * scale + 0.5f, 0.0f),
+                                   65535.0f);
+      dst[i] = static_cast<uint16_t>(value);
+    }
+  });
+}
+
+void UShortImageToFloat(const UShortImage& in, float scale, Array3Df* out) {
+  out->Resize(in.Height(), in.Width(), in.Depth());
+  const float inverse_scale = 1.0f / scale;
+  ForEachRun(in, out, [inverse_scale](const uint16_t* src, int size,
+                                      float* dst) {
+    for (int i = 0; i < size; ++i) {
+      dst[i] = src[i] * inverse_scale;
+    }
+  });
+}
+
+}  // namespace libmv
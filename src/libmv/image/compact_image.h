@@ -0,0 +1,126 @@
+// Copyright (c) 2020 libmv authors.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#ifndef LIBMV_IMAGE_COMPACT_IMAGE_H_
+#define LIBMV_IMAGE_COMPACT_IMAGE_H_
+
+#include <cstdint>
+#include <cstring>
+
+#include "libmv/image/array_nd.h"
+
+namespace libmv {
+
+// Images stored with 16 bits per value, which take half of the memory and
+// memory bandwidth of float images. They are meant for cached frames and
+// pyramid levels, the values are converted to floats when they are used.
+
+// IEEE 754 half precision float. It has 11 significant bits, so values up to
+// 2048 are stored exactly as integers and gradients keep about three decimal
+// digits of relative precision.
+struct Half {
+  uint16_t bits;
+};
+
+inline bool operator==(Half a, Half b) { return a.bits == b.bits; }
+inline bool operator!=(Half a, Half b) { return a.bits != b.bits; }
+
+typedef Array3D<Half> HalfImage;
+typedef Array3D<uint16_t> UShortImage;
+
+// Round to the nearest half, ties to even, same as the F16C instructions.
+// Values too large for a half become infinity.
+inline Half FloatToHalf(float value) {
+  uint32_t f;
+  std::memcpy(&f, &value, sizeof(f));
+  const uint32_t sign = (f >> 16) & 0x8000;
+  f &= 0x7fffffff;
+
+  Half half;
+  if (f >= 0x7f800000) {
+    // Infinity or NaN.
+    half.bits = f > 0x7f800000 ? 0x7e00 : 0x7c00;
+  } else if (f >= 0x477ff000) {
+    // Rounds to a value above the largest half, 65504.
+    half.bits = 0x7c00;
+  } else if (f < 0x38800000) {
+    // Denormal half. Adding 0.5 shifts the mantissa into place and the FPU
+    // does the rounding.
+    const uint32_t kMagic = 126u << 23;
+    float magic, shifted;
+    std::memcpy(&magic, &kMagic, sizeof(magic));
+    std::memcpy(&shifted, &f, sizeof(shifted));
+    shifted += magic;
+    std::memcpy(&f, &shifted, sizeof(f));
+    half.bits = f - kMagic;
+  } else {
+    const uint32_t mantissa_odd = (f >> 13) & 1;
+    // Rebias the exponent and round the mantissa, ties to even.
+    f += (uint32_t(15 - 127) << 23) + 0xfff + mantissa_odd;
+    half.bits = f >> 13;
+  }
+  half.bits |= sign;
+  return half;
+}
+
+inline float HalfToFloat(Half half) {
+  const uint32_t kExponentMask = 0x7c00 << 13;
+  uint32_t f = (half.bits & 0x7fff) << 13;
+  const uint32_t exponent = f & kExponentMask;
+  f += uint32_t(127 - 15) << 23;
+  float value;
+  if (exponent == kExponentMask) {
+    // Infinity or NaN.
+    f += uint32_t(128 - 16) << 23;
+    std::memcpy(&value, &f, sizeof(value));
+  } else if (exponent == 0) {
+    // Zero or denormal, renormalized by the FPU.
+    const uint32_t kMagic = 113u << 23;
+    float magic;
+    std::memcpy(&magic, &kMagic, sizeof(magic));
+    f += 1 << 23;
+    std::memcpy(&value, &f, sizeof(value));
+    value -= magic;
+  } else {
+    std::memcpy(&value, &f, sizeof(value));
+  }
+  return half.bits & 0x8000 ? -value : value;
+}
+
+// Convert arrays of size values. F16C instructions are used when the CPU
+// supports them, the results are the same as of the functions above except
+// for the payloads of NaNs.
+void ConvertFloatToHalf(const float* src, int size, Half* dst);
+void ConvertHalfToFloat(const Half* src, int size, float* dst);
+
+// Convert images, the output is resized to the shape of the input.
+void FloatImageToHalf(const Array3Df& in, HalfImage* out);
+void HalfImageToFloat(const HalfImage& in, Array3Df* out);
+
+// Convert images to 16-bit integers round(value * scale), clamped to the
+// range of uint16_t, and back to value / scale. Suited for non-negative
+// images of known range, for example 8-bit frames with a scale of 256 keep
+// eight extra bits of precision for the blurred and downsampled levels.
+void FloatImageToUShort(const Array3Df& in, float scale, UShortImage* out);
+void UShortImageToFloat(const UShortImage& in, float scale, Array3Df* out);
+
+}  // namespace libmv
+
+#endif  // LIBMV_IMAGE_COMPACT_IMAGE_H_
@@ -0,0 +1,135 @@
+// Copyright (c) 2020 libmv authors.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#include "libmv/image/compact_image.h"
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "testing/testing.h"
+
+using namespace libmv;
+
+namespace {
+
+TEST(CompactImage, HalfRoundTripsAllHalfs) {
+  for (int bits = 0; bits < 0x10000; ++bits) {
+    Half half;
+    half.bits = bits;
+    const float value = HalfToFloat(half);
+    if (std::isnan(value)) {
+      EXPECT_EQ(0x7c00, half.bits & 0x7c00);
+      continue;
+    }
+    EXPECT_EQ(bits, FloatToHalf(value).bits);
+  }
+}
+
+TEST(CompactImage, HalfValues) {
+  EXPECT_EQ(0x3c00, FloatToHalf(1.0f).bits);
+  EXPECT_EQ(0xc000, FloatToHalf(-2.0f).bits);
+  EXPECT_EQ(0x7bff, FloatToHalf(65504.0f).bits);
+  EXPECT_EQ(0x7c00, FloatToHalf(65520.0f).bits);
+  EXPECT_EQ(0x0001, FloatToHalf(std::ldexp(1.0f, -24)).bits);
+  EXPECT_EQ(0x0000, FloatToHalf(std::ldexp(1.0f, -26)).bits);
+  EXPECT_EQ(0x7c00,
+            FloatToHalf(std::numeric_limits<float>::infinity()).bits);
+  EXPECT_TRUE(std::isnan(
+      HalfToFloat(FloatToHalf(std::numeric_limits<float>::quiet_NaN()))));
+
+  // Ties round to even.
+  EXPECT_EQ(0x3c00, FloatToHalf(1.0f + std::ldexp(1.0f, -11)).bits);
+  EXPECT_EQ(0x3c02, FloatToHalf(1.0f + 3 * std::ldexp(1.0f, -11)).bits);
+
+  EXPECT_EQ(2048.0f, HalfToFloat(FloatToHalf(2048.0f)));
+  EXPECT_EQ(-0.5f, HalfToFloat(FloatToHalf(-0.5f)));
+}
+
+TEST(CompactImage, ArrayConversionsMatchScalar) {
+  std::vector<float> values;
+  for (int i = -3000; i < 3000; ++i) {
+    values.push_back(i * 0.731f);
+    values.push_back(std::ldexp(1.0f + i / 3000.0f, i / 100));
+  }
+  std::vector<Half> halfs(values.size());
+  ConvertFloatToHalf(&values[0], values.size(), &halfs[0]);
+  std::vector<float> floats(values.size());
+  ConvertHalfToFloat(&halfs[0], halfs.size(), &floats[0]);
+  for (int i = 0; i < values.size(); ++i) {
+    EXPECT_EQ(FloatToHalf(values[i]).bits, halfs[i].bits);
+    EXPECT_EQ(HalfToFloat(halfs[i]), floats[i]);
+  }
+}
+
+TEST(CompactImage, HalfImage) {
+  Array3Df image(5, 21, 3, ALIGNED_STORAGE);
+  for (int i = 0; i < image.Height(); ++i) {
+    for (int j = 0; j < image.Width(); ++j) {
+      for (int k = 0; k < image.Depth(); ++k) {
+        image(i, j, k) = i * 100 - j * 3 + k / 7.0f;
+      }
+    }
+  }
+
+  HalfImage half_image;
+  FloatImageToHalf(image, &half_image);
+  EXPECT_EQ(image.Shape(), half_image.Shape());
+  EXPECT_LT(half_image.MemorySizeInBytes(), image.MemorySizeInBytes());
+
+  Array3Df converted;
+  HalfImageToFloat(half_image, &converted);
+  EXPECT_EQ(image.Shape(), converted.Shape());
+  for (int i = 0; i < image.Height(); ++i) {
+    for (int j = 0; j < image.Width(); ++j) {
+      for (int k = 0; k < image.Depth(); ++k) {
+        EXPECT_EQ(HalfToFloat(half_image(i, j, k)), converted(i, j, k));
+        EXPECT_NEAR(image(i, j, k),
+                    converted(i, j, k),
+                    std::abs(image(i, j, k)) / 1024);
+      }
+    }
+  }
+}
+
+TEST(CompactImage, UShortImage) {
+  Array3Df image(3, 4);
+  for (int i = 0; i < image.Height(); ++i) {
+    for (int j = 0; j < image.Width(); ++j) {
+      image(i, j) = i * 100 + j * 0.25f;
+    }
+  }
+  image(0, 0) = -1;
+  image(2, 3) = 300;
+
+  UShortImage ushort_image;
+  FloatImageToUShort(image, 256, &ushort_image);
+  EXPECT_EQ(0, ushort_image(0, 0));
+  EXPECT_EQ(65535, ushort_image(2, 3));
+  EXPECT_EQ(100 * 256 + 64, ushort_image(1, 1));
+
+  Array3Df converted;
+  UShortImageToFloat(ushort_image, 256, &converted);
+  EXPECT_EQ(0, converted(0, 0));
+  EXPECT_EQ(100.25f, converted(1, 1));
+  EXPECT_EQ(200.5f, converted(2, 2));
+}
+
+}  // namespace
@@ -0,0 +1,376 @@
+// Copyright (c) 2020 libmv authors.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#include "libmv/image/compressed_image_cache.h"
+
+#include <zlib.h>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "libmv/logging/logging.h"
+
+namespace libmv {
+
+namespace {
+
+enum Codec {
+  // Bytes of the values, split into one plane for every byte of the value,
+  // and deflated.
+  CODEC_BYTE_PLANES,
+
+  // Float values which are all float(b) / 255 of a byte b, stored as b
+  // without further compression. Inflate is about as slow as decoding the
+  // JPEG file the frame came from, while converting the bytes back takes a
+  // fraction of that.
+  CODEC_SCALED_BYTES,
+};
+
+struct CompressedImageHeader {
+  int32_t type;
+  int32_t height;
+  int32_t width;
+  int32_t depth;
+  int32_t storage;
+  int32_t codec;
+};
+
+// Copy the values of the array to a contiguous buffer, and back.
+template <typename T>
+void GatherValues(const Array3D<T>& array, T* values) {
+  const int run = array.ContiguousLength();
+  for (int i = 0; i < array.Size(); i += run) {
+    std::memcpy(values + i,
+                array.Data() + array.ElementOffset(i),
+                run * sizeof(T));
+  }
+}
+
+template <typename T>
+void ScatterValues(const T* values, Array3D<T>* array) {
+  const int run = array->ContiguousLength();
+  for (int i = 0; i < array->Size(); i += run) {
+    std::memcpy(array->Data() + array->ElementOffset(i),
+                values + i,
+                run * sizeof(T));
+  }
+}
+
+// Byte b of the i-th value goes to planes[b * size + i]. Deflate finds few
+// matches in interleaved bytes of floats, the planes of the high bytes are
+// much more regular.
+void SplitBytePlanes(const unsigned char* values,
+                     int size,
+                     int value_size,
+                     unsigned char* planes) {
+  for (int b = 0; b < value_size; ++b) {
+    unsigned char* plane = planes + b * size;
+    for (int i = 0; i < size; ++i) {
+      plane[i] = values[i * value_size + b];
+    }
+  }
+}
+
+void MergeBytePlanes(const unsigned char* planes,
+                     int size,
+                     int value_size,
+                     unsigned char* values) {
+  for (int b = 0; b < value_size; ++b) {
+    const unsigned char* plane = planes + b * size;
+    for (int i = 0; i < size; ++i) {
+      values[i * value_size + b] = plane[i];
+    }
+  }
+}
+
+// Store the values as bytes if every value is exactly float(b) / 255, as
+// computed by ByteArrayToScaledFloatArray().
+bool FloatsToScaledBytes(const Array3Df& floats, unsigned char* bytes) {
+  const int run = floats.ContiguousLength();
+  for (int i = 0; i < floats.Size(); i += run) {
+    const float* values = floats.Data() + floats.ElementOffset(i);
+    for (int j = 0; j < run; ++j) {
+      const float value = values[j];
+      if (!(value >= 0.0f && value <= 1.0f)) {
+        return false;
+      }
+      const unsigned char b =
+          static_cast<unsigned char>(value * 255.0f + 0.5f);
+      const float scaled = float(b) / 255.0f;
+      // Compare the bits, so the sign of zeros is kept.
+      if (std::memcmp(&scaled, &value, sizeof(value)) != 0) {
+        return false;
+      }
+      bytes[i + j] = b;
+    }
+  }
+  return true;
+}
+
+void ScaledBytesToFloats(const unsigned char* bytes, Array3Df* floats) {
+  const int run = floats->ContiguousLength();
+  for (int i = 0; i < floats->Size(); i += run) {
+    float* values = floats->Data() + floats->ElementOffset(i);
+    for (int j = 0; j < run; ++j) {
+      values[j] = float(bytes[i + j]) / 255.0f;
+    }
+  }
+}
+
+template <typename T>
+void SetShape(const Array3D<T>& array, CompressedImageHeader* header) {
+  header->height = array.Height();
+  header->width = array.Width();
+  header->depth = array.Depth();
+  header->storage = array.Storage();
+}
+
+template <typename T>
+void GatherBytePlanes(const Array3D<T>& array,
+                      std::vector<unsigned char>* raw) {
+  const int size = array.Size();
+  std::vector<T> values(size);
+  GatherValues(array, values.data());
+  raw->resize(size * sizeof(T));
+  SplitBytePlanes(reinterpret_cast<const unsigned char*>(values.data()),
+                  size,
+                  sizeof(T),
+                  raw->data());
+}
+
+template <typename T>
+Image* ScatterBytePlanes(const unsigned char* raw,
+                         const CompressedImageHeader& header) {
+  Array3D<T>* array = new Array3D<T>(header.height,
+                                     header.width,
+                                     header.depth,
+                                     ArrayStorage(header.storage));
+  const int size = array->Size();
+  std::vector<T> values(size);
+  MergeBytePlanes(raw,
+                  size,
+                  sizeof(T),
+                  reinterpret_cast<unsigned char*>(values.data()));
+  ScatterValues(values.data(), array);
+  return new Image(array);
+}
+
+int ValueSize(int type) {
+  switch (type) {
+    case Image::BYTE: return sizeof(unsigned char);
+    case Image::FLOAT: return sizeof(float);
+    case Image::HALF: return sizeof(Half);
+    case Image::USHORT: return sizeof(uint16_t);
+    default: return 0;
+  }
+}
+
+// The fastest level, compression is done for every evicted frame.
+const int kCompressionLevel = 1;
+
+}  // namespace
+
+std::string CompressImage(const Image& image) {
+  CompressedImageHeader header;
+  header.codec = CODEC_BYTE_PLANES;
+  std::vector<unsigned char> raw;
+  if (const Array3Du* bytes = image.AsArray3Du()) {
+    header.type = Image::BYTE;
+    GatherBytePlanes(*bytes, &raw);
+    SetShape(*bytes, &header);
+  } else if (const Array3Df* floats = image.AsArray3Df()) {
+    header.type = Image::FLOAT;
+    raw.resize(floats->Size());
+    if (FloatsToScaledBytes(*floats, raw.data())) {
+      header.codec = CODEC_SCALED_BYTES;
+    } else {
+      GatherBytePlanes(*floats, &raw);
+    }
+    SetShape(*floats, &header);
+  } else if (const HalfImage* halfs = image.AsHalfImage()) {
+    header.type = Image::HALF;
+    GatherBytePlanes(*halfs, &raw);
+    SetShape(*halfs, &header);
+  } else if (const UShortImage* ushorts = image.AsUShortImage()) {
+    header.type = Image::USHORT;
+    GatherBytePlanes(*ushorts, &raw);
+    SetShape(*ushorts, &header);
+  } else {
+    return std::string();
+  }
+
+  if (header.codec == CODEC_SCALED_BYTES) {
+    std::string data(sizeof(header) + raw.size(), '\0');
+    std::memcpy(&data[0], &header, sizeof(header));
+    std::memcpy(&data[sizeof(header)], raw.data(), raw.size());
+    return data;
+  }
+
+  uLongf compressed_size = compressBound(raw.size());
+  std::string data(sizeof(header) + compressed_size, '\0');
+  std::memcpy(&data[0], &header, sizeof(header));
+  unsigned char* compressed =
+      reinterpret_cast<unsigned char*>(&data[sizeof(header)]);
+  if (compress2(compressed,
+                &compressed_size,
+                raw.data(),
+                raw.size(),
+                kCompressionLevel) != Z_OK) {
+    LOG(ERROR) << "Failed to compress an image.";
+    return std::string();
+  }
+  data.resize(sizeof(header) + compressed_size);
+  return data;
+}
+
+Image* DecompressImage(const std::string& data) {
+  CompressedImageHeader header;
+  if (data.size() < sizeof(header)) {
+    return NULL;
+  }
+  std::memcpy(&header, data.data(), sizeof(header));
+  const int value_size = ValueSize(header.type);
+  if (value_size == 0) {
+    return NULL;
+  }
+  const size_t size = size_t(header.height) * header.width * header.depth;
+  const unsigned char* payload =
+      reinterpret_cast<const unsigned char*>(data.data() + sizeof(header));
+  const size_t payload_size = data.size() - sizeof(header);
+
+  if (header.codec == CODEC_SCALED_BYTES) {
+    if (header.type != Image::FLOAT || payload_size != size) {
+      return NULL;
+    }
+    Array3Df* floats = new Array3Df(header.height,
+                                    header.width,
+                                    header.depth,
+                                    ArrayStorage(header.storage));
+    ScaledBytesToFloats(payload, floats);
+    return new Image(floats);
+  }
+
+  std::vector<unsigned char> raw(size * value_size);
+  uLongf decompressed_size = raw.size();
+  if (uncompress(raw.data(), &decompressed_size, payload, payload_size) !=
+          Z_OK ||
+      decompressed_size != raw.size()) {
+    LOG(ERROR) << "Failed to decompress an image.";
+    return NULL;
+  }
+
+  switch (header.type) {
+    case Image::BYTE:
+      return ScatterBytePlanes<unsigned char>(raw.data(), header);
+    case Image::FLOAT:
+      return ScatterBytePlanes<float>(raw.data(), header);
+    case Image::HALF:
+      return ScatterBytePlanes<Half>(raw.data(), header);
+    case Image::USHORT:
+      return ScatterBytePlanes<uint16_t>(raw.data(), header);
+  }
+  return NULL;
+}
+
+CompressedImageCache::CompressedImageCache(size_t max_size)
+    : max_size_(max_size), size_(0) {
+  stats_.hits = 0;
+  stats_.misses = 0;
+  stats_.evictions = 0;
+}
+
+bool CompressedImageCache::Store(const TaggedImageKey& key,
+                                 const Image& image) {
+  if (ContainsKey(key)) {
+    return false;
+  }
+  std::string data = CompressImage(image);
+  if (data.empty()) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Another thread might have stored the same key meanwhile.
+  if (index_.count(key)) {
+    return false;
+  }
+  size_ += data.size();
+  entries_.push_front(std::make_pair(key, std::string()));
+  entries_.front().second.swap(data);
+  index_[key] = entries_.begin();
+  EvictIfNecessary();
+  return index_.count(key) > 0;
+}
+
+Image* CompressedImageCache::Fetch(const TaggedImageKey& key) {
+  std::string data;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    EntryMap::iterator it = index_.find(key);
+    if (it == index_.end()) {
+      stats_.misses++;
+      return NULL;
+    }
+    stats_.hits++;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    // The copy is decompressed without the lock held.
+    data = it->second->second;
+  }
+  return DecompressImage(data);
+}
+
+bool CompressedImageCache::ContainsKey(const TaggedImageKey& key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return index_.count(key) > 0;
+}
+
+size_t CompressedImageCache::MaxSize() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return max_size_;
+}
+
+size_t CompressedImageCache::Size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return size_;
+}
+
+void CompressedImageCache::SetMaxSize(size_t max_size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  max_size_ = max_size;
+  EvictIfNecessary();
+}
+
+CacheStats CompressedImageCache::Stats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void CompressedImageCache::EvictIfNecessary() {
+  while (size_ > max_size_ && !entries_.empty()) {
+    const EntryList::value_type& oldest = entries_.back();
+    size_ -= oldest.second.size();
+    index_.erase(oldest.first);
+    entries_.pop_back();
+    stats_.evictions++;
+  }
+}
+
+}  // namespace libmv
@@ -0,0 +1,104 @@
+// Copyright (c) 2020 libmv authors.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#ifndef LIBMV_IMAGE_COMPRESSED_IMAGE_CACHE_H_
+#define LIBMV_IMAGE_COMPRESSED_IMAGE_CACHE_H_
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "libmv/image/concurrent_lru_cache.h"
+#include "libmv/image/image.h"
+
+namespace libmv {
+
+// A key for a shared image cache. Typically the void * will be a pointer to
+// the image sequence that is using the cache.
+typedef std::pair<void *, int> TaggedImageKey;
+
+// Losslessly compressed copies of images, kept in memory.
+//
+// This is the second tier of the ImageCache: frames evicted from the cache
+// are compressed and stored here, so when they are needed again they are
+// decompressed, which is much faster than decoding the image file again.
+//
+// Float images which were converted from bytes, which is the case for the
+// frames loaded from 8-bit files, are stored as the bytes. Other images are
+// split into planes of the bytes of their values, which compress better, and
+// deflated with zlib at its fastest level.
+//
+// The cache can be used by many threads at once. Compression and
+// decompression are done without the lock held.
+class CompressedImageCache {
+ public:
+  explicit CompressedImageCache(size_t max_size);
+
+  // Compress the image and store it, evicting the least recently used images
+  // when the cache becomes larger than its maximum size. Does nothing when
+  // the key is stored already, or for images of types which are not
+  // supported. Returns true if the image was stored.
+  bool Store(const TaggedImageKey& key, const Image& image);
+
+  // Decompressed copy of the stored image, owned by the caller, or NULL if
+  // the key is not stored. The image stays in the cache.
+  Image* Fetch(const TaggedImageKey& key);
+
+  bool ContainsKey(const TaggedImageKey& key);
+
+  // Sizes of the compressed data, in bytes.
+  size_t MaxSize() const;
+  size_t Size();
+  void SetMaxSize(size_t max_size);
+
+  CacheStats Stats();
+
+ private:
+  typedef std::list<std::pair<TaggedImageKey, std::string> > EntryList;
+  typedef std::unordered_map<TaggedImageKey,
+                             EntryList::iterator,
+                             CacheKeyHash<TaggedImageKey> > EntryMap;
+
+  // Must be called with the lock held.
+  void EvictIfNecessary();
+
+  mutable std::mutex mutex_;
+  size_t max_size_;
+  size_t size_;
+  CacheStats stats_;
+
+  // Most recently used entries first.
+  EntryList entries_;
+  EntryMap index_;
+};
+
+// Serialized and compressed form of an image, which is empty for the images
+// of types which are not supported. Exposed for testing.
+std::string CompressImage(const Image& image);
+
+// Image which was compressed by CompressImage(), or NULL if the data is not
+// valid.
+Image* DecompressImage(const std::string& data);
+
+}  // namespace libmv
+
+#endif  // LIBMV_IMAGE_COMPRESSED_IMAGE_CACHE_H_
@@ -0,0 +1,208 @@
+// Copyright (c) 2020 libmv authors.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#include "libmv/image/compressed_image_cache.h"
+
+#include <cmath>
+
+#include "libmv/image/cached_image_sequence.h"
+#include "testing/testing.h"
+
+using namespace libmv;
+
+namespace {
+
+Array3Df* ScaledBytesImage(int height, int width, int depth) {
+  Array3Df* image = new Array3Df(height, width, depth);
+  for (int i = 0; i < height; ++i) {
+    for (int j = 0; j < width; ++j) {
+      for (int k = 0; k < depth; ++k) {
+        (*image)(i, j, k) = float((i * 7 + j * 3 + k) % 256) / 255.0f;
+      }
+    }
+  }
+  return image;
+}
+
+void ExpectSameFloats(const Array3Df& expected, const Image* image) {
+  ASSERT_TRUE(image != NULL);
+  const Array3Df* floats = image->AsArray3Df();
+  ASSERT_TRUE(floats != NULL);
+  ASSERT_EQ(expected.Shape(), floats->Shape());
+  for (int i = 0; i < expected.Height(); ++i) {
+    for (int j = 0; j < expected.Width(); ++j) {
+      for (int k = 0; k < expected.Depth(); ++k) {
+        EXPECT_EQ(expected(i, j, k), (*floats)(i, j, k));
+      }
+    }
+  }
+}
+
+TEST(CompressImage, ScaledBytesAreStoredAsBytes) {
+  Image image(ScaledBytesImage(64, 48, 3));
+  std::string data = CompressImage(image);
+  // One byte for every value, and the header.
+  EXPECT_LT(data.size(), 64 * 48 * 3 + 64);
+
+  scoped_ptr<Image> restored(DecompressImage(data));
+  ExpectSameFloats(*image.AsArray3Df(), restored.get());
+}
+
+TEST(CompressImage, ArbitraryFloatsAreLossless) {
+  Array3Df* floats = new Array3Df(31, 17, 2);
+  for (int i = 0; i < floats->Height(); ++i) {
+    for (int j = 0; j < floats->Width(); ++j) {
+      (*floats)(i, j, 0) = std::sin(i * 0.1f) * std::cos(j * 0.3f);
+      (*floats)(i, j, 1) = -1000.0f + i * j / 3.0f;
+    }
+  }
+  (*floats)(0, 0, 0) = -0.0f;
+  Image image(floats);
+
+  scoped_ptr<Image> restored(DecompressImage(CompressImage(image)));
+  ExpectSameFloats(*floats, restored.get());
+  EXPECT_TRUE(std::signbit((*restored->AsArray3Df())(0, 0, 0)));
+}
+
+TEST(CompressImage, PaddedRowsAreKept) {
+  Array3Df* floats = new Array3Df(5, 3, 1, ALIGNED_STORAGE);
+  for (int i = 0; i < 5; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      (*floats)(i, j) = i + j * 0.5f;
+    }
+  }
+  Image image(floats);
+
+  scoped_ptr<Image> restored(DecompressImage(CompressImage(image)));
+  ExpectSameFloats(*floats, restored.get());
+  EXPECT_EQ(ALIGNED_STORAGE, restored->AsArray3Df()->Storage());
+}
+
+TEST(CompressImage, BytesAndHalfs) {
+  Array3Du* bytes = new Array3Du(10, 20, 3);
+  for (int i = 0; i < bytes->Size(); ++i) {
+    bytes->Data()[i] = i * 13;
+  }
+  Image byte_image(bytes);
+  scoped_ptr<Image> restored_bytes(DecompressImage(CompressImage(byte_image)));
+  ASSERT_TRUE(restored_bytes->AsArray3Du() != NULL);
+  EXPECT_EQ(*bytes, *restored_bytes->AsArray3Du());
+
+  HalfImage* halfs = new HalfImage(7, 9);
+  for (int i = 0; i < halfs->Size(); ++i) {
+    halfs->Data()[i] = FloatToHalf(i * 0.25f);
+  }
+  Image half_image(halfs);
+  scoped_ptr<Image> restored_halfs(DecompressImage(CompressImage(half_image)));
+  ASSERT_TRUE(restored_halfs->AsHalfImage() != NULL);
+  EXPECT_EQ(*halfs, *restored_halfs->AsHalfImage());
+}
+
+TEST(CompressImage, InvalidData) {
+  EXPECT_TRUE(DecompressImage("") == NULL);
+
+  std::string data = CompressImage(Image(ScaledBytesImage(8, 8, 1)));
+  data.resize(data.size() - 4);
+  EXPECT_TRUE(DecompressImage(data) == NULL);
+
+  data = CompressImage(Image(new Array3Du(8, 8, 1)));
+  data.resize(data.size() - 4);
+  EXPECT_TRUE(DecompressImage(data) == NULL);
+}
+
+TEST(CompressedImageCache, StoreAndFetch) {
+  CompressedImageCache cache(1024 * 1024);
+  TaggedImageKey key(&cache, 3);
+  EXPECT_TRUE(cache.Fetch(key) == NULL);
+
+  Image image(ScaledBytesImage(16, 16, 1));
+  EXPECT_TRUE(cache.Store(key, image));
+  EXPECT_FALSE(cache.Store(key, image));
+  EXPECT_TRUE(cache.ContainsKey(key));
+
+  scoped_ptr<Image> fetched(cache.Fetch(key));
+  ExpectSameFloats(*image.AsArray3Df(), fetched.get());
+  EXPECT_EQ(1, cache.Stats().hits);
+  EXPECT_EQ(1, cache.Stats().misses);
+}
+
+TEST(CompressedImageCache, EvictsLeastRecentlyUsed) {
+  Image image(ScaledBytesImage(32, 32, 1));
+  const size_t size = CompressImage(image).size();
+  CompressedImageCache cache(2 * size);
+
+  cache.Store(TaggedImageKey(NULL, 0), image);
+  cache.Store(TaggedImageKey(NULL, 1), image);
+  delete cache.Fetch(TaggedImageKey(NULL, 0));
+  cache.Store(TaggedImageKey(NULL, 2), image);
+
+  EXPECT_TRUE(cache.ContainsKey(TaggedImageKey(NULL, 0)));
+  EXPECT_FALSE(cache.ContainsKey(TaggedImageKey(NULL, 1)));
+  EXPECT_TRUE(cache.ContainsKey(TaggedImageKey(NULL, 2)));
+  EXPECT_EQ(2 * size, cache.Size());
+  EXPECT_EQ(1, cache.Stats().evictions);
+
+  cache.SetMaxSize(0);
+  EXPECT_EQ(0, cache.Size());
+}
+
+class CountingImageSequence : public CachedImageSequence {
+ public:
+  explicit CountingImageSequence(ImageCache* cache)
+      : CachedImageSequence(cache), num_loads(0) {}
+
+  virtual Image* LoadImage(int /*i*/) {
+    num_loads++;
+    return new Image(ScaledBytesImage(32, 32, 1));
+  }
+
+  virtual int Length() { return 10; }
+
+  int num_loads;
+};
+
+TEST(ImageCache, EvictedFramesAreRestored) {
+  // Room for one frame in the cache, and all of them in the second tier.
+  Image frame(ScaledBytesImage(32, 32, 1));
+  ImageCache cache(frame.MemorySizeInBytes(), 1, 1024 * 1024);
+  CountingImageSequence sequence(&cache);
+
+  for (int i = 0; i < sequence.Length(); ++i) {
+    sequence.GetImage(i);
+    sequence.Unpin(i);
+  }
+  EXPECT_EQ(10, sequence.num_loads);
+  EXPECT_EQ(9, cache.Stats().evictions);
+
+  for (int i = sequence.Length() - 1; i >= 0; --i) {
+    ExpectSameFloats(*frame.AsArray3Df(), sequence.GetImage(i));
+    sequence.Unpin(i);
+  }
+  EXPECT_EQ(10, sequence.num_loads);
+  EXPECT_EQ(9, cache.CompressedTier()->Stats().hits);
+}
+
+TEST(ImageCache, NoCompressedTierByDefault) {
+  ImageCache cache(1024, 1);
+  EXPECT_TRUE(cache.CompressedTier() == NULL);
+  EXPECT_TRUE(cache.Restore(TaggedImageKey(NULL, 0)) == NULL);
+}
+
+}  // namespace
@@ -0,0 +1,340 @@
+// Copyright (c) 2020 libmv authors.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#ifndef LIBMV_IMAGE_CONCURRENT_LRU_CACHE_H_
+#define LIBMV_IMAGE_CONCURRENT_LRU_CACHE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "libmv/base/scoped_ptr.h"
+#include "libmv/image/cache.h"
+
+namespace libmv {
+
+// Hash of the cache keys, which also works for pairs.
+template <typename K>
+struct CacheKeyHash : public std::hash<K> {};
+
+template <typename A, typename B>
+struct CacheKeyHash<std::pair<A, B> > {
+  size_t operator()(const std::pair<A, B>& key) const {
+    const size_t first = CacheKeyHash<A>()(key.first);
+    const size_t second = CacheKeyHash<B>()(key.second);
+    return first ^ (second + 0x9e3779b9 + (first << 6) + (first >> 2));
+  }
+};
+
+struct CacheStats {
+  // Fetches which found the key, and which did not.
+  int64_t hits;
+  int64_t misses;
+
+  // Items deleted to keep the size of the cache below the maximum size.
+  int64_t evictions;
+};
+
+// An LRU cache which can be used by many threads at once.
+//
+// The items are split between shards by the hash of the key, every shard has
+// its own lock and its own part of the maximum size. Only the shard of the
+// key is locked, so threads working on different keys rarely wait for each
+// other. The least recently unpinned item of a shard is evicted first, so
+// the order of the evictions is only approximately LRU for the whole cache.
+//
+// Pinning, unpinning and evicting take constant time. Sizes are size_t, so
+// caches can be larger than 2 GB.
+template <typename K, typename V, typename Hash = CacheKeyHash<K> >
+class ConcurrentLRUCache : public Cache<K, V> {
+ public:
+  // Every shard gets at least this much of the maximum size. Otherwise a
+  // small cache would be split into shards which are too small to hold the
+  // large items, like images.
+  static const size_t kMinShardSize = size_t(256) * 1024 * 1024;
+
+  // The number of shards is computed from the maximum size when it is zero,
+  // at most 16 shards are used.
+  explicit ConcurrentLRUCache(size_t max_size, int num_shards = 0)
+      : num_shards_(num_shards > 0 ? num_shards : DefaultNumShards(max_size)),
+        shards_(new Shard[num_shards_]),
+        max_size_(max_size),
+        size_(0),
+        hits_(0),
+        misses_(0),
+        evictions_(0) {
+    for (int i = 0; i < num_shards_; ++i) {
+      shards_[i].max_size = max_size / num_shards_;
+    }
+  }
+
+  virtual ~ConcurrentLRUCache() {
+    for (int i = 0; i < num_shards_; ++i) {
+      typename ItemMap::iterator it;
+      for (it = shards_[i].items.begin(); it != shards_[i].items.end(); ++it) {
+        delete it->second.value;
+      }
+    }
+  }
+
+  virtual bool FetchAndPin(const K& key, V** value) {
+    Shard& shard = ShardOf(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    typename ItemMap::iterator it = shard.items.find(key);
+    if (it == shard.items.end()) {
+      misses_++;
+      return false;
+    }
+    hits_++;
+    Pin(&it->second);
+    *value = it->second.value;
+    return true;
+  }
+
+  virtual void StoreAndPinSized(const K& key, V* value, const size_t size) {
+    InsertAndPin(key, value, size);
+  }
+
+  // Store and pin the value, and return the value which is stored. If the key
+  // is already stored, for example by another thread which loaded the same
+  // item at the same time, value is deleted and the stored value is pinned
+  // and returned instead.
+  V* InsertAndPin(const K& key, V* value, const size_t size) {
+    Shard& shard = ShardOf(key);
+    EvictedItems evicted;
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    std::pair<typename ItemMap::iterator, bool> inserted =
+        shard.items.insert(std::make_pair(key, Item()));
+    Item* item = &inserted.first->second;
+    if (!inserted.second) {
+      if (item->value != value) {
+        delete value;
+      }
+      Pin(item);
+      return item->value;
+    }
+    item->key = &inserted.first->first;
+    item->value = value;
+    item->size = size;
+    item->use_count = 1;
+    shard.size += size;
+    size_ += size;
+    EvictIfNecessary(&shard, &evicted);
+    lock.unlock();
+    HandleEvicted(evicted);
+    return value;
+  }
+
+  void Pin(const K& key) {
+    Shard& shard = ShardOf(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    typename ItemMap::iterator it = shard.items.find(key);
+    assert(it != shard.items.end());
+    Pin(&it->second);
+  }
+
+  virtual void Unpin(const K& key) {
+    Shard& shard = ShardOf(key);
+    EvictedItems evicted;
+    {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      typename ItemMap::iterator it = shard.items.find(key);
+      assert(it != shard.items.end());
+      if (Unpin(&it->second, &shard)) {
+        EvictIfNecessary(&shard, &evicted);
+      }
+    }
+    HandleEvicted(evicted);
+  }
+
+  // Unpin every pinned item once.
+  virtual void MassUnpin() {
+    EvictedItems evicted;
+    for (int i = 0; i < num_shards_; ++i) {
+      Shard& shard = shards_[i];
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      typename ItemMap::iterator it;
+      for (it = shard.items.begin(); it != shard.items.end(); ++it) {
+        if (it->second.use_count > 0) {
+          Unpin(&it->second, &shard);
+        }
+      }
+      EvictIfNecessary(&shard, &evicted);
+    }
+    HandleEvicted(evicted);
+  }
+
+  virtual bool ContainsKey(const K& key) {
+    Shard& shard = ShardOf(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.items.find(key) != shard.items.end();
+  }
+
+  virtual size_t MaxSize() const { return max_size_; }
+
+  virtual size_t Size() const { return size_; }
+
+  virtual void SetMaxSize(const size_t max_size) {
+    max_size_ = max_size;
+    EvictedItems evicted;
+    for (int i = 0; i < num_shards_; ++i) {
+      Shard& shard = shards_[i];
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      shard.max_size = max_size / num_shards_;
+      EvictIfNecessary(&shard, &evicted);
+    }
+    HandleEvicted(evicted);
+  }
+
+  int NumShards() const { return num_shards_; }
+
+  CacheStats Stats() const {
+    CacheStats stats;
+    stats.hits = hits_;
+    stats.misses = misses_;
+    stats.evictions = evictions_;
+    return stats;
+  }
+
+ protected:
+  // Called for every evicted item, without any lock held, so it can be slow
+  // and can access the cache. Takes ownership of the value.
+  virtual void Evicted(const K& /*key*/, V* value) { delete value; }
+
+ private:
+  struct Item {
+    const K* key;
+    V* value;
+    size_t size;
+    int use_count;
+
+    // Neighbours in the list of the unpinned items of the shard, which goes
+    // from the newest to the oldest item.
+    Item* next;
+    Item* prev;
+
+    Item()
+        : key(NULL),
+          value(NULL),
+          size(0),
+          use_count(0),
+          next(NULL),
+          prev(NULL) {}
+  };
+
+  typedef std::unordered_map<K, Item, Hash> ItemMap;
+
+  struct Shard {
+    std::mutex mutex;
+    ItemMap items;
+    size_t size;
+    size_t max_size;
+
+    // Circular list of the unpinned items. The newest one follows the
+    // sentinel, and the oldest one precedes it.
+    Item unpinned;
+
+    Shard() : size(0), max_size(0) {
+      unpinned.next = &unpinned;
+      unpinned.prev = &unpinned;
+    }
+  };
+
+  static int DefaultNumShards(size_t max_size) {
+    return std::min<size_t>(std::max<size_t>(max_size / kMinShardSize, 1), 16);
+  }
+
+  Shard& ShardOf(const K& key) {
+    // The low bits of the hash select the bucket in the map, the high bits of
+    // a mix of it select the shard.
+    const uint64_t mixed = uint64_t(Hash()(key)) * 0x9e3779b97f4a7c15ull;
+    return shards_[(mixed >> 32) % num_shards_];
+  }
+
+  // Must be called with the lock of the shard of the item held.
+  void Pin(Item* item) {
+    if (item->use_count == 0) {
+      item->prev->next = item->next;
+      item->next->prev = item->prev;
+      item->next = item->prev = NULL;
+    }
+    item->use_count++;
+  }
+
+  // Returns whether the item became unpinned. Must be called with the lock of
+  // the shard held.
+  bool Unpin(Item* item, Shard* shard) {
+    assert(item->use_count > 0);
+    item->use_count--;
+    if (item->use_count > 0) {
+      return false;
+    }
+    Item* sentinel = &shard->unpinned;
+    item->prev = sentinel;
+    item->next = sentinel->next;
+    sentinel->next->prev = item;
+    sentinel->next = item;
+    return true;
+  }
+
+  typedef std::vector<std::pair<K, V*> > EvictedItems;
+
+  // Remove the least recently unpinned items from the shard until it fits in
+  // its maximum size. The values are passed to Evicted() by HandleEvicted()
+  // after the lock is released. Must be called with the lock of the shard
+  // held.
+  void EvictIfNecessary(Shard* shard, EvictedItems* evicted) {
+    Item* sentinel = &shard->unpinned;
+    while (shard->size > shard->max_size && sentinel->prev != sentinel) {
+      Item* oldest = sentinel->prev;
+      oldest->prev->next = sentinel;
+      sentinel->prev = oldest->prev;
+      shard->size -= oldest->size;
+      size_ -= oldest->size;
+      evictions_++;
+      evicted->push_back(std::make_pair(*oldest->key, oldest->value));
+      shard->items.erase(*oldest->key);
+    }
+  }
+
+  void HandleEvicted(const EvictedItems& evicted) {
+    for (int i = 0; i < evicted.size(); ++i) {
+      Evicted(evicted[i].first, evicted[i].second);
+    }
+  }
+
+  int num_shards_;
+  scoped_array<Shard> shards_;
+  std::atomic<size_t> max_size_;
+  std::atomic<size_t> size_;
+  std::atomic<int64_t> hits_;
+  std::atomic<int64_t> misses_;
+  std::atomic<int64_t> evictions_;
+};
+
+}  // namespace libmv
+
+#endif  // LIBMV_IMAGE_CONCURRENT_LRU_CACHE_H_
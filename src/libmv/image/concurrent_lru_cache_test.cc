@@ -0,0 +1,160 @@
+// Copyright (c) 2020 libmv authors.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#include "libmv/image/concurrent_lru_cache.h"
+
+#include <thread>
+#include <vector>
+
+#include "testing/testing.h"
+
+namespace {
+
+typedef libmv::ConcurrentLRUCache<int, int> TestCache;
+
+TEST(ConcurrentLRUCache, NullOnEmptyKey) {
+  TestCache cache(10);
+  int* ptr = NULL;
+  EXPECT_FALSE(cache.FetchAndPin(4, &ptr));
+  EXPECT_EQ(1, cache.Stats().misses);
+}
+
+TEST(ConcurrentLRUCache, StoreAndRetreiveOneItem) {
+  TestCache cache(10);
+  int* ptr = NULL;
+  cache.StoreAndPin(4, new int(40));
+  EXPECT_TRUE(cache.FetchAndPin(4, &ptr));
+  EXPECT_EQ(40, *ptr);
+  EXPECT_EQ(1, cache.Stats().hits);
+}
+
+TEST(ConcurrentLRUCache, InsertExistingKeyReturnsStoredValue) {
+  TestCache cache(10);
+  int* stored = new int(40);
+  EXPECT_EQ(stored, cache.InsertAndPin(4, stored, 1));
+  EXPECT_EQ(stored, cache.InsertAndPin(4, new int(41), 1));
+  EXPECT_EQ(1, cache.Size());
+
+  // The key is pinned twice now.
+  cache.Unpin(4);
+  cache.SetMaxSize(0);
+  EXPECT_TRUE(cache.ContainsKey(4));
+  cache.Unpin(4);
+  EXPECT_FALSE(cache.ContainsKey(4));
+}
+
+TEST(ConcurrentLRUCache, MaxSizeExceededWhenItemsPinned) {
+  TestCache cache(3);
+  cache.StoreAndPin(4, new int(40));
+  cache.StoreAndPin(5, new int(50));
+  cache.StoreAndPin(6, new int(60));
+  EXPECT_EQ(3, cache.Size());
+  cache.StoreAndPin(7, new int(70));
+  EXPECT_EQ(4, cache.Size());
+}
+
+TEST(ConcurrentLRUCache, LeastRecentlyUnpinnedIsEvicted) {
+  TestCache cache(3);
+  cache.StoreAndPin(4, new int(40));
+  cache.StoreAndPin(5, new int(50));
+  cache.StoreAndPin(6, new int(60));
+  cache.Unpin(5);
+  cache.Unpin(4);
+  cache.Unpin(6);
+
+  // Pinning takes the item out of the eviction order.
+  cache.Pin(5);
+
+  cache.StoreAndPin(7, new int(70));
+  EXPECT_EQ(3, cache.Size());
+  EXPECT_FALSE(cache.ContainsKey(4));
+  cache.StoreAndPin(8, new int(80));
+  EXPECT_FALSE(cache.ContainsKey(6));
+  EXPECT_TRUE(cache.ContainsKey(5));
+  EXPECT_EQ(2, cache.Stats().evictions);
+}
+
+TEST(ConcurrentLRUCache, SizeDecreaseWhenMaxSizeChanged) {
+  TestCache cache(3);
+  cache.StoreAndPin(4, new int(40));
+  cache.StoreAndPin(5, new int(50));
+  cache.StoreAndPin(6, new int(60));
+  cache.MassUnpin();
+  EXPECT_EQ(3, cache.Size());
+  cache.SetMaxSize(2);
+  EXPECT_EQ(2, cache.Size());
+  cache.SetMaxSize(1);
+  EXPECT_EQ(1, cache.Size());
+  cache.SetMaxSize(10);
+  EXPECT_EQ(1, cache.Size());
+}
+
+TEST(ConcurrentLRUCache, SizesLargerThanInt) {
+  const size_t kGigabyte = size_t(1) << 30;
+  TestCache cache(8 * kGigabyte, 1);
+  for (int i = 0; i < 6; ++i) {
+    cache.StoreAndPinSized(i, new int(i), kGigabyte);
+  }
+  EXPECT_EQ(6 * kGigabyte, cache.Size());
+  cache.MassUnpin();
+  EXPECT_EQ(6 * kGigabyte, cache.Size());
+  cache.SetMaxSize(3 * kGigabyte);
+  EXPECT_EQ(3 * kGigabyte, cache.Size());
+}
+
+TEST(ConcurrentLRUCache, LargeCacheIsSharded) {
+  TestCache cache(size_t(256) << 30);
+  EXPECT_EQ(16, cache.NumShards());
+}
+
+TEST(ConcurrentLRUCache, SmallCacheHasOneShard) {
+  TestCache cache(10 * 1024 * 1024);
+  EXPECT_EQ(1, cache.NumShards());
+}
+
+TEST(ConcurrentLRUCache, ConcurrentAccess) {
+  const int kNumThreads = 4;
+  const int kNumKeys = 64;
+  TestCache cache(kNumKeys / 2, 4);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; ++t) {
+    threads.push_back(std::thread([&cache, t] {
+      for (int i = 0; i < 10000; ++i) {
+        const int key = (i * 7 + t * 13) % kNumKeys;
+        int* value;
+        if (!cache.FetchAndPin(key, &value)) {
+          value = cache.InsertAndPin(key, new int(key), 1);
+        }
+        EXPECT_EQ(key, *value);
+        cache.Unpin(key);
+      }
+    }));
+  }
+  for (int t = 0; t < kNumThreads; ++t) {
+    threads[t].join();
+  }
+
+  EXPECT_LE(cache.Size(), kNumKeys / 2);
+  libmv::CacheStats stats = cache.Stats();
+  EXPECT_EQ(kNumThreads * 10000, stats.hits + stats.misses);
+}
+
+}  // namespace
@@ -20,12 +20,38 @@
 
 #include "libmv/image/convolve.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <vector>
+
+// AVX2 code is compiled using target attributes and is only used when the
+// CPU reports support for it, so the library itself does not require AVX2.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define LIBMV_CONVOLVE_AVX2
+#  include <immintrin.h>
+#elif defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
 
 #include "libmv/image/image.h"
+#include "libmv/threading/parallel_for.h"
 
 namespace libmv {
 
+namespace {
+
+// Images are processed in parallel in bands of rows with at least this many
+// pixels, so small images such as the tracker patches stay on the calling
+// thread.
+const int kMinPixelsPerBand = 64 * 1024;
+
+int BandHeight(int width) {
+  return std::max(1, kMinPixelsPerBand / std::max(1, width));
+}
+
+}  // namespace
+
 // Compute a Gaussian kernel and derivative, such that you can take the
 // derivative of an image by convolving with the kernel horizontally then the
 // derivative vertically to get (eg) the y derivative.
@@ -67,17 +93,22 @@ template <int size, bool vertical>
 void FastConvolve(const Vec& kernel,
                   int width,
                   int height,
-                  const float* src,
+                  int begin_row,
+                  int end_row,
+                  const float* src_image,
                   int src_stride,
                   int src_line_stride,
-                  float* dst,
-                  int dst_stride) {
+                  float* dst_image,
+                  int dst_stride,
+                  int dst_line_stride) {
   double coefficients[2 * size + 1];
   for (int k = 0; k < 2 * size + 1; ++k) {
     coefficients[k] = kernel(2 * size - k);
   }
   // Fast path: if the kernel has a certain size, use the constant sized loops.
-  for (int y = 0; y < height; ++y) {
+  for (int y = begin_row; y < end_row; ++y) {
+    const float* src = src_image + y * src_line_stride;
+    float* dst = dst_image + y * dst_line_stride;
     for (int x = 0; x < width; ++x) {
       double sum = 0;
       for (int k = -size; k <= size; ++k) {
@@ -98,28 +129,20 @@ void FastConvolve(const Vec& kernel,
   }
 }
 
+// Reference implementation of the convolution, which accumulates the sum in
+// double precision. Only the rows [begin_row, end_row) are computed.
 template <bool vertical>
-void Convolve(const Array3Df& in,
-              const Vec& kernel,
-              Array3Df* out_pointer,
-              int plane) {
-  int width = in.Width();
-  int height = in.Height();
-  Array3Df& out = *out_pointer;
-  if (plane == -1) {
-    out.ResizeLike(in);
-    plane = 0;
-  }
-
-  assert(kernel.size() % 2 == 1);
-  assert(&in != out_pointer);
-
-  int src_line_stride = in.Stride(0);
-  int src_stride = in.Stride(1);
-  int dst_stride = out.Stride(1);
-  const float* src = in.Data();
-  float* dst = out.Data() + plane;
-
+void ScalarConvolve(const Vec& kernel,
+                    int width,
+                    int height,
+                    int begin_row,
+                    int end_row,
+                    const float* src_image,
+                    int src_stride,
+                    int src_line_stride,
+                    float* dst_image,
+                    int dst_stride,
+                    int dst_line_stride) {
   // Use a dispatch table to make most convolutions used in practice use the
   // fast path.
   int half_width = kernel.size() / 2;
@@ -129,18 +152,23 @@ void Convolve(const Array3Df& in,
     FastConvolve<size, vertical>(kernel,                                       \
                                  width,                                        \
                                  height,                                       \
-                                 src,                                          \
+                                 begin_row,                                    \
+                                 end_row,                                      \
+                                 src_image,                                    \
                                  src_stride,                                   \
                                  src_line_stride,                              \
-                                 dst,                                          \
-                                 dst_stride);                                  \
+                                 dst_image,                                    \
+                                 dst_stride,                                   \
+                                 dst_line_stride);                             \
     break;
     static_convolution(1) static_convolution(2) static_convolution(3)
         static_convolution(4) static_convolution(5) static_convolution(6)
             static_convolution(7)
 #undef static_convolution
                 default : int dynamic_size = kernel.size() / 2;
-    for (int y = 0; y < height; ++y) {
+    for (int y = begin_row; y < end_row; ++y) {
+      const float* src = src_image + y * src_line_stride;
+      float* dst = dst_image + y * dst_line_stride;
       for (int x = 0; x < width; ++x) {
         double sum = 0;
         // Slow path: this loop cannot be unrolled.
@@ -165,6 +193,298 @@ void Convolve(const Array3Df& in,
   }
 }
 
+
+namespace {
+
+// Compute weighted sum of rows:
+//
+//   dst[x] = sum_k weights[k] * rows[k][x]
+//
+// Both horizontal and vertical convolutions are expressed this way, with the
+// rows being shifted copies of the same row for the horizontal one.
+//
+// The sum is accumulated in double precision in the same order as in
+// ScalarConvolve(), so the results are exactly the same.
+typedef void (*WeightedSumFunction)(const float* const* rows,
+                                    const double* weights,
+                                    int num_rows,
+                                    int width,
+                                    float* dst);
+
+// Scalar part of the weighted sum, for the columns [begin, end) which are
+// not handled by the vector code.
+void WeightedSumScalar(const float* const* rows,
+                       const double* weights,
+                       int num_rows,
+                       int begin,
+                       int end,
+                       float* dst) {
+  for (int x = begin; x < end; ++x) {
+    double sum = 0.0;
+    for (int k = 0; k < num_rows; ++k) {
+      sum += rows[k][x] * weights[k];
+    }
+    dst[x] = static_cast<float>(sum);
+  }
+}
+
+#ifdef __SSE2__
+void WeightedSumSSE2(const float* const* rows,
+                     const double* weights,
+                     int num_rows,
+                     int width,
+                     float* dst) {
+  int x = 0;
+  for (; x + 4 <= width; x += 4) {
+    __m128d sum_low = _mm_setzero_pd();
+    __m128d sum_high = _mm_setzero_pd();
+    for (int k = 0; k < num_rows; ++k) {
+      const __m128d weight = _mm_set1_pd(weights[k]);
+      const __m128 values = _mm_loadu_ps(rows[k] + x);
+      sum_low = _mm_add_pd(sum_low, _mm_mul_pd(_mm_cvtps_pd(values), weight));
+      sum_high = _mm_add_pd(
+          sum_high,
+          _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(values, values)), weight));
+    }
+    _mm_storeu_ps(dst + x,
+                  _mm_movelh_ps(_mm_cvtpd_ps(sum_low), _mm_cvtpd_ps(sum_high)));
+  }
+  WeightedSumScalar(rows, weights, num_rows, x, width, dst);
+}
+#endif  // __SSE2__
+
+#ifdef LIBMV_CONVOLVE_AVX2
+// Only multiplications and additions are used to get the same results as
+// the scalar code, fused multiply-add would round differently.
+__attribute__((target("avx2"))) void WeightedSumAVX2(const float* const* rows,
+                                                     const double* weights,
+                                                     int num_rows,
+                                                     int width,
+                                                     float* dst) {
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m256d sum_low = _mm256_setzero_pd();
+    __m256d sum_high = _mm256_setzero_pd();
+    for (int k = 0; k < num_rows; ++k) {
+      const __m256d weight = _mm256_set1_pd(weights[k]);
+      const __m128 values_low = _mm_loadu_ps(rows[k] + x);
+      const __m128 values_high = _mm_loadu_ps(rows[k] + x + 4);
+      sum_low = _mm256_add_pd(
+          sum_low, _mm256_mul_pd(_mm256_cvtps_pd(values_low), weight));
+      sum_high = _mm256_add_pd(
+          sum_high, _mm256_mul_pd(_mm256_cvtps_pd(values_high), weight));
+    }
+    _mm_storeu_ps(dst + x, _mm256_cvtpd_ps(sum_low));
+    _mm_storeu_ps(dst + x + 4, _mm256_cvtpd_ps(sum_high));
+  }
+  WeightedSumScalar(rows, weights, num_rows, x, width, dst);
+}
+#endif  // LIBMV_CONVOLVE_AVX2
+
+WeightedSumFunction GetWeightedSumFunction(
+    ConvolutionInstructionSet instruction_set) {
+  switch (instruction_set) {
+#ifdef LIBMV_CONVOLVE_AVX2
+    case CONVOLVE_AVX2:
+      return WeightedSumAVX2;
+#endif
+#ifdef __SSE2__
+    case CONVOLVE_SSE2:
+      return WeightedSumSSE2;
+#endif
+    default:
+      return NULL;
+  }
+}
+
+std::atomic<int>& CurrentConvolutionInstructionSet() {
+  static std::atomic<int> instruction_set(BestConvolutionInstructionSet());
+  return instruction_set;
+}
+
+// Convolution using vector instructions, for the rows [begin_row, end_row).
+//
+// Rows of the input are copied to a contiguous buffer first, which also
+// takes care of multichannel images and of the zero padding at the image
+// boundary, so the inner loop has no conditionals.
+template <bool vertical>
+void VectorizedConvolve(const Vec& kernel,
+                        WeightedSumFunction weighted_sum,
+                        int width,
+                        int height,
+                        int begin_row,
+                        int end_row,
+                        const float* src,
+                        int src_stride,
+                        int src_line_stride,
+                        float* dst,
+                        int dst_stride,
+                        int dst_line_stride) {
+  const int half_width = kernel.size() / 2;
+  const int num_weights = kernel.size();
+
+  // Same order of coefficients as in ScalarConvolve().
+  std::vector<double> weights(num_weights);
+  for (int k = 0; k < num_weights; ++k) {
+    weights[k] = kernel(num_weights - 1 - k);
+  }
+
+  std::vector<const float*> rows(num_weights);
+  std::vector<double> row_weights(num_weights);
+  std::vector<float> output_row(dst_stride == 1 ? 0 : width);
+
+  // Copy channel of multichannel image, so rows are contiguous. Only the rows
+  // of the band and the rows around it which are covered by the kernel are
+  // needed.
+  std::vector<float> input;
+  int first_input_row = 0;
+  if (vertical && src_stride != 1) {
+    first_input_row = std::max(0, begin_row - half_width);
+    const int end_input_row = std::min(height, end_row + half_width);
+    input.resize(width * (end_input_row - first_input_row));
+    for (int y = first_input_row; y < end_input_row; ++y) {
+      float* input_row = &input[(y - first_input_row) * width];
+      for (int x = 0; x < width; ++x) {
+        input_row[x] = src[y * src_line_stride + x * src_stride];
+      }
+    }
+    src = &input[0];
+    src_stride = 1;
+    src_line_stride = width;
+  }
+
+  std::vector<float> padded_row;
+  if (!vertical) {
+    padded_row.resize(width + 2 * half_width, 0.0f);
+  }
+
+  for (int y = begin_row; y < end_row; ++y) {
+    int num_rows = 0;
+    if (vertical) {
+      // Rows outside of the image are skipped, same as in ScalarConvolve().
+      for (int k = -half_width; k <= half_width; ++k) {
+        if (y + k >= 0 && y + k < height) {
+          rows[num_rows] = src + (y + k - first_input_row) * src_line_stride;
+          row_weights[num_rows] = weights[k + half_width];
+          num_rows++;
+        }
+      }
+    } else {
+      const float* src_row = src + y * src_line_stride;
+      for (int x = 0; x < width; ++x) {
+        padded_row[half_width + x] = src_row[x * src_stride];
+      }
+      for (int k = 0; k < num_weights; ++k) {
+        rows[k] = &padded_row[k];
+        row_weights[k] = weights[k];
+      }
+      num_rows = num_weights;
+    }
+
+    float* dst_row = dst + y * dst_line_stride;
+    if (dst_stride == 1) {
+      weighted_sum(&rows[0], &row_weights[0], num_rows, width, dst_row);
+    } else {
+      weighted_sum(&rows[0], &row_weights[0], num_rows, width, &output_row[0]);
+      for (int x = 0; x < width; ++x) {
+        dst_row[x * dst_stride] = output_row[x];
+      }
+    }
+  }
+}
+
+}  // namespace
+
+ConvolutionInstructionSet BestConvolutionInstructionSet() {
+#ifdef LIBMV_CONVOLVE_AVX2
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return CONVOLVE_AVX2;
+  }
+#endif
+#ifdef __SSE2__
+  return CONVOLVE_SSE2;
+#else
+  return CONVOLVE_SCALAR;
+#endif
+}
+
+ConvolutionInstructionSet GetConvolutionInstructionSet() {
+  return static_cast<ConvolutionInstructionSet>(
+      CurrentConvolutionInstructionSet().load());
+}
+
+void SetConvolutionInstructionSet(ConvolutionInstructionSet instruction_set) {
+  CurrentConvolutionInstructionSet() =
+      std::min(instruction_set, BestConvolutionInstructionSet());
+}
+
+template <bool vertical>
+void Convolve(const Array3Df& in,
+              const Vec& kernel,
+              Array3Df* out_pointer,
+              int plane) {
+  int width = in.Width();
+  int height = in.Height();
+  Array3Df& out = *out_pointer;
+
+  // Without a plane all channels are convolved, otherwise the first channel
+  // of the input goes to the plane of the output.
+  int num_channels = 1;
+  if (plane == -1) {
+    out.ResizeLike(in);
+    num_channels = in.Depth();
+    plane = 0;
+  }
+
+  assert(kernel.size() % 2 == 1);
+  assert(&in != out_pointer);
+
+  int src_line_stride = in.Stride(0);
+  int src_stride = in.Stride(1);
+  int dst_line_stride = out.Stride(0);
+  int dst_stride = out.Stride(1);
+
+  WeightedSumFunction weighted_sum =
+      GetWeightedSumFunction(GetConvolutionInstructionSet());
+
+  // Bands of output rows are independent. Vertical convolution of a band
+  // reads the rows around it as well, which are shared with the neighbour
+  // bands.
+  ParallelForRanges(height, BandHeight(width), [&](int begin, int end) {
+    for (int k = 0; k < num_channels; ++k) {
+      const float* src = in.Data() + k * in.Stride(2);
+      float* dst = out.Data() + (plane + k) * out.Stride(2);
+      if (weighted_sum) {
+        VectorizedConvolve<vertical>(kernel,
+                                     weighted_sum,
+                                     width,
+                                     height,
+                                     begin,
+                                     end,
+                                     src,
+                                     src_stride,
+                                     src_line_stride,
+                                     dst,
+                                     dst_stride,
+                                     dst_line_stride);
+      } else {
+        ScalarConvolve<vertical>(kernel,
+                                 width,
+                                 height,
+                                 begin,
+                                 end,
+                                 src,
+                                 src_stride,
+                                 src_line_stride,
+                                 dst,
+                                 dst_stride,
+                                 dst_line_stride);
+      }
+    }
+  });
+}
+
 void ConvolveHorizontal(const Array3Df& in,
                         const Vec& kernel,
                         Array3Df* out_pointer,
@@ -179,30 +499,295 @@ void ConvolveVertical(const Array3Df& in,
   Convolve<true>(in, kernel, out_pointer, plane);
 }
 
+namespace {
+
+// Coefficients of the recursive Gaussian filter from
+//
+//   I.T. Young, L.J. van Vliet, "Recursive implementation of the Gaussian
+//   filter", Signal Processing 44 (1995) 139-151.
+//
+// Forward pass is w[n] = B * u[n] + a1 * w[n-1] + a2 * w[n-2] + a3 * w[n-3]
+// and the backward pass is the same, running in the opposite direction.
+struct RecursiveGaussianCoefficients {
+  explicit RecursiveGaussianCoefficients(double sigma) {
+    assert(sigma >= 0.5);
+    double q;
+    if (sigma >= 2.5) {
+      q = 0.98711 * sigma - 0.96330;
+    } else {
+      q = 3.97156 - 4.14554 * sqrt(1.0 - 0.26891 * sigma);
+    }
+    const double q2 = q * q, q3 = q2 * q;
+    const double b0 = 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+    const double b1 = 2.44413 * q + 2.85619 * q2 + 1.26661 * q3;
+    const double b2 = -(1.4281 * q2 + 1.26661 * q3);
+    const double b3 = 0.422205 * q3;
+    a1 = b1 / b0;
+    a2 = b2 / b0;
+    a3 = b3 / b0;
+    B = 1.0 - (a1 + a2 + a3);
+
+    ComputeBoundaryMatrix(q);
+  }
+
+  // The image is padded with zeros, same as for the FIR filters. Input after
+  // the end of the line is zero, so the forward pass continues there as a
+  // homogeneous recursion and the initial values of the backward pass are a
+  // linear function of the last three forward values [1]. Here the matrix of
+  // this function is found by running both passes on the padding for every
+  // unit vector of the forward values.
+  //
+  // [1] B. Triggs, M. Sdika, "Boundary conditions for Young - van Vliet
+  //     recursive filtering", IEEE Trans. Signal Processing 54 (2006).
+  void ComputeBoundaryMatrix(double q) {
+    // The slowest pole decays by ln(1.16680) / q per sample, run the passes
+    // long enough for the tail to drop below the double precision.
+    const int length = (int)ceil(260.0 * q) + 16;
+    std::vector<double> w(length + 3), v(length + 6);
+    for (int j = 0; j < 3; ++j) {
+      std::fill(w.begin(), w.end(), 0.0);
+      std::fill(v.begin(), v.end(), 0.0);
+      // w[0], w[1], w[2] are the last three values of the line.
+      w[2 - j] = 1.0;
+      for (int n = 3; n < length + 3; ++n) {
+        w[n] = a1 * w[n - 1] + a2 * w[n - 2] + a3 * w[n - 3];
+      }
+      for (int n = length + 2; n >= 3; --n) {
+        v[n] = B * w[n] + a1 * v[n + 1] + a2 * v[n + 2] + a3 * v[n + 3];
+      }
+      for (int i = 0; i < 3; ++i) {
+        M[i][j] = v[3 + i];
+      }
+    }
+  }
+
+  double B, a1, a2, a3;
+
+  // Maps the last three values of the forward pass, starting from the last
+  // one, to the first three values of the backward pass after the line.
+  double M[3][3];
+};
+
+// Filter a number of lines at once. Sample n of line l is at
+// src[n * src_sample_stride + l * src_line_stride], same for dst.
+//
+// Lines are processed in the inner loop, so filtering along the columns
+// walks the image row by row.
+void RecursiveGaussianLines(const RecursiveGaussianCoefficients& c,
+                            bool derivative,
+                            const float* src,
+                            int src_sample_stride,
+                            int src_line_stride,
+                            int length,
+                            int num_lines,
+                            float* dst,
+                            int dst_sample_stride,
+                            int dst_line_stride,
+                            std::vector<double>* buffer) {
+  // Values of the samples from -3 to length + 2 of every line. Input is
+  // copied to [0, length) first and both passes then run in place on
+  // contiguous rows of the buffer.
+  const int L = num_lines;
+  buffer->assign((length + 6) * L, 0.0);
+  double* b = &(*buffer)[3 * L];
+
+  for (int n = 0; n < length; ++n) {
+    const float* s = src + n * src_sample_stride;
+    double* bn = b + n * L;
+    for (int l = 0; l < L; ++l) {
+      bn[l] = s[l * src_line_stride];
+    }
+  }
+
+  const double B = c.B, a1 = c.a1, a2 = c.a2, a3 = c.a3;
+  for (int n = 0; n < length; ++n) {
+    double* bn = b + n * L;
+    const double* b1 = bn - L;
+    const double* b2 = bn - 2 * L;
+    const double* b3 = bn - 3 * L;
+    for (int l = 0; l < L; ++l) {
+      bn[l] = B * bn[l] + a1 * b1[l] + a2 * b2[l] + a3 * b3[l];
+    }
+  }
+
+  for (int l = 0; l < L; ++l) {
+    const double w0 = b[(length - 1) * L + l];
+    const double w1 = b[(length - 2) * L + l];
+    const double w2 = b[(length - 3) * L + l];
+    for (int i = 0; i < 3; ++i) {
+      b[(length + i) * L + l] =
+          c.M[i][0] * w0 + c.M[i][1] * w1 + c.M[i][2] * w2;
+    }
+  }
+
+  // Also compute the sample before the line, which is needed for the
+  // derivative. Forward value there is zero.
+  for (int n = length - 1; n >= -1; --n) {
+    double* bn = b + n * L;
+    const double* b1 = bn + L;
+    const double* b2 = bn + 2 * L;
+    const double* b3 = bn + 3 * L;
+    for (int l = 0; l < L; ++l) {
+      bn[l] = B * bn[l] + a1 * b1[l] + a2 * b2[l] + a3 * b3[l];
+    }
+  }
+
+  for (int n = 0; n < length; ++n) {
+    float* d = dst + n * dst_sample_stride;
+    const double* bn = b + n * L;
+    if (derivative) {
+      for (int l = 0; l < L; ++l) {
+        d[l * dst_line_stride] =
+            static_cast<float>(0.5 * (bn[l + L] - bn[l - L]));
+      }
+    } else {
+      for (int l = 0; l < L; ++l) {
+        d[l * dst_line_stride] = static_cast<float>(bn[l]);
+      }
+    }
+  }
+}
+
+template <bool vertical>
+void RecursiveGaussian(const Array3Df& in,
+                       double sigma,
+                       bool derivative,
+                       Array3Df* out_pointer,
+                       int plane) {
+  int width = in.Width();
+  int height = in.Height();
+  Array3Df& out = *out_pointer;
+
+  // Same as for the convolutions, without a plane all channels are filtered.
+  int num_channels = 1;
+  if (plane == -1) {
+    out.ResizeLike(in);
+    num_channels = in.Depth();
+    plane = 0;
+  }
+
+  assert(&in != out_pointer);
+
+  const RecursiveGaussianCoefficients coefficients(sigma);
+
+  // Lines are filtered in groups, so the buffer stays in cache. Columns of
+  // the group are read row by row, so the group needs to be wider to make
+  // good use of the cache lines and pages.
+  //
+  // Lines are independent, so the groups are processed in parallel: bands of
+  // rows for the horizontal filter, and strips of columns for the vertical
+  // one, since the recursion runs along the whole column.
+  const int kGroupSize = vertical ? 128 : 32;
+  const int length = vertical ? height : width;
+  const int num_lines = vertical ? width : height;
+  const int src_sample_stride = vertical ? in.Stride(0) : in.Stride(1);
+  const int src_line_stride = vertical ? in.Stride(1) : in.Stride(0);
+  const int dst_sample_stride = vertical ? out.Stride(0) : out.Stride(1);
+  const int dst_line_stride = vertical ? out.Stride(1) : out.Stride(0);
+  const int lines_per_band = std::max(kGroupSize, BandHeight(length));
+  ParallelForRanges(num_lines, lines_per_band, [&](int begin, int end) {
+    std::vector<double> buffer;
+    for (int k = 0; k < num_channels; ++k) {
+      const float* src = in.Data() + k * in.Stride(2);
+      float* dst = out.Data() + (plane + k) * out.Stride(2);
+      for (int line = begin; line < end; line += kGroupSize) {
+        RecursiveGaussianLines(coefficients,
+                               derivative,
+                               src + line * src_line_stride,
+                               src_sample_stride,
+                               src_line_stride,
+                               length,
+                               std::min(kGroupSize, end - line),
+                               dst + line * dst_line_stride,
+                               dst_sample_stride,
+                               dst_line_stride,
+                               &buffer);
+      }
+    }
+  });
+}
+
+// Gaussian and its derivative along one of the axes. Small sigmas use the
+// FIR kernels, large ones the recursive filters.
+class SeparableGaussian {
+ public:
+  explicit SeparableGaussian(double sigma)
+      : sigma_(sigma), recursive_(sigma >= kRecursiveGaussianMinSigma) {
+    if (!recursive_) {
+      ComputeGaussianKernel(sigma, &kernel_, &derivative_);
+    }
+  }
+
+  void Horizontal(const Array3Df& in,
+                  bool derivative,
+                  Array3Df* out,
+                  int plane = -1) const {
+    if (recursive_) {
+      RecursiveGaussianHorizontal(in, sigma_, derivative, out, plane);
+    } else {
+      ConvolveHorizontal(in, derivative ? derivative_ : kernel_, out, plane);
+    }
+  }
+
+  void Vertical(const Array3Df& in,
+                bool derivative,
+                Array3Df* out,
+                int plane = -1) const {
+    if (recursive_) {
+      RecursiveGaussianVertical(in, sigma_, derivative, out, plane);
+    } else {
+      ConvolveVertical(in, derivative ? derivative_ : kernel_, out, plane);
+    }
+  }
+
+ private:
+  double sigma_;
+  bool recursive_;
+  Vec kernel_, derivative_;
+};
+
+}  // namespace
+
+void RecursiveGaussianHorizontal(const Array3Df& in,
+                                 double sigma,
+                                 bool derivative,
+                                 Array3Df* out_pointer,
+                                 int plane) {
+  RecursiveGaussian<false>(in, sigma, derivative, out_pointer, plane);
+}
+
+void RecursiveGaussianVertical(const Array3Df& in,
+                               double sigma,
+                               bool derivative,
+                               Array3Df* out_pointer,
+                               int plane) {
+  RecursiveGaussian<true>(in, sigma, derivative, out_pointer, plane);
+}
+
 void ConvolveGaussian(const Array3Df& in, double sigma, Array3Df* out_pointer) {
-  Vec kernel, derivative;
-  ComputeGaussianKernel(sigma, &kernel, &derivative);
+  SeparableGaussian gaussian(sigma);
 
-  Array3Df tmp;
-  ConvolveVertical(in, kernel, &tmp);
-  ConvolveHorizontal(tmp, kernel, out_pointer);
+  // Rows of the intermediate images start at cache lines, so the loads of the
+  // vectorized convolution do not cross them.
+  Array3Df tmp(ALIGNED_STORAGE);
+  gaussian.Vertical(in, false, &tmp);
+  gaussian.Horizontal(tmp, false, out_pointer);
 }
 
 void ImageDerivatives(const Array3Df& in,
                       double sigma,
                       Array3Df* gradient_x,
                       Array3Df* gradient_y) {
-  Vec kernel, derivative;
-  ComputeGaussianKernel(sigma, &kernel, &derivative);
-  Array3Df tmp;
+  SeparableGaussian gaussian(sigma);
+  Array3Df tmp(ALIGNED_STORAGE);
 
   // Compute first derivative in x.
-  ConvolveVertical(in, kernel, &tmp);
-  ConvolveHorizontal(tmp, derivative, gradient_x);
+  gaussian.Vertical(in, false, &tmp);
+  gaussian.Horizontal(tmp, true, gradient_x);
 
   // Compute first derivative in y.
-  ConvolveHorizontal(in, kernel, &tmp);
-  ConvolveVertical(tmp, derivative, gradient_y);
+  gaussian.Horizontal(in, false, &tmp);
+  gaussian.Vertical(tmp, true, gradient_y);
 }
 
 void BlurredImageAndDerivatives(const Array3Df& in,
@@ -210,20 +795,19 @@ void BlurredImageAndDerivatives(const Array3Df& in,
                                 Array3Df* blurred_image,
                                 Array3Df* gradient_x,
                                 Array3Df* gradient_y) {
-  Vec kernel, derivative;
-  ComputeGaussianKernel(sigma, &kernel, &derivative);
-  Array3Df tmp;
+  SeparableGaussian gaussian(sigma);
+  Array3Df tmp(ALIGNED_STORAGE);
 
   // Compute convolved image.
-  ConvolveVertical(in, kernel, &tmp);
-  ConvolveHorizontal(tmp, kernel, blurred_image);
+  gaussian.Vertical(in, false, &tmp);
+  gaussian.Horizontal(tmp, false, blurred_image);
 
   // Compute first derivative in x (reusing vertical convolution above).
-  ConvolveHorizontal(tmp, derivative, gradient_x);
+  gaussian.Horizontal(tmp, true, gradient_x);
 
   // Compute first derivative in y.
-  ConvolveHorizontal(in, kernel, &tmp);
-  ConvolveVertical(tmp, derivative, gradient_y);
+  gaussian.Horizontal(in, false, &tmp);
+  gaussian.Vertical(tmp, true, gradient_y);
 }
 
 // Compute the gaussian blur of an image and the derivatives of the blurred
@@ -235,21 +819,20 @@ void BlurredImageAndDerivativesChannels(const Array3Df& in,
                                         Array3Df* blurred_and_gradxy) {
   assert(in.Depth() == 1);
 
-  Vec kernel, derivative;
-  ComputeGaussianKernel(sigma, &kernel, &derivative);
+  SeparableGaussian gaussian(sigma);
 
   // Compute convolved image.
-  Array3Df tmp;
-  ConvolveVertical(in, kernel, &tmp);
+  Array3Df tmp(ALIGNED_STORAGE);
+  gaussian.Vertical(in, false, &tmp);
   blurred_and_gradxy->Resize(in.Height(), in.Width(), 3);
-  ConvolveHorizontal(tmp, kernel, blurred_and_gradxy, 0);
+  gaussian.Horizontal(tmp, false, blurred_and_gradxy, 0);
 
   // Compute first derivative in x.
-  ConvolveHorizontal(tmp, derivative, blurred_and_gradxy, 1);
+  gaussian.Horizontal(tmp, true, blurred_and_gradxy, 1);
 
   // Compute first derivative in y.
-  ConvolveHorizontal(in, kernel, &tmp);
-  ConvolveVertical(tmp, derivative, blurred_and_gradxy, 2);
+  gaussian.Horizontal(in, false, &tmp);
+  gaussian.Vertical(tmp, true, blurred_and_gradxy, 2);
 }
 
 void BoxFilterHorizontal(const Array3Df& in,
@@ -259,31 +842,34 @@ void BoxFilterHorizontal(const Array3Df& in,
   out.ResizeLike(in);
   int half_width = (window_size - 1) / 2;
 
-  for (int k = 0; k < in.Depth(); ++k) {
-    for (int i = 0; i < in.Height(); ++i) {
-      float sum = 0;
-      // Init sum.
-      for (int j = 0; j < half_width; ++j) {
-        sum += in(i, j, k);
-      }
-      // Fill left border.
-      for (int j = 0; j < half_width + 1; ++j) {
-        sum += in(i, j + half_width, k);
-        out(i, j, k) = sum;
-      }
-      // Fill interior.
-      for (int j = half_width + 1; j < in.Width() - half_width; ++j) {
-        sum -= in(i, j - half_width - 1, k);
-        sum += in(i, j + half_width, k);
-        out(i, j, k) = sum;
-      }
-      // Fill right border.
-      for (int j = in.Width() - half_width; j < in.Width(); ++j) {
-        sum -= in(i, j - half_width - 1, k);
-        out(i, j, k) = sum;
-      }
-    }
-  }
+  ParallelForRanges(
+      in.Height(), BandHeight(in.Width()), [&](int begin_row, int end_row) {
+        for (int k = 0; k < in.Depth(); ++k) {
+          for (int i = begin_row; i < end_row; ++i) {
+            float sum = 0;
+            // Init sum.
+            for (int j = 0; j < half_width; ++j) {
+              sum += in(i, j, k);
+            }
+            // Fill left border.
+            for (int j = 0; j < half_width + 1; ++j) {
+              sum += in(i, j + half_width, k);
+              out(i, j, k) = sum;
+            }
+            // Fill interior.
+            for (int j = half_width + 1; j < in.Width() - half_width; ++j) {
+              sum -= in(i, j - half_width - 1, k);
+              sum += in(i, j + half_width, k);
+              out(i, j, k) = sum;
+            }
+            // Fill right border.
+            for (int j = in.Width() - half_width; j < in.Width(); ++j) {
+              sum -= in(i, j - half_width - 1, k);
+              out(i, j, k) = sum;
+            }
+          }
+        }
+      });
 }
 
 void BoxFilterVertical(const Array3Df& in,
@@ -293,35 +879,49 @@ void BoxFilterVertical(const Array3Df& in,
   out.ResizeLike(in);
   int half_width = (window_size - 1) / 2;
 
-  for (int k = 0; k < in.Depth(); ++k) {
-    for (int j = 0; j < in.Width(); ++j) {
-      float sum = 0;
-      // Init sum.
-      for (int i = 0; i < half_width; ++i) {
-        sum += in(i, j, k);
-      }
-      // Fill left border.
-      for (int i = 0; i < half_width + 1; ++i) {
-        sum += in(i + half_width, j, k);
-        out(i, j, k) = sum;
+  // The running sums of all the columns are updated row by row, which walks
+  // the memory in order. Every band of rows starts the sums from the rows
+  // around its first row.
+  const int height = in.Height();
+  const int width = in.Width();
+  const int depth = in.Depth();
+  ParallelForRanges(height, BandHeight(width), [&](int begin_row, int end_row) {
+    std::vector<float> sum(width * depth, 0.0f);
+    const int first = std::max(0, begin_row - half_width);
+    const int last = std::min(height - 1, begin_row + half_width);
+    for (int i = first; i <= last; ++i) {
+      for (int j = 0; j < width; ++j) {
+        for (int k = 0; k < depth; ++k) {
+          sum[j * depth + k] += in(i, j, k);
+        }
       }
-      // Fill interior.
-      for (int i = half_width + 1; i < in.Height() - half_width; ++i) {
-        sum -= in(i - half_width - 1, j, k);
-        sum += in(i + half_width, j, k);
-        out(i, j, k) = sum;
+    }
+    for (int i = begin_row; i < end_row; ++i) {
+      if (i > begin_row) {
+        const int removed_row = i - half_width - 1;
+        const int added_row = i + half_width;
+        for (int j = 0; j < width; ++j) {
+          for (int k = 0; k < depth; ++k) {
+            if (removed_row >= 0) {
+              sum[j * depth + k] -= in(removed_row, j, k);
+            }
+            if (added_row < height) {
+              sum[j * depth + k] += in(added_row, j, k);
+            }
+          }
+        }
       }
-      // Fill right border.
-      for (int i = in.Height() - half_width; i < in.Height(); ++i) {
-        sum -= in(i - half_width - 1, j, k);
-        out(i, j, k) = sum;
+      for (int j = 0; j < width; ++j) {
+        for (int k = 0; k < depth; ++k) {
+          out(i, j, k) = sum[j * depth + k];
+        }
       }
     }
-  }
+  });
 }
 
 void BoxFilter(const Array3Df& in, int box_width, Array3Df* out) {
-  Array3Df tmp;
+  Array3Df tmp(ALIGNED_STORAGE);
   BoxFilterHorizontal(in, box_width, &tmp);
   BoxFilterVertical(tmp, box_width, out);
 }
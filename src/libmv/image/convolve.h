@@ -47,6 +47,26 @@ inline double GaussianInversePositive(double y, double sigma) {
 }
 
 void ComputeGaussianKernel(double sigma, Vec* kernel, Vec* derivative);
+
+// Instruction sets which can be used by the convolution functions. All of
+// them give exactly the same results.
+enum ConvolutionInstructionSet {
+  CONVOLVE_SCALAR,
+  CONVOLVE_SSE2,
+  CONVOLVE_AVX2,
+};
+
+// Best instruction set supported by the CPU, which is used by default.
+ConvolutionInstructionSet BestConvolutionInstructionSet();
+
+// Instruction set used by the convolutions. Instruction sets which are not
+// supported by the CPU are replaced with the best supported one. This is
+// mainly useful for testing and benchmarking.
+ConvolutionInstructionSet GetConvolutionInstructionSet();
+void SetConvolutionInstructionSet(ConvolutionInstructionSet instruction_set);
+
+// Convolve all channels of the image, or only the first channel into the
+// given plane of the output.
 void ConvolveHorizontal(const FloatImage& in,
                         const Vec& kernel,
                         FloatImage* out_pointer,
@@ -55,6 +75,27 @@ void ConvolveVertical(const FloatImage& in,
                       const Vec& kernel,
                       FloatImage* out_pointer,
                       int plane = -1);
+
+// Recursive Gaussian filter along rows or columns of the image, or the first
+// derivative of it when derivative is true. Cost per pixel does not depend on
+// sigma, which has to be at least 0.5. The image is padded with zeros, and
+// the channels and the plane are handled the same as for the convolutions.
+void RecursiveGaussianHorizontal(const FloatImage& in,
+                                 double sigma,
+                                 bool derivative,
+                                 FloatImage* out_pointer,
+                                 int plane = -1);
+void RecursiveGaussianVertical(const FloatImage& in,
+                               double sigma,
+                               bool derivative,
+                               FloatImage* out_pointer,
+                               int plane = -1);
+
+// Gaussians with sigma of at least this value are computed with the
+// recursive filters by the functions below, smaller ones are convolved with
+// the kernels from ComputeGaussianKernel().
+const double kRecursiveGaussianMinSigma = 4.0;
+
 void ConvolveGaussian(const FloatImage& in,
                       double sigma,
                       FloatImage* out_pointer);
@@ -18,8 +18,10 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
 // IN THE SOFTWARE.
 
+#include <cstdlib>
 #include <iostream>
 
+#include "libmv/base/vector.h"
 #include "libmv/image/convolve.h"
 #include "libmv/image/image.h"
 #include "libmv/numeric/numeric.h"
@@ -107,4 +109,330 @@ TEST(Convolve, BlurredImageAndDerivativesChannelsVerticalSlope) {
   EXPECT_NEAR(blurred_and_derivatives(5, 5, 2), 2.0, 1e-7);
 }
 
+void CreateRandomImage(int width, int height, int depth, FloatImage* image) {
+  image->Resize(height, width, depth);
+  for (int i = 0; i < image->Size(); ++i) {
+    image->Data()[i] = (float)rand() / RAND_MAX;
+  }
+}
+
+void ExpectImagesEqual(const FloatImage& expected,
+                       const FloatImage& actual,
+                       int depth) {
+  ASSERT_EQ(expected.Width(), actual.Width());
+  ASSERT_EQ(expected.Height(), actual.Height());
+  for (int y = 0; y < expected.Height(); ++y) {
+    for (int x = 0; x < expected.Width(); ++x) {
+      for (int d = 0; d < depth; ++d) {
+        EXPECT_EQ(expected(y, x, d), actual(y, x, d));
+      }
+    }
+  }
+}
+
+// Run all the convolutions using the given instruction set.
+void ConvolveAll(ConvolutionInstructionSet instruction_set,
+                 const FloatImage& image,
+                 const FloatImage& multichannel_image,
+                 vector<FloatImage>* results) {
+  ConvolutionInstructionSet previous_instruction_set =
+      GetConvolutionInstructionSet();
+  SetConvolutionInstructionSet(instruction_set);
+
+  results->clear();
+  results->resize(7);
+
+  // Small kernel uses the fixed size loops of the scalar code, while the
+  // large one uses the generic loop.
+  ConvolveGaussian(image, 0.9, &(*results)[0]);
+  ConvolveGaussian(image, 4.0, &(*results)[1]);
+  ImageDerivatives(image, 1.2, &(*results)[2], &(*results)[3]);
+  BlurredImageAndDerivativesChannels(image, 1.0, &(*results)[4]);
+
+  // All channels of multichannel image are convolved.
+  Vec kernel, derivative;
+  ComputeGaussianKernel(1.5, &kernel, &derivative);
+  ConvolveHorizontal(multichannel_image, kernel, &(*results)[5]);
+  ConvolveVertical(multichannel_image, derivative, &(*results)[6]);
+
+  SetConvolutionInstructionSet(previous_instruction_set);
+}
+
+TEST(Convolve, InstructionSetsMatchScalar) {
+  // Width is not a multiple of the vector size, so the scalar tail is used
+  // as well.
+  FloatImage image, multichannel_image;
+  CreateRandomImage(53, 37, 1, &image);
+  CreateRandomImage(29, 41, 3, &multichannel_image);
+
+  vector<FloatImage> expected_results;
+  ConvolveAll(CONVOLVE_SCALAR, image, multichannel_image, &expected_results);
+
+  int depths[] = {1, 1, 1, 1, 3, 3, 3};
+  for (int i = CONVOLVE_SSE2; i <= BestConvolutionInstructionSet(); ++i) {
+    ConvolutionInstructionSet instruction_set = (ConvolutionInstructionSet)i;
+    vector<FloatImage> results;
+    ConvolveAll(instruction_set, image, multichannel_image, &results);
+
+    for (int j = 0; j < results.size(); ++j) {
+      ExpectImagesEqual(expected_results[j], results[j], depths[j]);
+    }
+  }
+}
+
+void Transpose(const FloatImage& in, FloatImage* out) {
+  out->Resize(in.Width(), in.Height(), in.Depth());
+  for (int y = 0; y < in.Height(); ++y) {
+    for (int x = 0; x < in.Width(); ++x) {
+      for (int d = 0; d < in.Depth(); ++d) {
+        (*out)(x, y, d) = in(y, x, d);
+      }
+    }
+  }
+}
+
+TEST(Convolve, VerticalConvolutionOfBands) {
+  // Image is large enough to be split into several bands of rows, which
+  // read rows of the neighbour bands. Horizontal convolution of transposed
+  // image has no dependencies between the rows, and gives the same result.
+  FloatImage image, multichannel_image;
+  CreateRandomImage(500, 600, 1, &image);
+  CreateRandomImage(470, 610, 3, &multichannel_image);
+
+  Vec kernel, derivative;
+  ComputeGaussianKernel(2.0, &kernel, &derivative);
+
+  ConvolutionInstructionSet previous_instruction_set =
+      GetConvolutionInstructionSet();
+  for (int i = CONVOLVE_SCALAR; i <= BestConvolutionInstructionSet(); ++i) {
+    SetConvolutionInstructionSet((ConvolutionInstructionSet)i);
+    const FloatImage* images[] = {&image, &multichannel_image};
+    for (int j = 0; j < 2; ++j) {
+      FloatImage vertical, transposed, horizontal, expected_vertical;
+      ConvolveVertical(*images[j], kernel, &vertical);
+      Transpose(*images[j], &transposed);
+      ConvolveHorizontal(transposed, kernel, &horizontal);
+      Transpose(horizontal, &expected_vertical);
+      ExpectImagesEqual(expected_vertical, vertical, images[j]->Depth());
+    }
+  }
+  SetConvolutionInstructionSet(previous_instruction_set);
+}
+
+TEST(Convolve, MultichannelMatchesSingleChannel) {
+  FloatImage multichannel_image;
+  CreateRandomImage(67, 45, 3, &multichannel_image);
+
+  Vec kernel, derivative;
+  ComputeGaussianKernel(1.5, &kernel, &derivative);
+
+  FloatImage horizontal, vertical;
+  ConvolveHorizontal(multichannel_image, kernel, &horizontal);
+  ConvolveVertical(multichannel_image, derivative, &vertical);
+  EXPECT_EQ(3, horizontal.Depth());
+  EXPECT_EQ(3, vertical.Depth());
+
+  for (int d = 0; d < 3; ++d) {
+    FloatImage channel(multichannel_image.Height(), multichannel_image.Width());
+    for (int y = 0; y < channel.Height(); ++y) {
+      for (int x = 0; x < channel.Width(); ++x) {
+        channel(y, x) = multichannel_image(y, x, d);
+      }
+    }
+    FloatImage expected_horizontal, expected_vertical;
+    ConvolveHorizontal(channel, kernel, &expected_horizontal);
+    ConvolveVertical(channel, derivative, &expected_vertical);
+    for (int y = 0; y < channel.Height(); ++y) {
+      for (int x = 0; x < channel.Width(); ++x) {
+        EXPECT_EQ(expected_horizontal(y, x), horizontal(y, x, d));
+        EXPECT_EQ(expected_vertical(y, x), vertical(y, x, d));
+      }
+    }
+  }
+}
+
+TEST(Convolve, BoxFilterOfBands) {
+  FloatImage image, filtered;
+  CreateRandomImage(400, 700, 2, &image);
+
+  const int half_width = 3;
+  BoxFilter(image, 2 * half_width + 1, &filtered);
+
+  for (int y = 0; y < image.Height(); ++y) {
+    for (int x = 0; x < image.Width(); ++x) {
+      for (int d = 0; d < image.Depth(); ++d) {
+        double sum = 0.0;
+        for (int i = y - half_width; i <= y + half_width; ++i) {
+          for (int j = x - half_width; j <= x + half_width; ++j) {
+            if (image.Contains(i, j)) {
+              sum += image(i, j, d);
+            }
+          }
+        }
+        EXPECT_NEAR(sum, filtered(y, x, d), 1e-4);
+      }
+    }
+  }
+}
+
+TEST(Convolve, Views) {
+  // Functions read the pixels using the strides, so views give the same
+  // result as their contiguous copies.
+  FloatImage image;
+  CreateRandomImage(60, 50, 3, &image);
+
+  const FloatImage views[] = {
+      image.Crop(5, 7, 31, 43), image.Channel(2), image.Rows(10, 40)};
+  for (int i = 0; i < 3; ++i) {
+    const FloatImage& view = views[i];
+    FloatImage copy(view);
+    ASSERT_TRUE(copy.IsContiguous());
+
+    for (int j = CONVOLVE_SCALAR; j <= BestConvolutionInstructionSet(); ++j) {
+      ConvolutionInstructionSet previous_instruction_set =
+          GetConvolutionInstructionSet();
+      SetConvolutionInstructionSet((ConvolutionInstructionSet)j);
+
+      FloatImage expected, actual;
+      if (view.Depth() == 1) {
+        BlurredImageAndDerivativesChannels(copy, 1.2, &expected);
+        BlurredImageAndDerivativesChannels(view, 1.2, &actual);
+        ExpectImagesEqual(expected, actual, 3);
+      }
+
+      Vec kernel, derivative;
+      ComputeGaussianKernel(1.0, &kernel, &derivative);
+      ConvolveVertical(copy, derivative, &expected);
+      ConvolveVertical(view, derivative, &actual);
+      ExpectImagesEqual(expected, actual, 1);
+
+      SetConvolutionInstructionSet(previous_instruction_set);
+    }
+
+    FloatImage expected, actual;
+    BoxFilter(copy, 5, &expected);
+    BoxFilter(view, 5, &actual);
+    ExpectImagesEqual(expected, actual, view.Depth());
+  }
+}
+
+TEST(Convolve, AlignedStorage) {
+  FloatImage image;
+  CreateRandomImage(45, 30, 1, &image);
+  FloatImage aligned_image(ALIGNED_STORAGE);
+  aligned_image = image;
+
+  FloatImage expected, actual(ALIGNED_STORAGE);
+  BlurredImageAndDerivativesChannels(image, 1.5, &expected);
+  BlurredImageAndDerivativesChannels(aligned_image, 1.5, &actual);
+  EXPECT_EQ(ALIGNED_STORAGE, actual.Storage());
+  ExpectImagesEqual(expected, actual, 3);
+
+  BoxFilter(image, 3, &expected);
+  BoxFilter(aligned_image, 3, &actual);
+  ExpectImagesEqual(expected, actual, 1);
+}
+
+TEST(Convolve, SetConvolutionInstructionSet) {
+  ConvolutionInstructionSet previous_instruction_set =
+      GetConvolutionInstructionSet();
+  EXPECT_EQ(BestConvolutionInstructionSet(), previous_instruction_set);
+
+  SetConvolutionInstructionSet(CONVOLVE_SCALAR);
+  EXPECT_EQ(CONVOLVE_SCALAR, GetConvolutionInstructionSet());
+
+  // Unsupported instruction sets fall back to the best supported one.
+  SetConvolutionInstructionSet(CONVOLVE_AVX2);
+  EXPECT_EQ(BestConvolutionInstructionSet(), GetConvolutionInstructionSet());
+
+  SetConvolutionInstructionSet(previous_instruction_set);
+}
+
+TEST(Convolve, RecursiveGaussianImpulseResponse) {
+  const double sigma = 5.0;
+  FloatImage image(1, 101), blurred;
+  image.Fill(0);
+  image(0, 50) = 1.0;
+  RecursiveGaussianHorizontal(image, sigma, false, &blurred);
+  for (int x = 0; x < image.Width(); ++x) {
+    // Young - van Vliet approximation is within a few percent of the peak.
+    EXPECT_NEAR(Gaussian(x - 50, sigma), blurred(0, x), 3e-3);
+  }
+}
+
+TEST(Convolve, RecursiveGaussianConstantAndSlope) {
+  const double sigma = 6.0;
+  FloatImage image(150, 160);
+  for (int y = 0; y < image.Height(); ++y) {
+    for (int x = 0; x < image.Width(); ++x) {
+      image(y, x) = 3.0 + 0.5 * x - 0.25 * y;
+    }
+  }
+
+  FloatImage blurred_and_derivatives;
+  BlurredImageAndDerivativesChannels(image, sigma, &blurred_and_derivatives);
+
+  // Away from the zero padding linear image does not change, and the
+  // derivatives are the slopes.
+  for (int y = 70; y < 80; ++y) {
+    for (int x = 75; x < 85; ++x) {
+      EXPECT_NEAR(image(y, x), blurred_and_derivatives(y, x, 0), 1e-4);
+      EXPECT_NEAR(0.5, blurred_and_derivatives(y, x, 1), 1e-5);
+      EXPECT_NEAR(-0.25, blurred_and_derivatives(y, x, 2), 1e-5);
+    }
+  }
+}
+
+TEST(Convolve, RecursiveGaussianIsUsedForLargeSigma) {
+  FloatImage image;
+  CreateRandomImage(40, 30, 1, &image);
+
+  const double sigma = kRecursiveGaussianMinSigma;
+  FloatImage blurred, vertical, expected_blurred;
+  ConvolveGaussian(image, sigma, &blurred);
+  RecursiveGaussianVertical(image, sigma, false, &vertical);
+  RecursiveGaussianHorizontal(vertical, sigma, false, &expected_blurred);
+  ExpectImagesEqual(expected_blurred, blurred, 1);
+
+  // Borders are padded with zeros, same as for the kernel convolutions.
+  FloatImage kernel_blurred;
+  Vec kernel, derivative;
+  ComputeGaussianKernel(sigma, &kernel, &derivative);
+  ConvolveVertical(image, kernel, &vertical);
+  ConvolveHorizontal(vertical, kernel, &kernel_blurred);
+  for (int y = 0; y < image.Height(); ++y) {
+    for (int x = 0; x < image.Width(); ++x) {
+      EXPECT_NEAR(kernel_blurred(y, x), blurred(y, x), 2e-2);
+    }
+  }
+}
+
+TEST(Convolve, RecursiveGaussianOfMultichannelImage) {
+  FloatImage multichannel_image;
+  CreateRandomImage(150, 140, 3, &multichannel_image);
+
+  const double sigma = kRecursiveGaussianMinSigma;
+  FloatImage horizontal, vertical;
+  RecursiveGaussianHorizontal(multichannel_image, sigma, false, &horizontal);
+  RecursiveGaussianVertical(multichannel_image, sigma, true, &vertical);
+
+  for (int d = 0; d < 3; ++d) {
+    FloatImage channel(multichannel_image.Height(), multichannel_image.Width());
+    for (int y = 0; y < channel.Height(); ++y) {
+      for (int x = 0; x < channel.Width(); ++x) {
+        channel(y, x) = multichannel_image(y, x, d);
+      }
+    }
+    FloatImage expected_horizontal, expected_vertical;
+    RecursiveGaussianHorizontal(channel, sigma, false, &expected_horizontal);
+    RecursiveGaussianVertical(channel, sigma, true, &expected_vertical);
+    for (int y = 0; y < channel.Height(); ++y) {
+      for (int x = 0; x < channel.Width(); ++x) {
+        EXPECT_EQ(expected_horizontal(y, x), horizontal(y, x, d));
+        EXPECT_EQ(expected_vertical(y, x), vertical(y, x, d));
+      }
+    }
+  }
+}
+
 }  // namespace
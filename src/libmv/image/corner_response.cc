@@ -0,0 +1,418 @@
+// Copyright (c) 2014 libmv authors.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#include "libmv/image/corner_response.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+#include "libmv/image/convolve.h"
+
+namespace libmv {
+
+namespace {
+
+// Size of the square tiles in which the response is computed. Intermediate
+// buffers of a tile take a few hundreds of kilobytes, so they stay in L2
+// cache.
+const int kTileSize = 64;
+
+// Convolve every row of the buffer:
+//
+//   out(y, x) = sum_k weights[k] * in(y, x + k)
+//
+// Input rows need to have num_weights - 1 extra values.
+void ConvolveRows(const float* in,
+                  int in_stride,
+                  const float* weights,
+                  int num_weights,
+                  int width,
+                  int height,
+                  float* out,
+                  int out_stride) {
+  for (int y = 0; y < height; ++y) {
+    const float* in_row = in + y * in_stride;
+    float* out_row = out + y * out_stride;
+    int x = 0;
+#ifdef __SSE2__
+    for (; x + 4 <= width; x += 4) {
+      __m128 sum = _mm_setzero_ps();
+      for (int k = 0; k < num_weights; ++k) {
+        sum = _mm_add_ps(sum,
+                         _mm_mul_ps(_mm_set1_ps(weights[k]),
+                                    _mm_loadu_ps(in_row + x + k)));
+      }
+      _mm_storeu_ps(out_row + x, sum);
+    }
+#endif
+    // Same order of operations as above, so the result does not depend on
+    // where the tile boundaries are.
+    for (; x < width; ++x) {
+      float sum = 0.0f;
+      for (int k = 0; k < num_weights; ++k) {
+        sum += weights[k] * in_row[x + k];
+      }
+      out_row[x] = sum;
+    }
+  }
+}
+
+// Convolve every column of the buffer:
+//
+//   out(y, x) = sum_k weights[k] * in(y + k, x)
+//
+// Input needs to have num_weights - 1 extra rows.
+void ConvolveColumns(const float* in,
+                     int in_stride,
+                     const float* weights,
+                     int num_weights,
+                     int width,
+                     int height,
+                     float* out,
+                     int out_stride) {
+  for (int y = 0; y < height; ++y) {
+    const float* in_row = in + y * in_stride;
+    float* out_row = out + y * out_stride;
+    int x = 0;
+#ifdef __SSE2__
+    for (; x + 4 <= width; x += 4) {
+      __m128 sum = _mm_setzero_ps();
+      for (int k = 0; k < num_weights; ++k) {
+        sum = _mm_add_ps(sum,
+                         _mm_mul_ps(_mm_set1_ps(weights[k]),
+                                    _mm_loadu_ps(in_row + k * in_stride + x)));
+      }
+      _mm_storeu_ps(out_row + x, sum);
+    }
+#endif
+    for (; x < width; ++x) {
+      float sum = 0.0f;
+      for (int k = 0; k < num_weights; ++k) {
+        sum += weights[k] * in_row[k * in_stride + x];
+      }
+      out_row[x] = sum;
+    }
+  }
+}
+
+// Set values of the buffer which are outside of the image to zero.
+//
+// Convolutions of the whole image skip samples outside of the image, which
+// is the same as convolving image padded with zeros. Intermediate buffers of
+// a tile near the image boundary are larger than the image, so they need to
+// be cleared to get the same result.
+void ZeroOutsideOfImage(int image_width,
+                        int image_height,
+                        int buffer_x0,
+                        int buffer_y0,
+                        int width,
+                        int height,
+                        float* buffer,
+                        int stride) {
+  const int begin = std::min(std::max(-buffer_x0, 0), width);
+  const int end = std::min(std::max(image_width - buffer_x0, 0), width);
+  if (begin == 0 && end == width && buffer_y0 >= 0 &&
+      buffer_y0 + height <= image_height) {
+    return;
+  }
+  for (int y = 0; y < height; ++y) {
+    float* row = buffer + y * stride;
+    const int image_y = buffer_y0 + y;
+    if (image_y < 0 || image_y >= image_height) {
+      std::fill(row, row + width, 0.0f);
+    } else {
+      std::fill(row, row + begin, 0.0f);
+      std::fill(row + end, row + width, 0.0f);
+    }
+  }
+}
+
+// Intermediate buffers of a single tile.
+struct TileBuffers {
+  std::vector<float> input;
+  std::vector<float> blurred_vertical;
+  std::vector<float> blurred_horizontal;
+  std::vector<float> gradient_x;
+  std::vector<float> gradient_y;
+  std::vector<float> product;
+  std::vector<float> product_blurred_vertical;
+  std::vector<float> tensor_xx;
+  std::vector<float> tensor_xy;
+  std::vector<float> tensor_yy;
+};
+
+// Kernels of the Gaussian and its derivative, in the order they are applied
+// by ConvolveRows() and ConvolveColumns().
+struct Kernels {
+  explicit Kernels(double sigma) {
+    Vec kernel, derivative;
+    ComputeGaussianKernel(sigma, &kernel, &derivative);
+    half_width = kernel.size() / 2;
+    size = kernel.size();
+    // Reverse the kernels, the same way as ConvolveHorizontal() does.
+    for (int k = 0; k < size; ++k) {
+      gaussian.push_back(kernel(size - 1 - k));
+      gaussian_derivative.push_back(derivative(size - 1 - k));
+    }
+  }
+
+  int half_width;
+  int size;
+  std::vector<float> gaussian;
+  std::vector<float> gaussian_derivative;
+};
+
+// Compute the structure tensor of a tile starting at x0, y0.
+void ComputeStructureTensorOfTile(const FloatImage& image,
+                                  const Kernels& kernels,
+                                  int x0,
+                                  int y0,
+                                  int width,
+                                  int height,
+                                  TileBuffers* buffers) {
+  const int image_width = image.Width();
+  const int image_height = image.Height();
+  const int r = kernels.half_width;
+  const int size = kernels.size;
+
+  // Derivatives of the image need 2 * r pixels of the input around the tile:
+  // one r for the derivatives and another one for the smoothing.
+  const int width_2r = width + 2 * r, height_2r = height + 2 * r;
+  const int width_4r = width + 4 * r, height_4r = height + 4 * r;
+
+  buffers->input.resize(width_4r * height_4r);
+  float* input = &buffers->input[0];
+  for (int y = 0; y < height_4r; ++y) {
+    const int image_y = y0 - 2 * r + y;
+    for (int x = 0; x < width_4r; ++x) {
+      const int image_x = x0 - 2 * r + x;
+      if (image_x >= 0 && image_x < image_width && image_y >= 0 &&
+          image_y < image_height) {
+        input[y * width_4r + x] = image(image_y, image_x);
+      } else {
+        input[y * width_4r + x] = 0.0f;
+      }
+    }
+  }
+
+  // Derivative in x, smoothed vertically.
+  buffers->blurred_vertical.resize(width_4r * height_2r);
+  float* blurred_vertical = &buffers->blurred_vertical[0];
+  ConvolveColumns(input,
+                  width_4r,
+                  &kernels.gaussian[0],
+                  size,
+                  width_4r,
+                  height_2r,
+                  blurred_vertical,
+                  width_4r);
+  ZeroOutsideOfImage(image_width,
+                     image_height,
+                     x0 - 2 * r,
+                     y0 - r,
+                     width_4r,
+                     height_2r,
+                     blurred_vertical,
+                     width_4r);
+
+  buffers->gradient_x.resize(width_2r * height_2r);
+  float* gradient_x = &buffers->gradient_x[0];
+  ConvolveRows(blurred_vertical,
+               width_4r,
+               &kernels.gaussian_derivative[0],
+               size,
+               width_2r,
+               height_2r,
+               gradient_x,
+               width_2r);
+
+  // Derivative in y, smoothed horizontally.
+  buffers->blurred_horizontal.resize(width_2r * height_4r);
+  float* blurred_horizontal = &buffers->blurred_horizontal[0];
+  ConvolveRows(input,
+               width_4r,
+               &kernels.gaussian[0],
+               size,
+               width_2r,
+               height_4r,
+               blurred_horizontal,
+               width_2r);
+  ZeroOutsideOfImage(image_width,
+                     image_height,
+                     x0 - r,
+                     y0 - 2 * r,
+                     width_2r,
+                     height_4r,
+                     blurred_horizontal,
+                     width_2r);
+
+  buffers->gradient_y.resize(width_2r * height_2r);
+  float* gradient_y = &buffers->gradient_y[0];
+  ConvolveColumns(blurred_horizontal,
+                  width_2r,
+                  &kernels.gaussian_derivative[0],
+                  size,
+                  width_2r,
+                  height_2r,
+                  gradient_y,
+                  width_2r);
+
+  // Smooth products of the derivatives one by one.
+  buffers->product.resize(width_2r * height_2r);
+  buffers->product_blurred_vertical.resize(width_2r * height);
+  float* product = &buffers->product[0];
+  float* product_blurred_vertical = &buffers->product_blurred_vertical[0];
+
+  std::vector<float>* tensors[3] = {
+      &buffers->tensor_xx, &buffers->tensor_xy, &buffers->tensor_yy};
+  const float* first_factors[3] = {gradient_x, gradient_x, gradient_y};
+  const float* second_factors[3] = {gradient_x, gradient_y, gradient_y};
+
+  for (int i = 0; i < 3; ++i) {
+    const float* a = first_factors[i];
+    const float* b = second_factors[i];
+    for (int j = 0; j < width_2r * height_2r; ++j) {
+      product[j] = a[j] * b[j];
+    }
+    ZeroOutsideOfImage(image_width,
+                       image_height,
+                       x0 - r,
+                       y0 - r,
+                       width_2r,
+                       height_2r,
+                       product,
+                       width_2r);
+
+    ConvolveColumns(product,
+                    width_2r,
+                    &kernels.gaussian[0],
+                    size,
+                    width_2r,
+                    height,
+                    product_blurred_vertical,
+                    width_2r);
+    ZeroOutsideOfImage(image_width,
+                       image_height,
+                       x0 - r,
+                       y0,
+                       width_2r,
+                       height,
+                       product_blurred_vertical,
+                       width_2r);
+
+    tensors[i]->resize(width * height);
+    ConvolveRows(product_blurred_vertical,
+                 width_2r,
+                 &kernels.gaussian[0],
+                 size,
+                 width,
+                 height,
+                 &(*tensors[i])[0],
+                 width);
+  }
+}
+
+inline float CornerResponse(const CornerResponseOptions& options,
+                            double xx,
+                            double xy,
+                            double yy) {
+  const double determinant = xx * yy - xy * xy;
+  const double trace = xx + yy;
+  switch (options.type) {
+    case HARRIS_CORNER_RESPONSE:
+      return determinant - options.harris_alpha * trace * trace;
+    case SHI_TOMASI_CORNER_RESPONSE:
+      return 0.5 * (trace - sqrt(Square(xx - yy) + 4.0 * xy * xy));
+  }
+  return 0.0f;
+}
+
+}  // namespace
+
+CornerResponseOptions::CornerResponseOptions()
+    : type(HARRIS_CORNER_RESPONSE), sigma(0.9), harris_alpha(0.06) {
+}
+
+void ComputeCornerResponse(const FloatImage& image,
+                           const CornerResponseOptions& options,
+                           FloatImage* response) {
+  response->Resize(image.Height(), image.Width(), 1);
+  ComputeCornerResponseInRegion(image, options, 0, 0, response);
+}
+
+void ComputeCornerResponseInRegion(const FloatImage& image,
+                                   const CornerResponseOptions& options,
+                                   int x0,
+                                   int y0,
+                                   FloatImage* response) {
+  assert(image.Depth() == 1);
+  assert(response->Depth() == 1);
+
+  const Kernels kernels(options.sigma);
+  const int width = response->Width();
+  const int height = response->Height();
+  const int num_tiles_x = (width + kTileSize - 1) / kTileSize;
+  const int num_tiles_y = (height + kTileSize - 1) / kTileSize;
+  const int num_tiles = num_tiles_x * num_tiles_y;
+
+#if defined(_OPENMP)
+#  pragma omp parallel
+#endif
+  {
+    TileBuffers buffers;
+
+#if defined(_OPENMP)
+#  pragma omp for schedule(dynamic)
+#endif
+    for (int tile = 0; tile < num_tiles; ++tile) {
+      const int tile_x = (tile % num_tiles_x) * kTileSize;
+      const int tile_y = (tile / num_tiles_x) * kTileSize;
+      const int tile_width = std::min(kTileSize, width - tile_x);
+      const int tile_height = std::min(kTileSize, height - tile_y);
+
+      ComputeStructureTensorOfTile(image,
+                                   kernels,
+                                   x0 + tile_x,
+                                   y0 + tile_y,
+                                   tile_width,
+                                   tile_height,
+                                   &buffers);
+
+      for (int y = 0; y < tile_height; ++y) {
+        for (int x = 0; x < tile_width; ++x) {
+          const int i = y * tile_width + x;
+          (*response)(tile_y + y, tile_x + x) =
+              CornerResponse(options,
+                             buffers.tensor_xx[i],
+                             buffers.tensor_xy[i],
+                             buffers.tensor_yy[i]);
+        }
+      }
+    }
+  }
+}
+
+}  // namespace libmv
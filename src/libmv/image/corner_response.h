@@ -0,0 +1,85 @@
+// Copyright (c) 2014 libmv authors.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#ifndef LIBMV_IMAGE_CORNER_RESPONSE_H_
+#define LIBMV_IMAGE_CORNER_RESPONSE_H_
+
+#include "libmv/image/image.h"
+
+namespace libmv {
+
+// Function of the structure tensor used as a corner response.
+enum CornerResponseType {
+  // det(A) - alpha * trace(A)^2.
+  HARRIS_CORNER_RESPONSE,
+
+  // Smaller eigenvalue of A.
+  SHI_TOMASI_CORNER_RESPONSE,
+};
+
+struct CornerResponseOptions {
+  CornerResponseOptions();
+
+  CornerResponseType type;
+
+  // Sigma of the Gaussian used for both the image derivatives and the
+  // smoothing of the structure tensor.
+  double sigma;
+
+  // Sensitivity parameter of the Harris response.
+  double harris_alpha;
+};
+
+/*!
+    Compute corner response of every pixel of a grayscale \a image.
+
+    The response is computed from the structure tensor
+
+      A = G * [ Ix^2  Ix*Iy ]
+              [ Ix*Iy Iy^2  ]
+
+    where G is the Gaussian and Ix, Iy are the image derivatives, using the
+    same zero padding as ImageDerivatives() and ConvolveGaussian().
+
+    All the steps are done at once for small tiles of the image, so the
+    intermediate images stay in cache and only the response is written to
+    the memory.
+*/
+void ComputeCornerResponse(const FloatImage& image,
+                           const CornerResponseOptions& options,
+                           FloatImage* response);
+
+/*!
+    Compute corner response of a rectangular region of \a image.
+
+    The region starts at \a x0, \a y0 and has the size of the \a response,
+    which needs to be allocated by the caller. This is the same as cropping
+    the result of ComputeCornerResponse(), and is useful when the response is
+    only needed around some of the pixels.
+*/
+void ComputeCornerResponseInRegion(const FloatImage& image,
+                                   const CornerResponseOptions& options,
+                                   int x0,
+                                   int y0,
+                                   FloatImage* response);
+
+}  // namespace libmv
+
+#endif  // LIBMV_IMAGE_CORNER_RESPONSE_H_
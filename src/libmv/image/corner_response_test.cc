@@ -0,0 +1,130 @@
+// Copyright (c) 2014 libmv authors.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#include <cstdlib>
+
+#include "libmv/image/convolve.h"
+#include "libmv/image/corner_response.h"
+#include "libmv/image/image.h"
+#include "libmv/numeric/numeric.h"
+#include "testing/testing.h"
+
+using namespace libmv;
+
+namespace {
+
+void CreateRandomImage(int width, int height, FloatImage* image) {
+  image->Resize(height, width);
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      (*image)(y, x) = (float)rand() / RAND_MAX;
+    }
+  }
+}
+
+// Compute the response the straightforward way, using whole image passes.
+void ComputeReferenceResponse(const FloatImage& image,
+                              const CornerResponseOptions& options,
+                              FloatImage* response) {
+  FloatImage gradient_x, gradient_y;
+  ImageDerivatives(image, options.sigma, &gradient_x, &gradient_y);
+
+  FloatImage gradient_xx, gradient_yy, gradient_xy;
+  MultiplyElements(gradient_x, gradient_x, &gradient_xx);
+  MultiplyElements(gradient_y, gradient_y, &gradient_yy);
+  MultiplyElements(gradient_x, gradient_y, &gradient_xy);
+
+  FloatImage xx, yy, xy;
+  ConvolveGaussian(gradient_xx, options.sigma, &xx);
+  ConvolveGaussian(gradient_yy, options.sigma, &yy);
+  ConvolveGaussian(gradient_xy, options.sigma, &xy);
+
+  response->Resize(image.Height(), image.Width());
+  for (int y = 0; y < image.Height(); ++y) {
+    for (int x = 0; x < image.Width(); ++x) {
+      Mat2 A;
+      A << xx(y, x), xy(y, x), xy(y, x), yy(y, x);
+      if (options.type == HARRIS_CORNER_RESPONSE) {
+        (*response)(y, x) =
+            A.determinant() - options.harris_alpha * Square(A.trace());
+      } else {
+        Eigen::SelfAdjointEigenSolver<Mat2> eigen_solver(A);
+        (*response)(y, x) = eigen_solver.eigenvalues().minCoeff();
+      }
+    }
+  }
+}
+
+void CheckResponseMatchesReference(const CornerResponseOptions& options) {
+  // Use size which is not a multiple of the tile size.
+  FloatImage image;
+  CreateRandomImage(150, 83, &image);
+
+  FloatImage expected_response, response;
+  ComputeReferenceResponse(image, options, &expected_response);
+  ComputeCornerResponse(image, options, &response);
+
+  EXPECT_EQ(image.Width(), response.Width());
+  EXPECT_EQ(image.Height(), response.Height());
+  for (int y = 0; y < image.Height(); ++y) {
+    for (int x = 0; x < image.Width(); ++x) {
+      EXPECT_NEAR(expected_response(y, x), response(y, x), 1e-6);
+    }
+  }
+}
+
+}  // namespace
+
+TEST(CornerResponse, HarrisMatchesReference) {
+  CornerResponseOptions options;
+  options.type = HARRIS_CORNER_RESPONSE;
+  CheckResponseMatchesReference(options);
+}
+
+TEST(CornerResponse, ShiTomasiMatchesReference) {
+  CornerResponseOptions options;
+  options.type = SHI_TOMASI_CORNER_RESPONSE;
+  options.sigma = 1.5;
+  CheckResponseMatchesReference(options);
+}
+
+TEST(CornerResponse, RegionMatchesWholeImage) {
+  FloatImage image;
+  CreateRandomImage(200, 170, &image);
+
+  CornerResponseOptions options;
+  FloatImage whole_response;
+  ComputeCornerResponse(image, options, &whole_response);
+
+  // Regions near the boundary and in the middle of the image.
+  int regions[][4] = {
+      {0, 0, 30, 40}, {37, 91, 70, 65}, {150, 100, 50, 70}, {3, 5, 1, 1}};
+  for (int i = 0; i < sizeof(regions) / sizeof(*regions); ++i) {
+    const int x0 = regions[i][0], y0 = regions[i][1];
+    FloatImage response(regions[i][3], regions[i][2]);
+    ComputeCornerResponseInRegion(image, options, x0, y0, &response);
+
+    for (int y = 0; y < response.Height(); ++y) {
+      for (int x = 0; x < response.Width(); ++x) {
+        EXPECT_EQ(whole_response(y0 + y, x0 + x), response(y, x));
+      }
+    }
+  }
+}
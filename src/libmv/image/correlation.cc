@@ -0,0 +1,119 @@
+// Copyright (c) 2020 libmv authors.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#include "libmv/image/correlation.h"
+
+#include <cmath>
+#include <vector>
+
+#include "libmv/image/integral_image.h"
+#include "libmv/threading/parallel_for.h"
+
+namespace libmv {
+
+namespace {
+
+// Sum of the window with top left corner (r, c) of a summed area table.
+inline double WindowSum(const Array3D<double>& integral_image,
+                        int r,
+                        int c,
+                        int height,
+                        int width) {
+  double sum = integral_image(r + height - 1, c + width - 1);
+  if (r > 0) {
+    sum -= integral_image(r - 1, c + width - 1);
+  }
+  if (c > 0) {
+    sum -= integral_image(r + height - 1, c - 1);
+  }
+  if (r > 0 && c > 0) {
+    sum += integral_image(r - 1, c - 1);
+  }
+  return sum;
+}
+
+}  // namespace
+
+void NormalizedCrossCorrelation(const FloatImage& pattern,
+                                const FloatImage& image,
+                                FloatImage* scores) {
+  const int pattern_height = pattern.Height();
+  const int pattern_width = pattern.Width();
+  const int scores_height = image.Height() - pattern_height + 1;
+  const int scores_width = image.Width() - pattern_width + 1;
+  if (pattern_height == 0 || pattern_width == 0 || scores_height <= 0 ||
+      scores_width <= 0) {
+    scores->Resize(0, 0, 1);
+    return;
+  }
+  scores->Resize(scores_height, scores_width, 1);
+
+  // With the pattern centered, the covariance is the sum of its products
+  // with the window, the mean of the window cancels out.
+  const int num_pixels = pattern_height * pattern_width;
+  double pattern_mean = 0;
+  for (int r = 0; r < pattern_height; ++r) {
+    for (int c = 0; c < pattern_width; ++c) {
+      pattern_mean += pattern(r, c, 0);
+    }
+  }
+  pattern_mean /= num_pixels;
+  std::vector<float> centered_pattern(num_pixels);
+  double pattern_variance = 0;
+  for (int r = 0; r < pattern_height; ++r) {
+    for (int c = 0; c < pattern_width; ++c) {
+      const double value = pattern(r, c, 0) - pattern_mean;
+      centered_pattern[r * pattern_width + c] = value;
+      pattern_variance += value * value;
+    }
+  }
+
+  Array3D<double> integral_image, squared_integral_image;
+  IntegralImage(image, &integral_image);
+  SquaredIntegralImage(image, &squared_integral_image);
+
+  ParallelForRanges(scores_height, 16, [&](int begin, int end) {
+    for (int r = begin; r < end; ++r) {
+      for (int c = 0; c < scores_width; ++c) {
+        const double sum = WindowSum(
+            integral_image, r, c, pattern_height, pattern_width);
+        const double squared_sum = WindowSum(
+            squared_integral_image, r, c, pattern_height, pattern_width);
+        const double window_variance = squared_sum - sum * sum / num_pixels;
+        const double denominator = pattern_variance * window_variance;
+        if (denominator <= 1e-12) {
+          (*scores)(r, c, 0) = 0.0f;
+          continue;
+        }
+        double covariance = 0;
+        for (int pr = 0; pr < pattern_height; ++pr) {
+          const float* pattern_row = &centered_pattern[pr * pattern_width];
+          for (int pc = 0; pc < pattern_width; ++pc) {
+            covariance += pattern_row[pc] * image(r + pr, c + pc, 0);
+          }
+        }
+        const double score = covariance / std::sqrt(denominator);
+        (*scores)(r, c, 0) = std::max(-1.0, std::min(1.0, score));
+      }
+    }
+  });
+}
+
+}  // namespace libmv
@@ -68,6 +68,17 @@ inline double PearsonProductMomentCorrelation(
   return correlation;
 }
 
+// Normalized cross correlation of the pattern with every window of the image
+// of the same size, using the first channel of both. scores is resized to
+// (image height - pattern height + 1) x (image width - pattern width + 1),
+// and the score of the window with top left corner (r, c) is stored at
+// (r, c). Scores are in [-1, 1], windows or patterns of constant intensity
+// score 0. The means and variances of the windows are taken from summed area
+// tables, so only the products with the pattern are summed per window.
+void NormalizedCrossCorrelation(const FloatImage& pattern,
+                                const FloatImage& image,
+                                FloatImage* scores);
+
 }  // namespace libmv
 
 #endif  // LIBMV_IMAGE_IMAGE_CORRELATION_H
@@ -0,0 +1,96 @@
+// Copyright (c) 2020 libmv authors.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#include "libmv/image/correlation.h"
+#include "testing/testing.h"
+
+using namespace libmv;
+
+namespace {
+
+TEST(NormalizedCrossCorrelation, FindsPatternCutFromImage) {
+  FloatImage image(40, 50);
+  for (int r = 0; r < image.Height(); ++r) {
+    for (int c = 0; c < image.Width(); ++c) {
+      image(r, c) = ((r * 17 + c * c * 5 + r * c) % 97) / 97.0f;
+    }
+  }
+  FloatImage pattern(7, 9);
+  for (int r = 0; r < pattern.Height(); ++r) {
+    for (int c = 0; c < pattern.Width(); ++c) {
+      // Changing brightness and contrast does not change the scores.
+      pattern(r, c) = 2.0f * image(r + 12, c + 20) + 0.5f;
+    }
+  }
+
+  FloatImage scores;
+  NormalizedCrossCorrelation(pattern, image, &scores);
+  ASSERT_EQ(34, scores.Height());
+  ASSERT_EQ(42, scores.Width());
+
+  int best_r = -1, best_c = -1;
+  float best_score = -2.0f;
+  for (int r = 0; r < scores.Height(); ++r) {
+    for (int c = 0; c < scores.Width(); ++c) {
+      EXPECT_LE(-1.0f, scores(r, c));
+      EXPECT_GE(1.0f, scores(r, c));
+      if (scores(r, c) > best_score) {
+        best_score = scores(r, c);
+        best_r = r;
+        best_c = c;
+      }
+    }
+  }
+  EXPECT_EQ(12, best_r);
+  EXPECT_EQ(20, best_c);
+  EXPECT_NEAR(1.0, best_score, 1e-5);
+
+  // The score of a window matches the correlation computed directly.
+  FloatImage window(7, 9);
+  for (int r = 0; r < window.Height(); ++r) {
+    for (int c = 0; c < window.Width(); ++c) {
+      window(r, c) = image(r + 3, c + 30);
+    }
+  }
+  EXPECT_NEAR(PearsonProductMomentCorrelation(pattern, window),
+              scores(3, 30),
+              1e-5);
+}
+
+TEST(NormalizedCrossCorrelation, ConstantWindowsScoreZero) {
+  FloatImage image(10, 10);
+  image.Fill(0.25f);
+  FloatImage pattern(3, 3);
+  for (int r = 0; r < 3; ++r) {
+    for (int c = 0; c < 3; ++c) {
+      pattern(r, c) = r + c;
+    }
+  }
+  FloatImage scores;
+  NormalizedCrossCorrelation(pattern, image, &scores);
+  ASSERT_EQ(8, scores.Height());
+  for (int r = 0; r < scores.Height(); ++r) {
+    for (int c = 0; c < scores.Width(); ++c) {
+      EXPECT_EQ(0.0f, scores(r, c));
+    }
+  }
+}
+
+}  // namespace
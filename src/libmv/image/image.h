@@ -24,6 +24,7 @@
 #include <cmath>
 
 #include "libmv/image/array_nd.h"
+#include "libmv/image/compact_image.h"
 
 namespace libmv {
 
@@ -42,6 +43,8 @@ class Image {
   // Create an image from an array. The image takes ownership of the array.
   Image(Array3Du* array) : array_type_(BYTE), array_(array) {}
   Image(Array3Df* array) : array_type_(FLOAT), array_(array) {}
+  Image(HalfImage* array) : array_type_(HALF), array_(array) {}
+  Image(UShortImage* array) : array_type_(USHORT), array_(array) {}
 
   Image(const Image& img) : array_type_(NONE), array_(NULL) { *this = img; }
 
@@ -52,6 +55,8 @@ class Image {
     FLOAT,
     INT,
     SHORT,
+    HALF,
+    USHORT,
   };
 
   // Size in bytes that the image takes in memory.
@@ -70,6 +75,12 @@ class Image {
       case SHORT:
         size = reinterpret_cast<Array3Ds*>(array_)->MemorySizeInBytes();
         break;
+      case HALF:
+        size = reinterpret_cast<HalfImage*>(array_)->MemorySizeInBytes();
+        break;
+      case USHORT:
+        size = reinterpret_cast<UShortImage*>(array_)->MemorySizeInBytes();
+        break;
       default: size = 0; assert(0);
     }
     size += sizeof(*this);
@@ -82,6 +93,8 @@ class Image {
       case FLOAT: delete reinterpret_cast<Array3Df*>(array_); break;
       case INT: delete reinterpret_cast<Array3Di*>(array_); break;
       case SHORT: delete reinterpret_cast<Array3Ds*>(array_); break;
+      case HALF: delete reinterpret_cast<HalfImage*>(array_); break;
+      case USHORT: delete reinterpret_cast<UShortImage*>(array_); break;
       default: assert(0);
     }
   }
@@ -106,6 +119,14 @@ class Image {
           delete reinterpret_cast<Array3Ds*>(array_);
           array_ = new Array3Ds(*(Array3Ds*)f.array_);
           break;
+        case HALF:
+          delete reinterpret_cast<HalfImage*>(array_);
+          array_ = new HalfImage(*(HalfImage*)f.array_);
+          break;
+        case USHORT:
+          delete reinterpret_cast<UShortImage*>(array_);
+          array_ = new UShortImage(*(UShortImage*)f.array_);
+          break;
         default: assert(0);
       }
     }
@@ -126,6 +147,20 @@ class Image {
     return NULL;
   }
 
+  HalfImage* AsHalfImage() const {
+    if (array_type_ == HALF) {
+      return reinterpret_cast<HalfImage*>(array_);
+    }
+    return NULL;
+  }
+
+  UShortImage* AsUShortImage() const {
+    if (array_type_ == USHORT) {
+      return reinterpret_cast<UShortImage*>(array_);
+    }
+    return NULL;
+  }
+
  private:
   DataType array_type_;
   BaseArray* array_;
@@ -29,6 +29,8 @@
 #ifndef LIBMV_IMAGE_IMAGE_DRAWING_H
 #define LIBMV_IMAGE_IMAGE_DRAWING_H
 
+#include <cmath>
+
 namespace libmv {
 
 /// Put the pixel in the image to the given color only if the point (xc,yc)
@@ -20,15 +20,22 @@
 
 #include "libmv/image/image_io.h"
 
+#include <algorithm>
 #include <cstring>
+#include <vector>
 
 #include <iostream>
 
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
 extern "C" {
 #include "jpeglib.h"
 #include "png.h"
 }
 
+#include "libmv/image/image_converter.h"
 #include "libmv/logging/logging.h"
 
 namespace libmv {
@@ -64,31 +71,369 @@ Format GetFormat(const char* c) {
     return Jpg;
   if (CmpFormatExt(p, ".jpeg"))
     return Jpg;
+  if (CmpFormatExt(p, ".pfm"))
+    return Pfm;
 
   LOG(ERROR) << "Error: Couldn't open " << c << " Unknown file format";
   return Unknown;
 }
 
 int ReadImage(const char* filename, ByteImage* im) {
+  return ReadImage(filename, im, 1);
+}
+
+int ReadImage(const char* filename, FloatImage* im) {
+  return ReadImage(filename, im, READ_ALL_CHANNELS, 1);
+}
+
+namespace {
+
+bool IsLittleEndian() {
+  const uint16_t one = 1;
+  return *reinterpret_cast<const unsigned char*>(&one) == 1;
+}
+
+// Receives the rows of pixels from the decoders. Rows of 8-bit, 16-bit or
+// float values, and the rows can come in any order.
+class RowSink {
+ public:
+  virtual ~RowSink() {}
+
+  // Called once the size of the decoded image is known. Returns false when
+  // the image can not be stored.
+  virtual bool Start(int height, int width, int depth) = 0;
+
+  // The rows have width * depth values. Values of 16-bit rows go up to
+  // max_value, which is 65535 unless a PNM file says otherwise.
+  virtual void WriteRow(int y, const unsigned char* row) = 0;
+  virtual void WriteRow16(int y, const uint16_t* row, int max_value) = 0;
+  virtual void WriteRowFloat(int y, const float* row) = 0;
+};
+
+class ByteImageRowSink : public RowSink {
+ public:
+  explicit ByteImageRowSink(ByteImage* image) : image_(image) {}
+
+  virtual bool Start(int height, int width, int depth) {
+    image_->Resize(height, width, depth);
+    return true;
+  }
+
+  virtual void WriteRow(int y, const unsigned char* row) {
+    std::memcpy(&(*image_)(y, 0, 0), row, image_->Width() * image_->Depth());
+  }
+
+  // Rounded to the nearest byte.
+  virtual void WriteRow16(int y, const uint16_t* row, int max_value) {
+    unsigned char* output = &(*image_)(y, 0, 0);
+    const int size = image_->Width() * image_->Depth();
+    for (int i = 0; i < size; ++i) {
+      output[i] = (row[i] * 255 + max_value / 2) / max_value;
+    }
+  }
+
+  // Clamped to [0, 1] and scaled like FloatArrayToScaledByteArray().
+  virtual void WriteRowFloat(int y, const float* row) {
+    unsigned char* output = &(*image_)(y, 0, 0);
+    const int size = image_->Width() * image_->Depth();
+    for (int i = 0; i < size; ++i) {
+      output[i] = (unsigned char)(255 * std::min(1.0f, std::max(0.0f, row[i])));
+    }
+  }
+
+ private:
+  ByteImage* image_;
+};
+
+// Same as float(bytes[i]) / 255.0f, which ByteArrayToScaledFloatArray()
+// computes. The division is exact in IEEE arithmetic, so the vector code
+// gives the same results.
+void ScaledBytesToFloats(const unsigned char* bytes, int size, float* floats) {
+  int i = 0;
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128();
+  const __m128 scale = _mm_set1_ps(255.0f);
+  for (; i + 16 <= size; i += 16) {
+    const __m128i values =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i));
+    const __m128i low = _mm_unpacklo_epi8(values, zero);
+    const __m128i high = _mm_unpackhi_epi8(values, zero);
+    const __m128i quarters[4] = {
+        _mm_unpacklo_epi16(low, zero),
+        _mm_unpackhi_epi16(low, zero),
+        _mm_unpacklo_epi16(high, zero),
+        _mm_unpackhi_epi16(high, zero),
+    };
+    for (int k = 0; k < 4; ++k) {
+      _mm_storeu_ps(floats + i + 4 * k,
+                    _mm_div_ps(_mm_cvtepi32_ps(quarters[k]), scale));
+    }
+  }
+#endif  // __SSE2__
+  for (; i < size; ++i) {
+    floats[i] = float(bytes[i]) / 255.0f;
+  }
+}
+
+// Converts the rows to floats as they are decoded, so no byte image of the
+// full size is made. Writes all channels, one channel or the luminance.
+class FloatImageRowSink : public RowSink {
+ public:
+  FloatImageRowSink(int channel, FloatImage* image)
+      : channel_(channel), image_(image), depth_(0) {}
+
+  virtual bool Start(int height, int width, int depth) {
+    if (channel_ >= depth) {
+      LOG(ERROR) << "Error: The image has no channel " << channel_;
+      return false;
+    }
+    depth_ = depth;
+    const int output_depth = channel_ == READ_ALL_CHANNELS ? depth : 1;
+    if (!image_->OwnsData() && (image_->Height() != height ||
+                                image_->Width() != width ||
+                                image_->Depth() != output_depth)) {
+      LOG(ERROR) << "Error: The image is a view of another size, "
+                 << height << "x" << width << "x" << output_depth
+                 << " is needed.";
+      return false;
+    }
+    image_->Resize(height, width, output_depth);
+    if (image_->Stride(2) != 1 || image_->Stride(1) != output_depth) {
+      LOG(ERROR) << "Error: The pixels of the image are not contiguous.";
+      return false;
+    }
+    if (channel_ != READ_ALL_CHANNELS) {
+      floats_.resize(width * depth);
+    }
+    return true;
+  }
+
+  virtual void WriteRow(int y, const unsigned char* row) {
+    ScaledBytesToFloats(row, image_->Width() * depth_, ConvertedRow(y));
+    SelectChannels(y);
+  }
+
+  virtual void WriteRow16(int y, const uint16_t* row, int max_value) {
+    float* output = ConvertedRow(y);
+    const int size = image_->Width() * depth_;
+    const float scale = max_value;
+    for (int i = 0; i < size; ++i) {
+      output[i] = float(row[i]) / scale;
+    }
+    SelectChannels(y);
+  }
+
+  virtual void WriteRowFloat(int y, const float* row) {
+    std::memcpy(ConvertedRow(y), row, image_->Width() * depth_ * sizeof(*row));
+    SelectChannels(y);
+  }
+
+ private:
+  // The row of all channels is converted to the image directly, or to a
+  // buffer to select the channels from.
+  float* ConvertedRow(int y) {
+    if (channel_ == READ_ALL_CHANNELS) {
+      return &(*image_)(y, 0, 0);
+    }
+    return &floats_[0];
+  }
+
+  void SelectChannels(int y) {
+    if (channel_ == READ_ALL_CHANNELS) {
+      return;
+    }
+    const int width = image_->Width();
+    float* output = &(*image_)(y, 0, 0);
+    const float* input = &floats_[0];
+    if (channel_ == READ_GRAY && depth_ >= 3) {
+      // Same arithmetic as Rgb2Gray() of the float image.
+      for (int x = 0; x < width; ++x, input += depth_) {
+        output[x] = RGB2GRAY(input[0], input[1], input[2]);
+      }
+    } else {
+      // Gray images are their own luminance, alpha is ignored.
+      input += channel_ == READ_GRAY ? 0 : channel_;
+      for (int x = 0; x < width; ++x, input += depth_) {
+        output[x] = *input;
+      }
+    }
+  }
+
+  int channel_;
+  FloatImage* image_;
+  int depth_;
+
+  // Row converted to floats, when not all channels are written.
+  std::vector<float> floats_;
+};
+
+void WriteRows(const FloatImage& image, RowSink* sink) {
+  for (int y = 0; y < image.Height(); ++y) {
+    sink->WriteRowFloat(y, &image(y, 0, 0));
+  }
+}
+
+// Values of a row of a float image clamped to [0, 1] and rounded to 16-bit
+// values, stored big endian as PNG and PNM files have them.
+void FloatRowToBigEndian16(const FloatImage& image,
+                           int y,
+                           unsigned char* bytes) {
+  for (int x = 0; x < image.Width(); ++x) {
+    for (int k = 0; k < image.Depth(); ++k) {
+      const float value = std::min(1.0f, std::max(0.0f, image(y, x, k)));
+      const int scaled = static_cast<int>(value * 65535.0f + 0.5f);
+      *bytes++ = scaled >> 8;
+      *bytes++ = scaled & 0xff;
+    }
+  }
+}
+
+int DecodeJpgStream(FILE* file, int scale_denom, RowSink* sink);
+int DecodePngStream(FILE* file, RowSink* sink);
+int DecodePnmStream(FILE* file, RowSink* sink);
+int DecodePfmStream(FILE* file, RowSink* sink);
+
+// Decode the file of the given format. Only JPEG files can be scaled.
+int DecodeFile(const char* filename,
+               Format format,
+               int scale_denom,
+               RowSink* sink) {
+  assert(scale_denom == 1 || format == Jpg);
+  if (format == Unknown) {
+    return 0;
+  }
+  FILE* file = fopen(filename, "rb");
+  if (!file) {
+    LOG(ERROR) << "Error: Couldn't open " << filename << " fopen returned 0";
+    return 0;
+  }
+  int res = 0;
+  switch (format) {
+    case Jpg: res = DecodeJpgStream(file, scale_denom, sink); break;
+    case Png: res = DecodePngStream(file, sink); break;
+    case Pnm: res = DecodePnmStream(file, sink); break;
+    case Pfm: res = DecodePfmStream(file, sink); break;
+    default: break;
+  }
+  fclose(file);
+  return res;
+}
+
+}  // namespace
+
+static bool IsValidScaleDenom(int scale_denom) {
+  if (scale_denom == 1 || scale_denom == 2 || scale_denom == 4 ||
+      scale_denom == 8) {
+    return true;
+  }
+  LOG(ERROR) << "Error: Unsupported scale 1/" << scale_denom;
+  return false;
+}
+
+// Average the blocks of scale_denom x scale_denom pixels. The blocks at the
+// right and bottom border are partial when the size is not a multiple of
+// scale_denom, so the size is rounded up like the size of scaled JPEGs.
+static void ScaleDownByteImage(const ByteImage& in,
+                               int scale_denom,
+                               ByteImage* out) {
+  const int height = (in.Height() + scale_denom - 1) / scale_denom;
+  const int width = (in.Width() + scale_denom - 1) / scale_denom;
+  const int depth = in.Depth();
+  out->Resize(height, width, depth);
+  for (int r = 0; r < height; ++r) {
+    const int r1 = std::min(in.Height(), (r + 1) * scale_denom);
+    for (int c = 0; c < width; ++c) {
+      const int c1 = std::min(in.Width(), (c + 1) * scale_denom);
+      const int count = (r1 - r * scale_denom) * (c1 - c * scale_denom);
+      for (int k = 0; k < depth; ++k) {
+        int sum = 0;
+        for (int y = r * scale_denom; y < r1; ++y) {
+          for (int x = c * scale_denom; x < c1; ++x) {
+            sum += in(y, x, k);
+          }
+        }
+        (*out)(r, c, k) = (sum + count / 2) / count;
+      }
+    }
+  }
+}
+
+static void ScaleDownFloatImage(const FloatImage& in,
+                                int scale_denom,
+                                FloatImage* out) {
+  const int height = (in.Height() + scale_denom - 1) / scale_denom;
+  const int width = (in.Width() + scale_denom - 1) / scale_denom;
+  const int depth = in.Depth();
+  out->Resize(height, width, depth);
+  for (int r = 0; r < height; ++r) {
+    const int r1 = std::min(in.Height(), (r + 1) * scale_denom);
+    for (int c = 0; c < width; ++c) {
+      const int c1 = std::min(in.Width(), (c + 1) * scale_denom);
+      const int count = (r1 - r * scale_denom) * (c1 - c * scale_denom);
+      for (int k = 0; k < depth; ++k) {
+        float sum = 0;
+        for (int y = r * scale_denom; y < r1; ++y) {
+          for (int x = c * scale_denom; x < c1; ++x) {
+            sum += in(y, x, k);
+          }
+        }
+        (*out)(r, c, k) = sum / count;
+      }
+    }
+  }
+}
+
+int ReadImage(const char* filename, ByteImage* im, int scale_denom) {
+  if (!IsValidScaleDenom(scale_denom)) {
+    return 0;
+  }
   Format f = GetFormat(filename);
+  if (f == Jpg) {
+    return ReadJpg(filename, im, scale_denom);
+  }
 
-  switch (f) {
-    case Pnm: return ReadPnm(filename, im);
-    case Png: return ReadPng(filename, im);
-    case Jpg: return ReadJpg(filename, im);
-    default: return 0;
-  };
+  ByteImage full_image;
+  ByteImageRowSink sink(scale_denom == 1 ? im : &full_image);
+  if (!DecodeFile(filename, f, 1, &sink)) {
+    return 0;
+  }
+  if (scale_denom != 1) {
+    ScaleDownByteImage(full_image, scale_denom, im);
+  }
+  return 1;
 }
 
-int ReadImage(const char* filename, FloatImage* im) {
+int ReadImage(const char* filename, FloatImage* im, int scale_denom) {
+  return ReadImage(filename, im, READ_ALL_CHANNELS, scale_denom);
+}
+
+int ReadImage(const char* filename,
+              FloatImage* im,
+              int channel,
+              int scale_denom) {
+  if (!IsValidScaleDenom(scale_denom)) {
+    return 0;
+  }
+  FloatImageRowSink sink(channel, im);
   Format f = GetFormat(filename);
+  if (f == Jpg || scale_denom == 1) {
+    return DecodeFile(filename, f, scale_denom, &sink);
+  }
 
-  switch (f) {
-    case Pnm: return ReadPnm(filename, im);
-    case Png: return ReadPng(filename, im);
-    case Jpg: return ReadJpg(filename, im);
-    default: return 0;
-  };
+  // Other files are decoded fully and averaged.
+  FloatImage image, scaled_image;
+  FloatImageRowSink image_sink(READ_ALL_CHANNELS, &image);
+  if (!DecodeFile(filename, f, 1, &image_sink)) {
+    return 0;
+  }
+  ScaleDownFloatImage(image, scale_denom, &scaled_image);
+  if (!sink.Start(scaled_image.Height(),
+                  scaled_image.Width(),
+                  scaled_image.Depth())) {
+    return 0;
+  }
+  WriteRows(scaled_image, &sink);
+  return 1;
 }
 
 int WriteImage(const ByteImage& im, const char* filename) {
@@ -109,29 +454,41 @@ int WriteImage(const FloatImage& im, const char* filename) {
     case Pnm: return WritePnm(im, filename);
     case Png: return WritePng(im, filename);
     case Jpg: return WriteJpg(im, filename);
+    case Pfm: return WritePfm(im, filename);
     default: return 0;
   };
 }
 
-int ReadJpg(const char* filename, ByteImage* im) {
+int WriteImage16(const FloatImage& im, const char* filename) {
+  Format f = GetFormat(filename);
+
+  switch (f) {
+    case Pnm: return WritePnm16(im, filename);
+    case Png: return WritePng16(im, filename);
+    case Pfm: return WritePfm(im, filename);
+    default:
+      LOG(ERROR) << "Error: " << filename << " can not have 16-bit values.";
+      return 0;
+  };
+}
+
+int ReadJpg(const char* filename, ByteImage* im, int scale_denom) {
   FILE* file = fopen(filename, "rb");
   if (!file) {
     LOG(ERROR) << "Error: Couldn't open " << filename << " fopen returned 0";
     return 0;
   }
-  int res = ReadJpgStream(file, im);
+  int res = ReadJpgStream(file, im, scale_denom);
   fclose(file);
   return res;
 }
 
-int ReadJpg(const char* filename, FloatImage* image) {
-  ByteImage byte_image;
-  int res = ReadJpg(filename, &byte_image);
-  if (!res) {
-    return res;
+int ReadJpg(const char* filename, FloatImage* image, int scale_denom) {
+  if (!IsValidScaleDenom(scale_denom)) {
+    return 0;
   }
-  ByteArrayToScaledFloatArray(byte_image, image);
-  return res;
+  FloatImageRowSink sink(READ_ALL_CHANNELS, image);
+  return DecodeFile(filename, Jpg, scale_denom, &sink);
 }
 
 struct my_error_mgr {
@@ -146,7 +503,18 @@ jpeg_error(j_common_ptr cinfo) {
   longjmp(myerr->setjmp_buffer, 1);
 }
 
-int ReadJpgStream(FILE* file, ByteImage* im) {
+int ReadJpgStream(FILE* file, ByteImage* im, int scale_denom) {
+  ByteImageRowSink sink(im);
+  return DecodeJpgStream(file, scale_denom, &sink);
+}
+
+namespace {
+
+int DecodeJpgStream(FILE* file, int scale_denom, RowSink* sink) {
+  if (!IsValidScaleDenom(scale_denom)) {
+    return 0;
+  }
+
   jpeg_decompress_struct cinfo;
   struct my_error_mgr jerr;
   JSAMPARRAY buffer;
@@ -161,6 +529,9 @@ int ReadJpgStream(FILE* file, ByteImage* im) {
   jpeg_create_decompress(&cinfo);
   jpeg_stdio_src(&cinfo, file);
   jpeg_read_header(&cinfo, TRUE);
+  // The IDCT outputs the reduced size directly, skipping most of the work.
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = scale_denom;
   jpeg_start_decompress(&cinfo);
 
   int row_stride = cinfo.output_width * cinfo.output_components;
@@ -168,18 +539,17 @@ int ReadJpgStream(FILE* file, ByteImage* im) {
   buffer = (*cinfo.mem->alloc_sarray)(
       (j_common_ptr)&cinfo, JPOOL_IMAGE, row_stride, 1);
 
-  im->Resize(cinfo.output_height, cinfo.output_width, cinfo.output_components);
-
-  unsigned char* ptr = im->Data();
+  if (!sink->Start(cinfo.output_height,
+                   cinfo.output_width,
+                   cinfo.output_components)) {
+    jpeg_destroy_decompress(&cinfo);
+    return 0;
+  }
 
   while (cinfo.output_scanline < cinfo.output_height) {
+    const int y = cinfo.output_scanline;
     jpeg_read_scanlines(&cinfo, buffer, 1);
-
-    int i;
-    for (i = 0; i < row_stride; ++i) {
-      *ptr = (*buffer)[i];
-      ptr++;
-    }
+    sink->WriteRow(y, *buffer);
   }
 
   jpeg_finish_decompress(&cinfo);
@@ -187,6 +557,8 @@ int ReadJpgStream(FILE* file, ByteImage* im) {
   return 1;
 }
 
+}  // namespace
+
 int WriteJpg(const ByteImage& im, const char* filename, int quality) {
   FILE* file = fopen(filename, "wb");
   if (!file) {
@@ -265,18 +637,20 @@ int ReadPng(const char* filename, ByteImage* im) {
 }
 
 int ReadPng(const char* filename, FloatImage* image) {
-  ByteImage byte_image;
-  int res = ReadPng(filename, &byte_image);
-  if (!res) {
-    return res;
-  }
-  ByteArrayToScaledFloatArray(byte_image, image);
-  return res;
+  FloatImageRowSink sink(READ_ALL_CHANNELS, image);
+  return DecodeFile(filename, Png, 1, &sink);
 }
 
 // The writing and reading functions using libpng are based on
 //     http://zarb.org/~gc/html/libpng.html
 int ReadPngStream(FILE* file, ByteImage* im) {
+  ByteImageRowSink sink(im);
+  return DecodePngStream(file, &sink);
+}
+
+namespace {
+
+int DecodePngStream(FILE* file, RowSink* sink) {
   png_byte header[8];
 
   if (fread(header, 1, 8, file) != 8) {
@@ -292,39 +666,78 @@ int ReadPngStream(FILE* file, ByteImage* im) {
     return 0;
 
   png_infop info_ptr = png_create_info_struct(png_ptr);
-  if (!info_ptr)
+  if (!info_ptr) {
+    png_destroy_read_struct(&png_ptr, NULL, NULL);
     return 0;
+  }
 
-  if (setjmp(png_jmpbuf(png_ptr)))
+  // Rows of all the passes of interlaced images are combined in one buffer.
+  std::vector<png_byte> rows;
+
+  if (setjmp(png_jmpbuf(png_ptr))) {
+    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
     return 0;
+  }
 
   png_init_io(png_ptr, file);
   png_set_sig_bytes(png_ptr, 8);
 
   png_read_info(png_ptr, info_ptr);
 
-  im->Resize(png_get_image_height(png_ptr, info_ptr), png_get_image_width(png_ptr, info_ptr), png_get_channels(png_ptr, info_ptr));
+  // Rows have one byte for every value, or two bytes in the byte order of
+  // the host for 16-bit images.
+  png_set_packing(png_ptr);
+  if (png_get_color_type(png_ptr, info_ptr) == PNG_COLOR_TYPE_PALETTE) {
+    png_set_palette_to_rgb(png_ptr);
+  } else if (png_get_color_type(png_ptr, info_ptr) == PNG_COLOR_TYPE_GRAY &&
+             png_get_bit_depth(png_ptr, info_ptr) < 8) {
+    png_set_expand_gray_1_2_4_to_8(png_ptr);
+  }
+  if (png_get_bit_depth(png_ptr, info_ptr) == 16 && IsLittleEndian()) {
+    png_set_swap(png_ptr);
+  }
+  const int num_passes = png_set_interlace_handling(png_ptr);
 
   png_read_update_info(png_ptr, info_ptr);
 
-  if (setjmp(png_jmpbuf(png_ptr)))
+  const int height = png_get_image_height(png_ptr, info_ptr);
+  const int width = png_get_image_width(png_ptr, info_ptr);
+  const int depth = png_get_channels(png_ptr, info_ptr);
+  const bool is_16_bit = png_get_bit_depth(png_ptr, info_ptr) == 16;
+  if (!sink->Start(height, width, depth)) {
+    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
     return 0;
+  }
 
-  png_bytep* row_pointers =
-      (png_bytep*)malloc(sizeof(png_bytep) * png_get_channels(png_ptr, info_ptr) * im->Height());
-
-  unsigned char* ptr = (unsigned char*)im->Data();
-  int y;
-  for (y = 0; y < im->Height(); ++y)
-    row_pointers[y] = (png_byte*)ptr + png_get_rowbytes(png_ptr, info_ptr) * y;
-
-  png_read_image(png_ptr, row_pointers);
-
-  free(row_pointers);
+  const size_t row_bytes = png_get_rowbytes(png_ptr, info_ptr);
+  if (num_passes == 1) {
+    rows.resize(row_bytes);
+  } else {
+    rows.resize(row_bytes * height);
+    for (int pass = 0; pass < num_passes - 1; ++pass) {
+      for (int y = 0; y < height; ++y) {
+        png_read_row(png_ptr, &rows[row_bytes * y], NULL);
+      }
+    }
+  }
+  // The rows are complete in the last pass.
+  for (int y = 0; y < height; ++y) {
+    png_byte* row = num_passes == 1 ? &rows[0] : &rows[row_bytes * y];
+    png_read_row(png_ptr, row, NULL);
+    if (is_16_bit) {
+      sink->WriteRow16(y, reinterpret_cast<const uint16_t*>(row), 65535);
+    } else {
+      sink->WriteRow(y, row);
+    }
+  }
 
+  png_read_end(png_ptr, NULL);
+  png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
   return 1;
 }
 
+}  // namespace
+
 int WritePng(const ByteImage& im, const char* filename) {
   FILE* file = fopen(filename, "wb");
   if (!file) {
@@ -405,6 +818,66 @@ int WritePngStream(const ByteImage& im, FILE* file) {
   return 1;
 }
 
+int WritePng16(const FloatImage& image, const char* filename) {
+  FILE* file = fopen(filename, "wb");
+  if (!file) {
+    LOG(ERROR) << "Error: Couldn't open " << filename << " fopen returned 0";
+    return 0;
+  }
+  int res = WritePng16Stream(image, file);
+  fclose(file);
+  return res;
+}
+
+int WritePng16Stream(const FloatImage& image, FILE* file) {
+  if (image.Depth() != 3 && image.Depth() != 1) {
+    return 0;
+  }
+
+  png_structp png_ptr =
+      png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  if (!png_ptr) {
+    return 0;
+  }
+  png_infop info_ptr = png_create_info_struct(png_ptr);
+  if (!info_ptr) {
+    png_destroy_write_struct(&png_ptr, NULL);
+    return 0;
+  }
+
+  std::vector<png_byte> row(2 * image.Width() * image.Depth());
+
+  if (setjmp(png_jmpbuf(png_ptr))) {
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    return 0;
+  }
+
+  // Computed after setjmp(), so longjmp() can not clobber it.
+  const int colour =
+      image.Depth() == 3 ? PNG_COLOR_TYPE_RGB : PNG_COLOR_TYPE_GRAY;
+
+  png_init_io(png_ptr, file);
+  png_set_IHDR(png_ptr,
+               info_ptr,
+               image.Width(),
+               image.Height(),
+               16,
+               colour,
+               PNG_INTERLACE_NONE,
+               PNG_COMPRESSION_TYPE_BASE,
+               PNG_FILTER_TYPE_BASE);
+  png_write_info(png_ptr, info_ptr);
+
+  for (int y = 0; y < image.Height(); ++y) {
+    FloatRowToBigEndian16(image, y, &row[0]);
+    png_write_row(png_ptr, &row[0]);
+  }
+
+  png_write_end(png_ptr, NULL);
+  png_destroy_write_struct(&png_ptr, &info_ptr);
+  return 1;
+}
+
 int ReadPnm(const char* filename, ByteImage* im) {
   FILE* file = fopen(filename, "rb");
   if (!file) {
@@ -417,20 +890,21 @@ int ReadPnm(const char* filename, ByteImage* im) {
 }
 
 int ReadPnm(const char* filename, FloatImage* image) {
-  ByteImage byte_image;
-  int res = ReadPnm(filename, &byte_image);
-  if (!res) {
-    return res;
-  }
-  ByteArrayToScaledFloatArray(byte_image, image);
-  return res;
+  FloatImageRowSink sink(READ_ALL_CHANNELS, image);
+  return DecodeFile(filename, Pnm, 1, &sink);
 }
-// TODO(maclean): Consider making this templated to support loading into both
-// Eigen and Array3D's.
+
+int ReadPnmStream(FILE* file, ByteImage* im) {
+  ByteImageRowSink sink(im);
+  return DecodePnmStream(file, &sink);
+}
+
+namespace {
+
 // Comment handling as per the description provided at
 //   http://netpbm.sourceforge.net/doc/pgm.html
 // and http://netpbm.sourceforge.net/doc/pbm.html
-int ReadPnmStream(FILE* file, ByteImage* im) {
+int DecodePnmStream(FILE* file, RowSink* sink) {
   const int NUM_VALUES = 3;
   const int INT_BUFFER_SIZE = 256;
 
@@ -472,10 +946,7 @@ int ReadPnmStream(FILE* file, ByteImage* im) {
         intBuffer[intIndex] = 0;  // NULL-terminate the string
         values[valuesIndex++] = atoi(intBuffer);
         intIndex = 0;  // reset for next int token
-        // use this line if image class aloows 2-byte grey-scale
-        //        if (valuesIndex == 3 && values[2] > 65535) return 0 ;
-        // to conform with current image class
-        if (valuesIndex == 3 && values[2] > 255)
+        if (valuesIndex == 3 && (values[2] <= 0 || values[2] > 65535))
           return 0;
       }
     } else if (isdigit(nextChar)) {
@@ -495,18 +966,39 @@ int ReadPnmStream(FILE* file, ByteImage* im) {
     }
   }
 
-  // use this line if image class aloows 2-byte grey-scale
-  //  if (values[2] > 255 && magicnumber == 5) depth = 2 ;
-
-  // Read pixels.
-  im->Resize(values[1], values[0], depth);
-  res = fread(im->Data(), 1, im->Size(), file);
-  if (res != im->Size()) {
+  if (!sink->Start(values[1], values[0], depth)) {
     return 0;
   }
+
+  // Read pixels, values of more than 255 take two bytes, big endian.
+  const int max_value = values[2];
+  const int row_size = values[0] * depth;
+  if (max_value <= 255) {
+    std::vector<unsigned char> row(row_size);
+    for (int y = 0; y < values[1]; ++y) {
+      if (fread(&row[0], 1, row_size, file) != row_size) {
+        return 0;
+      }
+      sink->WriteRow(y, &row[0]);
+    }
+  } else {
+    std::vector<unsigned char> bytes(2 * row_size);
+    std::vector<uint16_t> row(row_size);
+    for (int y = 0; y < values[1]; ++y) {
+      if (fread(&bytes[0], 1, bytes.size(), file) != bytes.size()) {
+        return 0;
+      }
+      for (int i = 0; i < row_size; ++i) {
+        row[i] = (bytes[2 * i] << 8) | bytes[2 * i + 1];
+      }
+      sink->WriteRow16(y, &row[0], max_value);
+    }
+  }
   return 1;
 }
 
+}  // namespace
+
 int WritePnm(const ByteImage& im, const char* filename) {
   FILE* file = fopen(filename, "wb");
   if (!file) {
@@ -549,4 +1041,129 @@ int WritePnmStream(const ByteImage& im, FILE* file) {
   return 1;
 }
 
+int WritePnm16(const FloatImage& image, const char* filename) {
+  FILE* file = fopen(filename, "wb");
+  if (!file) {
+    LOG(ERROR) << "Error: Couldn't open " << filename << " fopen returned 0";
+    return 0;
+  }
+  int res = WritePnm16Stream(image, file);
+  fclose(file);
+  return res;
+}
+
+int WritePnm16Stream(const FloatImage& image, FILE* file) {
+  if (image.Depth() != 1 && image.Depth() != 3) {
+    return 0;
+  }
+  fprintf(file,
+          "%s\n%d %d %d\n",
+          image.Depth() == 1 ? "P5" : "P6",
+          image.Width(),
+          image.Height(),
+          65535);
+
+  std::vector<unsigned char> row(2 * image.Width() * image.Depth());
+  for (int y = 0; y < image.Height(); ++y) {
+    FloatRowToBigEndian16(image, y, &row[0]);
+    if (fwrite(&row[0], 1, row.size(), file) != row.size()) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int ReadPfm(const char* filename, FloatImage* image) {
+  FloatImageRowSink sink(READ_ALL_CHANNELS, image);
+  return DecodeFile(filename, Pfm, 1, &sink);
+}
+
+int ReadPfmStream(FILE* file, FloatImage* image) {
+  FloatImageRowSink sink(READ_ALL_CHANNELS, image);
+  return DecodePfmStream(file, &sink);
+}
+
+namespace {
+
+// The header is "PF" for 3 channels or "Pf" for one, the width, the height
+// and a scale whose sign gives the byte order, negative for little endian.
+// Rows are stored from the bottom of the image to the top.
+int DecodePfmStream(FILE* file, RowSink* sink) {
+  char type[3];
+  int width, height;
+  double scale;
+  if (fscanf(file, "%2s %d %d %lf", type, &width, &height, &scale) != 4 ||
+      width <= 0 || height <= 0 || scale == 0.0 || !isspace(fgetc(file))) {
+    return 0;
+  }
+  int depth;
+  if (std::strcmp(type, "PF") == 0) {
+    depth = 3;
+  } else if (std::strcmp(type, "Pf") == 0) {
+    depth = 1;
+  } else {
+    return 0;
+  }
+  if (!sink->Start(height, width, depth)) {
+    return 0;
+  }
+
+  const bool swap_bytes = (scale < 0) != IsLittleEndian();
+  const int row_size = width * depth;
+  std::vector<float> row(row_size);
+  for (int y = height - 1; y >= 0; --y) {
+    if (fread(&row[0], sizeof(float), row_size, file) != row_size) {
+      return 0;
+    }
+    if (swap_bytes) {
+      unsigned char* bytes = reinterpret_cast<unsigned char*>(&row[0]);
+      for (int i = 0; i < row_size; ++i, bytes += 4) {
+        std::swap(bytes[0], bytes[3]);
+        std::swap(bytes[1], bytes[2]);
+      }
+    }
+    sink->WriteRowFloat(y, &row[0]);
+  }
+  return 1;
+}
+
+}  // namespace
+
+int WritePfm(const FloatImage& image, const char* filename) {
+  FILE* file = fopen(filename, "wb");
+  if (!file) {
+    LOG(ERROR) << "Error: Couldn't open " << filename << " fopen returned 0";
+    return 0;
+  }
+  int res = WritePfmStream(image, file);
+  fclose(file);
+  return res;
+}
+
+int WritePfmStream(const FloatImage& image, FILE* file) {
+  if (image.Depth() != 1 && image.Depth() != 3) {
+    return 0;
+  }
+  fprintf(file,
+          "%s\n%d %d\n%s\n",
+          image.Depth() == 3 ? "PF" : "Pf",
+          image.Width(),
+          image.Height(),
+          IsLittleEndian() ? "-1.0" : "1.0");
+
+  std::vector<float> row(image.Width() * image.Depth());
+  for (int y = image.Height() - 1; y >= 0; --y) {
+    float* output = &row[0];
+    for (int x = 0; x < image.Width(); ++x) {
+      for (int k = 0; k < image.Depth(); ++k) {
+        *output++ = image(y, x, k);
+      }
+    }
+    if (fwrite(&row[0], sizeof(float), row.size(), file) != row.size()) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
 }  // namespace libmv
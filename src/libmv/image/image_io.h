@@ -28,26 +28,72 @@
 namespace libmv {
 
 enum Format {
-  Pnm, Png, Jpg, Unknown
+  Pnm, Png, Jpg, Pfm, Unknown
 };
 
 Format GetFormat(const char *c);
 
 int ReadImage(const char *, ByteImage *);
 int ReadImage(const char *, FloatImage *);
+
+// Read the image at 1/scale_denom of its size, rounded up, for the callers
+// which only need a coarse pyramid level or a preview. The scale_denom must
+// be 1, 2, 4 or 8. JPEG files are decoded at the reduced size directly, by
+// scaling the DCT, which is several times faster than decoding the full image.
+// Other formats are decoded fully and averaged over scale_denom^2 blocks.
+int ReadImage(const char *, ByteImage *, int scale_denom);
+int ReadImage(const char *, FloatImage *, int scale_denom);
+
+// Values of the channel argument of ReadImage(). Non-negative values select
+// the channel with that index.
+enum {
+  // All channels of the file.
+  READ_ALL_CHANNELS = -1,
+
+  // The luminance, same as Rgb2Gray() of the float image. Files with one or
+  // two channels give their first channel.
+  READ_GRAY = -2,
+};
+
+// Read the image to a float image of the selected channels. The pixels are
+// converted to floats row by row as they are decoded, which saves the
+// allocation of a byte image and the passes over it. When the float image
+// already has the right shape, it is not reallocated. It can also be a view
+// of a buffer of the caller, Array3Df(data, height, width, depth), then it
+// must have the right shape and contiguous rows.
+int ReadImage(const char *filename,
+              FloatImage *image,
+              int channel,
+              int scale_denom);
 int WriteImage(const ByteImage &, const char *);
 int WriteImage(const FloatImage &, const char *);
 
+// 16-bit PNG and PNM files keep their precision when read to float images,
+// a value v becomes v / 65535, or v divided by the maximum value in the
+// header of PNM files. Read to byte images, they are rounded to 8 bits.
+//
+// PFM files, the portable float maps of one or three channels, keep the
+// floats exactly. WriteImage() of a float image writes them for the .pfm
+// extension.
+
+// Write the float image with 16 bits per value to PNG and PNM files, or to a
+// PFM file. Values are clamped to [0, 1] and rounded for the 16-bit files.
+// The rows are converted and written one at a time, without a copy of the
+// whole image.
+int WriteImage16(const FloatImage &, const char *);
+
 int ReadPng(const char *, ByteImage *);
 int ReadPng(const char *, FloatImage *);
 int ReadPngStream(FILE *, ByteImage *);
 int WritePng(const ByteImage &, const char *);
 int WritePng(const FloatImage &, const char *);
 int WritePngStream(const ByteImage &, FILE *);
+int WritePng16(const FloatImage &, const char *);
+int WritePng16Stream(const FloatImage &, FILE *);
 
-int ReadJpg(const char *, ByteImage *);
-int ReadJpg(const char *, FloatImage *);
-int ReadJpgStream(FILE *, ByteImage *);
+int ReadJpg(const char *, ByteImage *, int scale_denom = 1);
+int ReadJpg(const char *, FloatImage *, int scale_denom = 1);
+int ReadJpgStream(FILE *, ByteImage *, int scale_denom = 1);
 int WriteJpg(const ByteImage &, const char *, int quality = 90);
 int WriteJpg(const FloatImage &, const char *, int quality = 90);
 int WriteJpgStream(const ByteImage &, FILE *, int quality = 90);
@@ -58,6 +104,13 @@ int ReadPnmStream(FILE *file, ByteImage *im);
 int WritePnm(const ByteImage &im, const char *filename);
 int WritePnm(const FloatImage &im, const char *filename);
 int WritePnmStream(const ByteImage &im, FILE *file);
+int WritePnm16(const FloatImage &im, const char *filename);
+int WritePnm16Stream(const FloatImage &im, FILE *file);
+
+int ReadPfm(const char *filename, FloatImage *im);
+int ReadPfmStream(FILE *file, FloatImage *im);
+int WritePfm(const FloatImage &im, const char *filename);
+int WritePfmStream(const FloatImage &im, FILE *file);
 
 }  // namespace libmv
 
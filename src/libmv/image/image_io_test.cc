@@ -22,6 +22,7 @@
 #include <string>
 
 #include "libmv/image/image.h"
+#include "libmv/image/image_converter.h"
 #include "libmv/image/image_io.h"
 #include "testing/testing.h"
 
@@ -228,6 +229,255 @@ TEST_F(ImageIOTest, Jpg) {
   EXPECT_TRUE(read_image == image);
 }
 
+TEST_F(ImageIOTest, ReadJpgScaled) {
+  Array3Du image(37, 50, 3);
+  for (int i = 0; i < image.Height(); ++i) {
+    for (int j = 0; j < image.Width(); ++j) {
+      for (int k = 0; k < 3; ++k) {
+        image(i, j, k) = 40 + 3 * i + 2 * j + 10 * k;
+      }
+    }
+  }
+  string out_filename = TmpFile("test_write_jpg_scaled.jpg");
+  EXPECT_TRUE(WriteJpg(image, out_filename.c_str(), 100));
+
+  for (int scale_denom = 2; scale_denom <= 8; scale_denom *= 2) {
+    Array3Du read_image;
+    EXPECT_TRUE(ReadImage(out_filename.c_str(), &read_image, scale_denom));
+    // The size is rounded up.
+    EXPECT_EQ((37 + scale_denom - 1) / scale_denom, read_image.Height());
+    EXPECT_EQ((50 + scale_denom - 1) / scale_denom, read_image.Width());
+    EXPECT_EQ(3, read_image.Depth());
+
+    // The pixels are about the average of the blocks, check the center of
+    // the first one.
+    const float center = (scale_denom - 1) / 2.0f;
+    for (int k = 0; k < 3; ++k) {
+      EXPECT_NEAR(40 + 5 * center + 10 * k, read_image(0, 0, k), 4);
+    }
+  }
+
+  FloatImage float_image;
+  EXPECT_TRUE(ReadImage(out_filename.c_str(), &float_image, 4));
+  EXPECT_EQ(10, float_image.Height());
+  EXPECT_EQ(13, float_image.Width());
+}
+
+TEST_F(ImageIOTest, ReadImageScaledPnm) {
+  Array3Du image(3, 5);
+  for (int i = 0; i < image.Height(); ++i) {
+    for (int j = 0; j < image.Width(); ++j) {
+      image(i, j) = 10 * i + j;
+    }
+  }
+  string out_filename = TmpFile("test_write_pnm_scaled.pgm");
+  EXPECT_TRUE(WritePnm(image, out_filename.c_str()));
+
+  Array3Du read_image;
+  EXPECT_TRUE(ReadImage(out_filename.c_str(), &read_image, 2));
+  EXPECT_EQ(2, read_image.Height());
+  EXPECT_EQ(3, read_image.Width());
+  // Rounded averages of the blocks, which are partial at the borders.
+  EXPECT_EQ(6, read_image(0, 0));
+  EXPECT_EQ(8, read_image(0, 1));
+  EXPECT_EQ(9, read_image(0, 2));
+  EXPECT_EQ(21, read_image(1, 0));
+  EXPECT_EQ(24, read_image(1, 2));
+
+  EXPECT_FALSE(ReadImage(out_filename.c_str(), &read_image, 3));
+}
+
+// Float image whose values are all multiples of 1 / 65535.
+FloatImage Make16BitImage(int depth) {
+  FloatImage image(7, 9, depth);
+  for (int i = 0; i < image.Height(); ++i) {
+    for (int j = 0; j < image.Width(); ++j) {
+      for (int k = 0; k < depth; ++k) {
+        image(i, j, k) = ((i * 9 + j) * 1021 + k * 4099) % 65536 / 65535.0f;
+      }
+    }
+  }
+  return image;
+}
+
+TEST_F(ImageIOTest, Write16BitFiles) {
+  const char* filenames[] = {"test_write_16.png",
+                             "test_write_16.pgm",
+                             "test_write_16_rgb.png",
+                             "test_write_16_rgb.ppm"};
+  for (int f = 0; f < 4; ++f) {
+    FloatImage image = Make16BitImage(f < 2 ? 1 : 3);
+    string filename = TmpFile(filenames[f]);
+    EXPECT_TRUE(WriteImage16(image, filename.c_str()));
+
+    FloatImage read_image;
+    EXPECT_TRUE(ReadImage(filename.c_str(), &read_image));
+    EXPECT_TRUE(image == read_image) << filename;
+
+    // Rounded to the nearest byte for byte images.
+    Array3Du byte_image;
+    EXPECT_TRUE(ReadImage(filename.c_str(), &byte_image));
+    EXPECT_EQ(int(image(2, 3, 0) * 255 + 0.5f), byte_image(2, 3, 0));
+  }
+}
+
+TEST_F(ImageIOTest, Write16BitClamps) {
+  FloatImage image(1, 3);
+  image(0, 0) = -0.5;
+  image(0, 1) = 0.5;
+  image(0, 2) = 2.0;
+  string filename = TmpFile("test_write_16_clamp.png");
+  EXPECT_TRUE(WritePng16(image, filename.c_str()));
+
+  FloatImage read_image;
+  EXPECT_TRUE(ReadPng(filename.c_str(), &read_image));
+  EXPECT_EQ(0.0f, read_image(0, 0));
+  EXPECT_EQ(32768 / 65535.0f, read_image(0, 1));
+  EXPECT_EQ(1.0f, read_image(0, 2));
+}
+
+TEST_F(ImageIOTest, Pnm16BitMaxValue) {
+  string filename = TmpFile("test_read_pnm_max_value.pgm");
+  FILE* file = fopen(filename.c_str(), "wb");
+  ASSERT_TRUE(file != NULL);
+  const unsigned char pixels[] = {0x00, 0x00, 0x01, 0xf4, 0x03, 0xe8};
+  fprintf(file, "P5\n3 1\n1000\n");
+  fwrite(pixels, 1, sizeof(pixels), file);
+  fclose(file);
+
+  FloatImage image;
+  EXPECT_TRUE(ReadPnm(filename.c_str(), &image));
+  EXPECT_EQ(0.0f, image(0, 0));
+  EXPECT_EQ(0.5f, image(0, 1));
+  EXPECT_EQ(1.0f, image(0, 2));
+}
+
+TEST_F(ImageIOTest, PfmIsExact) {
+  const char* filenames[] = {"test_write_gray.pfm", "test_write_rgb.pfm"};
+  for (int f = 0; f < 2; ++f) {
+    FloatImage image(5, 4, f == 0 ? 1 : 3);
+    for (int i = 0; i < image.Size(); ++i) {
+      image.Data()[i] = (i - 17) / 3.0f;
+    }
+    string filename = TmpFile(filenames[f]);
+    EXPECT_TRUE(WriteImage(image, filename.c_str()));
+
+    FloatImage read_image;
+    EXPECT_TRUE(ReadImage(filename.c_str(), &read_image));
+    EXPECT_TRUE(image == read_image) << filename;
+  }
+
+  FloatImage two_channels(2, 2, 2);
+  EXPECT_FALSE(WritePfm(two_channels, TmpFile("test_two.pfm").c_str()));
+}
+
+TEST_F(ImageIOTest, PfmOtherByteOrder) {
+  // The first row of the file is the bottom of the image.
+  const unsigned char big_endian[] = {0x3f, 0x80, 0x00, 0x00,
+                                      0xc0, 0x00, 0x00, 0x00};
+  string filename = TmpFile("test_read_big_endian.pfm");
+  FILE* file = fopen(filename.c_str(), "wb");
+  ASSERT_TRUE(file != NULL);
+  fprintf(file, "Pf\n1 2\n1.0\n");
+  fwrite(big_endian, 1, sizeof(big_endian), file);
+  fclose(file);
+
+  FloatImage image;
+  EXPECT_TRUE(ReadPfm(filename.c_str(), &image));
+  EXPECT_EQ(-2.0f, image(0, 0));
+  EXPECT_EQ(1.0f, image(1, 0));
+}
+
+class ReadImageChannelsTest : public ImageIOTest {
+ public:
+  // RGB image with every byte value in every channel.
+  void SetUp() {
+    image_.Resize(16, 24, 3);
+    for (int i = 0; i < image_.Height(); ++i) {
+      for (int j = 0; j < image_.Width(); ++j) {
+        for (int k = 0; k < 3; ++k) {
+          image_(i, j, k) = (i * 16 + j + 85 * k) % 256;
+        }
+      }
+    }
+  }
+
+  // The float image and its luminance, read the usual way.
+  void ReadExpected(const string& filename,
+                    FloatImage* expected,
+                    FloatImage* expected_gray) {
+    EXPECT_TRUE(ReadImage(filename.c_str(), expected));
+    libmv::Rgb2Gray(*expected, expected_gray);
+  }
+
+ protected:
+  Array3Du image_;
+};
+
+TEST_F(ReadImageChannelsTest, AllChannelsAreExact) {
+  string png_filename = TmpFile("test_read_channels.png");
+  EXPECT_TRUE(WritePng(image_, png_filename.c_str()));
+
+  FloatImage expected, image;
+  libmv::ByteArrayToScaledFloatArray(image_, &expected);
+  EXPECT_TRUE(ReadImage(png_filename.c_str(),
+                        &image,
+                        libmv::READ_ALL_CHANNELS,
+                        1));
+  EXPECT_TRUE(expected == image);
+}
+
+TEST_F(ReadImageChannelsTest, Gray) {
+  const char* filenames[] = {"test_read_gray.png",
+                             "test_read_gray.jpg",
+                             "test_read_gray.ppm"};
+  for (int f = 0; f < 3; ++f) {
+    string filename = TmpFile(filenames[f]);
+    EXPECT_TRUE(WriteImage(image_, filename.c_str()));
+
+    FloatImage expected, expected_gray, gray;
+    ReadExpected(filename, &expected, &expected_gray);
+    EXPECT_TRUE(ReadImage(filename.c_str(), &gray, libmv::READ_GRAY, 1));
+    EXPECT_TRUE(expected_gray == gray) << filename;
+  }
+}
+
+TEST_F(ReadImageChannelsTest, OneChannel) {
+  string filename = TmpFile("test_read_channel.jpg");
+  EXPECT_TRUE(WriteJpg(image_, filename.c_str(), 100));
+
+  FloatImage expected, expected_gray, green;
+  ReadExpected(filename, &expected, &expected_gray);
+  EXPECT_TRUE(ReadImage(filename.c_str(), &green, 1, 1));
+  ASSERT_EQ(1, green.Depth());
+  for (int i = 0; i < image_.Height(); ++i) {
+    for (int j = 0; j < image_.Width(); ++j) {
+      EXPECT_EQ(expected(i, j, 1), green(i, j));
+    }
+  }
+
+  EXPECT_FALSE(ReadImage(filename.c_str(), &green, 3, 1));
+}
+
+TEST_F(ReadImageChannelsTest, CallerBuffer) {
+  string filename = TmpFile("test_read_buffer.png");
+  EXPECT_TRUE(WritePng(image_, filename.c_str()));
+
+  FloatImage expected, expected_gray;
+  ReadExpected(filename, &expected, &expected_gray);
+
+  std::vector<float> buffer(16 * 24);
+  Array3Df view(&buffer[0], 16, 24, 1);
+  EXPECT_TRUE(ReadImage(filename.c_str(), &view, libmv::READ_GRAY, 1));
+  EXPECT_EQ(&buffer[0], view.Data());
+  EXPECT_EQ(expected_gray(3, 5), buffer[3 * 24 + 5]);
+
+  // The view does not fit the image at half of the size.
+  EXPECT_FALSE(ReadImage(filename.c_str(), &view, libmv::READ_GRAY, 2));
+  Array3Df half_view(&buffer[0], 8, 12, 1);
+  EXPECT_TRUE(ReadImage(filename.c_str(), &half_view, libmv::READ_GRAY, 2));
+}
+
 TEST(GetFormat, filenames) {
   EXPECT_EQ(GetFormat("something.jpg"), libmv::Jpg);
   EXPECT_EQ(GetFormat("something.png"), libmv::Png);
@@ -238,6 +488,7 @@ TEST(GetFormat, filenames) {
   EXPECT_EQ(GetFormat(".s/o.m/e.t/h.i/n.g.JPG"), libmv::Jpg);
   EXPECT_EQ(GetFormat(".s/o.m/e.t/h.i/n.g.PNG"), libmv::Png);
   EXPECT_EQ(GetFormat(".s/o.m/e.t/h.i/n.g.PNM"), libmv::Pnm);
+  EXPECT_EQ(GetFormat("something.pfm"), libmv::Pfm);
 }
 
 }  // namespace
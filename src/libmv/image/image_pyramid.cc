@@ -20,63 +20,132 @@
 
 #include "libmv/image/image_pyramid.h"
 
+#include <mutex>
+
 #include "libmv/base/vector.h"
 #include "libmv/image/convolve.h"
 #include "libmv/image/sample.h"
+#include "libmv/logging/logging.h"
 
 namespace libmv {
 
-class ConcreteImagePyramid : public ImagePyramid {
+class LazyImagePyramid : public ImagePyramid {
  public:
-  ConcreteImagePyramid() {}
-
-  ConcreteImagePyramid(const FloatImage& image,
-                       int num_levels,
-                       double sigma = 0.9) {
-    Init(image, num_levels, sigma);
-  }
-
-  virtual ~ConcreteImagePyramid() {}
-
-  void Init(const FloatImage& image, int num_levels, double sigma = 0.9) {
+  LazyImagePyramid(const FloatImage& image,
+                   int num_levels,
+                   double sigma = 0.9,
+                   ImagePyramidStorage storage = PYRAMID_FLOAT)
+      : sigma_(sigma),
+        storage_(storage),
+        downsamples_(num_levels),
+        has_downsample_(num_levels, false),
+        has_level_(num_levels, false),
+        has_float_level_(num_levels, storage == PYRAMID_FLOAT) {
     assert(image.Depth() == 1);
+    assert(num_levels > 0);
 
+    downsamples_[0] = image;
+    has_downsample_[0] = true;
     levels_.resize(num_levels);
+    if (storage == PYRAMID_HALF) {
+      half_levels_.resize(num_levels);
+    }
+  }
 
-    BlurredImageAndDerivativesChannels(image, sigma, &levels_[0]);
+  virtual ~LazyImagePyramid() {}
 
-    vector<FloatImage> downsamples(num_levels);
-    downsamples[0] = image;  // FIXME: useless copy
+  // Levels stored as half floats are converted to floats on the first
+  // access, and the converted level is kept as well.
+  virtual const FloatImage& Level(int i) {
+    if (i < 0 || i >= NumLevels()) {
+      LOG(FATAL) << "Level " << i << " of a pyramid with " << NumLevels()
+                 << " levels.";
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    ComputeLevel(i);
+    if (!has_float_level_[i]) {
+      HalfImageToFloat(half_levels_[i], &levels_[i]);
+      has_float_level_[i] = true;
+    }
+    return levels_[i];
+  }
 
-    for (int i = 1; i < NumLevels(); ++i) {
-      DownsampleChannelsBy2(downsamples[i - 1], &downsamples[i]);
-      BlurredImageAndDerivativesChannels(downsamples[i], sigma, &levels_[i]);
+  virtual const HalfImage* HalfLevel(int i) {
+    assert(0 <= i && i < NumLevels());
+    if (storage_ != PYRAMID_HALF) {
+      return NULL;
     }
+    std::lock_guard<std::mutex> lock(mutex_);
+    ComputeLevel(i);
+    return &half_levels_[i];
   }
 
-  virtual const FloatImage& Level(int i) {
+  virtual const FloatImage& DownsampledImage(int i) {
     assert(0 <= i && i < NumLevels());
-    return levels_[i];
+    std::lock_guard<std::mutex> lock(mutex_);
+    ComputeDownsample(i);
+    return downsamples_[i];
   }
 
-  virtual int NumLevels() const { return levels_.size(); }
+  virtual int NumLevels() const { return downsamples_.size(); }
 
   int MemorySizeInBytes() const {
+    const int bytes_per_value =
+        storage_ == PYRAMID_HALF ? sizeof(Half) : sizeof(float);
+    int height = downsamples_[0].Height();
+    int width = downsamples_[0].Width();
     int sum = 0;
     for (int i = 0; i < NumLevels(); ++i) {
-      sum += levels_[i].MemorySizeInBytes();
+      sum += height * width * (3 * bytes_per_value + sizeof(float));
+      height /= 2;
+      width /= 2;
     }
     return sum;
   }
 
  private:
+  // Must be called with the mutex locked.
+  void ComputeDownsample(int i) {
+    if (!has_downsample_[i]) {
+      ComputeDownsample(i - 1);
+      DownsampleChannelsBy2(downsamples_[i - 1], &downsamples_[i]);
+      has_downsample_[i] = true;
+    }
+  }
+
+  // Must be called with the mutex locked.
+  void ComputeLevel(int i) {
+    if (has_level_[i]) {
+      return;
+    }
+    ComputeDownsample(i);
+    if (storage_ == PYRAMID_HALF) {
+      // Levels stored as half floats are computed in a float temporary.
+      FloatImage level;
+      BlurredImageAndDerivativesChannels(downsamples_[i], sigma_, &level);
+      FloatImageToHalf(level, &half_levels_[i]);
+    } else {
+      BlurredImageAndDerivativesChannels(downsamples_[i], sigma_, &levels_[i]);
+    }
+    has_level_[i] = true;
+  }
+
+  double sigma_;
+  ImagePyramidStorage storage_;
+  vector<FloatImage> downsamples_;
   vector<FloatImage> levels_;
+  vector<HalfImage> half_levels_;
+  std::vector<bool> has_downsample_;
+  std::vector<bool> has_level_;
+  std::vector<bool> has_float_level_;
+  std::mutex mutex_;
 };
 
 ImagePyramid* MakeImagePyramid(const FloatImage& image,
                                int num_levels,
-                               double sigma) {
-  return new ConcreteImagePyramid(image, num_levels, sigma);
+                               double sigma,
+                               ImagePyramidStorage storage) {
+  return new LazyImagePyramid(image, num_levels, sigma, storage);
 }
 
 }  // namespace libmv
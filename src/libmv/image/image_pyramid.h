@@ -25,17 +25,50 @@
 
 namespace libmv {
 
+// Type used to store the levels of a pyramid. Half floats take half of the
+// memory, which is useful for pyramids kept in caches.
+enum ImagePyramidStorage {
+  PYRAMID_FLOAT,
+  PYRAMID_HALF,
+};
+
+// Pyramid of an image. Level i has three channels, the image downsampled by
+// 2 i times and blurred, and the x and y derivatives of it.
+//
+// Pyramids are meant to be shared by everything which works on the same
+// frame, so the levels can be accessed from several threads at once.
 class ImagePyramid {
  public:
   virtual ~ImagePyramid() {}
+
+  // Level as floats. Levels of a pyramid stored as half floats are
+  // converted, and the converted copy is kept with the pyramid, so consumers
+  // of such pyramids should prefer HalfLevel(), as KLTContext::TrackFeature()
+  // does.
   virtual const FloatImage &Level(int i) = 0;
+
+  // Level of a pyramid stored as half floats, or NULL if it is stored as
+  // floats.
+  virtual const HalfImage *HalfLevel(int /*i*/) { return NULL; }
+
+  // Image downsampled by 2 i times, without the blur. Image 0 is the image
+  // the pyramid was made from.
+  virtual const FloatImage &DownsampledImage(int i) = 0;
+
   virtual int NumLevels() const = 0;
   virtual int MemorySizeInBytes() const = 0;
 };
 
+// Make a pyramid of an image. The levels and downsampled images are computed
+// on the first access, so only the ones which are used are computed. The
+// memory size is the size of all levels in the storage type and of all
+// downsampled images, so the size of the pyramid in a cache does not change.
+// Float copies of the levels made by Level() of a half pyramid are not
+// included.
 ImagePyramid *MakeImagePyramid(const FloatImage &image,
                                int num_levels,
-                               double sigma);
+                               double sigma,
+                               ImagePyramidStorage storage = PYRAMID_FLOAT);
 }  // namespace libmv
 
 #endif  // LIBMV_IMAGE_IMAGE_PYRAMID_H
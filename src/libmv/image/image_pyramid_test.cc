@@ -19,7 +19,9 @@
 // IN THE SOFTWARE.
 
 #include "libmv/image/image_pyramid.h"
+#include "libmv/image/convolve.h"
 #include "libmv/image/image.h"
+#include "libmv/image/sample.h"
 #include "testing/testing.h"
 
 using libmv::Array3Df;
@@ -39,4 +41,85 @@ TEST(ImagePyramid, Init) {
   delete ip;
 }
 
+TEST(ImagePyramid, DownsampledImages) {
+  Array3Df image(32, 32);
+  for (int i = 0; i < image.Height(); ++i) {
+    for (int j = 0; j < image.Width(); ++j) {
+      image(i, j) = i + 2 * j;
+    }
+  }
+  ImagePyramid* ip = MakeImagePyramid(image, 3, 0.9);
+
+  EXPECT_EQ(image, ip->DownsampledImage(0));
+  Array3Df downsampled1, downsampled2;
+  libmv::DownsampleChannelsBy2(image, &downsampled1);
+  libmv::DownsampleChannelsBy2(downsampled1, &downsampled2);
+  EXPECT_EQ(downsampled2, ip->DownsampledImage(2));
+  EXPECT_EQ(downsampled1, ip->DownsampledImage(1));
+
+  // Level computed on first access matches the direct computation.
+  Array3Df level2;
+  libmv::BlurredImageAndDerivativesChannels(downsampled2, 0.9, &level2);
+  EXPECT_EQ(level2, ip->Level(2));
+  EXPECT_EQ(&ip->Level(2), &ip->Level(2));
+  delete ip;
+}
+
+TEST(ImagePyramid, HalfStorage) {
+  Array3Df image(32, 32);
+  for (int i = 0; i < image.Height(); ++i) {
+    for (int j = 0; j < image.Width(); ++j) {
+      image(i, j) = i + 2 * j;
+    }
+  }
+  ImagePyramid* ip = MakeImagePyramid(image, 2, 0.9);
+  ImagePyramid* half_ip =
+      MakeImagePyramid(image, 2, 0.9, libmv::PYRAMID_HALF);
+
+  EXPECT_EQ(half_ip->NumLevels(), 2);
+  EXPECT_TRUE(ip->HalfLevel(0) == NULL);
+  // Levels take 6 bytes per pixel instead of 12, downsampled images 4 bytes.
+  EXPECT_EQ(10 * ip->MemorySizeInBytes(), 16 * half_ip->MemorySizeInBytes());
+  for (int l = 0; l < 2; ++l) {
+    const Array3Df& level = ip->Level(l);
+    const libmv::HalfImage& half_level = *half_ip->HalfLevel(l);
+    EXPECT_EQ(level.Shape(), half_level.Shape());
+    for (int i = 0; i < level.Height(); ++i) {
+      for (int j = 0; j < level.Width(); ++j) {
+        for (int k = 0; k < level.Depth(); ++k) {
+          EXPECT_EQ(libmv::FloatToHalf(level(i, j, k)), half_level(i, j, k));
+        }
+      }
+    }
+  }
+  delete ip;
+  delete half_ip;
+}
+
+TEST(ImagePyramid, FloatLevelOfHalfStorage) {
+  Array3Df image(32, 32);
+  for (int i = 0; i < image.Height(); ++i) {
+    for (int j = 0; j < image.Width(); ++j) {
+      image(i, j) = i + 2 * j;
+    }
+  }
+  ImagePyramid* half_ip =
+      MakeImagePyramid(image, 2, 0.9, libmv::PYRAMID_HALF);
+
+  for (int l = 0; l < 2; ++l) {
+    const Array3Df& level = half_ip->Level(l);
+    const libmv::HalfImage& half_level = *half_ip->HalfLevel(l);
+    EXPECT_EQ(half_level.Shape(), level.Shape());
+    for (int i = 0; i < level.Height(); ++i) {
+      for (int j = 0; j < level.Width(); ++j) {
+        for (int k = 0; k < level.Depth(); ++k) {
+          EXPECT_EQ(libmv::HalfToFloat(half_level(i, j, k)), level(i, j, k));
+        }
+      }
+    }
+    EXPECT_EQ(&level, &half_ip->Level(l));
+  }
+  delete half_ip;
+}
+
 }  // namespace
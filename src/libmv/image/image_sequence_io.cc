@@ -19,41 +19,342 @@
 // IN THE SOFTWARE.
 
 #include "libmv/image/image_sequence_io.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+
 #include "libmv/image/cached_image_sequence.h"
 #include "libmv/image/image_io.h"
+#include "libmv/image/mapped_pnm.h"
 
 namespace libmv {
 
+namespace {
+
+Image* LoadImageFromFile(const std::string& filename,
+                         int i,
+                         int scale_denom = 1) {
+  Array3Df* image = new Array3Df;
+  if (!ReadImage(filename.c_str(), image, scale_denom)) {
+    delete image;
+    // TODO(keir): Better error reporting?
+    fprintf(stderr, "Failed loading image %d: %s\n", i, filename.c_str());
+    return 0;
+  }
+  return new Image(image);
+}
+
+}  // namespace
+
 // An image sequence loaded from disk with caching behaviour.
 class LazyImageSequenceFromFiles : public CachedImageSequence {
  public:
   virtual ~LazyImageSequenceFromFiles() {}
 
   LazyImageSequenceFromFiles(const std::vector<std::string>& image_filenames,
-                             ImageCache* cache)
-      : CachedImageSequence(cache), filenames_(image_filenames) {}
+                             ImageCache* cache,
+                             int scale_denom)
+      : CachedImageSequence(cache),
+        filenames_(image_filenames),
+        scale_denom_(scale_denom) {}
 
   virtual int Length() { return filenames_.size(); }
 
   virtual Image* LoadImage(int i) {
-    Array3Df* image = new Array3Df;
-    if (!ReadImage(filenames_[i].c_str(), image)) {
-      delete image;
-      // TODO(keir): Better error reporting?
-      fprintf(
-          stderr, "Failed loading image %d: %s\n", i, filenames_[i].c_str());
-      return 0;
-    }
-    return new Image(image);
+    return LoadImageFromFile(filenames_[i], i, scale_denom_);
   }
 
  private:
   std::vector<std::string> filenames_;
+  int scale_denom_;
 };
 
 ImageSequence* ImageSequenceFromFiles(const std::vector<std::string>& filenames,
-                                      ImageCache* cache) {
-  return new LazyImageSequenceFromFiles(filenames, cache);
+                                      ImageCache* cache,
+                                      int scale_denom) {
+  return new LazyImageSequenceFromFiles(filenames, cache, scale_denom);
+}
+
+class PrefetchingImageSequence : public CachedImageSequence {
+ public:
+  PrefetchingImageSequence(const std::vector<std::string>& image_filenames,
+                           ImageCache* cache,
+                           int num_prefetched_frames,
+                           int num_threads)
+      : CachedImageSequence(cache),
+        filenames_(image_filenames),
+        num_prefetched_frames_(num_prefetched_frames),
+        last_frame_(-1),
+        direction_(1),
+        window_begin_(0),
+        window_end_(0),
+        stop_(false) {
+    for (int i = 0; i < num_threads; ++i) {
+      threads_.push_back(std::thread([this] { DecodeFrames(); }));
+    }
+  }
+
+  virtual ~PrefetchingImageSequence() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+      queue_.clear();
+    }
+    queue_changed_.notify_all();
+    for (int i = 0; i < threads_.size(); ++i) {
+      threads_[i].join();
+    }
+    for (std::map<int, Image*>::iterator it = decoded_.begin();
+         it != decoded_.end();
+         ++it) {
+      delete it->second;
+    }
+  }
+
+  virtual int Length() { return filenames_.size(); }
+
+  virtual Image* GetImage(int i) {
+    Prefetch(i);
+    StoreDecodedFrames();
+    return CachedImageSequence::GetImage(i);
+  }
+
+  // Called when the frame is not in the cache. Frames which are being
+  // decoded are waited for.
+  virtual Image* LoadImage(int i) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (decoding_.count(i)) {
+        frame_decoded_.wait(lock);
+      }
+      std::map<int, Image*>::iterator it = decoded_.find(i);
+      if (it != decoded_.end()) {
+        Image* image = it->second;
+        decoded_.erase(it);
+        return image;
+      }
+    }
+    return LoadImageFromFile(filenames_[i], i);
+  }
+
+ private:
+  // Frames in the compressed tier are not decoded ahead either, restoring
+  // them is cheap.
+  bool IsCached(int i) {
+    TaggedImageKey cache_key(this, i);
+    CompressedImageCache* compressed = Cache()->CompressedTier();
+    return Cache()->ContainsKey(cache_key) ||
+           (compressed && compressed->ContainsKey(cache_key));
+  }
+
+  // Queue the frames following i in the direction of the access, replacing
+  // the frames queued for the previous access.
+  void Prefetch(int i) {
+    if (i == last_frame_ + 1) {
+      direction_ = 1;
+    } else if (i == last_frame_ - 1) {
+      direction_ = -1;
+    }
+    last_frame_ = i;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.clear();
+    window_begin_ = i;
+    window_end_ = i;
+    for (int k = 1; k <= num_prefetched_frames_ && !threads_.empty(); ++k) {
+      const int frame = i + direction_ * k;
+      if (frame < 0 || frame >= Length()) {
+        break;
+      }
+      window_begin_ = std::min(window_begin_, frame);
+      window_end_ = std::max(window_end_, frame);
+      if (!IsCached(frame) && !decoded_.count(frame) &&
+          !decoding_.count(frame)) {
+        queue_.push_back(frame);
+      }
+    }
+    queue_changed_.notify_all();
+  }
+
+  // Move the decoded frames to the cache. Frames which are not needed any
+  // more, because the access jumped elsewhere, are dropped.
+  void StoreDecodedFrames() {
+    std::map<int, Image*> decoded;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      decoded.swap(decoded_);
+    }
+    for (std::map<int, Image*>::iterator it = decoded.begin();
+         it != decoded.end();
+         ++it) {
+      const int frame = it->first;
+      Image* image = it->second;
+      if (!image || frame < window_begin_ || frame > window_end_ ||
+          IsCached(frame)) {
+        delete image;
+        continue;
+      }
+      TaggedImageKey cache_key(this, frame);
+      Cache()->StoreAndPinSized(cache_key, image, image->MemorySizeInBytes());
+      Cache()->Unpin(cache_key);
+    }
+  }
+
+  // Body of the decoding threads.
+  void DecodeFrames() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      while (!stop_ && queue_.empty()) {
+        queue_changed_.wait(lock);
+      }
+      if (stop_) {
+        return;
+      }
+      const int frame = queue_.front();
+      queue_.pop_front();
+      decoding_.insert(frame);
+
+      lock.unlock();
+      Image* image = LoadImageFromFile(filenames_[frame], frame);
+      lock.lock();
+
+      decoding_.erase(frame);
+      decoded_[frame] = image;
+      frame_decoded_.notify_all();
+    }
+  }
+
+  std::vector<std::string> filenames_;
+  int num_prefetched_frames_;
+
+  // Accessed only by the thread requesting the images.
+  int last_frame_;
+  int direction_;
+  int window_begin_;
+  int window_end_;
+
+  // Guarded by the mutex.
+  std::deque<int> queue_;
+  std::set<int> decoding_;
+  std::map<int, Image*> decoded_;
+  bool stop_;
+
+  std::mutex mutex_;
+  std::condition_variable queue_changed_;
+  std::condition_variable frame_decoded_;
+  std::vector<std::thread> threads_;
+};
+
+ImageSequence* PrefetchingImageSequenceFromFiles(
+    const std::vector<std::string>& filenames,
+    ImageCache* cache,
+    int num_prefetched_frames,
+    int num_threads) {
+  return new PrefetchingImageSequence(
+      filenames, cache, num_prefetched_frames, num_threads);
+}
+
+class MappedPnmSequence : public ImageSequence {
+ public:
+  explicit MappedPnmSequence(const std::vector<std::string>& filenames)
+      : filenames_(filenames), frames_(filenames.size()) {}
+
+  virtual ~MappedPnmSequence() {
+    for (size_t i = 0; i < frames_.size(); ++i) {
+      delete frames_[i].float_image;
+      delete frames_[i].image;
+      delete frames_[i].file;
+    }
+  }
+
+  virtual Image* GetImage(int i) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return PinFrame(i) ? frames_[i].image : NULL;
+  }
+
+  // The byte pixels are converted to floats scaled to [0, 1] like the ones
+  // of ImageSequenceFromFiles(). The converted image is kept until the frame
+  // is unpinned.
+  virtual FloatImage* GetFloatImage(int i) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!PinFrame(i)) {
+      return NULL;
+    }
+    Frame& frame = frames_[i];
+    if (!frame.float_image) {
+      frame.float_image = new FloatImage;
+      ByteArrayToScaledFloatArray(*frame.image->AsArray3Du(),
+                                  frame.float_image);
+    }
+    return frame.float_image;
+  }
+
+  virtual void Unpin(int i) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Frame& frame = frames_[i];
+    assert(frame.use_count > 0);
+    if (--frame.use_count == 0) {
+      delete frame.float_image;
+      delete frame.image;
+      delete frame.file;
+      frame.float_image = NULL;
+      frame.image = NULL;
+      frame.file = NULL;
+    }
+  }
+
+  virtual int Length() { return filenames_.size(); }
+
+ private:
+  struct Frame {
+    Frame() : file(NULL), image(NULL), float_image(NULL), use_count(0) {}
+    MappedPnmFile* file;
+    Image* image;
+    FloatImage* float_image;
+    int use_count;
+  };
+
+  // Map the file of the frame if it is not pinned yet, and pin it. Must be
+  // called with the mutex locked.
+  bool PinFrame(int i) {
+    Frame& frame = frames_[i];
+    if (frame.use_count == 0) {
+      frame.file = new MappedPnmFile;
+      if (!frame.file->Open(filenames_[i].c_str())) {
+        fprintf(stderr,
+                "Failed loading image %d: %s\n",
+                i,
+                filenames_[i].c_str());
+        delete frame.file;
+        frame.file = NULL;
+        return false;
+      }
+      // The mapping is private, so writes to the view only change the
+      // pages of this process.
+      const ByteImage& pixels = frame.file->Pixels();
+      frame.image = new Image(new Array3Du(
+          const_cast<unsigned char*>(pixels.Data()),
+          pixels.Height(),
+          pixels.Width(),
+          pixels.Depth()));
+    }
+    frame.use_count++;
+    return true;
+  }
+
+  std::vector<std::string> filenames_;
+  std::vector<Frame> frames_;
+  std::mutex mutex_;
+};
+
+ImageSequence* MappedPnmSequenceFromFiles(
+    const std::vector<std::string>& filenames) {
+  return new MappedPnmSequence(filenames);
 }
 
 }  // namespace libmv
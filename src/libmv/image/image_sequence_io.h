@@ -30,8 +30,37 @@ class ImageSequence;
 class ImageCache;
 
 // An image sequence loaded from disk. Images in the sequerce are float images.
+//
+// With scale_denom of 2, 4 or 8 the images are read at that fraction of their
+// size, see ReadImage(). JPEG files are decoded at the reduced size directly,
+// which makes such sequences a cheap source for coarse pyramid levels.
 ImageSequence *ImageSequenceFromFiles(const std::vector<std::string> &filenames,
-                                      ImageCache *cache);
+                                      ImageCache *cache,
+                                      int scale_denom = 1);
+
+// An image sequence loaded from disk, which decodes the frames following the
+// last requested one on background threads, so a sequential pass does not
+// wait for the decoder. Up to num_prefetched_frames frames are decoded ahead,
+// backwards when the frames are requested in decreasing order. Pending
+// decodes are cancelled when the requested frames jump elsewhere.
+//
+// Decoded frames are moved to the cache by the thread which requests images,
+// the cache is not accessed from the decoding threads.
+ImageSequence *PrefetchingImageSequenceFromFiles(
+    const std::vector<std::string> &filenames,
+    ImageCache *cache,
+    int num_prefetched_frames = 4,
+    int num_threads = 2);
+
+// An image sequence of binary 8-bit PGM or PPM files, which are mapped to
+// memory while their images are pinned. GetImage() returns byte images which
+// are views of the privately mapped pixels, modifying them does not change
+// the files. GetFloatImage() converts the pixels to floats scaled to [0, 1],
+// the converted copy is kept while the frame is pinned. Frames are not
+// cached otherwise, the system keeps the recently used files in its page
+// cache instead.
+ImageSequence *MappedPnmSequenceFromFiles(
+    const std::vector<std::string> &filenames);
 
 // TODO(keir): Add a from AVI or from MOV here.
 
@@ -31,6 +31,8 @@ using libmv::Image;
 using libmv::ImageCache;
 using libmv::ImageSequence;
 using libmv::ImageSequenceFromFiles;
+using libmv::MappedPnmSequenceFromFiles;
+using libmv::PrefetchingImageSequenceFromFiles;
 using std::string;
 
 namespace {
@@ -78,4 +80,113 @@ TEST(ImageSequenceIO, FromFiles) {
   unlink(image2_fn.c_str());
 }
 
+// Write frames with all pixels set to the index of the frame divided by 10.
+std::vector<string> WriteFrames(int num_frames) {
+  std::vector<string> files;
+  for (int i = 0; i < num_frames; ++i) {
+    Array3Df image(6, 5);
+    image.Fill(i / 10.f);
+    char filename[64];
+    snprintf(filename, sizeof(filename), "/prefetch_%d.pgm", i);
+    files.push_back(string(THIS_SOURCE_DIR) + filename);
+    WritePnm(image, files.back().c_str());
+  }
+  return files;
+}
+
+void ExpectFrame(ImageSequence* sequence, int i) {
+  Array3Df* image = sequence->GetFloatImage(i);
+  ASSERT_TRUE(image);
+  EXPECT_EQ(5, image->Width());
+  EXPECT_EQ(6, image->Height());
+  EXPECT_NEAR(i / 10.f, (*image)(3, 2), 1.f / 255);
+  sequence->Unpin(i);
+}
+
+TEST(ImageSequenceIO, PrefetchingFromFiles) {
+  const int kNumFrames = 10;
+  std::vector<string> files = WriteFrames(kNumFrames);
+
+  // Cache of a few frames, so frames are evicted and decoded again.
+  ImageCache cache(4 * 6 * 5 * sizeof(float));
+  ImageSequence* sequence = PrefetchingImageSequenceFromFiles(files, &cache, 3);
+  EXPECT_EQ(kNumFrames, sequence->Length());
+
+  // Forward, backward, and jumping around.
+  for (int i = 0; i < kNumFrames; ++i) {
+    ExpectFrame(sequence, i);
+  }
+  for (int i = kNumFrames - 1; i >= 0; --i) {
+    ExpectFrame(sequence, i);
+  }
+  const int jumps[] = {5, 1, 8, 2, 3, 9, 0};
+  for (int i = 0; i < 7; ++i) {
+    ExpectFrame(sequence, jumps[i]);
+  }
+
+  // Destroy the sequence while frames are being decoded.
+  ExpectFrame(sequence, 4);
+  delete sequence;
+
+  for (int i = 0; i < kNumFrames; ++i) {
+    unlink(files[i].c_str());
+  }
+}
+
+TEST(ImageSequenceIO, PrefetchingWithoutThreads) {
+  std::vector<string> files = WriteFrames(3);
+  ImageCache cache;
+  ImageSequence* sequence =
+      PrefetchingImageSequenceFromFiles(files, &cache, 2, 0);
+  for (int i = 0; i < 3; ++i) {
+    ExpectFrame(sequence, i);
+  }
+  delete sequence;
+  for (int i = 0; i < 3; ++i) {
+    unlink(files[i].c_str());
+  }
+}
+
+TEST(ImageSequenceIO, MappedPnmFromFiles) {
+  libmv::Array3Du image1(2, 3);
+  for (int i = 0; i < image1.Size(); ++i) {
+    image1.Data()[i] = 10 * i;
+  }
+  string image1_fn = string(THIS_SOURCE_DIR) + "/mapped_1.pgm";
+  WritePnm(image1, image1_fn.c_str());
+
+  std::vector<std::string> files;
+  files.push_back(image1_fn);
+  files.push_back(string(THIS_SOURCE_DIR) + "/hopefully_unexisting_file.pgm");
+  ImageSequence* sequence = MappedPnmSequenceFromFiles(files);
+  EXPECT_EQ(2, sequence->Length());
+
+  Image* image = sequence->GetImage(0);
+  ASSERT_TRUE(image);
+  ASSERT_TRUE(image->AsArray3Du());
+  EXPECT_FALSE(image->AsArray3Du()->OwnsData());
+  EXPECT_TRUE(image1 == *image->AsArray3Du());
+  // Pinned images are shared.
+  EXPECT_EQ(image, sequence->GetImage(0));
+  sequence->Unpin(0);
+  sequence->Unpin(0);
+
+  EXPECT_TRUE(sequence->GetImage(1) == NULL);
+
+  // Float consumers get the pixels scaled to [0, 1].
+  libmv::FloatImage* float_image = sequence->GetFloatImage(0);
+  ASSERT_TRUE(float_image);
+  EXPECT_EQ(image1.Shape(), float_image->Shape());
+  for (int i = 0; i < image1.Size(); ++i) {
+    EXPECT_FLOAT_EQ(image1.Data()[i] / 255.0f, float_image->Data()[i]);
+  }
+  EXPECT_EQ(float_image, sequence->GetFloatImage(0));
+  sequence->Unpin(0);
+  sequence->Unpin(0);
+  EXPECT_TRUE(sequence->GetFloatImage(1) == NULL);
+
+  delete sequence;
+  unlink(image1_fn.c_str());
+}
+
 }  // namespace
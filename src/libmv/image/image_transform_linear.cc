@@ -20,12 +20,114 @@
 
 #include "libmv/image/image_transform_linear.h"
 
+#include <algorithm>
+#include <vector>
+
 #include "libmv/image/image_drawing.h"
 #include "libmv/image/sample.h"
 #include "libmv/logging/logging.h"
+#include "libmv/threading/parallel_for.h"
 
 namespace libmv {
 
+namespace {
+
+// The output is warped in tiles, so the input pixels read for a rotation or
+// a perspective warp stay in the cache. Bands of tile rows are processed in
+// parallel.
+const int kTileWidth = 128;
+const int kTileHeight = 32;
+
+// Bilinear samples of the output pixels of a row segment which map inside
+// the input image.
+struct RowSamples {
+  void Resize(int size, int depth) {
+    columns.resize(size);
+    x.resize(size);
+    y.resize(size);
+    values.resize(size * depth);
+  }
+
+  // Output columns of the samples, their coordinates in the input image and
+  // the values of all channels of each.
+  int num_samples;
+  std::vector<int> columns;
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> values;
+};
+
+// Sample the input image at the output pixels [begin, end) of row y, mapped
+// by the inverse warp Hinv. The homography is stepped along the row: the
+// homogeneous coordinates of a pixel are the ones of the previous pixel plus
+// the first column of Hinv. Pixels are kept when the truncated coordinates
+// are inside the input image, as WarpImage() always did.
+void SampleRow(const FloatImage& image,
+               const Mat3& Hinv,
+               int y,
+               int begin,
+               int end,
+               RowSamples* samples) {
+  samples->Resize(end - begin, image.Depth());
+
+  int num_samples = 0;
+  const Vec3 step = Hinv.col(0);
+  Vec3 q = Hinv * Vec3(begin, y, 1.0);
+  // The homogeneous coordinate is the same along the rows of affine warps.
+  const bool affine = step(2) == 0.0;
+  const double affine_inverse_w = 1.0 / q(2);
+  for (int x = begin; x < end; ++x, q += step) {
+    const double inverse_w = affine ? affine_inverse_w : 1.0 / q(2);
+    const double xi = q(0) * inverse_w;
+    const double yi = q(1) * inverse_w;
+    if (image.Contains(static_cast<int>(yi), static_cast<int>(xi))) {
+      samples->columns[num_samples] = x;
+      samples->x[num_samples] = xi;
+      samples->y[num_samples] = yi;
+      num_samples++;
+    }
+  }
+  samples->num_samples = num_samples;
+  SampleLinear(image,
+               num_samples,
+               &samples->y[0],
+               &samples->x[0],
+               &samples->values[0]);
+}
+
+// Call store(y, x, sample) for the pixels of image_out inside the bounding
+// box of the warp which map inside image_in, with the values of all channels
+// of image_in sampled there.
+template <typename StorePixel>
+void WarpPixels(const FloatImage& image_in,
+                const Mat3& Hinv,
+                const Vec4i& bbox,
+                FloatImage* image_out,
+                const StorePixel& store) {
+  const int x_begin = std::max(0, bbox(0));
+  const int x_end = std::min(image_out->Width(), bbox(1) + 1);
+  const int y_begin = std::max(0, bbox(2));
+  const int y_end = std::min(image_out->Height(), bbox(3) + 1);
+  if (x_begin >= x_end || y_begin >= y_end) {
+    return;
+  }
+  const int depth = image_in.Depth();
+  ParallelForRanges(y_end - y_begin, kTileHeight, [&](int begin, int end) {
+    RowSamples samples;
+    for (int tile_x = x_begin; tile_x < x_end; tile_x += kTileWidth) {
+      const int tile_end = std::min(x_end, tile_x + kTileWidth);
+      for (int y = y_begin + begin; y < y_begin + end; ++y) {
+        SampleRow(image_in, Hinv, y, tile_x, tile_end, &samples);
+        for (int i = 0; i < samples.num_samples; ++i) {
+          store(y, samples.columns[i], &samples.values[i * depth]);
+        }
+      }
+    }
+  });
+}
+
+}  // namespace
+
 /**
  * Computes the bounding box of an image warp.
  */
@@ -163,20 +265,16 @@ void WarpImage(const FloatImage& image_in,
   const Mat3 Hinv = Hbis.inverse();
   // -- (Backward mapping. For the destination pixel search which pixel
   //     contribute ?).
-  Vec3 qi, qm;
-  for (int j = bbox(2); j <= bbox(3); ++j)
-    for (int i = bbox(0); i <= bbox(1); ++i)
-      if (image_out->Contains(j, i)) {
-        qm << i, j, 1.0;
-        qi = Hinv * qm;
-        qi /= qi(2);
-        const int xImage = static_cast<int>(qi(0));
-        const int yImage = static_cast<int>(qi(1));
-        if (image_in.Contains(yImage, xImage)) {
-          for (int d = 0; d < image_out->Depth(); ++d)
-            (*image_out)(j, i, d) = SampleLinear(image_in, qi(1), qi(0), d);
-        }
-      }
+  const int depth = image_out->Depth();
+  WarpPixels(image_in,
+             Hinv,
+             bbox,
+             image_out,
+             [&](int j, int i, const float* sample) {
+               for (int d = 0; d < depth; ++d) {
+                 (*image_out)(j, i, d) = sample[d];
+               }
+             });
 }
 
 /**
@@ -197,42 +295,36 @@ void WarpImageBlend(const FloatImage& image_in,
   // -- Fill destination image
   // -- (Backward mapping. For the destination pixel search which pixel
   //     contribute ?).
-  Vec3 qi, qm;
-  bool bOutContrib = false;
-  for (int j = bbox(2); j <= bbox(3); ++j)
-    for (int i = bbox(0); i <= bbox(1); ++i)
-      if (image_out->Contains(j, i)) {
-        // - Algo :
-        //  For the destination pixel (i,j) search which pixel from image_in
-        //   and image_out contribute.
-        //  Perform a mean blending in the overlap zone, transfert original
-        //   value in the other part.
-        qm << i, j, 1.0;
-        qi = Hinv * qm;
-        qi /= qi(2);
-        const int xImage = static_cast<int>(qi(0));
-        const int yImage = static_cast<int>(qi(1));
-        if (image_in.Contains(yImage, xImage)) {
-          bOutContrib = false;
-          for (int d = 0; d < image_out->Depth(); ++d)
-            if ((*image_out)(j, i, d) > 0) {
-              bOutContrib = true;
-              break;
-            }
-          if (bOutContrib) {  // mean blending between image_out and image_in
-            for (int d = 0; d < image_out->Depth(); ++d) {
-              // Let's fade the previous frames
-              (*image_out)(j, i, d) =
-                  (1 - blending_ratio) * (*image_out)(j, i, d) +
-                  blending_ratio * SampleLinear(image_in, qi(1), qi(0), d);
-            }
-            continue;
-          } else {  // only image_in contrib
-            for (int d = 0; d < image_out->Depth(); ++d)
-              (*image_out)(j, i, d) = SampleLinear(image_in, qi(1), qi(0), d);
-            continue;
-          }
-        }
-      }
+  const int depth = image_out->Depth();
+  WarpPixels(image_in,
+             Hinv,
+             bbox,
+             image_out,
+             [&](int j, int i, const float* sample) {
+               // - Algo :
+               //  For the destination pixel (i,j) search which pixel from
+               //   image_in and image_out contribute.
+               //  Perform a mean blending in the overlap zone, transfert
+               //   original value in the other part.
+               bool bOutContrib = false;
+               for (int d = 0; d < depth; ++d) {
+                 if ((*image_out)(j, i, d) > 0) {
+                   bOutContrib = true;
+                   break;
+                 }
+               }
+               if (bOutContrib) {  // mean blending of image_out and image_in
+                 for (int d = 0; d < depth; ++d) {
+                   // Let's fade the previous frames
+                   (*image_out)(j, i, d) =
+                       (1 - blending_ratio) * (*image_out)(j, i, d) +
+                       blending_ratio * sample[d];
+                 }
+               } else {  // only image_in contrib
+                 for (int d = 0; d < depth; ++d) {
+                   (*image_out)(j, i, d) = sample[d];
+                 }
+               }
+             });
 }
 }  // namespace libmv
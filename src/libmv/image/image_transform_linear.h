@@ -108,6 +108,10 @@ void RotateImage(const FloatImage &image_in,
  * \param adapt_img_size The output image will be resized to contain all 
  *                       the rotated input image
  *
+ * The output is warped in tiles, and bands of tiles are processed in
+ * parallel. The pixels of a row of a tile are interpolated in one batch by
+ * the SIMD SampleLinear().
+ *
  * \note image_out SHOULD NOT be the image_in! (no local copy)
  *                 use XXX instead (TODO(julien) make a WarpImageMe function
  */
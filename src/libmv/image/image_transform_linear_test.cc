@@ -24,6 +24,7 @@
 #include "libmv/image/image_drawing.h"
 #include "libmv/image/image_io.h"
 #include "libmv/image/image_transform_linear.h"
+#include "libmv/image/sample.h"
 #include "libmv/logging/logging.h"
 #include "testing/testing.h"
 
@@ -33,8 +34,6 @@ using namespace libmv;
  *
  * - ComputeBoundingBox TODO(julien) Add a unit test
  * - RotateImage        TODO(julien) Correct bug that fails the unit test
- * - WarpImage          TODO(julien) Add a unit test
- * - WarpImageBlend     TODO(julien) Add a unit test
  */
 
 // Assert that pixels was drawn at the good place
@@ -198,3 +197,78 @@ TEST(ImageTransform, RescaleImageTranslation) {
   // TODO(sergey): Doublecheck registration is indeed identity here.
   EXPECT_MATRIX_EQ(Mat3::Identity(), Hreg);
 }
+
+// Warp of every output pixel by the full homography, as WarpImage() did
+// before it was tiled.
+void ReferenceWarp(const FloatImage& image_in,
+                   const Mat3& H,
+                   FloatImage* image_out) {
+  const Mat3 Hinv = H.inverse();
+  for (int j = 0; j < image_out->Height(); ++j) {
+    for (int i = 0; i < image_out->Width(); ++i) {
+      Vec3 qi = Hinv * Vec3(i, j, 1.0);
+      qi /= qi(2);
+      if (image_in.Contains(static_cast<int>(qi(1)),
+                            static_cast<int>(qi(0)))) {
+        for (int d = 0; d < image_out->Depth(); ++d) {
+          (*image_out)(j, i, d) = SampleLinear(image_in, qi(1), qi(0), d);
+        }
+      }
+    }
+  }
+}
+
+TEST(ImageTransform, WarpImageMatchesReference) {
+  // Larger than a tile, with a perspective part and borders which are
+  // partially covered.
+  const int w = 300, h = 90;
+  Mat3 H;
+  // clang-format off
+  H << 0.9,  0.2,  -7.5,
+      -0.1,  1.1,   4.25,
+       1e-4, 2e-4,  1;
+  // clang-format on
+  for (int depth = 1; depth <= 3; depth += 2) {
+    FloatImage image(h, w, depth);
+    for (int i = 0; i < image.Size(); ++i) {
+      image.Data()[i] = (i * 7919 % 1000) / 1000.0f;
+    }
+    // Pixels which are not covered by the warp stay -1.
+    FloatImage expected(h, w, depth), warped(h, w, depth);
+    expected.Fill(-1);
+    warped.Fill(-1);
+    ReferenceWarp(image, H, &expected);
+    WarpImage(image, H, &warped);
+    for (int i = 0; i < expected.Size(); ++i) {
+      EXPECT_NEAR(expected.Data()[i], warped.Data()[i], 1e-6);
+    }
+
+    // Pixels which are black in the output take the warped image, the other
+    // ones are blended.
+    FloatImage blended(h, w, depth);
+    blended.Fill(0);
+    for (int i = 0; i < w; ++i) {
+      for (int d = 0; d < depth; ++d) {
+        blended(h / 2, i, d) = 1.0;
+      }
+    }
+    WarpImageBlend(image, H, &blended, 0.25);
+    int num_covered = 0;
+    for (int i = 0; i < w; ++i) {
+      if (expected(h / 2, i, 0) == -1) {
+        EXPECT_EQ(1.0, blended(h / 2, i, 0));
+      } else {
+        num_covered++;
+        EXPECT_NEAR(0.75 + 0.25 * expected(h / 2, i, 0),
+                    blended(h / 2, i, 0),
+                    1e-6);
+      }
+      if (expected(h / 3, i, 0) == -1) {
+        EXPECT_EQ(0.0, blended(h / 3, i, 0));
+      } else {
+        EXPECT_NEAR(expected(h / 3, i, 0), blended(h / 3, i, 0), 1e-6);
+      }
+    }
+    EXPECT_GT(num_covered, w / 2);
+  }
+}
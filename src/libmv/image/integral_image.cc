@@ -0,0 +1,262 @@
+// Copyright (c) 2020 libmv authors.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#include "libmv/image/integral_image.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+#include "libmv/threading/parallel_for.h"
+
+namespace libmv {
+
+namespace {
+
+// Images with fewer pixels are integrated on the calling thread.
+const int kMinParallelPixels = 512 * 1024;
+
+// Columns of the strips which are summed down in parallel.
+const int kStripWidth = 256;
+
+template <bool squared>
+inline int64_t Value(unsigned char pixel) {
+  return squared ? int64_t(pixel) * pixel : pixel;
+}
+
+template <bool squared>
+inline double Value(float pixel) {
+  return squared ? double(pixel) * pixel : pixel;
+}
+
+// Set row to the prefix sums of the pixels, or of their squares, plus the
+// row above when it is not NULL. The sums are accumulated from left to
+// right, the SSE2 code only sums the pixels of a group before adding them to
+// the running sum.
+template <bool squared>
+void IntegrateRowScalar(const unsigned char* pixels,
+                        int pixel_stride,
+                        int begin,
+                        int width,
+                        int64_t row_sum,
+                        const int64_t* above,
+                        int64_t* row) {
+  for (int c = begin; c < width; ++c) {
+    row_sum += Value<squared>(pixels[c * pixel_stride]);
+    row[c] = above ? row_sum + above[c] : row_sum;
+  }
+}
+
+template <bool squared>
+void IntegrateRowScalar(const float* pixels,
+                        int pixel_stride,
+                        int begin,
+                        int width,
+                        double row_sum,
+                        const double* above,
+                        double* row) {
+  for (int c = begin; c < width; ++c) {
+    row_sum += Value<squared>(pixels[c * pixel_stride]);
+    row[c] = above ? row_sum + above[c] : row_sum;
+  }
+}
+
+template <bool squared>
+void IntegrateRow(const unsigned char* pixels,
+                  int pixel_stride,
+                  int width,
+                  const int64_t* above,
+                  int64_t* row) {
+  int c = 0;
+  int64_t row_sum = 0;
+#ifdef __SSE2__
+  if (pixel_stride == 1) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i carry = zero;
+    for (; c + 4 <= width; c += 4) {
+      int32_t four_pixels;
+      std::memcpy(&four_pixels, pixels + c, sizeof(four_pixels));
+      __m128i values = _mm_unpacklo_epi8(_mm_cvtsi32_si128(four_pixels), zero);
+      if (squared) {
+        // The squares fit in unsigned 16-bit values.
+        values = _mm_mullo_epi16(values, values);
+      }
+      values = _mm_unpacklo_epi16(values, zero);
+      // Prefix sums of the four values in 32 bits.
+      values = _mm_add_epi32(values, _mm_slli_si128(values, 4));
+      values = _mm_add_epi32(values, _mm_slli_si128(values, 8));
+      __m128i low = _mm_add_epi64(_mm_unpacklo_epi32(values, zero), carry);
+      __m128i high = _mm_add_epi64(_mm_unpackhi_epi32(values, zero), carry);
+      carry = _mm_unpackhi_epi64(high, high);
+      if (above) {
+        low = _mm_add_epi64(
+            low, _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + c)));
+        high = _mm_add_epi64(
+            high,
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + c + 2)));
+      }
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(row + c), low);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(row + c + 2), high);
+    }
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(&row_sum), carry);
+  }
+#endif  // __SSE2__
+  IntegrateRowScalar<squared>(
+      pixels, pixel_stride, c, width, row_sum, above, row);
+}
+
+template <bool squared>
+void IntegrateRow(const float* pixels,
+                  int pixel_stride,
+                  int width,
+                  const double* above,
+                  double* row) {
+  int c = 0;
+  double row_sum = 0;
+#ifdef __SSE2__
+  if (pixel_stride == 1) {
+    const __m128d zero = _mm_setzero_pd();
+    __m128d carry = zero;
+    for (; c + 4 <= width; c += 4) {
+      const __m128 values = _mm_loadu_ps(pixels + c);
+      __m128d low = _mm_cvtps_pd(values);
+      __m128d high = _mm_cvtps_pd(_mm_movehl_ps(values, values));
+      if (squared) {
+        low = _mm_mul_pd(low, low);
+        high = _mm_mul_pd(high, high);
+      }
+      // Prefix sums of the pairs, then of the four values.
+      low = _mm_add_pd(low, _mm_unpacklo_pd(zero, low));
+      high = _mm_add_pd(high, _mm_unpacklo_pd(zero, high));
+      high = _mm_add_pd(high, _mm_unpackhi_pd(low, low));
+      low = _mm_add_pd(low, carry);
+      high = _mm_add_pd(high, carry);
+      carry = _mm_unpackhi_pd(high, high);
+      if (above) {
+        low = _mm_add_pd(low, _mm_loadu_pd(above + c));
+        high = _mm_add_pd(high, _mm_loadu_pd(above + c + 2));
+      }
+      _mm_storeu_pd(row + c, low);
+      _mm_storeu_pd(row + c + 2, high);
+    }
+    _mm_store_sd(&row_sum, carry);
+  }
+#endif  // __SSE2__
+  IntegrateRowScalar<squared>(
+      pixels, pixel_stride, c, width, row_sum, above, row);
+}
+
+// Add the row above to columns [begin, end) of the row.
+void AddRow(const int64_t* above, int begin, int end, int64_t* row) {
+  int c = begin;
+#ifdef __SSE2__
+  for (; c + 2 <= end; c += 2) {
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(row + c),
+        _mm_add_epi64(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + c)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + c))));
+  }
+#endif  // __SSE2__
+  for (; c < end; ++c) {
+    row[c] += above[c];
+  }
+}
+
+void AddRow(const double* above, int begin, int end, double* row) {
+  int c = begin;
+#ifdef __SSE2__
+  for (; c + 2 <= end; c += 2) {
+    _mm_storeu_pd(row + c,
+                  _mm_add_pd(_mm_loadu_pd(above + c), _mm_loadu_pd(row + c)));
+  }
+#endif  // __SSE2__
+  for (; c < end; ++c) {
+    row[c] += above[c];
+  }
+}
+
+template <bool squared, typename Pixel, typename Sum>
+void ComputeIntegralImage(const Array3D<Pixel>& image,
+                          Array3D<Sum>* integral_image) {
+  const int height = image.Height();
+  const int width = image.Width();
+  integral_image->Resize(height, width);
+  if (height == 0 || width == 0) {
+    return;
+  }
+  const int pixel_stride = image.Stride(1);
+
+  if (NumParallelThreads() == 1 || height * width < kMinParallelPixels) {
+    const Sum* above = NULL;
+    for (int r = 0; r < height; ++r) {
+      Sum* row = &(*integral_image)(r, 0);
+      IntegrateRow<squared>(&image(r, 0, 0), pixel_stride, width, above, row);
+      above = row;
+    }
+    return;
+  }
+
+  // The prefix sums of the rows are independent, then every row gets the
+  // sums of the rows above it added in the same order as above.
+  const int band_height = std::max(1, kMinParallelPixels / 8 / width);
+  ParallelForRanges(height, band_height, [&](int begin, int end) {
+    for (int r = begin; r < end; ++r) {
+      IntegrateRow<squared>(&image(r, 0, 0),
+                            pixel_stride,
+                            width,
+                            static_cast<const Sum*>(NULL),
+                            &(*integral_image)(r, 0));
+    }
+  });
+  ParallelForRanges(width, kStripWidth, [&](int begin, int end) {
+    for (int r = 1; r < height; ++r) {
+      AddRow(&(*integral_image)(r - 1, 0),
+             begin,
+             end,
+             &(*integral_image)(r, 0));
+    }
+  });
+}
+
+}  // namespace
+
+void IntegralImage(const ByteImage& image, Array3D<int64_t>* integral_image) {
+  ComputeIntegralImage<false>(image, integral_image);
+}
+
+void IntegralImage(const FloatImage& image, Array3D<double>* integral_image) {
+  ComputeIntegralImage<false>(image, integral_image);
+}
+
+void SquaredIntegralImage(const ByteImage& image,
+                          Array3D<int64_t>* squared_integral_image) {
+  ComputeIntegralImage<true>(image, squared_integral_image);
+}
+
+void SquaredIntegralImage(const FloatImage& image,
+                          Array3D<double>* squared_integral_image) {
+  ComputeIntegralImage<true>(image, squared_integral_image);
+}
+
+}  // namespace libmv
@@ -21,7 +21,10 @@
 #ifndef LIBMV_IMAGE_INTEGRAL_IMAGE_H
 #define LIBMV_IMAGE_INTEGRAL_IMAGE_H
 
+#include <cstdint>
+
 #include "libmv/image/array_nd.h"
+#include "libmv/image/image.h"
 #include "libmv/logging/logging.h"
 
 namespace libmv {
@@ -49,6 +52,24 @@ inline void IntegralImage(const TImage &image, TIntegralImage *integral_image) {
   }
 }
 
+// Summed area tables of the first channel of byte and float images, with the
+// sums accumulated in 64-bit integers, which are exact, or in doubles. They do
+// not overflow or drift on large images as 32-bit and float sums do. The
+// prefix sums of the rows are computed with SSE2, and then added down the
+// columns. For large images both passes run in parallel, over bands of rows
+// and then over strips of columns, which does the same additions as a single
+// thread, so the results do not depend on the number of threads.
+void IntegralImage(const ByteImage &image, Array3D<int64_t> *integral_image);
+void IntegralImage(const FloatImage &image, Array3D<double> *integral_image);
+
+// Summed area tables of the squares of the pixels. Together with the table
+// of the pixels they give the variance of any window in constant time, as
+// needed by normalized cross correlation.
+void SquaredIntegralImage(const ByteImage &image,
+                          Array3D<int64_t> *squared_integral_image);
+void SquaredIntegralImage(const FloatImage &image,
+                          Array3D<double> *squared_integral_image);
+
 // The sum of the pixels in an area bounded by row, column, width, and height.
 // If the bounding box exceeds the image, then the partial sum is returned (or
 // zero if the box completely misses the image).
@@ -63,4 +63,89 @@ TEST(BoxIntegral, ThreeByThree) {
   EXPECT_EQ(0, BoxIntegral(integral_image, 7, 0, 2, 9));
 }
 
+// Fill the image with a pattern which does not repeat along the rows.
+template <typename TImage>
+void FillImage(int height, int width, TImage* image) {
+  image->Resize(height, width, 1);
+  for (int r = 0; r < height; ++r) {
+    for (int c = 0; c < width; ++c) {
+      (*image)(r, c, 0) = (r * 31 + c * c * 7 + 13) % 256;
+    }
+  }
+}
+
+TEST(IntegralImage, ByteImageMatchesGenericVersion) {
+  // Odd widths leave columns for the scalar code after the SSE2 groups, the
+  // large image is integrated in parallel bands and strips.
+  const int sizes[][2] = {{1, 1}, {7, 13}, {64, 65}, {1031, 1027}};
+  for (int i = 0; i < 4; ++i) {
+    ByteImage image;
+    FillImage(sizes[i][0], sizes[i][1], &image);
+
+    Array3D<int64_t> integral_image, squared_integral_image;
+    IntegralImage(image, &integral_image);
+    SquaredIntegralImage(image, &squared_integral_image);
+
+    Array3D<int64_t> squares(image.Height(), image.Width());
+    for (int r = 0; r < image.Height(); ++r) {
+      for (int c = 0; c < image.Width(); ++c) {
+        squares(r, c) = int64_t(image(r, c)) * image(r, c);
+      }
+    }
+    Array3D<int64_t> expected, expected_squared;
+    IntegralImage<ByteImage, Array3D<int64_t> >(image, &expected);
+    IntegralImage<Array3D<int64_t>, Array3D<int64_t> >(squares,
+                                                       &expected_squared);
+
+    ASSERT_EQ(image.Height(), integral_image.Height());
+    ASSERT_EQ(image.Width(), integral_image.Width());
+    for (int r = 0; r < image.Height(); ++r) {
+      for (int c = 0; c < image.Width(); ++c) {
+        ASSERT_EQ(expected(r, c), integral_image(r, c));
+        ASSERT_EQ(expected_squared(r, c), squared_integral_image(r, c));
+      }
+    }
+  }
+}
+
+TEST(IntegralImage, FloatImageMatchesGenericVersion) {
+  const int sizes[][2] = {{1, 1}, {7, 13}, {64, 65}, {1031, 1027}};
+  for (int i = 0; i < 4; ++i) {
+    FloatImage image;
+    FillImage(sizes[i][0], sizes[i][1], &image);
+    for (int r = 0; r < image.Height(); ++r) {
+      for (int c = 0; c < image.Width(); ++c) {
+        image(r, c, 0) /= 255.0f;
+      }
+    }
+
+    Array3D<double> integral_image, squared_integral_image;
+    IntegralImage(image, &integral_image);
+    SquaredIntegralImage(image, &squared_integral_image);
+
+    Array3D<double> squares(image.Height(), image.Width());
+    for (int r = 0; r < image.Height(); ++r) {
+      for (int c = 0; c < image.Width(); ++c) {
+        squares(r, c) = double(image(r, c)) * image(r, c);
+      }
+    }
+    Array3D<double> expected, expected_squared;
+    IntegralImage<FloatImage, Array3D<double> >(image, &expected);
+    IntegralImage<Array3D<double>, Array3D<double> >(squares,
+                                                     &expected_squared);
+
+    ASSERT_EQ(image.Height(), integral_image.Height());
+    ASSERT_EQ(image.Width(), integral_image.Width());
+    for (int r = 0; r < image.Height(); ++r) {
+      for (int c = 0; c < image.Width(); ++c) {
+        const double tolerance = 1e-12 * (1 + expected_squared(r, c));
+        ASSERT_NEAR(expected(r, c), integral_image(r, c), tolerance);
+        ASSERT_NEAR(expected_squared(r, c),
+                    squared_integral_image(r, c),
+                    tolerance);
+      }
+    }
+  }
+}
+
 }  // namespace
@@ -96,7 +96,7 @@ template<typename K, typename V>
 class LRUCache : public Cache<K, V> {
  public:
   // O(1)
-  LRUCache(int max_size)
+  LRUCache(size_t max_size)
     : max_size_(max_size),
       size_(0) {}
   // O(n log n)
@@ -133,7 +133,7 @@ class LRUCache : public Cache<K, V> {
     return true;
   }
   // O(n log n)
-  virtual void StoreAndPinSized(const K &key, V *value, const int size) {
+  virtual void StoreAndPinSized(const K &key, V *value, const size_t size) {
     size_ += size;
     CachedItem new_item;
     new_item.ptr = value;
@@ -147,15 +147,15 @@ class LRUCache : public Cache<K, V> {
     return items_.find(key) != items_.end();
   }
   // O(1)
-  virtual int MaxSize() const {
+  virtual size_t MaxSize() const {
     return max_size_;
   }
   // O(1)
-  virtual int Size() const {
+  virtual size_t Size() const {
     return size_;
   }
   // O(n log n)
-  virtual void SetMaxSize(const int max_size) {
+  virtual void SetMaxSize(const size_t max_size) {
     max_size_ = max_size;
     DeleteUnpinnedItemsIfNecessary();
   }
@@ -185,7 +185,7 @@ class LRUCache : public Cache<K, V> {
   struct CachedItem {
     V *ptr;
     int use_count;
-    int size;
+    size_t size;
     CachedItem() : ptr(NULL) {}
   };
   // O(log n)
@@ -220,8 +220,8 @@ class LRUCache : public Cache<K, V> {
   typedef map<const K, CachedItem> CacheMap;
   CacheMap items_;
 
-  int max_size_;
-  int size_;
+  size_t max_size_;
+  size_t size_;
 };
 
 }  // namespace libmv
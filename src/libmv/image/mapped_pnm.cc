@@ -0,0 +1,178 @@
+// Copyright (c) 2020 libmv authors.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#include "libmv/image/mapped_pnm.h"
+
+#include <cctype>
+#include <cstdio>
+
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+#include "libmv/logging/logging.h"
+
+namespace libmv {
+
+size_t ParsePnmHeader(const unsigned char* data,
+                      size_t size,
+                      int* height,
+                      int* width,
+                      int* depth) {
+  if (size < 2 || data[0] != 'P') {
+    return 0;
+  }
+  if (data[1] == '5') {
+    *depth = 1;
+  } else if (data[1] == '6') {
+    *depth = 3;
+  } else {
+    return 0;
+  }
+
+  // Width, height and the maximum value, separated by whitespace, with
+  // comments from '#' to the end of the line anywhere. A single whitespace
+  // character follows the maximum value.
+  int values[3] = {0, 0, 0};
+  int num_values = 0;
+  bool in_token = false;
+  size_t i = 2;
+  while (num_values < 3) {
+    if (i == size) {
+      return 0;
+    }
+    const unsigned char c = data[i++];
+    if (isspace(c)) {
+      if (in_token) {
+        in_token = false;
+        num_values++;
+      }
+    } else if (isdigit(c)) {
+      in_token = true;
+      values[num_values] = 10 * values[num_values] + (c - '0');
+      if (values[num_values] > (1 << 24)) {
+        return 0;
+      }
+    } else if (c == '#') {
+      while (i < size && data[i] != '\n') {
+        ++i;
+      }
+    } else {
+      return 0;
+    }
+  }
+  if (values[0] <= 0 || values[1] <= 0 || values[2] <= 0 ||
+      values[2] > 255) {
+    return 0;
+  }
+  *width = values[0];
+  *height = values[1];
+  return i;
+}
+
+MappedPnmFile::MappedPnmFile() : data_(NULL), size_(0) {}
+
+MappedPnmFile::~MappedPnmFile() { Close(); }
+
+bool MappedPnmFile::Open(const char* filename) {
+  Close();
+
+#ifdef _WIN32
+  // There is no mmap(), the file is read to a buffer instead.
+  FILE* file = fopen(filename, "rb");
+  if (!file) {
+    LOG(ERROR) << "Error: Couldn't open " << filename;
+    return false;
+  }
+  fseek(file, 0, SEEK_END);
+  const long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  if (size <= 0) {
+    fclose(file);
+    return false;
+  }
+  size_ = size;
+  data_ = new unsigned char[size_];
+  const size_t read = fread(data_, 1, size_, file);
+  fclose(file);
+  if (read != size_) {
+    Close();
+    return false;
+  }
+#else
+  const int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "Error: Couldn't open " << filename;
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+  size_ = st.st_size;
+  // The private mapping is writable, writes copy the touched pages and never
+  // reach the file.
+  void* data =
+      mmap(NULL, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  // The mapping keeps the file open.
+  close(fd);
+  if (data == MAP_FAILED) {
+    LOG(ERROR) << "Error: Couldn't map " << filename;
+    size_ = 0;
+    return false;
+  }
+  data_ = data;
+#endif
+
+  const unsigned char* bytes = static_cast<const unsigned char*>(data_);
+  int height, width, depth;
+  const size_t offset = ParsePnmHeader(bytes, size_, &height, &width, &depth);
+  if (offset == 0 || (size_ - offset) / depth / width < height) {
+    LOG(ERROR) << "Error: " << filename << " is not a binary 8-bit PNM file.";
+    Close();
+    return false;
+  }
+  // The view does not own the pixels.
+  pixels_ = ByteImage(const_cast<unsigned char*>(bytes + offset),
+                      height,
+                      width,
+                      depth);
+  return true;
+}
+
+void MappedPnmFile::Close() {
+  pixels_ = ByteImage();
+  if (data_ == NULL) {
+    return;
+  }
+#ifdef _WIN32
+  delete[] static_cast<unsigned char*>(data_);
+#else
+  munmap(data_, size_);
+#endif
+  data_ = NULL;
+  size_ = 0;
+}
+
+}  // namespace libmv
@@ -0,0 +1,75 @@
+// Copyright (c) 2020 libmv authors.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#ifndef LIBMV_IMAGE_MAPPED_PNM_H_
+#define LIBMV_IMAGE_MAPPED_PNM_H_
+
+#include <cstddef>
+
+#include "libmv/image/image.h"
+
+namespace libmv {
+
+// A binary 8-bit PGM (P5) or PPM (P6) file mapped to memory, whose pixels are
+// used where they are instead of being copied to an image.
+//
+// This is meant for the uncompressed intermediate frames passed between the
+// stages of a pipeline. The pages are read by the system when they are first
+// touched, and frames which were read recently are served from the page
+// cache without any copy.
+class MappedPnmFile {
+ public:
+  MappedPnmFile();
+  ~MappedPnmFile();
+
+  // Map the file, closing the file mapped before. Returns false for files
+  // which are not binary 8-bit PGM or PPM files, or which are truncated.
+  bool Open(const char* filename);
+  void Close();
+  bool IsOpen() const { return data_ != NULL; }
+
+  // View of the pixels in the mapped file, which is empty when no file is
+  // open. It is valid until the file is closed. The mapping is private, so
+  // views of the pixels made from Pixels().Data() can be written to without
+  // changing the file.
+  const ByteImage& Pixels() const { return pixels_; }
+
+ private:
+  // Not copyable.
+  MappedPnmFile(const MappedPnmFile&);
+  MappedPnmFile& operator=(const MappedPnmFile&);
+
+  void* data_;
+  size_t size_;
+  ByteImage pixels_;
+};
+
+// Parse the header of a binary 8-bit PGM or PPM file in memory, the same way
+// ReadPnmStream() does. Returns the offset of the pixels, or 0 if the header
+// is not valid, including zero width, height or maximum value.
+size_t ParsePnmHeader(const unsigned char* data,
+                      size_t size,
+                      int* height,
+                      int* width,
+                      int* depth);
+
+}  // namespace libmv
+
+#endif  // LIBMV_IMAGE_MAPPED_PNM_H_
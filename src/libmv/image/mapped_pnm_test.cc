@@ -0,0 +1,137 @@
+// Copyright (c) 2020 libmv authors.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#include "libmv/image/mapped_pnm.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "libmv/image/image_io.h"
+#include "testing/testing.h"
+
+using libmv::ByteImage;
+using libmv::MappedPnmFile;
+using libmv::ParsePnmHeader;
+using std::string;
+
+namespace {
+
+string TestFile(const char* name) {
+  return string(THIS_SOURCE_DIR) + "/image_test/" + name;
+}
+
+void WriteFile(const string& filename, const string& contents) {
+  FILE* file = fopen(filename.c_str(), "wb");
+  fwrite(contents.data(), 1, contents.size(), file);
+  fclose(file);
+}
+
+size_t Parse(const string& header, int* height, int* width, int* depth) {
+  return ParsePnmHeader(reinterpret_cast<const unsigned char*>(header.data()),
+                        header.size(),
+                        height,
+                        width,
+                        depth);
+}
+
+TEST(ParsePnmHeader, ValidHeaders) {
+  int height, width, depth;
+  EXPECT_EQ(11, Parse("P5 3 2 255\nxxxxxx", &height, &width, &depth));
+  EXPECT_EQ(2, height);
+  EXPECT_EQ(3, width);
+  EXPECT_EQ(1, depth);
+
+  string commented = "P6\n# comment\n4 #inside\n5\n255 ";
+  EXPECT_EQ(commented.size(), Parse(commented, &height, &width, &depth));
+  EXPECT_EQ(5, height);
+  EXPECT_EQ(4, width);
+  EXPECT_EQ(3, depth);
+}
+
+TEST(ParsePnmHeader, InvalidHeaders) {
+  int height, width, depth;
+  EXPECT_EQ(0, Parse("P2 3 2 255\n", &height, &width, &depth));
+  EXPECT_EQ(0, Parse("P5 3 2 65535\n", &height, &width, &depth));
+  EXPECT_EQ(0, Parse("P5 3 2", &height, &width, &depth));
+  EXPECT_EQ(0, Parse("P5 3 x 255\n", &height, &width, &depth));
+  EXPECT_EQ(0, Parse("P5 0 0 255\n", &height, &width, &depth));
+  EXPECT_EQ(0, Parse("P5 3 0 255\n", &height, &width, &depth));
+  EXPECT_EQ(0, Parse("P5 0 2 255\n", &height, &width, &depth));
+  EXPECT_EQ(0, Parse("P5 3 2 0\n", &height, &width, &depth));
+}
+
+TEST(MappedPnmFile, PixelsAreMapped) {
+  ByteImage image(3, 4, 3);
+  for (int i = 0; i < image.Size(); ++i) {
+    image.Data()[i] = i * 7;
+  }
+  string filename = TestFile("test_mapped.ppm");
+  EXPECT_TRUE(WritePnm(image, filename.c_str()));
+
+  MappedPnmFile file;
+  EXPECT_FALSE(file.IsOpen());
+  ASSERT_TRUE(file.Open(filename.c_str()));
+  EXPECT_TRUE(file.IsOpen());
+  EXPECT_FALSE(file.Pixels().OwnsData());
+  EXPECT_TRUE(image == file.Pixels());
+
+  file.Close();
+  EXPECT_FALSE(file.IsOpen());
+  EXPECT_EQ(0, file.Pixels().Size());
+  unlink(filename.c_str());
+}
+
+TEST(MappedPnmFile, InvalidFiles) {
+  MappedPnmFile file;
+  EXPECT_FALSE(file.Open("hopefully_unexisting_file"));
+
+  string filename = TestFile("test_mapped_truncated.pgm");
+  WriteFile(filename, "P5 4 4 255\n0123456789");
+  EXPECT_FALSE(file.Open(filename.c_str()));
+  EXPECT_FALSE(file.IsOpen());
+
+  WriteFile(filename, "P5 0 0 255\n");
+  EXPECT_FALSE(file.Open(filename.c_str()));
+
+  WriteFile(filename, "P5 4 4 255\n0123456789abcdef");
+  EXPECT_TRUE(file.Open(filename.c_str()));
+  EXPECT_EQ('f', file.Pixels()(3, 3));
+  unlink(filename.c_str());
+}
+
+TEST(MappedPnmFile, WritesDoNotReachTheFile) {
+  string filename = TestFile("test_mapped_written.pgm");
+  WriteFile(filename, "P5 2 2 255\nabcd");
+
+  MappedPnmFile file;
+  ASSERT_TRUE(file.Open(filename.c_str()));
+  // Non-owning view of the mapped pixels, like the ones of the sequence.
+  ByteImage view(const_cast<unsigned char*>(file.Pixels().Data()), 2, 2);
+  view(1, 1) = 'x';
+  EXPECT_EQ('x', file.Pixels()(1, 1));
+  file.Close();
+
+  ASSERT_TRUE(file.Open(filename.c_str()));
+  EXPECT_EQ('d', file.Pixels()(1, 1));
+  unlink(filename.c_str());
+}
+
+}  // namespace
@@ -20,11 +20,14 @@
 
 #include "libmv/image/pyramid_sequence.h"
 
+#include <mutex>
+#include <string>
 #include <vector>
 
 #include "libmv/image/image_pyramid.h"
 #include "libmv/image/image_sequence.h"
 #include "libmv/image/image_sequence_filters.h"
+#include "libmv/image/image_sequence_io.h"
 #include "libmv/image/lru_cache.h"
 
 namespace libmv {
@@ -35,24 +38,41 @@ PyramidSequence::~PyramidSequence() {
 class ImageSequenceBackedImagePyramid : public ImagePyramid {
  public:
   virtual ~ImageSequenceBackedImagePyramid() {
-    for (size_t i = 0; i < pinned_levels_.size(); ++i) {
-      if (pinned_levels_[i]) {
+    for (size_t i = 0; i < levels_.size(); ++i) {
+      if (level_images_[i]) {
         levels_[i]->Unpin(frame_);
       }
+      if (downsampled_images_[i]) {
+        downsamples_[i]->Unpin(frame_);
+      }
     }
   }
 
   ImageSequenceBackedImagePyramid(const std::vector<ImageSequence*> levels,
+                                  const std::vector<ImageSequence*> downsamples,
                                   int frame)
-      : levels_(levels), pinned_levels_(levels.size()), frame_(frame) {
-    for (size_t i = 0; i < pinned_levels_.size(); ++i) {
-      pinned_levels_[i] = 0;
+      : levels_(levels),
+        downsamples_(downsamples),
+        level_images_(levels.size(), NULL),
+        downsampled_images_(downsamples.size(), NULL),
+        frame_(frame) {}
+
+  // The images are pinned on the first access and stay pinned until the
+  // pyramid is destroyed.
+  virtual const FloatImage& Level(int i) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!level_images_[i]) {
+      level_images_[i] = levels_[i]->GetFloatImage(frame_);
     }
+    return *level_images_[i];
   }
 
-  virtual const FloatImage& Level(int i) {
-    pinned_levels_[i] = 1;
-    return *levels_[i]->GetFloatImage(frame_);
+  virtual const FloatImage& DownsampledImage(int i) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!downsampled_images_[i]) {
+      downsampled_images_[i] = downsamples_[i]->GetFloatImage(frame_);
+    }
+    return *downsampled_images_[i];
   }
 
   virtual int NumLevels() const { return levels_.size(); }
@@ -64,61 +84,116 @@ class ImageSequenceBackedImagePyramid : public ImagePyramid {
 
  private:
   const std::vector<ImageSequence*> levels_;
-  std::vector<int> pinned_levels_;
+  const std::vector<ImageSequence*> downsamples_;
+  std::vector<const FloatImage*> level_images_;
+  std::vector<const FloatImage*> downsampled_images_;
   int frame_;
+  std::mutex mutex_;
 };
 
 class ConcretePyramidSequence : public PyramidSequence {
  public:
   virtual ~ConcretePyramidSequence() {
-    for (size_t i = 0; i < levels_.size(); ++i) {
-      delete downsamples_[i];
+    // Pyramids unpin the images of the sequences, so they go first. The
+    // source sequence is not owned.
+    for (int i = 0; i < source_->Length(); ++i) {
+      delete constructed_pyramids_[i];
     }
     for (size_t i = 0; i < levels_.size(); ++i) {
       delete levels_[i];
     }
-    for (int i = 0; i < source_->Length(); ++i) {
-      delete constructed_pyramids_[i];
+    for (size_t i = 0; i < owned_downsamples_.size(); ++i) {
+      delete owned_downsamples_[i];
+    }
+    if (owns_sources_) {
+      for (size_t i = 0; i < sources_.size(); ++i) {
+        delete sources_[i];
+      }
     }
   }
 
-  ConcretePyramidSequence(ImageSequence* source, int levels, double sigma) {
+  // The downsampled sequences of the levels are taken from sources where it
+  // has them, and made by downsampling the previous level otherwise.
+  ConcretePyramidSequence(const std::vector<ImageSequence*>& sources,
+                          int levels,
+                          double sigma,
+                          bool owns_sources = false)
+      : source_(sources[0]),
+        sources_(sources),
+        owns_sources_(owns_sources) {
     downsamples_.resize(levels);
-    downsamples_[0] = source;
+    downsamples_[0] = source_;
     for (int i = 1; i < levels; ++i) {
-      downsamples_[i] = DownsampleSequenceBy2(downsamples_[i - 1]);
+      if (i < sources.size() && sources[i]) {
+        downsamples_[i] = sources[i];
+      } else {
+        downsamples_[i] = DownsampleSequenceBy2(downsamples_[i - 1]);
+        owned_downsamples_.push_back(downsamples_[i]);
+      }
     }
     levels_.resize(levels);
     for (int i = 0; i < levels; ++i) {
       levels_[i] = BlurSequenceAndTakeDerivatives(downsamples_[i], sigma);
     }
-    constructed_pyramids_.resize(source->Length());
-    for (int i = 0; i < source->Length(); ++i) {
+    constructed_pyramids_.resize(source_->Length());
+    for (int i = 0; i < source_->Length(); ++i) {
       constructed_pyramids_[i] = NULL;
     }
   }
 
   virtual int Length() { return source_->Length(); }
 
+  // The pyramid of a frame is made once and shared by all callers, its
+  // images are computed when they are used.
   virtual ImagePyramid* Pyramid(int frame) {
+    std::lock_guard<std::mutex> lock(mutex_);
     if (!constructed_pyramids_[frame]) {
       constructed_pyramids_[frame] =
-          new ImageSequenceBackedImagePyramid(levels_, frame);
+          new ImageSequenceBackedImagePyramid(levels_, downsamples_, frame);
     }
     return constructed_pyramids_[frame];
   }
 
  private:
   ImageSequence* source_;
+  std::vector<ImageSequence*> sources_;
+  bool owns_sources_;
   std::vector<ImageSequence*> levels_;
   std::vector<ImageSequence*> downsamples_;
+  // The downsampled sequences made here, the others are not owned.
+  std::vector<ImageSequence*> owned_downsamples_;
   std::vector<ImagePyramid*> constructed_pyramids_;
+  std::mutex mutex_;
 };
 
 PyramidSequence* MakePyramidSequence(ImageSequence* source,
                                      int levels,
                                      double sigma) {
-  return new ConcretePyramidSequence(source, levels, sigma);
+  return new ConcretePyramidSequence(
+      std::vector<ImageSequence*>(1, source), levels, sigma);
+}
+
+PyramidSequence* MakePyramidSequence(
+    const std::vector<ImageSequence*>& downsamples,
+    int levels,
+    double sigma) {
+  return new ConcretePyramidSequence(downsamples, levels, sigma);
+}
+
+PyramidSequence* MakePyramidSequenceFromFiles(
+    const std::vector<std::string>& filenames,
+    ImageCache* cache,
+    int levels,
+    double sigma,
+    bool decode_coarse_levels) {
+  std::vector<ImageSequence*> sources;
+  sources.push_back(PrefetchingImageSequenceFromFiles(filenames, cache));
+  if (decode_coarse_levels) {
+    for (int i = 1; i < levels && i <= 3; ++i) {
+      sources.push_back(ImageSequenceFromFiles(filenames, cache, 1 << i));
+    }
+  }
+  return new ConcretePyramidSequence(sources, levels, sigma, true);
 }
 
 /////////////////////////////////////////////////////////////
@@ -128,19 +203,24 @@ class SimpleConcretePyramidSequence : public PyramidSequence {
  public:
   virtual ~SimpleConcretePyramidSequence() {}
 
-  SimpleConcretePyramidSequence(ImageSequence* source, int levels, double sigma)
+  SimpleConcretePyramidSequence(ImageSequence* source,
+                                int levels,
+                                double sigma,
+                                ImagePyramidStorage storage)
       : source_(source),
         levels_(levels),
         sigma_(sigma),
+        storage_(storage),
         cache_(10 * 1024 * 1024) {}
 
   virtual int Length() { return source_->Length(); }
 
   virtual ImagePyramid* Pyramid(int frame) {
+    std::lock_guard<std::mutex> lock(mutex_);
     ImagePyramid* pyramid;
     if (!cache_.FetchAndPin(frame, &pyramid)) {
-      pyramid =
-          MakeImagePyramid(*source_->GetFloatImage(frame), levels_, sigma_);
+      pyramid = MakeImagePyramid(
+          *source_->GetFloatImage(frame), levels_, sigma_, storage_);
       source_->Unpin(frame);
       cache_.StoreAndPinSized(frame, pyramid, pyramid->MemorySizeInBytes());
     }
@@ -151,13 +231,16 @@ class SimpleConcretePyramidSequence : public PyramidSequence {
   ImageSequence* source_;
   int levels_;
   double sigma_;
+  ImagePyramidStorage storage_;
   LRUCache<int, ImagePyramid> cache_;
+  std::mutex mutex_;
 };
 
 PyramidSequence* MakeSimplePyramidSequence(ImageSequence* source,
                                            int levels,
-                                           double sigma) {
-  return new SimpleConcretePyramidSequence(source, levels, sigma);
+                                           double sigma,
+                                           ImagePyramidStorage storage) {
+  return new SimpleConcretePyramidSequence(source, levels, sigma, storage);
 }
 
 // End of pau trying things.
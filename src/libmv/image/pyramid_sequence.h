@@ -21,10 +21,15 @@
 #ifndef LIBMV_IMAGE_PYRAMID_SEQUENCE_H_
 #define LIBMV_IMAGE_PYRAMID_SEQUENCE_H_
 
+#include <string>
+#include <vector>
+
+#include "libmv/image/image_pyramid.h"
 #include "libmv/image/image_sequence.h"
 
 namespace libmv {
 
+class ImageCache;
 class ImagePyramid;
 
 class PyramidSequence {
@@ -45,10 +50,44 @@ PyramidSequence *MakePyramidSequence(ImageSequence *sequence,
                                      int levels,
                                      double sigma);
 
+// Pyramid sequence which takes the images of the coarse levels from the
+// given sequences instead of downsampling the finer level, for example from
+// ImageSequenceFromFiles() with a scale_denom of 2^i for the level i. The
+// downsamples[0] is the full resolution sequence, NULL entries are
+// downsampled from the previous level as usual. The sequences are not owned.
+PyramidSequence *MakePyramidSequence(
+    const std::vector<ImageSequence *> &downsamples,
+    int levels,
+    double sigma);
+
+// Pyramid sequence of image files, which are read with
+// PrefetchingImageSequenceFromFiles(), so the frames following the requested
+// one are decoded while it is tracked. The sequences of the files are owned
+// by the pyramid sequence, the cache is not.
+//
+// With decode_coarse_levels the images of the levels 1 to 3 are read from the
+// files at 1/2, 1/4 and 1/8 of their size instead of downsampling the finer
+// level, which decodes JPEG files at the reduced size directly. Coarser levels
+// are downsampled from the level 3.
+PyramidSequence *MakePyramidSequenceFromFiles(
+    const std::vector<std::string> &filenames,
+    ImageCache *cache,
+    int levels,
+    double sigma,
+    bool decode_coarse_levels = false);
+
 // This is pau trying things
-PyramidSequence *MakeSimplePyramidSequence(ImageSequence *sequence,
-                                           int levels,
-                                           double sigma);
+//
+// The pyramids are kept in a cache of 10 MB. With PYRAMID_HALF storage the
+// levels take 6 instead of 12 bytes per pixel, while the downsampled images
+// stay floats, so about 1.6 times as many of them fit, as long as the levels
+// are read with HalfLevel(). KLTContext::TrackFeature() does, other callers
+// of Level() make float copies of the levels which the cache does not count.
+PyramidSequence *MakeSimplePyramidSequence(
+    ImageSequence *sequence,
+    int levels,
+    double sigma,
+    ImagePyramidStorage storage = PYRAMID_FLOAT);
 }  // namespace libmv
 
 #endif  // LIBMV_IMAGE_PYRAMID_SEQUENCE_H_
@@ -19,7 +19,10 @@
 // IN THE SOFTWARE.
 
 #include <cstdio>
+#include <string>
+#include <vector>
 
+#include "libmv/image/image_io.h"
 #include "libmv/image/image_pyramid.h"
 #include "libmv/image/mock_image_sequence.h"
 #include "libmv/image/pyramid_sequence.h"
@@ -30,6 +33,7 @@ using libmv::ImageCache;
 using libmv::ImagePyramid;
 using libmv::MockImageSequence;
 using libmv::PyramidSequence;
+using std::string;
 
 namespace {
 
@@ -84,6 +88,142 @@ TEST(FilteredSequence, TwoLevelFilters) {
   EXPECT_NEAR(0.0, imageP1L1(4, 4, 2), 1e-9);  // Gradient y.
 }
 
+TEST(FilteredSequence, PyramidsAreShared) {
+  ImageCache cache;
+  MockImageSequence source(&cache);
+  Array3Df image0(16, 16);
+  image0.Fill(1);
+  source.Append(&image0);
+
+  PyramidSequence* pyramid_sequence = MakePyramidSequence(&source, 2, 1.0);
+
+  ImagePyramid* pyramid = pyramid_sequence->Pyramid(0);
+  EXPECT_EQ(pyramid, pyramid_sequence->Pyramid(0));
+
+  const Array3Df& downsampled0 = pyramid->DownsampledImage(0);
+  EXPECT_EQ(image0, downsampled0);
+  const Array3Df& downsampled1 = pyramid->DownsampledImage(1);
+  ASSERT_EQ(8, downsampled1.Height());
+  ASSERT_EQ(8, downsampled1.Width());
+  ASSERT_EQ(1, downsampled1.Depth());
+  EXPECT_EQ(1.0, downsampled1(4, 4));
+
+  // Images are pinned once, however many times they are used.
+  EXPECT_EQ(&pyramid->Level(1), &pyramid->Level(1));
+
+  delete pyramid_sequence;
+}
+
+TEST(FilteredSequence, CoarseLevelsFromSequences) {
+  ImageCache cache;
+  MockImageSequence source(&cache);
+  MockImageSequence half_source(&cache);
+  Array3Df image0(16, 16);
+  Array3Df half_image0(8, 8);
+  image0.Fill(1);
+  half_image0.Fill(5);
+  source.Append(&image0);
+  half_source.Append(&half_image0);
+
+  std::vector<libmv::ImageSequence*> downsamples;
+  downsamples.push_back(&source);
+  downsamples.push_back(&half_source);
+  PyramidSequence* pyramid_sequence =
+      MakePyramidSequence(downsamples, 3, 1.0);
+
+  ImagePyramid* pyramid = pyramid_sequence->Pyramid(0);
+  EXPECT_EQ(image0, pyramid->DownsampledImage(0));
+  EXPECT_EQ(half_image0, pyramid->DownsampledImage(1));
+  EXPECT_NEAR(5.0, pyramid->Level(1)(4, 4, 0), 1e-6);
+
+  // Levels past the given sequences are downsampled from the last one.
+  const Array3Df& downsampled2 = pyramid->DownsampledImage(2);
+  ASSERT_EQ(4, downsampled2.Height());
+  ASSERT_EQ(4, downsampled2.Width());
+  EXPECT_EQ(5.0, downsampled2(2, 2));
+
+  delete pyramid_sequence;
+}
+
+// Write frames with all pixels set to the index of the frame divided by 10.
+std::vector<string> WriteFrames(int num_frames) {
+  std::vector<string> files;
+  for (int i = 0; i < num_frames; ++i) {
+    Array3Df image(16, 12);
+    image.Fill(i / 10.f);
+    char filename[64];
+    snprintf(filename, sizeof(filename), "/pyramid_sequence_%d.pgm", i);
+    files.push_back(string(THIS_SOURCE_DIR) + filename);
+    WritePnm(image, files.back().c_str());
+  }
+  return files;
+}
+
+TEST(FilteredSequence, FromFiles) {
+  const int kNumFrames = 6;
+  std::vector<string> files = WriteFrames(kNumFrames);
+  ImageCache cache;
+  PyramidSequence* pyramid_sequence =
+      MakePyramidSequenceFromFiles(files, &cache, 2, 1.0);
+  EXPECT_EQ(kNumFrames, pyramid_sequence->Length());
+
+  for (int i = 0; i < kNumFrames; ++i) {
+    ImagePyramid* pyramid = pyramid_sequence->Pyramid(i);
+    const Array3Df& level0 = pyramid->Level(0);
+    ASSERT_EQ(16, level0.Height());
+    ASSERT_EQ(12, level0.Width());
+    EXPECT_NEAR(i / 10.f, level0(8, 6, 0), 1.f / 255);
+    const Array3Df& level1 = pyramid->Level(1);
+    ASSERT_EQ(8, level1.Height());
+    ASSERT_EQ(6, level1.Width());
+    EXPECT_NEAR(i / 10.f, level1(4, 3, 0), 0.01);  // Blurred near borders.
+  }
+
+  delete pyramid_sequence;
+  for (int i = 0; i < kNumFrames; ++i) {
+    unlink(files[i].c_str());
+  }
+}
+
+TEST(FilteredSequence, CoarseLevelsDecodedFromFiles) {
+  // A JPEG file, which is decoded at the reduced size, with a size that is
+  // rounded differently by the decoder than by downsampling.
+  Array3Df image(36, 44);
+  for (int y = 0; y < image.Height(); ++y) {
+    for (int x = 0; x < image.Width(); ++x) {
+      image(y, x) = (x + y) / 80.f;
+    }
+  }
+  std::vector<string> files;
+  files.push_back(string(THIS_SOURCE_DIR) + "/pyramid_sequence_coarse.jpg");
+  WriteJpg(image, files[0].c_str());
+
+  ImageCache cache;
+  PyramidSequence* pyramid_sequence =
+      MakePyramidSequenceFromFiles(files, &cache, 5, 1.0, true);
+  ImagePyramid* pyramid = pyramid_sequence->Pyramid(0);
+  for (int i = 1; i <= 3; ++i) {
+    Array3Df expected;
+    ASSERT_TRUE(ReadImage(files[0].c_str(), &expected, 1 << i));
+    EXPECT_EQ(expected, pyramid->DownsampledImage(i));
+  }
+  EXPECT_EQ(5, pyramid->DownsampledImage(3).Height());
+  EXPECT_EQ(6, pyramid->DownsampledImage(3).Width());
+
+  // The level past 1/8 is downsampled from the decoded one.
+  EXPECT_EQ(2, pyramid->DownsampledImage(4).Height());
+  EXPECT_EQ(3, pyramid->DownsampledImage(4).Width());
+  EXPECT_EQ(5, pyramid->Level(3).Height());
+  delete pyramid_sequence;
+
+  // Without it the levels are downsampled from the full size image.
+  pyramid_sequence = MakePyramidSequenceFromFiles(files, &cache, 5, 1.0);
+  EXPECT_EQ(4, pyramid_sequence->Pyramid(0)->DownsampledImage(3).Height());
+  delete pyramid_sequence;
+
+  unlink(files[0].c_str());
+}
+
 TEST(SimpleFilteredSequence, TwoLevelFilters) {
   ImageCache cache;
   MockImageSequence source(&cache);
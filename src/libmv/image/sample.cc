@@ -0,0 +1,367 @@
+// Copyright (c) 2020 libmv authors.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#include "libmv/image/sample.h"
+
+#include <algorithm>
+#include <atomic>
+
+// AVX2 code is compiled using target attributes and is only used when the
+// CPU reports support for it, as in convolve.cc.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define LIBMV_SAMPLE_AVX2
+#  include <immintrin.h>
+#elif defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
+
+namespace libmv {
+
+namespace {
+
+// Sample blocks of points with SIMD, returns the number of points which were
+// sampled. Points of blocks which are not all in bounds are sampled by the
+// scalar SampleLinear(), unless the caller knows that all of them are.
+typedef int (*SampleBlocksFunction)(const FloatImage& image,
+                                    bool in_bounds,
+                                    int num_samples,
+                                    const float* y,
+                                    const float* x,
+                                    float* samples);
+
+void SampleLinearScalar(const FloatImage& image,
+                        int begin,
+                        int num_samples,
+                        const float* y,
+                        const float* x,
+                        float* samples) {
+  const int depth = image.Depth();
+  for (int i = begin; i < num_samples; ++i) {
+    SampleLinear(image, y[i], x[i], samples + i * depth);
+  }
+}
+
+// Store the values of channel k of consecutive samples.
+inline void StoreChannel(const float* values,
+                         int num_values,
+                         int depth,
+                         int k,
+                         float* samples) {
+  for (int j = 0; j < num_values; ++j) {
+    samples[j * depth + k] = values[j];
+  }
+}
+
+#ifdef __SSE2__
+// The arithmetic of SampleLinear() for the two lower points: the products of
+// the first neighbours are rounded to floats, the rest is computed in
+// doubles, so the results are exactly the same.
+inline __m128d InterpolatePairSSE2(__m128 dx,
+                                   __m128 dy,
+                                   __m128 im11,
+                                   __m128 im12,
+                                   __m128 im21,
+                                   __m128 im22) {
+  const __m128d one_minus_dx = _mm_sub_pd(_mm_set1_pd(1.0), _mm_cvtps_pd(dx));
+  const __m128d top = _mm_add_pd(_mm_cvtps_pd(_mm_mul_ps(dx, im11)),
+                                 _mm_mul_pd(one_minus_dx, _mm_cvtps_pd(im12)));
+  const __m128d bottom =
+      _mm_add_pd(_mm_cvtps_pd(_mm_mul_ps(dx, im21)),
+                 _mm_mul_pd(one_minus_dx, _mm_cvtps_pd(im22)));
+  const __m128 one_minus_dy = _mm_sub_ps(_mm_set1_ps(1.0f), dy);
+  return _mm_add_pd(_mm_mul_pd(_mm_cvtps_pd(dy), top),
+                    _mm_mul_pd(_mm_cvtps_pd(one_minus_dy), bottom));
+}
+
+inline __m128 InterpolateSSE2(__m128 dx,
+                              __m128 dy,
+                              __m128 im11,
+                              __m128 im12,
+                              __m128 im21,
+                              __m128 im22) {
+  const __m128d low = InterpolatePairSSE2(dx, dy, im11, im12, im21, im22);
+  const __m128d high = InterpolatePairSSE2(_mm_movehl_ps(dx, dx),
+                                           _mm_movehl_ps(dy, dy),
+                                           _mm_movehl_ps(im11, im11),
+                                           _mm_movehl_ps(im12, im12),
+                                           _mm_movehl_ps(im21, im21),
+                                           _mm_movehl_ps(im22, im22));
+  return _mm_movelh_ps(_mm_cvtpd_ps(low), _mm_cvtpd_ps(high));
+}
+
+// True when the truncated coordinates are in [0, size - 2], where
+// LinearInitAxis() takes the two neighbours without clamping.
+inline bool AllInsideSSE2(__m128i ix, __m128i iy, int width, int height) {
+  const __m128i minus_one = _mm_set1_epi32(-1);
+  const __m128i inside_x =
+      _mm_and_si128(_mm_cmpgt_epi32(ix, minus_one),
+                    _mm_cmplt_epi32(ix, _mm_set1_epi32(width - 1)));
+  const __m128i inside_y =
+      _mm_and_si128(_mm_cmpgt_epi32(iy, minus_one),
+                    _mm_cmplt_epi32(iy, _mm_set1_epi32(height - 1)));
+  return _mm_movemask_epi8(_mm_and_si128(inside_x, inside_y)) == 0xffff;
+}
+
+// SSE2 has no gathers, the neighbours are loaded one by one.
+int SampleLinearSSE2(const FloatImage& image,
+                     bool in_bounds,
+                     int num_samples,
+                     const float* y,
+                     const float* x,
+                     float* samples) {
+  const float* data = image.Data();
+  const int row_stride = image.Stride(0);
+  const int column_stride = image.Stride(1);
+  const int channel_stride = image.Stride(2);
+  const int depth = image.Depth();
+  const int s1 = column_stride;
+  const int s2 = row_stride;
+  const int s3 = row_stride + column_stride;
+  const __m128i one = _mm_set1_epi32(1);
+
+  int i = 0;
+  for (; i + 4 <= num_samples; i += 4) {
+    const __m128 xs = _mm_loadu_ps(x + i);
+    const __m128 ys = _mm_loadu_ps(y + i);
+    const __m128i ix = _mm_cvttps_epi32(xs);
+    const __m128i iy = _mm_cvttps_epi32(ys);
+    if (!in_bounds &&
+        !AllInsideSSE2(ix, iy, image.Width(), image.Height())) {
+      SampleLinearScalar(image, i, i + 4, y, x, samples);
+      continue;
+    }
+    // Weights of the first neighbours, x2 - x as in LinearInitAxis().
+    const __m128 dx = _mm_sub_ps(_mm_cvtepi32_ps(_mm_add_epi32(ix, one)), xs);
+    const __m128 dy = _mm_sub_ps(_mm_cvtepi32_ps(_mm_add_epi32(iy, one)), ys);
+
+    int columns[4], rows[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(columns), ix);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(rows), iy);
+    const float* p0 = data + rows[0] * row_stride + columns[0] * column_stride;
+    const float* p1 = data + rows[1] * row_stride + columns[1] * column_stride;
+    const float* p2 = data + rows[2] * row_stride + columns[2] * column_stride;
+    const float* p3 = data + rows[3] * row_stride + columns[3] * column_stride;
+    for (int k = 0; k < depth; ++k) {
+      const int c = k * channel_stride;
+      const __m128 im11 = _mm_setr_ps(p0[c], p1[c], p2[c], p3[c]);
+      const __m128 im12 =
+          _mm_setr_ps(p0[c + s1], p1[c + s1], p2[c + s1], p3[c + s1]);
+      const __m128 im21 =
+          _mm_setr_ps(p0[c + s2], p1[c + s2], p2[c + s2], p3[c + s2]);
+      const __m128 im22 =
+          _mm_setr_ps(p0[c + s3], p1[c + s3], p2[c + s3], p3[c + s3]);
+      const __m128 result = InterpolateSSE2(dx, dy, im11, im12, im21, im22);
+      if (depth == 1) {
+        _mm_storeu_ps(samples + i, result);
+      } else {
+        float values[4];
+        _mm_storeu_ps(values, result);
+        StoreChannel(values, 4, depth, k, samples + i * depth);
+      }
+    }
+  }
+  return i;
+}
+#endif  // __SSE2__
+
+#ifdef LIBMV_SAMPLE_AVX2
+// Same as InterpolateSSE2() for four points, with the doubles in one
+// register.
+__attribute__((target("avx2"))) inline __m128 InterpolateAVX2(__m128 dx,
+                                                              __m128 dy,
+                                                              __m128 im11,
+                                                              __m128 im12,
+                                                              __m128 im21,
+                                                              __m128 im22) {
+  const __m256d one_minus_dx =
+      _mm256_sub_pd(_mm256_set1_pd(1.0), _mm256_cvtps_pd(dx));
+  const __m256d top =
+      _mm256_add_pd(_mm256_cvtps_pd(_mm_mul_ps(dx, im11)),
+                    _mm256_mul_pd(one_minus_dx, _mm256_cvtps_pd(im12)));
+  const __m256d bottom =
+      _mm256_add_pd(_mm256_cvtps_pd(_mm_mul_ps(dx, im21)),
+                    _mm256_mul_pd(one_minus_dx, _mm256_cvtps_pd(im22)));
+  const __m128 one_minus_dy = _mm_sub_ps(_mm_set1_ps(1.0f), dy);
+  return _mm256_cvtpd_ps(
+      _mm256_add_pd(_mm256_mul_pd(_mm256_cvtps_pd(dy), top),
+                    _mm256_mul_pd(_mm256_cvtps_pd(one_minus_dy), bottom)));
+}
+
+// The neighbours of eight points are gathered at a time.
+__attribute__((target("avx2"))) int SampleLinearAVX2(const FloatImage& image,
+                                                     bool in_bounds,
+                                                     int num_samples,
+                                                     const float* y,
+                                                     const float* x,
+                                                     float* samples) {
+  const float* data = image.Data();
+  const int column_stride = image.Stride(1);
+  const int row_stride = image.Stride(0);
+  const int channel_stride = image.Stride(2);
+  const int depth = image.Depth();
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i minus_one = _mm256_set1_epi32(-1);
+  const __m256i last_x = _mm256_set1_epi32(image.Width() - 1);
+  const __m256i last_y = _mm256_set1_epi32(image.Height() - 1);
+  const __m256i row_strides = _mm256_set1_epi32(row_stride);
+  const __m256i column_strides = _mm256_set1_epi32(column_stride);
+
+  int i = 0;
+  for (; i + 8 <= num_samples; i += 8) {
+    const __m256 xs = _mm256_loadu_ps(x + i);
+    const __m256 ys = _mm256_loadu_ps(y + i);
+    const __m256i ix = _mm256_cvttps_epi32(xs);
+    const __m256i iy = _mm256_cvttps_epi32(ys);
+    if (!in_bounds) {
+      const __m256i inside_x =
+          _mm256_and_si256(_mm256_cmpgt_epi32(ix, minus_one),
+                           _mm256_cmpgt_epi32(last_x, ix));
+      const __m256i inside_y =
+          _mm256_and_si256(_mm256_cmpgt_epi32(iy, minus_one),
+                           _mm256_cmpgt_epi32(last_y, iy));
+      if (_mm256_movemask_epi8(_mm256_and_si256(inside_x, inside_y)) != -1) {
+        SampleLinearScalar(image, i, i + 8, y, x, samples);
+        continue;
+      }
+    }
+    const __m256 dx =
+        _mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_add_epi32(ix, one)), xs);
+    const __m256 dy =
+        _mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_add_epi32(iy, one)), ys);
+    const __m128 dx_low = _mm256_castps256_ps128(dx);
+    const __m128 dx_high = _mm256_extractf128_ps(dx, 1);
+    const __m128 dy_low = _mm256_castps256_ps128(dy);
+    const __m128 dy_high = _mm256_extractf128_ps(dy, 1);
+    const __m256i offsets =
+        _mm256_add_epi32(_mm256_mullo_epi32(iy, row_strides),
+                         _mm256_mullo_epi32(ix, column_strides));
+    for (int k = 0; k < depth; ++k) {
+      const float* p = data + k * channel_stride;
+      const __m256 im11 = _mm256_i32gather_ps(p, offsets, 4);
+      const __m256 im12 = _mm256_i32gather_ps(p + column_stride, offsets, 4);
+      const __m256 im21 = _mm256_i32gather_ps(p + row_stride, offsets, 4);
+      const __m256 im22 =
+          _mm256_i32gather_ps(p + row_stride + column_stride, offsets, 4);
+      const __m128 low = InterpolateAVX2(dx_low,
+                                         dy_low,
+                                         _mm256_castps256_ps128(im11),
+                                         _mm256_castps256_ps128(im12),
+                                         _mm256_castps256_ps128(im21),
+                                         _mm256_castps256_ps128(im22));
+      const __m128 high = InterpolateAVX2(dx_high,
+                                          dy_high,
+                                          _mm256_extractf128_ps(im11, 1),
+                                          _mm256_extractf128_ps(im12, 1),
+                                          _mm256_extractf128_ps(im21, 1),
+                                          _mm256_extractf128_ps(im22, 1));
+      if (depth == 1) {
+        _mm_storeu_ps(samples + i, low);
+        _mm_storeu_ps(samples + i + 4, high);
+      } else {
+        float values[8];
+        _mm_storeu_ps(values, low);
+        _mm_storeu_ps(values + 4, high);
+        StoreChannel(values, 8, depth, k, samples + i * depth);
+      }
+    }
+  }
+  return i;
+}
+#endif  // LIBMV_SAMPLE_AVX2
+
+SampleBlocksFunction GetSampleBlocksFunction(
+    SampleInstructionSet instruction_set) {
+  switch (instruction_set) {
+#ifdef LIBMV_SAMPLE_AVX2
+    case SAMPLE_AVX2:
+      return SampleLinearAVX2;
+#endif
+#ifdef __SSE2__
+    case SAMPLE_SSE2:
+      return SampleLinearSSE2;
+#endif
+    default:
+      return NULL;
+  }
+}
+
+std::atomic<int>& CurrentSampleInstructionSet() {
+  static std::atomic<int> instruction_set(BestSampleInstructionSet());
+  return instruction_set;
+}
+
+void SampleLinearBatch(const FloatImage& image,
+                       bool in_bounds,
+                       int num_samples,
+                       const float* y,
+                       const float* x,
+                       float* samples) {
+  SampleBlocksFunction sample_blocks =
+      GetSampleBlocksFunction(GetSampleInstructionSet());
+  int begin = 0;
+  if (sample_blocks && image.Height() > 0 && image.Width() > 0) {
+    begin = sample_blocks(image, in_bounds, num_samples, y, x, samples);
+  }
+  SampleLinearScalar(image, begin, num_samples, y, x, samples);
+}
+
+}  // namespace
+
+SampleInstructionSet BestSampleInstructionSet() {
+#ifdef LIBMV_SAMPLE_AVX2
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return SAMPLE_AVX2;
+  }
+#endif
+#ifdef __SSE2__
+  return SAMPLE_SSE2;
+#else
+  return SAMPLE_SCALAR;
+#endif
+}
+
+SampleInstructionSet GetSampleInstructionSet() {
+  return static_cast<SampleInstructionSet>(
+      CurrentSampleInstructionSet().load());
+}
+
+void SetSampleInstructionSet(SampleInstructionSet instruction_set) {
+  CurrentSampleInstructionSet() =
+      std::min(instruction_set, BestSampleInstructionSet());
+}
+
+void SampleLinear(const FloatImage& image,
+                  int num_samples,
+                  const float* y,
+                  const float* x,
+                  float* samples) {
+  SampleLinearBatch(image, false, num_samples, y, x, samples);
+}
+
+void SampleLinearInBounds(const FloatImage& image,
+                          int num_samples,
+                          const float* y,
+                          const float* x,
+                          float* samples) {
+  SampleLinearBatch(image, true, num_samples, y, x, samples);
+}
+
+}  // namespace libmv
@@ -21,6 +21,9 @@
 #ifndef LIBMV_IMAGE_SAMPLE_H_
 #define LIBMV_IMAGE_SAMPLE_H_
 
+#include <algorithm>
+#include <vector>
+
 #include "libmv/image/image.h"
 
 namespace libmv {
@@ -89,6 +92,70 @@ inline void SampleLinear(const Array3D<T>& image, float y, float x, T* sample) {
   }
 }
 
+/// Linear interpolation of all channels at num_samples points, with exactly
+/// the same results as SampleLinear() of every point (y[i], x[i]). The values
+/// of sample i are written to samples[i * depth, (i + 1) * depth). Blocks of
+/// points whose neighbours are all inside the image are interpolated with
+/// SIMD, gathering the neighbours with AVX2 where the CPU supports it. Other
+/// points are clamped at the border one at a time.
+void SampleLinear(const FloatImage& image,
+                  int num_samples,
+                  const float* y,
+                  const float* x,
+                  float* samples);
+
+/// Same as above for points known to be in bounds, with truncated coordinates
+/// in [0, height - 2] and [0, width - 2], which skips the checks.
+void SampleLinearInBounds(const FloatImage& image,
+                          int num_samples,
+                          const float* y,
+                          const float* x,
+                          float* samples);
+
+/// Instruction sets which can be used by the batched SampleLinear().
+enum SampleInstructionSet {
+  SAMPLE_SCALAR,
+  SAMPLE_SSE2,
+  SAMPLE_AVX2,
+};
+
+/// Best instruction set supported by the CPU, which is used by default.
+SampleInstructionSet BestSampleInstructionSet();
+
+/// Instruction set used by the batched sampling. Instruction sets which are
+/// not supported by the CPU are replaced with the best supported one. This is
+/// mainly useful for testing and benchmarking.
+SampleInstructionSet GetSampleInstructionSet();
+void SetSampleInstructionSet(SampleInstructionSet instruction_set);
+
+/// Linear interpolation of half float images. The values are converted to
+/// floats before the interpolation.
+inline float SampleLinear(const HalfImage& image, float y, float x, int v = 0) {
+  int x1, y1, x2, y2;
+  float dx, dy;
+
+  LinearInitAxis(y, image.Height(), &y1, &y2, &dy);
+  LinearInitAxis(x, image.Width(), &x1, &x2, &dx);
+
+  const float im11 = HalfToFloat(image(y1, x1, v));
+  const float im12 = HalfToFloat(image(y1, x2, v));
+  const float im21 = HalfToFloat(image(y2, x1, v));
+  const float im22 = HalfToFloat(image(y2, x2, v));
+
+  return dy * (dx * im11 + (1.0 - dx) * im12) +
+         (1 - dy) * (dx * im21 + (1.0 - dx) * im22);
+}
+
+/// Linear interpolation of all channels of half float images.
+inline void SampleLinear(const HalfImage& image,
+                         float y,
+                         float x,
+                         float* sample) {
+  for (int i = 0; i < image.Depth(); ++i) {
+    sample[i] = SampleLinear(image, y, x, i);
+  }
+}
+
 // Downsample all channels by 2. If the image has odd width or height, the last
 // row or column is ignored.
 // FIXME(MatthiasF): this implementation shouldn't be in an interface file
@@ -122,7 +189,21 @@ inline void SamplePattern(const FloatImage& image,
                           int half_width,
                           int channels,
                           FloatImage* sampled) {
-  sampled->Resize(2 * half_width + 1, 2 * half_width + 1, channels);
+  const int size = 2 * half_width + 1;
+  sampled->Resize(size, size, channels);
+  if (channels == image.Depth() && sampled->Stride(1) == channels &&
+      sampled->Stride(2) == 1) {
+    // Rows of the pattern are sampled in one batch.
+    std::vector<float> xs(size), ys(size);
+    for (int c = -half_width; c <= half_width; ++c) {
+      xs[c + half_width] = x + c;
+    }
+    for (int r = -half_width; r <= half_width; ++r) {
+      std::fill(ys.begin(), ys.end(), float(y + r));
+      SampleLinear(image, size, &ys[0], &xs[0], &(*sampled)(r + half_width, 0));
+    }
+    return;
+  }
   for (int r = -half_width; r <= half_width; ++r) {
     for (int c = -half_width; c <= half_width; ++c) {
       for (int i = 0; i < channels; ++i) {
@@ -18,6 +18,9 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
 // IN THE SOFTWARE.
 
+#include <cstdlib>
+#include <vector>
+
 #include "libmv/image/sample.h"
 #include "testing/testing.h"
 
@@ -46,6 +49,18 @@ TEST(Image, Linear) {
   EXPECT_EQ(1.5, SampleLinear(image, 0.5, 0.5));
 }
 
+TEST(Image, LinearHalf) {
+  HalfImage image(2, 2, 2);
+  for (int i = 0; i < 8; ++i) {
+    image.Data()[i] = FloatToHalf(i);
+  }
+  EXPECT_EQ(3.0f, SampleLinear(image, 0.5, 0.5, 0));
+  float sample[2];
+  SampleLinear(image, 0.5, 0.5, sample);
+  EXPECT_EQ(3.0f, sample[0]);
+  EXPECT_EQ(4.0f, sample[1]);
+}
+
 TEST(Image, DownsampleBy2) {
   Array3Df image(2, 2);
   image(0, 0) = 0;
@@ -86,4 +101,94 @@ TEST(Image, DownsampleBy2MultiChannel) {
   EXPECT_FLOAT_EQ((5 + 6 + 7 + 8) / 4., resampled_image(0, 0, 1));
   EXPECT_FLOAT_EQ((9 + 10 + 11 + 12) / 4., resampled_image(0, 0, 2));
 }
+
+// Points inside the image, at its borders where the neighbours are clamped
+// and outside of it.
+void CreateSamplePoints(int height,
+                        int width,
+                        std::vector<float>* y,
+                        std::vector<float>* x) {
+  srand(5);
+  for (int i = 0; i < 200; ++i) {
+    y->push_back((height + 4) * (rand() / float(RAND_MAX)) - 2);
+    x->push_back((width + 4) * (rand() / float(RAND_MAX)) - 2);
+  }
+  const float corners_y[] = {-0.5, 0, 0, height - 1.0f, height - 1.5f};
+  const float corners_x[] = {0, -0.5, width - 1.0f, 0, width - 1.25f};
+  for (int i = 0; i < 5; ++i) {
+    y->push_back(corners_y[i]);
+    x->push_back(corners_x[i]);
+  }
+}
+
+TEST(Image, LinearBatchMatchesSinglePoints) {
+  SampleInstructionSet previous_instruction_set = GetSampleInstructionSet();
+  for (int depth = 1; depth <= 3; depth += 2) {
+    FloatImage image(13, 17, depth);
+    for (int i = 0; i < image.Size(); ++i) {
+      image.Data()[i] = (i * 7919 % 1000) / 1000.0f;
+    }
+    std::vector<float> y, x;
+    CreateSamplePoints(image.Height(), image.Width(), &y, &x);
+    const int num_samples = y.size();
+
+    std::vector<float> expected(num_samples * depth);
+    for (int i = 0; i < num_samples; ++i) {
+      SampleLinear(image, y[i], x[i], &expected[i * depth]);
+    }
+    for (int i = SAMPLE_SCALAR; i <= BestSampleInstructionSet(); ++i) {
+      SetSampleInstructionSet((SampleInstructionSet)i);
+      std::vector<float> samples(num_samples * depth);
+      SampleLinear(image, num_samples, &y[0], &x[0], &samples[0]);
+      for (int j = 0; j < samples.size(); ++j) {
+        EXPECT_EQ(expected[j], samples[j]) << "instruction set " << i;
+      }
+    }
+  }
+  SetSampleInstructionSet(previous_instruction_set);
+}
+
+TEST(Image, LinearInBounds) {
+  SampleInstructionSet previous_instruction_set = GetSampleInstructionSet();
+  FloatImage image(9, 11, 2);
+  for (int i = 0; i < image.Size(); ++i) {
+    image.Data()[i] = i * 0.25f;
+  }
+  std::vector<float> y, x;
+  for (int i = 0; i < 37; ++i) {
+    y.push_back((i * 0.37f) - int(i * 0.37f / 8) * 8);
+    x.push_back((i * 0.61f) - int(i * 0.61f / 10) * 10);
+  }
+  for (int i = SAMPLE_SCALAR; i <= BestSampleInstructionSet(); ++i) {
+    SetSampleInstructionSet((SampleInstructionSet)i);
+    std::vector<float> samples(2 * y.size());
+    SampleLinearInBounds(image, y.size(), &y[0], &x[0], &samples[0]);
+    for (int j = 0; j < y.size(); ++j) {
+      float expected[2];
+      SampleLinear(image, y[j], x[j], expected);
+      EXPECT_EQ(expected[0], samples[2 * j]);
+      EXPECT_EQ(expected[1], samples[2 * j + 1]);
+    }
+  }
+  SetSampleInstructionSet(previous_instruction_set);
+}
+
+TEST(Image, SamplePatternBatch) {
+  FloatImage image(20, 20, 3);
+  for (int i = 0; i < image.Size(); ++i) {
+    image.Data()[i] = (i * 31 % 97) / 97.0f;
+  }
+  FloatImage pattern;
+  SamplePattern(image, 9.3, 10.6, 4, 3, &pattern);
+  ASSERT_EQ(9, pattern.Height());
+  for (int r = 0; r < 9; ++r) {
+    for (int c = 0; c < 9; ++c) {
+      for (int k = 0; k < 3; ++k) {
+        EXPECT_EQ(SampleLinear(image, 10.6 + r - 4, 9.3 + c - 4, k),
+                  pattern(r, c, k));
+      }
+    }
+  }
+}
+
 }  // namespace
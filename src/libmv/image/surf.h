@@ -191,7 +191,7 @@ void SurfFeatures(const TImage &image,
                   int num_octaves,
                   int num_intervals,
                   vector<TPointFeature> *detections) {
-  Matu integral_image;
+  Array3D<int64_t> integral_image;
   IntegralImage(image, &integral_image);
 
   MultiscaleDetectFeatures(integral_image, num_octaves, num_intervals,
@@ -32,6 +32,7 @@
 #include <Eigen/LU>
 #include <Eigen/QR>
 #include <Eigen/SVD>
+#include <Eigen/SparseCore>
 
 #if !defined(__MINGW64__)
 #  if defined(_WIN32) || defined(__APPLE__) || defined(__FreeBSD__) ||         \
@@ -76,6 +77,7 @@ typedef Eigen::Matrix<double, 4, 1> Mat41;
 typedef Eigen::Matrix<double, 4, 3> Mat43;
 typedef Eigen::Matrix<double, 4, 4> Mat4;
 typedef Eigen::Matrix<double, 4, 6> Mat46;
+typedef Eigen::Matrix<double, 6, 6> Mat6;
 typedef Eigen::Matrix<float, 2, 2> Mat2f;
 typedef Eigen::Matrix<float, 2, 3> Mat23f;
 typedef Eigen::Matrix<float, 3, 3> Mat3f;
@@ -135,6 +137,10 @@ typedef Eigen::Vector4i Vec4i;
 typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
     RMatf;
 
+// Row-major so that it maps directly onto compressed row storage as produced
+// by Ceres.
+typedef Eigen::SparseMatrix<double, Eigen::RowMajor> SparseMat;
+
 typedef Eigen::NumTraits<double> EigenDouble;
 
 using Eigen::Dynamic;
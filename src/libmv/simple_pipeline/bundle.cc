@@ -18,13 +18,24 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
 // IN THE SOFTWARE.
 
+// Ceres includes Eigen/StdVector, which specializes std::vector for the
+// aligned allocator and has to be seen before libmv::vector is instantiated.
+#include "ceres/ceres.h"
+#include "ceres/rotation.h"
+
 #include "libmv/simple_pipeline/bundle.h"
 
+#include <algorithm>
+#include <cmath>
 #include <map>
 #include <thread>
 
-#include "ceres/ceres.h"
-#include "ceres/rotation.h"
+#include <Eigen/SparseCholesky>
+
+#if defined(_OPENMP)
+#  include <omp.h>
+#endif
+
 #include "libmv/base/map.h"
 #include "libmv/base/vector.h"
 #include "libmv/logging/logging.h"
@@ -41,6 +52,18 @@ namespace libmv {
 
 namespace {
 
+// Number of threads used by Ceres. Bundles which run in a parallel region
+// already, such as the ones of keyframe candidates evaluated in parallel,
+// use one thread, so the number of threads does not multiply.
+int NumSolverThreads() {
+#if defined(_OPENMP)
+  if (omp_in_parallel()) {
+    return 1;
+  }
+#endif
+  return std::thread::hardware_concurrency();
+}
+
 bool NeedUseInvertIntrinsicsPipeline(const CameraIntrinsics* intrinsics) {
   const DistortionModelType distortion_model =
       intrinsics->GetDistortionModelType();
@@ -436,15 +459,12 @@ void UnpackCamerasRotationAndTranslation(
   }
 }
 
-// Converts sparse CRSMatrix to Eigen matrix, so it could be used
-// all over in the pipeline.
-//
-// TODO(sergey): currently uses dense Eigen matrices, best would
-//               be to use sparse Eigen matrices
-void CRSMatrixToEigenMatrix(const ceres::CRSMatrix& crs_matrix,
-                            Mat* eigen_matrix) {
-  eigen_matrix->resize(crs_matrix.num_rows, crs_matrix.num_cols);
-  eigen_matrix->setZero();
+// Converts sparse CRSMatrix to Eigen sparse matrix, so it could be used
+// all over in the pipeline without ever going dense.
+void CRSMatrixToSparseMatrix(const ceres::CRSMatrix& crs_matrix,
+                             SparseMat* sparse_matrix) {
+  std::vector<Eigen::Triplet<double>> triplets;
+  triplets.reserve(crs_matrix.values.size());
 
   for (int row = 0; row < crs_matrix.num_rows; ++row) {
     int start = crs_matrix.rows[row];
@@ -454,8 +474,293 @@ void CRSMatrixToEigenMatrix(const ceres::CRSMatrix& crs_matrix,
       int col = crs_matrix.cols[i];
       double value = crs_matrix.values[i];
 
-      (*eigen_matrix)(row, col) = value;
+      triplets.push_back(Eigen::Triplet<double>(row, col, value));
+    }
+  }
+
+  sparse_matrix->resize(crs_matrix.num_rows, crs_matrix.num_cols);
+  sparse_matrix->setFromTriplets(triplets.begin(), triplets.end());
+}
+
+// Compute a generalized inverse of a symmetric positive semi-definite matrix,
+// clamping the smallest eigenvalues. Used to deal with the gauge freedom of
+// the reconstruction.
+Mat SymmetricPseudoInverse(const Mat& matrix, int num_eigenvalues_to_clamp) {
+  Eigen::SelfAdjointEigenSolver<Mat> eigen_solver(matrix);
+  Vec D = eigen_solver.eigenvalues();
+  const Mat& V = eigen_solver.eigenvectors();
+
+  // Clamp too-small eigenvalues to zero to prevent numeric blowup.
+  // Eigenvalues are sorted in increasing order, so the ones to clamp are
+  // at the beginning.
+  double epsilon =
+      std::numeric_limits<double>::epsilon() * D.cwiseAbs().maxCoeff();
+  for (int i = 0; i < D.rows(); ++i) {
+    if (i < num_eigenvalues_to_clamp || D(i) <= epsilon) {
+      D(i) = 0.0;
+    } else {
+      D(i) = 1.0 / D(i);
+    }
+  }
+
+  return V * D.asDiagonal() * V.transpose();
+}
+
+// Modified Gram-Schmidt orthonormalization of the columns in place. This is
+// done by hand rather than with Eigen's Householder QR so the library does
+// not export QR instantiations which would clash with the ones in Ceres.
+void OrthonormalizeColumns(Mat* basis) {
+  for (int j = 0; j < basis->cols(); ++j) {
+    for (int k = 0; k < j; ++k) {
+      basis->col(j) -= basis->col(k).dot(basis->col(j)) * basis->col(k);
     }
+    basis->col(j).normalize();
+  }
+}
+
+// Orthonormal basis of the null space of the symmetric positive
+// semi-definite matrix, which is known to have the given dimension. The
+// eigenvectors of the smallest eigenvalues are the dominant ones of the
+// inverse of the slightly regularized matrix, so a few steps of subspace
+// iteration with its sparse factorization converge to them.
+Mat SparseNullSpace(const Eigen::SparseMatrix<double>& matrix,
+                    int null_space_dimension) {
+  const int size = matrix.rows();
+  const double regularization = 1e-8 * matrix.diagonal().cwiseAbs().maxCoeff();
+  Eigen::SparseMatrix<double> identity(size, size);
+  identity.setIdentity();
+  Eigen::SparseMatrix<double> regularized_matrix =
+      matrix + regularization * identity;
+  Eigen::SimplicialLDLT<Eigen::SparseMatrix<double> > ldlt(regularized_matrix);
+
+  // Deterministic start which is not orthogonal to the null space.
+  Mat basis(size, null_space_dimension);
+  for (int i = 0; i < size; ++i) {
+    for (int j = 0; j < null_space_dimension; ++j) {
+      basis(i, j) = std::cos(1.0 + i * (j + 1) + 0.5 * j);
+    }
+  }
+  for (int iteration = 0; iteration < 4; ++iteration) {
+    basis = ldlt.solve(basis);
+    OrthonormalizeColumns(&basis);
+  }
+  return basis;
+}
+
+// Indices of the rows of the matrix which are the best conditioned as a
+// set, picked greedily by the largest norm left after projecting out the
+// rows picked before, which is what column pivoted QR of the transposed
+// matrix does.
+std::vector<int> PickIndependentRows(const Mat& matrix, int num_rows) {
+  Mat residual = matrix;
+  std::vector<int> rows;
+  for (int i = 0; i < num_rows; ++i) {
+    int best_row;
+    double norm =
+        std::sqrt(residual.rowwise().squaredNorm().maxCoeff(&best_row));
+    if (norm == 0.0) {
+      break;
+    }
+    rows.push_back(best_row);
+    Vec direction = residual.row(best_row).transpose() / norm;
+    Vec projection = residual * direction;
+    residual -= projection * direction.transpose();
+  }
+  return rows;
+}
+
+// Compute marginal covariances of cameras and points from the jacobian,
+// which has all camera parameters in its first columns followed by 3 columns
+// for every point.
+//
+// Information matrix J^T * J has the following block structure:
+//
+//   | U   W |
+//   | W^T V |
+//
+// where V is block diagonal with 3x3 block per point. Points are eliminated
+// using the Schur complement S = U - W * V^-1 * W^T, which is sparse: its
+// blocks are non-zero only for pairs of cameras which observe a common
+// point. Covariance of the cameras is the pseudo-inverse S^+ which clamps out
+// the 7 degrees of freedom of the similarity gauge, and covariance of a
+// point p is
+//
+//   V_p^-1 + V_p^-1 * W_p^T * S^+ * W_p * V_p^-1
+//
+// where W_p only has non-zero rows for cameras which observe the point. So
+// only the entries of S^+ in the sparsity pattern of S are needed.
+//
+// With N being an orthonormal basis of the null space of S, P = I - N * N^T
+// and G any generalized inverse of S, S^+ = P * G * P. G is obtained by
+// fixing 7 parameters for which the rows of N are well conditioned, so the
+// rest of S is invertible, and the columns of S^+ are computed camera by
+// camera with its sparse factorization. Nothing of the size of S is dense.
+void ComputeMarginalCovariancesFromJacobian(
+    const SparseMat& jacobian,
+    const vector<int>& camera_block_sizes,
+    vector<Mat>* camera_covariances,
+    vector<Mat3>* point_covariances) {
+  typedef Eigen::SparseMatrix<double> ColumnMajorSparseMat;
+
+  int num_camera_parameters = 0;
+  for (int i = 0; i < camera_block_sizes.size(); ++i) {
+    num_camera_parameters += camera_block_sizes[i];
+  }
+  int num_point_parameters = jacobian.cols() - num_camera_parameters;
+  int num_points = num_point_parameters / 3;
+
+  // Column major storage makes column slicing cheap.
+  ColumnMajorSparseMat J = jacobian;
+  ColumnMajorSparseMat J_cameras = J.leftCols(num_camera_parameters);
+  ColumnMajorSparseMat J_points = J.rightCols(num_point_parameters);
+
+  ColumnMajorSparseMat U = J_cameras.transpose() * J_cameras;
+  ColumnMajorSparseMat W = J_cameras.transpose() * J_points;
+  ColumnMajorSparseMat V = J_points.transpose() * J_points;
+
+  // Invert diagonal blocks of V.
+  vector<Mat3> V_inverse(num_points);
+  std::vector<Eigen::Triplet<double>> V_inverse_triplets;
+  V_inverse_triplets.reserve(9 * num_points);
+  for (int i = 0; i < num_points; ++i) {
+    Mat3 V_i = Mat(V.block(3 * i, 3 * i, 3, 3));
+    V_inverse[i] = SymmetricPseudoInverse(V_i, 0);
+    for (int r = 0; r < 3; ++r) {
+      for (int c = 0; c < 3; ++c) {
+        V_inverse_triplets.push_back(
+            Eigen::Triplet<double>(3 * i + r, 3 * i + c, V_inverse[i](r, c)));
+      }
+    }
+  }
+  ColumnMajorSparseMat V_inverse_matrix(num_point_parameters,
+                                        num_point_parameters);
+  V_inverse_matrix.setFromTriplets(V_inverse_triplets.begin(),
+                                   V_inverse_triplets.end());
+
+  // Y = W * V^-1 only has non-zero rows for cameras observing the point.
+  ColumnMajorSparseMat Y = W * V_inverse_matrix;
+
+  // Reduced camera system.
+  ColumnMajorSparseMat Y_WT = Y * W.transpose();
+  ColumnMajorSparseMat S = U - Y_WT;
+
+  // Entries of S^+ in the sparsity pattern of S.
+  std::vector<Eigen::Triplet<double>> S_inverse_triplets;
+  S_inverse_triplets.reserve(S.nonZeros());
+
+  // There are 7 degrees of freedom, so clamp them out. When there are not
+  // more parameters than that, everything is clamped.
+  const int num_gauge_parameters = 7;
+  if (num_camera_parameters > num_gauge_parameters) {
+    Mat N = SparseNullSpace(S, num_gauge_parameters);
+
+    std::vector<int> fixed_parameters =
+        PickIndependentRows(N, num_gauge_parameters);
+    std::vector<bool> fixed(num_camera_parameters, false);
+    for (int i = 0; i < fixed_parameters.size(); ++i) {
+      fixed[fixed_parameters[i]] = true;
+    }
+    std::vector<int> reduced_index(num_camera_parameters, -1);
+    int num_reduced_parameters = 0;
+    for (int i = 0; i < num_camera_parameters; ++i) {
+      if (!fixed[i]) {
+        reduced_index[i] = num_reduced_parameters++;
+      }
+    }
+    std::vector<Eigen::Triplet<double>> reduced_triplets;
+    reduced_triplets.reserve(S.nonZeros());
+    for (int c = 0; c < S.outerSize(); ++c) {
+      for (ColumnMajorSparseMat::InnerIterator it(S, c); it; ++it) {
+        if (!fixed[it.row()] && !fixed[c]) {
+          reduced_triplets.push_back(Eigen::Triplet<double>(
+              reduced_index[it.row()], reduced_index[c], it.value()));
+        }
+      }
+    }
+    ColumnMajorSparseMat S_reduced(num_reduced_parameters,
+                                   num_reduced_parameters);
+    S_reduced.setFromTriplets(reduced_triplets.begin(),
+                              reduced_triplets.end());
+    Eigen::SimplicialLDLT<ColumnMajorSparseMat> ldlt(S_reduced);
+    if (ldlt.info() != Eigen::Success) {
+      LOG(ERROR) << "Failed to factorize the reduced camera system.";
+    }
+
+    for (int i = 0, offset = 0; i < camera_block_sizes.size(); ++i) {
+      int size = camera_block_sizes[i];
+
+      // Columns of P * G * P for the parameters of this camera.
+      Mat columns = -N * N.middleRows(offset, size).transpose();
+      columns.middleRows(offset, size) += Mat::Identity(size, size);
+      Mat reduced_columns(num_reduced_parameters, size);
+      for (int r = 0; r < num_camera_parameters; ++r) {
+        if (!fixed[r]) {
+          reduced_columns.row(reduced_index[r]) = columns.row(r);
+        }
+      }
+      reduced_columns = ldlt.solve(reduced_columns);
+      for (int r = 0; r < num_camera_parameters; ++r) {
+        if (fixed[r]) {
+          columns.row(r).setZero();
+        } else {
+          columns.row(r) = reduced_columns.row(reduced_index[r]);
+        }
+      }
+      columns -= N * (N.transpose() * columns);
+
+      for (int c = 0; c < size; ++c) {
+        for (ColumnMajorSparseMat::InnerIterator it(S, offset + c); it;
+             ++it) {
+          S_inverse_triplets.push_back(Eigen::Triplet<double>(
+              it.row(), offset + c, columns(it.row(), c)));
+        }
+      }
+      offset += size;
+    }
+  }
+  ColumnMajorSparseMat S_inverse(num_camera_parameters, num_camera_parameters);
+  S_inverse.setFromTriplets(S_inverse_triplets.begin(),
+                            S_inverse_triplets.end());
+
+  camera_covariances->resize(camera_block_sizes.size());
+  for (int i = 0, offset = 0; i < camera_block_sizes.size(); ++i) {
+    int size = camera_block_sizes[i];
+    (*camera_covariances)[i] = Mat(S_inverse.block(offset, offset, size, size));
+    offset += size;
+  }
+
+  point_covariances->resize(num_points);
+  for (int i = 0; i < num_points; ++i) {
+    // Gather rows of the cameras which observe this point.
+    std::vector<int> rows;
+    for (int c = 0; c < 3; ++c) {
+      for (ColumnMajorSparseMat::InnerIterator it(Y, 3 * i + c); it; ++it) {
+        rows.push_back(it.row());
+      }
+    }
+    std::sort(rows.begin(), rows.end());
+    rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+
+    Mat Y_i = Mat::Zero(rows.size(), 3);
+    for (int c = 0; c < 3; ++c) {
+      for (ColumnMajorSparseMat::InnerIterator it(Y, 3 * i + c); it; ++it) {
+        int k = std::lower_bound(rows.begin(), rows.end(), it.row()) -
+                rows.begin();
+        Y_i(k, c) = it.value();
+      }
+    }
+
+    // All these cameras observe the point, so their entries are in the
+    // sparsity pattern of S.
+    Mat S_inverse_i(rows.size(), rows.size());
+    for (int r = 0; r < rows.size(); ++r) {
+      for (int c = 0; c < rows.size(); ++c) {
+        S_inverse_i(r, c) = S_inverse.coeff(rows[r], rows[c]);
+      }
+    }
+
+    (*point_covariances)[i] =
+        V_inverse[i] + Y_i.transpose() * S_inverse_i * Y_i;
   }
 }
 
@@ -497,9 +802,17 @@ void EuclideanBundlerPerformEvaluation(const Tracks& tracks,
   evaluation->num_cameras = num_cameras;
   evaluation->num_points = num_points;
 
-  if (evaluation->evaluate_jacobian) {  // Evaluate jacobian matrix.
+  evaluation->images.clear();
+  evaluation->tracks.clear();
+  for (int i = 0; i < minimized_points.size(); i++) {
+    evaluation->tracks.push_back(minimized_points[i]->track);
+  }
+
+  if (evaluation->evaluate_jacobian || evaluation->evaluate_sparse_jacobian ||
+      evaluation->evaluate_covariance) {  // Evaluate jacobian matrix.
     ceres::CRSMatrix evaluated_jacobian;
     ceres::Problem::EvaluateOptions eval_options;
+    vector<int> camera_block_sizes;
 
     // Cameras goes first in the ordering.
     int max_image = tracks.MaxImage();
@@ -508,10 +821,19 @@ void EuclideanBundlerPerformEvaluation(const Tracks& tracks,
       if (camera) {
         double* current_camera_R_t = &(*all_cameras_R_t)[i](0);
 
+        // Camera does not have parameter block in the problem when all its
+        // markers are zero-weighted.
+        if (!problem->HasParameterBlock(current_camera_R_t)) {
+          continue;
+        }
+
         // All cameras are variable now.
         problem->SetParameterBlockVariable(current_camera_R_t);
 
         eval_options.parameter_blocks.push_back(current_camera_R_t);
+        camera_block_sizes.push_back(
+            problem->ParameterBlockLocalSize(current_camera_R_t));
+        evaluation->images.push_back(i);
       }
     }
 
@@ -523,7 +845,23 @@ void EuclideanBundlerPerformEvaluation(const Tracks& tracks,
 
     problem->Evaluate(eval_options, NULL, NULL, NULL, &evaluated_jacobian);
 
-    CRSMatrixToEigenMatrix(evaluated_jacobian, &evaluation->jacobian);
+    SparseMat sparse_jacobian;
+    CRSMatrixToSparseMatrix(evaluated_jacobian, &sparse_jacobian);
+
+    if (evaluation->evaluate_jacobian) {
+      evaluation->jacobian = Mat(sparse_jacobian);
+    }
+
+    if (evaluation->evaluate_covariance) {
+      ComputeMarginalCovariancesFromJacobian(sparse_jacobian,
+                                             camera_block_sizes,
+                                             &evaluation->camera_covariances,
+                                             &evaluation->point_covariances);
+    }
+
+    if (evaluation->evaluate_sparse_jacobian) {
+      evaluation->sparse_jacobian.swap(sparse_jacobian);
+    }
   }
 }
 
@@ -636,7 +974,7 @@ void EuclideanBundlePointsOnly(const CameraIntrinsics* invariant_intrinsics,
   options.use_explicit_schur_complement = true;
   options.use_inner_iterations = true;
   options.max_num_iterations = 100;
-  options.num_threads = std::thread::hardware_concurrency();
+  options.num_threads = NumSolverThreads();
 
   // Solve!
   ceres::Solver::Summary summary;
@@ -803,7 +1141,7 @@ void EuclideanBundleCommonIntrinsics(const Tracks& tracks,
   options.use_explicit_schur_complement = true;
   options.use_inner_iterations = true;
   options.max_num_iterations = 100;
-  options.num_threads = std::thread::hardware_concurrency();
+  options.num_threads = NumSolverThreads();
 
   // Solve!
   ceres::Solver::Summary summary;
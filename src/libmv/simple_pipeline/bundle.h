@@ -21,6 +21,7 @@
 #ifndef LIBMV_SIMPLE_PIPELINE_BUNDLE_H
 #define LIBMV_SIMPLE_PIPELINE_BUNDLE_H
 
+#include "libmv/base/vector.h"
 #include "libmv/numeric/numeric.h"
 
 namespace libmv {
@@ -32,7 +33,11 @@ class Tracks;
 
 struct BundleEvaluation {
   BundleEvaluation()
-      : num_cameras(0), num_points(0), evaluate_jacobian(false) {}
+      : num_cameras(0),
+        num_points(0),
+        evaluate_jacobian(false),
+        evaluate_sparse_jacobian(false),
+        evaluate_covariance(false) {}
 
   // Number of cameras appeared in bundle adjustment problem
   int num_cameras;
@@ -46,10 +51,41 @@ struct BundleEvaluation {
 
   // Contains evaluated jacobian of the problem.
   // Parameters are ordered in the following way:
-  //   - Intrinsics block
   //   - Cameras (for each camera rotation goes first, then translation)
   //   - Points
+  //
+  // NOTE: This is a dense matrix, so it quickly becomes huge for any
+  // non-trivial problem. Use sparse_jacobian for bigger problems.
   Mat jacobian;
+
+  // When set to truth, jacobian of the problem after optimization
+  // will be evaluated and stored in \parameter sparse_jacobian.
+  bool evaluate_sparse_jacobian;
+
+  // Same as jacobian, but stored in the compressed row storage, so the
+  // memory usage is proportional to the number of observations.
+  SparseMat sparse_jacobian;
+
+  // When set to truth, marginal covariances of all cameras and points are
+  // computed after optimization and stored in \parameter camera_covariances
+  // and \parameter point_covariances.
+  //
+  // Points are eliminated using the Schur complement, so only the reduced
+  // camera system is ever stored densely. The 7 degrees of freedom of the
+  // similarity gauge are clamped out.
+  bool evaluate_covariance;
+
+  // Images and tracks of the cameras and points in the order they appear in
+  // the jacobian and covariances.
+  vector<int> images;
+  vector<int> tracks;
+
+  // Marginal covariance of every camera, in the order of images.
+  // Uses the same parameterization as the jacobian.
+  vector<Mat> camera_covariances;
+
+  // Marginal covariance of every point, in the order of tracks.
+  vector<Mat3> point_covariances;
 };
 
 /*!
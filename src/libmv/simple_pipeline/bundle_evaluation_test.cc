@@ -0,0 +1,162 @@
+// Copyright (c) 2013 libmv authors.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#include "libmv/simple_pipeline/bundle.h"
+
+#include "libmv/logging/logging.h"
+#include "libmv/simple_pipeline/camera_intrinsics.h"
+#include "libmv/simple_pipeline/reconstruction.h"
+#include "libmv/simple_pipeline/tracks.h"
+#include "testing/testing.h"
+
+namespace libmv {
+
+namespace {
+
+// Create a small scene with a handful of cameras looking at a random cloud
+// of points. Every point is visible in cameras_per_point consecutive cameras.
+void CreateSyntheticScene(int num_cameras,
+                          int num_points,
+                          int cameras_per_point,
+                          Tracks* tracks,
+                          EuclideanReconstruction* reconstruction) {
+  Mat3X X(3, num_points);
+  X.setRandom();
+
+  for (int i = 0; i < num_cameras; ++i) {
+    Mat3 R = RotationAroundY(0.05 * i) * RotationAroundX(-0.02 * i);
+    Vec3 t(0.3 * i, -0.1 * i, 5.0);
+    reconstruction->InsertCamera(i, R, t);
+
+    for (int j = 0; j < num_points; ++j) {
+      int first_camera = j % (num_cameras - cameras_per_point + 1);
+      if (i < first_camera || i >= first_camera + cameras_per_point) {
+        continue;
+      }
+      Vec3 x = R * X.col(j) + t;
+      tracks->Insert(i, j, x(0) / x(2), x(1) / x(2));
+    }
+  }
+
+  for (int j = 0; j < num_points; ++j) {
+    reconstruction->InsertPoint(j, X.col(j));
+  }
+}
+
+}  // namespace
+
+TEST(Bundle, SparseJacobianMatchesDenseJacobian) {
+  Tracks tracks;
+  EuclideanReconstruction reconstruction;
+  CreateSyntheticScene(4, 20, 4, &tracks, &reconstruction);
+
+  PolynomialCameraIntrinsics intrinsics;
+  BundleEvaluation evaluation;
+  evaluation.evaluate_jacobian = true;
+  evaluation.evaluate_sparse_jacobian = true;
+
+  EuclideanBundleCommonIntrinsics(tracks,
+                                  BUNDLE_NO_INTRINSICS,
+                                  BUNDLE_NO_CONSTRAINTS,
+                                  &reconstruction,
+                                  &intrinsics,
+                                  &evaluation);
+
+  EXPECT_EQ(4, evaluation.num_cameras);
+  EXPECT_EQ(20, evaluation.num_points);
+  EXPECT_EQ(4, evaluation.images.size());
+  EXPECT_EQ(20, evaluation.tracks.size());
+
+  // Every residual depends on one camera and one point only.
+  EXPECT_EQ(2 * 4 * 20, evaluation.sparse_jacobian.rows());
+  EXPECT_EQ(6 * 4 + 3 * 20, evaluation.sparse_jacobian.cols());
+  EXPECT_GE(2 * 4 * 20 * (6 + 3), evaluation.sparse_jacobian.nonZeros());
+
+  Mat sparse_jacobian = Mat(evaluation.sparse_jacobian);
+  EXPECT_MATRIX_NEAR(evaluation.jacobian, sparse_jacobian, 1e-12);
+}
+
+TEST(Bundle, MarginalCovariancesMatchInverseOfInformationMatrix) {
+  // Every point is seen by three of the cameras only, so the reduced camera
+  // system is sparse.
+  const int num_cameras = 8, num_points = 40;
+  Tracks tracks;
+  EuclideanReconstruction reconstruction;
+  CreateSyntheticScene(num_cameras, num_points, 3, &tracks, &reconstruction);
+
+  PolynomialCameraIntrinsics intrinsics;
+  BundleEvaluation evaluation;
+  evaluation.evaluate_jacobian = true;
+  evaluation.evaluate_covariance = true;
+
+  EuclideanBundleCommonIntrinsics(tracks,
+                                  BUNDLE_NO_INTRINSICS,
+                                  BUNDLE_NO_CONSTRAINTS,
+                                  &reconstruction,
+                                  &intrinsics,
+                                  &evaluation);
+
+  ASSERT_EQ(num_cameras, evaluation.camera_covariances.size());
+  ASSERT_EQ(num_points, evaluation.point_covariances.size());
+
+  // The information matrix J^T * J is singular along the 7 degrees of
+  // freedom of the similarity gauge, with null space Z. The covariances
+  // clamp the gauge out of the cameras, which amounts to the inverse of the
+  // information matrix with the gauge of the cameras penalized, minus the
+  // gauge itself, with Z scaled so that its camera part is orthonormal.
+  const int num_camera_parameters = 6 * num_cameras;
+  const Mat& J = evaluation.jacobian;
+  Mat H = J.transpose() * J;
+  Eigen::SelfAdjointEigenSolver<Mat> eigen_solver(H);
+  Mat Z = eigen_solver.eigenvectors().leftCols(7);
+  Eigen::HouseholderQR<Mat> qr(Z.topRows(num_camera_parameters));
+  Mat R = qr.matrixQR().topRows(7).triangularView<Eigen::Upper>();
+  Z = Z * R.inverse();
+  Mat Z_cameras = Mat::Zero(H.rows(), 7);
+  Z_cameras.topRows(num_camera_parameters) = Z.topRows(num_camera_parameters);
+  Mat covariance =
+      (H + Z_cameras * Z_cameras.transpose()).inverse() - Z * Z.transpose();
+
+  // The entries are large as the cameras are only constrained by a few
+  // points, so compare them relative to the largest one.
+  const double tolerance = 1e-8 * covariance.cwiseAbs().maxCoeff();
+
+  for (int i = 0; i < num_cameras; ++i) {
+    const Mat& camera_covariance = evaluation.camera_covariances[i];
+    EXPECT_EQ(6, camera_covariance.rows());
+    EXPECT_EQ(6, camera_covariance.cols());
+    EXPECT_MATRIX_NEAR(
+        covariance.block(6 * i, 6 * i, 6, 6), camera_covariance, tolerance);
+  }
+
+  for (int i = 0; i < num_points; ++i) {
+    const Mat3& point_covariance = evaluation.point_covariances[i];
+    EXPECT_MATRIX_NEAR(point_covariance.transpose(), point_covariance, 1e-8);
+    EXPECT_MATRIX_NEAR(
+        covariance.block(num_camera_parameters + 3 * i,
+                         num_camera_parameters + 3 * i,
+                         3,
+                         3),
+        point_covariance,
+        tolerance);
+  }
+}
+
+}  // namespace libmv
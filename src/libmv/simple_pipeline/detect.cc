@@ -24,11 +24,14 @@
 
 #include <memory.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <cmath>
 #include <queue>
 
 #include "libmv/base/scoped_ptr.h"
 #include "libmv/image/array_nd.h"
 #include "libmv/image/convolve.h"
+#include "libmv/image/corner_response.h"
 #include "libmv/image/image_converter.h"
 #include "libmv/logging/logging.h"
 #include "libmv/simple_pipeline/detect.h"
@@ -60,45 +63,6 @@ class FeatureComparison {
   }
 };
 
-// Filter the features so there are no features closer than
-// minimal distance to each other.
-// This is a naive implementation with O(n^2) asymptotic.
-void FilterFeaturesByDistance(const vector<Feature>& all_features,
-                              int min_distance,
-                              vector<Feature>* detected_features) {
-  const int min_distance_squared = min_distance * min_distance;
-
-  // Use priority queue to sort the features by their score.
-  //
-  // Do this on copy of the input features to prevent possible
-  // distortion in callee function behavior.
-  std::priority_queue<Feature, std::vector<Feature>, FeatureComparison>
-      priority_features;
-
-  for (int i = 0; i < all_features.size(); i++) {
-    priority_features.push(all_features.at(i));
-  }
-
-  while (!priority_features.empty()) {
-    bool ok = true;
-    Feature a = priority_features.top();
-
-    for (int i = 0; i < detected_features->size(); i++) {
-      Feature& b = detected_features->at(i);
-      if (Square(a.x - b.x) + Square(a.y - b.y) < min_distance_squared) {
-        ok = false;
-        break;
-      }
-    }
-
-    if (ok) {
-      detected_features->push_back(a);
-    }
-
-    priority_features.pop();
-  }
-}
-
 void DetectFAST(const FloatImage& grayscale_image,
                 const DetectOptions& options,
                 vector<Feature>* detected_features) {
@@ -107,7 +71,7 @@ void DetectFAST(const FloatImage& grayscale_image,
   const int min_trackness = options.fast_min_trackness;
   const int margin = options.margin;
   const int width = grayscale_image.Width() - 2 * margin;
-  const int height = grayscale_image.Width() - 2 * margin;
+  const int height = grayscale_image.Height() - 2 * margin;
   const int stride = grayscale_image.Width();
 
   scoped_array<unsigned char> byte_image(
@@ -197,7 +161,7 @@ void DetectMORAVEC(const FloatImage& grayscale_image,
   const unsigned char* pattern = options.moravec_pattern;
   const int count = options.moravec_max_count;
   const int width = grayscale_image.Width() - 2 * margin;
-  const int height = grayscale_image.Width() - 2 * margin;
+  const int height = grayscale_image.Height() - 2 * margin;
   const int stride = grayscale_image.Width();
 
   scoped_array<unsigned char> byte_image(
@@ -287,37 +251,29 @@ void DetectHarris(const FloatImage& grayscale_image,
   const int margin = options.margin;
   const double threshold = options.harris_threshold;
 
-  FloatImage gradient_x, gradient_y;
-  ImageDerivatives(grayscale_image, sigma, &gradient_x, &gradient_y);
+  CornerResponseOptions response_options;
+  response_options.type = HARRIS_CORNER_RESPONSE;
+  response_options.sigma = sigma;
+  response_options.harris_alpha = alpha;
 
-  FloatImage gradient_xx, gradient_yy, gradient_xy;
-  MultiplyElements(gradient_x, gradient_x, &gradient_xx);
-  MultiplyElements(gradient_y, gradient_y, &gradient_yy);
-  MultiplyElements(gradient_x, gradient_y, &gradient_xy);
+  // Only compute the response inside of the margin.
+  const int width = grayscale_image.Width() - 2 * margin;
+  const int height = grayscale_image.Height() - 2 * margin;
+  if (width <= 0 || height <= 0) {
+    return;
+  }
 
-  FloatImage gradient_xx_blurred, gradient_yy_blurred, gradient_xy_blurred;
-  ConvolveGaussian(gradient_xx, sigma, &gradient_xx_blurred);
-  ConvolveGaussian(gradient_yy, sigma, &gradient_yy_blurred);
-  ConvolveGaussian(gradient_xy, sigma, &gradient_xy_blurred);
+  FloatImage response(height, width);
+  ComputeCornerResponseInRegion(
+      grayscale_image, response_options, margin, margin, &response);
 
   vector<Feature> all_features;
-  for (int y = margin; y < gradient_xx_blurred.Height() - margin; ++y) {
-    for (int x = margin; x < gradient_xx_blurred.Width() - margin; ++x) {
-      // Construct matrix
-      //
-      //  A = [ Ix^2  Ix*Iy ]
-      //      [ Ix*Iy Iy^2  ]
-      Mat2 A;
-      A(0, 0) = gradient_xx_blurred(y, x);
-      A(1, 1) = gradient_yy_blurred(y, x);
-      A(0, 1) = A(1, 0) = gradient_xy_blurred(y, x);
-
-      double detA = A.determinant();
-      double traceA = A.trace();
-      double harris_function = detA - alpha * traceA * traceA;
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      const float harris_function = response(y, x);
       if (harris_function > threshold) {
-        all_features.push_back(
-            Feature((float)x, (float)y, (float)harris_function, 5.0f));
+        all_features.push_back(Feature(
+            (float)(x + margin), (float)(y + margin), harris_function, 5.0f));
       }
     }
   }
@@ -325,6 +281,109 @@ void DetectHarris(const FloatImage& grayscale_image,
   FilterFeaturesByDistance(all_features, min_distance, detected_features);
 }
 
+void DetectInGrayscaleImage(const FloatImage& grayscale_image,
+                            const DetectOptions& options,
+                            vector<Feature>* detected_features) {
+  if (options.type == DetectOptions::FAST) {
+    DetectFAST(grayscale_image, options, detected_features);
+  } else if (options.type == DetectOptions::MORAVEC) {
+    DetectMORAVEC(grayscale_image, options, detected_features);
+  } else if (options.type == DetectOptions::HARRIS) {
+    DetectHarris(grayscale_image, options, detected_features);
+  } else {
+    LOG(FATAL) << "Unknown detector has been passed to featur detection";
+  }
+}
+
+// Detectors need some context around a pixel to compute its score. This
+// border is enough for gradients and blur of the Harris detector and for
+// the circle and non-maximum suppression of the FAST detector.
+const int kTileBorder = 16;
+
+// Split the image into tiles and detect features in them in parallel.
+//
+// Every tile is passed to the detector with a border around it, so features
+// close to the tile boundaries get the same score as if the whole image was
+// processed. Features detected in the border are ignored, they belong to the
+// neighbour tiles.
+void DetectTiled(const FloatImage& grayscale_image,
+                 const DetectOptions& options,
+                 vector<Feature>* detected_features) {
+  const int margin = options.margin;
+  const int tile_size = options.tile_size;
+  const int width = grayscale_image.Width();
+  const int height = grayscale_image.Height();
+
+  // Distance between features is only checked when all tiles are merged.
+  DetectOptions tile_options = options;
+  tile_options.margin = 0;
+  tile_options.min_distance = 0;
+  tile_options.tile_size = 0;
+
+  vector<int> tiles_x0, tiles_y0;
+  for (int y = margin; y < height - margin; y += tile_size) {
+    for (int x = margin; x < width - margin; x += tile_size) {
+      tiles_x0.push_back(x);
+      tiles_y0.push_back(y);
+    }
+  }
+
+  int num_tiles = tiles_x0.size();
+  std::vector<vector<Feature>> tiles_features(num_tiles);
+
+#if defined(_OPENMP)
+#  pragma omp parallel for schedule(dynamic)
+#endif
+  for (int i = 0; i < num_tiles; ++i) {
+    const int x0 = tiles_x0[i], y0 = tiles_y0[i];
+    const int x1 = std::min(x0 + tile_size, width - margin);
+    const int y1 = std::min(y0 + tile_size, height - margin);
+
+    const int crop_x0 = std::max(x0 - kTileBorder, 0);
+    const int crop_y0 = std::max(y0 - kTileBorder, 0);
+    const int crop_x1 = std::min(x1 + kTileBorder, width);
+    const int crop_y1 = std::min(y1 + kTileBorder, height);
+
+    const FloatImage cropped_image = grayscale_image.Crop(
+        crop_y0, crop_x0, crop_y1 - crop_y0, crop_x1 - crop_x0);
+
+    vector<Feature> cropped_features;
+    DetectInGrayscaleImage(cropped_image, tile_options, &cropped_features);
+
+    vector<Feature> tile_features;
+    for (int j = 0; j < cropped_features.size(); ++j) {
+      const Feature& feature = cropped_features[j];
+      const float x = feature.x + crop_x0, y = feature.y + crop_y0;
+      if (x >= x0 && x < x1 && y >= y0 && y < y1) {
+        tile_features.push_back(Feature(x, y, feature.score, feature.size));
+      }
+    }
+
+    if (options.max_features_per_tile > 0) {
+      FilterFeaturesByDistance(
+          tile_features, options.min_distance, &tiles_features[i]);
+      if (tiles_features[i].size() > options.max_features_per_tile) {
+        tiles_features[i].erase(
+            tiles_features[i].begin() + options.max_features_per_tile,
+            tiles_features[i].end());
+      }
+    } else {
+      tiles_features[i].swap(tile_features);
+    }
+  }
+
+  // Merge in the order of tiles, so the result does not depend on the
+  // number of threads.
+  vector<Feature> all_features;
+  for (int i = 0; i < num_tiles; ++i) {
+    all_features.insert(
+        all_features.end(), tiles_features[i].begin(), tiles_features[i].end());
+  }
+
+  FilterFeaturesByDistance(
+      all_features, options.min_distance, detected_features);
+}
+
 }  // namespace
 
 DetectOptions::DetectOptions()
@@ -334,7 +393,9 @@ DetectOptions::DetectOptions()
       fast_min_trackness(kDefaultFastMinTrackness),
       moravec_max_count(0),
       moravec_pattern(NULL),
-      harris_threshold(kDefaultHarrisThreshold) {
+      harris_threshold(kDefaultHarrisThreshold),
+      tile_size(0),
+      max_features_per_tile(0) {
 }
 
 void Detect(const FloatImage& image,
@@ -350,14 +411,117 @@ void Detect(const FloatImage& image,
     grayscale_image = image;
   }
 
-  if (options.type == DetectOptions::FAST) {
-    DetectFAST(grayscale_image, options, detected_features);
-  } else if (options.type == DetectOptions::MORAVEC) {
-    DetectMORAVEC(grayscale_image, options, detected_features);
-  } else if (options.type == DetectOptions::HARRIS) {
-    DetectHarris(grayscale_image, options, detected_features);
+  if (options.tile_size > 0 && options.type != DetectOptions::MORAVEC) {
+    DetectTiled(grayscale_image, options, detected_features);
   } else {
-    LOG(FATAL) << "Unknown detector has been passed to featur detection";
+    DetectInGrayscaleImage(grayscale_image, options, detected_features);
+  }
+}
+
+void FilterFeaturesByDistance(const vector<Feature>& all_features,
+                              int min_distance,
+                              vector<Feature>* detected_features) {
+  const int min_distance_squared = min_distance * min_distance;
+
+  if (all_features.empty()) {
+    return;
+  }
+
+  // Use priority queue to sort the features by their score.
+  //
+  // Do this on copy of the input features to prevent possible
+  // distortion in callee function behavior.
+  std::priority_queue<Feature, std::vector<Feature>, FeatureComparison>
+      priority_features;
+
+  for (int i = 0; i < all_features.size(); i++) {
+    priority_features.push(all_features.at(i));
+  }
+
+  // Accepted features are stored in a uniform grid with cells larger than
+  // the minimal distance, so a candidate only needs to be checked against
+  // features from the 3x3 cells around it.
+  //
+  // Cells are also not smaller than the average area per feature, so the
+  // grid never has considerably more cells than there are features.
+  const int num_detected_features = detected_features->size();
+  float min_x = all_features[0].x, max_x = all_features[0].x;
+  float min_y = all_features[0].y, max_y = all_features[0].y;
+  for (int i = 0; i < all_features.size(); i++) {
+    min_x = std::min(min_x, all_features[i].x);
+    max_x = std::max(max_x, all_features[i].x);
+    min_y = std::min(min_y, all_features[i].y);
+    max_y = std::max(max_y, all_features[i].y);
+  }
+  for (int i = 0; i < num_detected_features; i++) {
+    const Feature& feature = detected_features->at(i);
+    min_x = std::min(min_x, feature.x);
+    max_x = std::max(max_x, feature.x);
+    min_y = std::min(min_y, feature.y);
+    max_y = std::max(max_y, feature.y);
+  }
+
+  // One extra pixel keeps features closer than the minimal distance in the
+  // neighbour cells regardless of the rounding.
+  const int num_features = all_features.size() + num_detected_features;
+  const double area = ((double)max_x - min_x + 1) * ((double)max_y - min_y + 1);
+  const double cell_size =
+      std::max(min_distance + 1.0, sqrt(area / num_features));
+  const int grid_width = (int)(((double)max_x - min_x) / cell_size) + 1;
+  const int grid_height = (int)(((double)max_y - min_y) / cell_size) + 1;
+
+  // Features of every cell form a linked list: cell_first is an index of
+  // the first feature in detected_features and next_in_cell links it to the
+  // next feature of the same cell.
+  vector<int> cell_first(grid_width * grid_height, -1);
+  vector<int> next_in_cell;
+  next_in_cell.reserve(num_features);
+
+  auto cell_for_feature = [&](const Feature& feature, int* x, int* y) {
+    *x = (int)(((double)feature.x - min_x) / cell_size);
+    *y = (int)(((double)feature.y - min_y) / cell_size);
+  };
+
+  for (int i = 0; i < num_detected_features; i++) {
+    int cell_x, cell_y;
+    cell_for_feature(detected_features->at(i), &cell_x, &cell_y);
+    int cell = cell_y * grid_width + cell_x;
+    next_in_cell.push_back(cell_first[cell]);
+    cell_first[cell] = i;
+  }
+
+  while (!priority_features.empty()) {
+    bool ok = true;
+    Feature a = priority_features.top();
+
+    int cell_x, cell_y;
+    cell_for_feature(a, &cell_x, &cell_y);
+
+    const int x0 = std::max(cell_x - 1, 0);
+    const int x1 = std::min(cell_x + 1, grid_width - 1);
+    const int y0 = std::max(cell_y - 1, 0);
+    const int y1 = std::min(cell_y + 1, grid_height - 1);
+    for (int y = y0; ok && y <= y1; y++) {
+      for (int x = x0; ok && x <= x1; x++) {
+        int i = cell_first[y * grid_width + x];
+        for (; i != -1; i = next_in_cell[i]) {
+          Feature& b = detected_features->at(i);
+          if (Square(a.x - b.x) + Square(a.y - b.y) < min_distance_squared) {
+            ok = false;
+            break;
+          }
+        }
+      }
+    }
+
+    if (ok) {
+      int cell = cell_y * grid_width + cell_x;
+      next_in_cell.push_back(cell_first[cell]);
+      cell_first[cell] = detected_features->size();
+      detected_features->push_back(a);
+    }
+
+    priority_features.pop();
   }
 }
 
@@ -95,6 +95,19 @@ struct DetectOptions {
   // Threshold value of the Harris function to add new featrue
   // to the result.
   double harris_threshold;
+
+  // Size in pixels of square tiles the image is split into. Tiles are
+  // processed in parallel and then merged, so features from different
+  // tiles also respect the minimal distance.
+  //
+  // Zero means the whole image is processed at once. Not used by MORAVEC
+  // detector, which needs to see scores of the whole image.
+  int tile_size;
+
+  // Maximum number of features to detect in a single tile, which gives even
+  // spatial distribution of the features. Zero means there is no limit.
+  // Only used when tile_size is non-zero.
+  int max_features_per_tile;
 };
 
 // Detect features on a given image using given detector options.
@@ -105,6 +118,16 @@ void Detect(const FloatImage& image,
             const DetectOptions& options,
             vector<Feature>* detected_features);
 
+// Filter the features so there are no features closer than minimal distance
+// to each other, preferring features with higher score.
+//
+// Accepted features are appended to detected_features in the order of
+// decreasing score. Features which are already in detected_features are
+// kept and new features are also checked against them.
+void FilterFeaturesByDistance(const vector<Feature>& all_features,
+                              int min_distance,
+                              vector<Feature>* detected_features);
+
 std::ostream& operator<<(std::ostream& os, const Feature& feature);
 
 }  // namespace libmv
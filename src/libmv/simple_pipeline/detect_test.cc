@@ -20,6 +20,9 @@
 
 #include "libmv/simple_pipeline/detect.h"
 
+#include <cstdlib>
+#include <queue>
+
 #include "libmv/logging/logging.h"
 #include "testing/testing.h"
 
@@ -135,6 +138,81 @@ void PreformSingleTriangleTest(const DetectOptions& options) {
   CheckExpectedFeatures(detected_features, expected_features);
 }
 
+// Image with a number of dark squares on a bright background, so there are
+// features in all the tiles and on their boundaries.
+void CreateSquaresImage(FloatImage* image) {
+  image->Resize(50, 70);
+  image->fill(1.0);
+  for (int y = 4; y + 6 < image->Height(); y += 9) {
+    for (int x = 5; x + 6 < image->Width(); x += 11) {
+      for (int i = 0; i < 6; ++i) {
+        for (int j = 0; j < 6; ++j) {
+          (*image)(y + i, x + j) = 0.0;
+        }
+      }
+    }
+  }
+}
+
+// Reference implementation of the filtering, which checks candidates against
+// all the accepted features.
+void FilterFeaturesByDistanceBruteForce(const vector<Feature>& all_features,
+                                        int min_distance,
+                                        vector<Feature>* detected_features) {
+  class FeatureComparison {
+   public:
+    bool operator()(const Feature& left, const Feature& right) const {
+      return right.score > left.score;
+    }
+  };
+
+  std::priority_queue<Feature, std::vector<Feature>, FeatureComparison>
+      priority_features;
+  for (int i = 0; i < all_features.size(); i++) {
+    priority_features.push(all_features[i]);
+  }
+
+  while (!priority_features.empty()) {
+    Feature a = priority_features.top();
+    bool ok = true;
+    for (int i = 0; i < detected_features->size(); i++) {
+      Feature& b = detected_features->at(i);
+      if (Square(a.x - b.x) + Square(a.y - b.y) <
+          min_distance * min_distance) {
+        ok = false;
+        break;
+      }
+    }
+    if (ok) {
+      detected_features->push_back(a);
+    }
+    priority_features.pop();
+  }
+}
+
+void CreateRandomFeatures(int num_features,
+                          int width,
+                          int height,
+                          vector<Feature>* features) {
+  for (int i = 0; i < num_features; ++i) {
+    // Use a small set of scores, so there are plenty of ties.
+    features->push_back(Feature(rand() % width,
+                                rand() % height,
+                                rand() % 16,
+                                5.0));
+  }
+}
+
+void CheckSameFeatures(const vector<Feature>& detected_features,
+                       const vector<Feature>& expected_features) {
+  ASSERT_EQ(expected_features.size(), detected_features.size());
+  for (int i = 0; i < expected_features.size(); ++i) {
+    EXPECT_EQ(expected_features[i].x, detected_features[i].x);
+    EXPECT_EQ(expected_features[i].y, detected_features[i].y);
+    EXPECT_EQ(expected_features[i].score, detected_features[i].score);
+  }
+}
+
 }  // namespace
 
 #ifndef LIBMV_NO_FAST_DETECTOR
@@ -224,8 +302,82 @@ TEST(Detect, HarrisSingleTriangleTest) {
   PreformSingleTriangleTest(options);
 }
 
-// TODO(sergey): Add tests for margin option.
+TEST(Detect, HarrisTiledMatchesWholeImage) {
+  FloatImage image;
+  CreateSquaresImage(&image);
+
+  DetectOptions options;
+  options.type = DetectOptions::HARRIS;
+  options.margin = 3;
+  options.min_distance = 0;
+  options.harris_threshold = 1e-3;
 
-// TODO(sergey): Add tests for min_distance option.
+  vector<Feature> expected_features;
+  Detect(image, options, &expected_features);
+  EXPECT_LT(0, expected_features.size());
+
+  options.tile_size = 16;
+  vector<Feature> detected_features;
+  Detect(image, options, &detected_features);
+
+  CheckExpectedFeatures(detected_features, expected_features);
+}
+
+TEST(Detect, HarrisTiledMaxFeaturesPerTile) {
+  FloatImage image;
+  CreateSquaresImage(&image);
+
+  DetectOptions options;
+  options.type = DetectOptions::HARRIS;
+  options.margin = 3;
+  options.min_distance = 0;
+  options.harris_threshold = 1e-3;
+  options.tile_size = 16;
+  options.max_features_per_tile = 1;
+
+  vector<Feature> detected_features;
+  Detect(image, options, &detected_features);
+
+  // There are 3x4 tiles, all of them containing corners of the squares.
+  EXPECT_EQ(12, detected_features.size());
+}
+
+TEST(Detect, FilterFeaturesByDistanceMatchesBruteForce) {
+  srand(1);
+  int min_distances[] = {0, 1, 3, 10, 50};
+  for (int i = 0; i < sizeof(min_distances) / sizeof(*min_distances); ++i) {
+    vector<Feature> features;
+    CreateRandomFeatures(2000, 320, 240, &features);
+
+    vector<Feature> expected_features;
+    FilterFeaturesByDistanceBruteForce(
+        features, min_distances[i], &expected_features);
+
+    vector<Feature> detected_features;
+    FilterFeaturesByDistance(features, min_distances[i], &detected_features);
+
+    CheckSameFeatures(detected_features, expected_features);
+  }
+}
+
+TEST(Detect, FilterFeaturesByDistanceKeepsDetectedFeatures) {
+  srand(2);
+  vector<Feature> previous_features, features;
+  CreateRandomFeatures(100, 640, 480, &previous_features);
+  CreateRandomFeatures(1000, 640, 480, &features);
+  // Make sure the previous features are not all inside of the new features
+  // bounding box.
+  previous_features.push_back(Feature(-100.0, 1000.0, 1.0, 5.0));
+
+  vector<Feature> expected_features = previous_features;
+  FilterFeaturesByDistanceBruteForce(features, 15, &expected_features);
+
+  vector<Feature> detected_features = previous_features;
+  FilterFeaturesByDistance(features, 15, &detected_features);
+
+  CheckSameFeatures(detected_features, expected_features);
+}
+
+// TODO(sergey): Add tests for margin option.
 
 }  // namespace libmv
@@ -50,6 +50,16 @@ namespace libmv {
 bool EuclideanIntersect(const vector<Marker>& markers,
                         EuclideanReconstruction* reconstruction);
 
+/*!
+    Same as above, but the cameras are only read from \a reconstruction and
+    the intersected point is returned in \a point instead of being inserted.
+    This allows intersecting many tracks against the same reconstruction in
+    parallel.
+*/
+bool EuclideanIntersect(const vector<Marker>& markers,
+                        const EuclideanReconstruction& reconstruction,
+                        EuclideanPoint* point);
+
 /*!
     Estimate the homogeneous coordinates of a track by intersecting rays.
 
@@ -74,6 +84,14 @@ bool EuclideanIntersect(const vector<Marker>& markers,
 bool ProjectiveIntersect(const vector<Marker>& markers,
                          ProjectiveReconstruction* reconstruction);
 
+/*!
+    Same as above, but the cameras are only read from \a reconstruction and
+    the intersected point is returned in \a point instead of being inserted.
+*/
+bool ProjectiveIntersect(const vector<Marker>& markers,
+                         const ProjectiveReconstruction& reconstruction,
+                         ProjectivePoint* point);
+
 }  // namespace libmv
 
 #endif  // LIBMV_SIMPLE_PIPELINE_INTERSECT_H
@@ -18,9 +18,12 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
 // IN THE SOFTWARE.
 
+// Ceres includes Eigen/StdVector, which specializes std::vector for the
+// aligned allocator and has to be seen before libmv::vector is instantiated.
+#include "ceres/ceres.h"
+
 #include "libmv/simple_pipeline/keyframe_selection.h"
 
-#include "ceres/ceres.h"
 #include "libmv/logging/logging.h"
 #include "libmv/multiview/fundamental.h"
 #include "libmv/multiview/homography.h"
@@ -125,11 +128,295 @@ void FilterZeroWeightMarkersFromTracks(const Tracks& tracks,
   }
 }
 
+// Keyframe candidate which passed the correspondence ratio constraint.
+struct KeyframeCandidate {
+  int image;
+
+  // Markers of tracks visible in both current keyframe and candidate.
+  vector<Marker> tracked_markers;
+
+  // Correspondences in normalized space.
+  Mat x1, x2;
+
+  bool has_estimate;
+  KeyframeSelectionCache::TwoViewEstimate estimate;
+
+  // Results of the evaluation.
+  bool passed_gric;
+  double success_intersects_factor;
+  bool is_inversed;
+  double Sc;
+
+  // Two-frames reconstruction, from which the reconstruction error is
+  // estimated.
+  EuclideanReconstruction reconstruction;
+};
+
+void EstimateTwoViewModels(const Mat& x1,
+                           const Mat& x2,
+                           const Mat3& N,
+                           const Mat3& N_inverse,
+                           KeyframeSelectionCache::TwoViewEstimate* estimate) {
+  // Estimate homography using default options.
+  EstimateHomographyOptions estimate_homography_options;
+  EstimateHomography2DFromCorrespondences(
+      x1, x2, estimate_homography_options, &estimate->H);
+
+  // Convert homography to original pixel space.
+  estimate->H = N_inverse * estimate->H * N;
+
+  EstimateFundamentalOptions estimate_fundamental_options;
+  EstimateFundamentalFromCorrespondences(
+      x1, x2, estimate_fundamental_options, &estimate->F);
+
+  // Convert fundamental to original pixel space.
+  estimate->F = N_inverse * estimate->F * N;
+}
+
+// Run the checks on the candidate which do not depend on other candidates:
+// GRIC and two-frames reconstruction, which gives the ratio of successful
+// intersections.
+//
+// Stops as soon as the candidate is rejected.
+void EvaluateKeyframeCandidate(const CameraIntrinsics& intrinsics,
+                               const Mat3& N,
+                               const Mat3& N_inverse,
+                               int current_keyframe,
+                               KeyframeCandidate* candidate) {
+  const int candidate_image = candidate->image;
+  const vector<Marker>& tracked_markers = candidate->tracked_markers;
+  const Mat& x1 = candidate->x1;
+  const Mat& x2 = candidate->x2;
+
+  candidate->passed_gric = false;
+  candidate->is_inversed = false;
+
+  if (!candidate->has_estimate) {
+    EstimateTwoViewModels(x1, x2, N, N_inverse, &candidate->estimate);
+    candidate->has_estimate = true;
+  }
+
+  const Mat3& H = candidate->estimate.H;
+  const Mat3& F = candidate->estimate.F;
+
+  // TODO(sergey): STEP 2: Discard outlier matches
+
+  // STEP 3: Geometric Robust Information Criteria
+
+  // Compute error values for homography and fundamental matrices
+  Vec H_e, F_e;
+  H_e.resize(x1.cols());
+  F_e.resize(x1.cols());
+  for (int i = 0; i < x1.cols(); i++) {
+    Vec2 current_x1, current_x2;
+
+    intrinsics.NormalizedToImageSpace(
+        x1(0, i), x1(1, i), &current_x1(0), &current_x1(1));
+
+    intrinsics.NormalizedToImageSpace(
+        x2(0, i), x2(1, i), &current_x2(0), &current_x2(1));
+
+    H_e(i) = SymmetricGeometricDistance(H, current_x1, current_x2);
+    F_e(i) = SymmetricEpipolarDistance(F, current_x1, current_x2);
+  }
+
+  LG << "H_e: " << H_e.transpose();
+  LG << "F_e: " << F_e.transpose();
+
+  // Degeneracy constraint
+  double GRIC_H = GRIC(H_e, 2, 8, 4);
+  double GRIC_F = GRIC(F_e, 3, 7, 4);
+
+  LG << "GRIC values for frames " << current_keyframe << " and "
+     << candidate_image << ", H-GRIC: " << GRIC_H << ", F-GRIC: " << GRIC_F;
+
+  if (GRIC_H <= GRIC_F)
+    return;
+
+  // TODO(sergey): STEP 4: PELC criterion
+
+  // STEP 5: Estimation of reconstruction error
+  //
+  // Uses paper Keyframe Selection for Camera Motion and Structure
+  // Estimation from Multiple Views
+  // Uses ftp://ftp.tnt.uni-hannover.de/pub/papers/2004/ECCV2004-TTHBAW.pdf
+  // Basically, equation (15)
+  //
+  // TODO(sergey): separate all the constraints into functions,
+  //               this one is getting to much cluttered already
+
+  // Definitions in equation (15):
+  // - I is the number of 3D feature points
+  // - A is the number of essential parameters of one camera
+
+  EuclideanReconstruction& reconstruction = candidate->reconstruction;
+
+  // The F matrix should be an E matrix, but squash it just to be sure
+
+  // Reconstruction should happen using normalized fundamental matrix
+  Mat3 F_normal = N * F * N_inverse;
+
+  Mat3 E;
+  FundamentalToEssential(F_normal, &E);
+
+  // Recover motion between the two images. Since this function assumes a
+  // calibrated camera, use the identity for K
+  Mat3 R;
+  Vec3 t;
+  Mat3 K = Mat3::Identity();
+
+  if (!MotionFromEssentialAndCorrespondence(
+          E, K, x1.col(0), K, x2.col(0), &R, &t)) {
+    LG << "Failed to compute R and t from E and K";
+    return;
+  }
+
+  candidate->passed_gric = true;
+
+  LG << "Camera transform between frames " << current_keyframe << " and "
+     << candidate_image << ":\nR:\n"
+     << R << "\nt:" << t.transpose();
+
+  // First camera is identity, second one is relative to it
+  reconstruction.InsertCamera(current_keyframe, Mat3::Identity(), Vec3::Zero());
+  reconstruction.InsertCamera(candidate_image, R, t);
+
+  // Reconstruct 3D points
+  int intersects_total = 0, intersects_success = 0;
+  for (int i = 0; i < tracked_markers.size(); i++) {
+    if (!reconstruction.PointForTrack(tracked_markers[i].track)) {
+      vector<Marker> reconstructed_markers;
+
+      int track = tracked_markers[i].track;
+
+      reconstructed_markers.push_back(tracked_markers[i]);
+
+      // We know there're always only two markers for a track
+      // Also, we're using brute-force search because we don't
+      // actually know about markers layout in a list, but
+      // at this moment this cycle will run just once, which
+      // is not so big deal
+
+      for (int j = i + 1; j < tracked_markers.size(); j++) {
+        if (tracked_markers[j].track == track) {
+          reconstructed_markers.push_back(tracked_markers[j]);
+          break;
+        }
+      }
+
+      intersects_total++;
+
+      if (EuclideanIntersect(reconstructed_markers, &reconstruction)) {
+        LG << "Ran Intersect() for track " << track;
+        intersects_success++;
+      } else {
+        LG << "Filed to intersect track " << track;
+      }
+    }
+  }
+
+  candidate->success_intersects_factor =
+      (double)intersects_success / intersects_total;
+}
+
+// Estimate the reconstruction error of the candidate which passed all the
+// other checks. This bundles the two-frames reconstruction and inverts the
+// information matrix, which is the most expensive part of the evaluation.
+void EstimateKeyframeCandidateError(int current_keyframe,
+                                    KeyframeCandidate* candidate) {
+  const int candidate_image = candidate->image;
+  EuclideanReconstruction& reconstruction = candidate->reconstruction;
+
+  Tracks two_frames_tracks(candidate->tracked_markers);
+  PolynomialCameraIntrinsics empty_intrinsics;
+  BundleEvaluation evaluation;
+  evaluation.evaluate_jacobian = true;
+
+  EuclideanBundleCommonIntrinsics(two_frames_tracks,
+                                  BUNDLE_NO_INTRINSICS,
+                                  BUNDLE_NO_CONSTRAINTS,
+                                  &reconstruction,
+                                  &empty_intrinsics,
+                                  &evaluation);
+
+  Mat& jacobian = evaluation.jacobian;
+
+  Mat JT_J = jacobian.transpose() * jacobian;
+  // There are 7 degrees of freedom, so clamp them out.
+  Mat JT_J_inv = PseudoInverseWithClampedEigenvalues(JT_J, 7);
+
+  Mat temp_derived = JT_J * JT_J_inv * JT_J;
+  bool is_inversed = (temp_derived - JT_J).cwiseAbs2().sum() <
+                     1e-4 * std::min(temp_derived.cwiseAbs2().sum(),
+                                     JT_J.cwiseAbs2().sum());
+
+  LG << "Check on inversed: " << (is_inversed ? "true" : "false")
+     << ", det(JT_J): " << JT_J.determinant();
+
+  if (!is_inversed) {
+    return;
+  }
+
+  candidate->is_inversed = true;
+
+  Mat Sigma_P;
+  Sigma_P = JT_J_inv.bottomRightCorner(evaluation.num_points * 3,
+                                       evaluation.num_points * 3);
+
+  int I = evaluation.num_points;
+  int A = 12;
+
+  candidate->Sc = static_cast<double>(I + A) / Square(3 * I) * Sigma_P.trace();
+
+  LG << "Expected estimation error between " << current_keyframe << " and "
+     << candidate_image << ": " << candidate->Sc;
+}
+
 }  // namespace
 
-void SelectKeyframesBasedOnGRICAndVariance(const Tracks& _tracks,
+KeyframeSelectionOptions::KeyframeSelectionOptions()
+    : min_correspondence_ratio(0.8), max_correspondence_ratio(1.0) {
+}
+
+bool KeyframeSelectionCache::Lookup(int image1,
+                                    int image2,
+                                    TwoViewEstimate* estimate) const {
+  map<std::pair<int, int>, TwoViewEstimate>::const_iterator it =
+      estimates_.find(std::make_pair(image1, image2));
+  if (it == estimates_.end()) {
+    return false;
+  }
+  *estimate = it->second;
+  return true;
+}
+
+void KeyframeSelectionCache::Insert(int image1,
+                                    int image2,
+                                    const TwoViewEstimate& estimate) {
+  estimates_[std::make_pair(image1, image2)] = estimate;
+}
+
+void KeyframeSelectionCache::Clear() {
+  estimates_.clear();
+}
+
+int KeyframeSelectionCache::NumEstimates() const {
+  return estimates_.size();
+}
+
+void SelectKeyframesBasedOnGRICAndVariance(const Tracks& tracks,
                                            const CameraIntrinsics& intrinsics,
                                            vector<int>& keyframes) {
+  SelectKeyframesBasedOnGRICAndVariance(
+      tracks, intrinsics, KeyframeSelectionOptions(), NULL, keyframes);
+}
+
+void SelectKeyframesBasedOnGRICAndVariance(
+    const Tracks& _tracks,
+    const CameraIntrinsics& intrinsics,
+    const KeyframeSelectionOptions& options,
+    KeyframeSelectionCache* cache,
+    vector<int>& keyframes) {
   // Mirza Tahir Ahmed, Matthew N. Dailey
   // Robust key frame extraction for 3D reconstruction from video streams
   //
@@ -142,13 +429,8 @@ void SelectKeyframesBasedOnGRICAndVariance(const Tracks& _tracks,
   int next_keyframe = 1;
   int number_keyframes = 0;
 
-  // Limit correspondence ratio from both sides.
-  // On the one hand if number of correspondent features is too low,
-  // triangulation will suffer.
-  // On the other hand high correspondence likely means short baseline.
-  // which also will affect om accuracy
-  const double Tmin = 0.8;
-  const double Tmax = 1.0;
+  const double Tmin = options.min_correspondence_ratio;
+  const double Tmax = options.max_correspondence_ratio;
 
   Mat3 N = IntrinsicsNormalizationMatrix(intrinsics);
   Mat3 N_inverse = N.inverse();
@@ -165,6 +447,11 @@ void SelectKeyframesBasedOnGRICAndVariance(const Tracks& _tracks,
     number_keyframes++;
     next_keyframe = -1;
 
+    // STEP 1: Correspondence ratio constraint.
+    //
+    // This is cheap, so it is done for all candidates upfront, leaving only
+    // candidates which are worth of further evaluation.
+    std::vector<KeyframeCandidate> candidates;
     for (int candidate_image = current_keyframe + 1;
          candidate_image <= max_image;
          candidate_image++) {
@@ -189,7 +476,6 @@ void SelectKeyframesBasedOnGRICAndVariance(const Tracks& _tracks,
       if (x1.cols() < 8 || x2.cols() < 8)
         continue;
 
-      // STEP 1: Correspondence ratio constraint
       int Tc = tracked_markers.size();
       int Tf = all_markers.size();
       double Rc = static_cast<double>(Tc) / Tf;
@@ -200,200 +486,80 @@ void SelectKeyframesBasedOnGRICAndVariance(const Tracks& _tracks,
       if (Rc < Tmin || Rc > Tmax)
         continue;
 
-      Mat3 H, F;
-
-      // Estimate homography using default options.
-      EstimateHomographyOptions estimate_homography_options;
-      EstimateHomography2DFromCorrespondences(
-          x1, x2, estimate_homography_options, &H);
-
-      // Convert homography to original pixel space.
-      H = N_inverse * H * N;
-
-      EstimateFundamentalOptions estimate_fundamental_options;
-      EstimateFundamentalFromCorrespondences(
-          x1, x2, estimate_fundamental_options, &F);
-
-      // Convert fundamental to original pixel space.
-      F = N_inverse * F * N;
-
-      // TODO(sergey): STEP 2: Discard outlier matches
-
-      // STEP 3: Geometric Robust Information Criteria
-
-      // Compute error values for homography and fundamental matrices
-      Vec H_e, F_e;
-      H_e.resize(x1.cols());
-      F_e.resize(x1.cols());
-      for (int i = 0; i < x1.cols(); i++) {
-        Vec2 current_x1, current_x2;
+      KeyframeCandidate candidate;
+      candidate.image = candidate_image;
+      candidate.tracked_markers = tracked_markers;
+      candidate.x1 = x1;
+      candidate.x2 = x2;
+      candidate.has_estimate =
+          cache && cache->Lookup(
+                       current_keyframe, candidate_image, &candidate.estimate);
+      candidates.push_back(candidate);
+    }
 
-        intrinsics.NormalizedToImageSpace(
-            x1(0, i), x1(1, i), &current_x1(0), &current_x1(1));
+    // Evaluate all the remaining candidates in parallel.
+    int num_candidates = candidates.size();
+#if defined(_OPENMP)
+#  pragma omp parallel for schedule(dynamic)
+#endif
+    for (int i = 0; i < num_candidates; ++i) {
+      EvaluateKeyframeCandidate(
+          intrinsics, N, N_inverse, current_keyframe, &candidates[i]);
+    }
 
-        intrinsics.NormalizedToImageSpace(
-            x2(0, i), x2(1, i), &current_x2(0), &current_x2(1));
+    // A candidate needs at least as good ratio of successful intersections
+    // as all the candidates before it. This is checked in the order of
+    // images, so only the candidates which would have been bundled when
+    // evaluated one after another are bundled.
+    std::vector<int> bundled_candidates;
+    for (int i = 0; i < num_candidates; ++i) {
+      const KeyframeCandidate& candidate = candidates[i];
 
-        H_e(i) = SymmetricGeometricDistance(H, current_x1, current_x2);
-        F_e(i) = SymmetricEpipolarDistance(F, current_x1, current_x2);
+      if (cache) {
+        cache->Insert(current_keyframe, candidate.image, candidate.estimate);
       }
 
-      LG << "H_e: " << H_e.transpose();
-      LG << "F_e: " << F_e.transpose();
-
-      // Degeneracy constraint
-      double GRIC_H = GRIC(H_e, 2, 8, 4);
-      double GRIC_F = GRIC(F_e, 3, 7, 4);
-
-      LG << "GRIC values for frames " << current_keyframe << " and "
-         << candidate_image << ", H-GRIC: " << GRIC_H << ", F-GRIC: " << GRIC_F;
-
-      if (GRIC_H <= GRIC_F)
+      if (!candidate.passed_gric)
         continue;
 
-      // TODO(sergey): STEP 4: PELC criterion
-
-      // STEP 5: Estimation of reconstruction error
-      //
-      // Uses paper Keyframe Selection for Camera Motion and Structure
-      // Estimation from Multiple Views
-      // Uses ftp://ftp.tnt.uni-hannover.de/pub/papers/2004/ECCV2004-TTHBAW.pdf
-      // Basically, equation (15)
-      //
-      // TODO(sergey): separate all the constraints into functions,
-      //               this one is getting to much cluttered already
-
-      // Definitions in equation (15):
-      // - I is the number of 3D feature points
-      // - A is the number of essential parameters of one camera
-
-      EuclideanReconstruction reconstruction;
-
-      // The F matrix should be an E matrix, but squash it just to be sure
-
-      // Reconstruction should happen using normalized fundamental matrix
-      Mat3 F_normal = N * F * N_inverse;
-
-      Mat3 E;
-      FundamentalToEssential(F_normal, &E);
-
-      // Recover motion between the two images. Since this function assumes a
-      // calibrated camera, use the identity for K
-      Mat3 R;
-      Vec3 t;
-      Mat3 K = Mat3::Identity();
-
-      if (!MotionFromEssentialAndCorrespondence(
-              E, K, x1.col(0), K, x2.col(0), &R, &t)) {
-        LG << "Failed to compute R and t from E and K";
+      if (candidate.success_intersects_factor <
+          success_intersects_factor_best) {
+        LG << "Skip keyframe candidate " << candidate.image
+           << " because of lower successful intersections ratio";
         continue;
       }
 
-      LG << "Camera transform between frames " << current_keyframe << " and "
-         << candidate_image << ":\nR:\n"
-         << R << "\nt:" << t.transpose();
-
-      // First camera is identity, second one is relative to it
-      reconstruction.InsertCamera(
-          current_keyframe, Mat3::Identity(), Vec3::Zero());
-      reconstruction.InsertCamera(candidate_image, R, t);
-
-      // Reconstruct 3D points
-      int intersects_total = 0, intersects_success = 0;
-      for (int i = 0; i < tracked_markers.size(); i++) {
-        if (!reconstruction.PointForTrack(tracked_markers[i].track)) {
-          vector<Marker> reconstructed_markers;
-
-          int track = tracked_markers[i].track;
-
-          reconstructed_markers.push_back(tracked_markers[i]);
-
-          // We know there're always only two markers for a track
-          // Also, we're using brute-force search because we don't
-          // actually know about markers layout in a list, but
-          // at this moment this cycle will run just once, which
-          // is not so big deal
-
-          for (int j = i + 1; j < tracked_markers.size(); j++) {
-            if (tracked_markers[j].track == track) {
-              reconstructed_markers.push_back(tracked_markers[j]);
-              break;
-            }
-          }
-
-          intersects_total++;
-
-          if (EuclideanIntersect(reconstructed_markers, &reconstruction)) {
-            LG << "Ran Intersect() for track " << track;
-            intersects_success++;
-          } else {
-            LG << "Filed to intersect track " << track;
-          }
-        }
-      }
-
-      double success_intersects_factor =
-          (double)intersects_success / intersects_total;
-
-      if (success_intersects_factor < success_intersects_factor_best) {
-        LG << "Skip keyframe candidate because of "
-              "lower successful intersections ratio";
-
-        continue;
-      }
-
-      success_intersects_factor_best = success_intersects_factor;
-
-      Tracks two_frames_tracks(tracked_markers);
-      PolynomialCameraIntrinsics empty_intrinsics;
-      BundleEvaluation evaluation;
-      evaluation.evaluate_jacobian = true;
-
-      EuclideanBundleCommonIntrinsics(two_frames_tracks,
-                                      BUNDLE_NO_INTRINSICS,
-                                      BUNDLE_NO_CONSTRAINTS,
-                                      &reconstruction,
-                                      &empty_intrinsics,
-                                      &evaluation);
-
-      Mat& jacobian = evaluation.jacobian;
-
-      Mat JT_J = jacobian.transpose() * jacobian;
-      // There are 7 degrees of freedom, so clamp them out.
-      Mat JT_J_inv = PseudoInverseWithClampedEigenvalues(JT_J, 7);
+      success_intersects_factor_best = candidate.success_intersects_factor;
+      bundled_candidates.push_back(i);
+    }
 
-      Mat temp_derived = JT_J * JT_J_inv * JT_J;
-      bool is_inversed = (temp_derived - JT_J).cwiseAbs2().sum() <
-                         1e-4 * std::min(temp_derived.cwiseAbs2().sum(),
-                                         JT_J.cwiseAbs2().sum());
+    int num_bundled_candidates = bundled_candidates.size();
+#if defined(_OPENMP)
+#  pragma omp parallel for schedule(dynamic)
+#endif
+    for (int i = 0; i < num_bundled_candidates; ++i) {
+      EstimateKeyframeCandidateError(current_keyframe,
+                                     &candidates[bundled_candidates[i]]);
+    }
 
-      LG << "Check on inversed: " << (is_inversed ? "true" : "false")
-         << ", det(JT_J): " << JT_J.determinant();
+    // Choose the best candidate in the order of images, so the result is
+    // the same as if the candidates were evaluated one after another.
+    for (int i = 0; i < num_bundled_candidates; ++i) {
+      const KeyframeCandidate& candidate = candidates[bundled_candidates[i]];
 
-      if (!is_inversed) {
-        LG << "Ignoring candidature due to poor jacobian stability";
+      if (!candidate.is_inversed) {
+        LG << "Ignoring candidature of " << candidate.image
+           << " due to poor jacobian stability";
         continue;
       }
 
-      Mat Sigma_P;
-      Sigma_P = JT_J_inv.bottomRightCorner(evaluation.num_points * 3,
-                                           evaluation.num_points * 3);
-
-      int I = evaluation.num_points;
-      int A = 12;
-
-      double Sc = static_cast<double>(I + A) / Square(3 * I) * Sigma_P.trace();
-
-      LG << "Expected estimation error between " << current_keyframe << " and "
-         << candidate_image << ": " << Sc;
-
       // Pairing with a lower Sc indicates a better choice
-      if (Sc > Sc_best_candidate)
+      if (candidate.Sc > Sc_best_candidate)
         continue;
 
-      Sc_best_candidate = Sc;
+      Sc_best_candidate = candidate.Sc;
 
-      next_keyframe = candidate_image;
+      next_keyframe = candidate.image;
     }
 
     // This is a bit arbitrary and main reason of having this is to deal
@@ -21,12 +21,54 @@
 #ifndef LIBMV_SIMPLE_PIPELINE_KEYFRAME_SELECTION_H_
 #define LIBMV_SIMPLE_PIPELINE_KEYFRAME_SELECTION_H_
 
+#include <utility>
+
+#include "libmv/base/map.h"
 #include "libmv/base/vector.h"
 #include "libmv/simple_pipeline/camera_intrinsics.h"
 #include "libmv/simple_pipeline/tracks.h"
 
 namespace libmv {
 
+struct KeyframeSelectionOptions {
+  KeyframeSelectionOptions();
+
+  // Limit correspondence ratio from both sides.
+  // On the one hand if number of correspondent features is too low,
+  // triangulation will suffer.
+  // On the other hand high correspondence likely means short baseline.
+  // which also will affect om accuracy.
+  double min_correspondence_ratio;
+  double max_correspondence_ratio;
+};
+
+// Cache of the two-view estimates used by the keyframe selection.
+//
+// Homography and fundamental matrix of a pair of images only depend on the
+// tracks and intrinsics, so the cache could be shared by several runs of the
+// keyframe selection with different options. It is up to the caller to clear
+// the cache when tracks or intrinsics change.
+class KeyframeSelectionCache {
+ public:
+  struct TwoViewEstimate {
+    // Homography and fundamental matrix in the pixel space.
+    Mat3 H;
+    Mat3 F;
+  };
+
+  // Returns false if there is no estimate for the given pair of images.
+  bool Lookup(int image1, int image2, TwoViewEstimate* estimate) const;
+
+  void Insert(int image1, int image2, const TwoViewEstimate& estimate);
+
+  void Clear();
+
+  int NumEstimates() const;
+
+ private:
+  map<std::pair<int, int>, TwoViewEstimate> estimates_;
+};
+
 // Get list of all images which are good enough to be as keyframes from
 // camera reconstruction. Based on GRIC criteria and uses Pollefeys'
 // approach for correspondence ratio constraint.
@@ -47,6 +89,18 @@ void SelectKeyframesBasedOnGRICAndVariance(const Tracks& tracks,
                                            const CameraIntrinsics& intrinsics,
                                            vector<int>& keyframes);
 
+// Same as above, but with configurable options.
+//
+// Candidate keyframes are evaluated in parallel. If cache is not NULL,
+// two-view estimates are taken from it when possible and the newly computed
+// ones are stored there.
+void SelectKeyframesBasedOnGRICAndVariance(
+    const Tracks& tracks,
+    const CameraIntrinsics& intrinsics,
+    const KeyframeSelectionOptions& options,
+    KeyframeSelectionCache* cache,
+    vector<int>& keyframes);
+
 }  // namespace libmv
 
 #endif  // LIBMV_SIMPLE_PIPELINE_KEYFRAME_SELECTION_H_
@@ -58,6 +58,64 @@ TEST(KeyframeSelection, SyntheticNeighborFrame) {
   EXPECT_EQ(0, keyframes.size());
 }
 
+// Same synthetic frames as above, but selection happens several times
+// with the same cache and different options.
+TEST(KeyframeSelection, SyntheticNeighborFrameWithCache) {
+  PolynomialCameraIntrinsics intrinsics;
+  intrinsics.SetFocalLength(900.0, 900.0);
+  intrinsics.SetPrincipalPoint(640.0, 540.0);
+  intrinsics.SetRadialDistortion(0.0, 0.0, 0.0);
+
+  Tracks tracks;
+  const int markers_per_size = 15;
+
+  for (int x = 0; x < markers_per_size; x++) {
+    for (int y = 0; y < markers_per_size; y++) {
+      double current_x = 10 + x * 40, current_y = 10 + y * 40;
+      double next_x = current_x + 10, next_y = current_y + 10;
+
+      intrinsics.InvertIntrinsics(current_x, current_y, &current_x, &current_y);
+      intrinsics.InvertIntrinsics(next_x, next_y, &next_x, &next_y);
+
+      tracks.Insert(1, y * markers_per_size + x, current_x, current_y);
+      tracks.Insert(2, y * markers_per_size + x, next_x, next_y);
+    }
+  }
+
+  KeyframeSelectionCache cache;
+  KeyframeSelectionOptions options;
+  vector<int> keyframes;
+
+  SelectKeyframesBasedOnGRICAndVariance(
+      tracks, intrinsics, options, &cache, keyframes);
+  EXPECT_EQ(0, keyframes.size());
+  EXPECT_EQ(1, cache.NumEstimates());
+
+  KeyframeSelectionCache::TwoViewEstimate estimate;
+  EXPECT_TRUE(cache.Lookup(1, 2, &estimate));
+  EXPECT_FALSE(cache.Lookup(2, 1, &estimate));
+
+  // Re-tuned options re-use the estimate from the cache. It is replaced by a
+  // recognisable one, which would be overwritten by a new estimate.
+  KeyframeSelectionCache::TwoViewEstimate sentinel;
+  sentinel.H = Mat3::Identity();
+  sentinel.F << 0, -3, 2,
+                3, 0, -1,
+                -2, 1, 0;
+  cache.Insert(1, 2, sentinel);
+  options.min_correspondence_ratio = 0.9;
+  SelectKeyframesBasedOnGRICAndVariance(
+      tracks, intrinsics, options, &cache, keyframes);
+  EXPECT_EQ(0, keyframes.size());
+  EXPECT_EQ(1, cache.NumEstimates());
+  ASSERT_TRUE(cache.Lookup(1, 2, &estimate));
+  EXPECT_EQ(sentinel.H, estimate.H);
+  EXPECT_EQ(sentinel.F, estimate.F);
+
+  cache.Clear();
+  EXPECT_EQ(0, cache.NumEstimates());
+}
+
 // Frames 1 and 2 of FabrikEingang footage
 // Only one wall is tracked, should not be keyframes
 TEST(KeyframeSelection, FabrikEingangNeighborFrames) {
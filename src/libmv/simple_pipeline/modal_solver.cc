@@ -18,12 +18,15 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
 // IN THE SOFTWARE.
 
+// Ceres includes Eigen/StdVector, which specializes std::vector for the
+// aligned allocator and has to be seen before libmv::vector is instantiated.
+#include "ceres/ceres.h"
+#include "ceres/rotation.h"
+
 #include "libmv/simple_pipeline/modal_solver.h"
 
 #include <cstdio>
 
-#include "ceres/ceres.h"
-#include "ceres/rotation.h"
 #include "libmv/logging/logging.h"
 #include "libmv/multiview/panography.h"
 
@@ -20,8 +20,14 @@
 
 #include "libmv/simple_pipeline/pipeline.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
 
+#if defined(_OPENMP)
+#  include <omp.h>
+#endif
+
 #include "libmv/logging/logging.h"
 #include "libmv/simple_pipeline/bundle.h"
 #include "libmv/simple_pipeline/camera_intrinsics.h"
@@ -52,31 +58,41 @@ struct EuclideanPipelineRoutines {
   }
 
   static bool Resect(const vector<Marker>& markers,
-                     EuclideanReconstruction* reconstruction,
-                     bool final_pass) {
-    return EuclideanResect(markers, reconstruction, final_pass);
+                     const EuclideanReconstruction& reconstruction,
+                     bool final_pass,
+                     EuclideanCamera* camera) {
+    return EuclideanResect(markers, reconstruction, final_pass, camera);
   }
 
   static bool Intersect(const vector<Marker>& markers,
-                        EuclideanReconstruction* reconstruction) {
-    return EuclideanIntersect(markers, reconstruction);
+                        const EuclideanReconstruction& reconstruction,
+                        EuclideanPoint* point) {
+    return EuclideanIntersect(markers, reconstruction, point);
   }
 
-  static Marker ProjectMarker(const EuclideanPoint& point,
-                              const EuclideanCamera& camera,
-                              const CameraIntrinsics& intrinsics) {
-    Vec3 projected = camera.R * point.X + camera.t;
-    projected /= projected(2);
-
-    Marker reprojected_marker;
-    intrinsics.ApplyIntrinsics(projected(0),
-                               projected(1),
-                               &reprojected_marker.x,
-                               &reprojected_marker.y);
-
-    reprojected_marker.image = camera.image;
-    reprojected_marker.track = point.track;
-    return reprojected_marker;
+  static void InsertCamera(const EuclideanCamera& camera,
+                           EuclideanReconstruction* reconstruction) {
+    reconstruction->InsertCamera(camera.image, camera.R, camera.t);
+  }
+
+  static void InsertPoint(const EuclideanPoint& point,
+                          EuclideanReconstruction* reconstruction) {
+    reconstruction->InsertPoint(point.track, point.X);
+  }
+
+  // Project points into the normalized image space of the camera.
+  static void ProjectPoints(const EuclideanCamera& camera,
+                            const vector<const EuclideanPoint*>& points,
+                            Mat2X* projected) {
+    Mat3X X(3, points.size());
+    for (int i = 0; i < points.size(); ++i) {
+      X.col(i) = points[i]->X;
+    }
+
+    Mat3X x = camera.R * X;
+    x.colwise() += camera.t;
+
+    *projected = x.topRows<2>().array().rowwise() / x.row(2).array();
   }
 };
 
@@ -91,33 +107,42 @@ struct ProjectivePipelineRoutines {
   }
 
   static bool Resect(const vector<Marker>& markers,
-                     ProjectiveReconstruction* reconstruction,
-                     bool final_pass) {
+                     const ProjectiveReconstruction& reconstruction,
+                     bool final_pass,
+                     ProjectiveCamera* camera) {
     (void)final_pass;  // Ignored.
 
-    return ProjectiveResect(markers, reconstruction);
+    return ProjectiveResect(markers, reconstruction, camera);
   }
 
   static bool Intersect(const vector<Marker>& markers,
-                        ProjectiveReconstruction* reconstruction) {
-    return ProjectiveIntersect(markers, reconstruction);
+                        const ProjectiveReconstruction& reconstruction,
+                        ProjectivePoint* point) {
+    return ProjectiveIntersect(markers, reconstruction, point);
   }
 
-  static Marker ProjectMarker(const ProjectivePoint& point,
-                              const ProjectiveCamera& camera,
-                              const CameraIntrinsics& intrinsics) {
-    Vec3 projected = camera.P * point.X;
-    projected /= projected(2);
-
-    Marker reprojected_marker;
-    intrinsics.ApplyIntrinsics(projected(0),
-                               projected(1),
-                               &reprojected_marker.x,
-                               &reprojected_marker.y);
-
-    reprojected_marker.image = camera.image;
-    reprojected_marker.track = point.track;
-    return reprojected_marker;
+  static void InsertCamera(const ProjectiveCamera& camera,
+                           ProjectiveReconstruction* reconstruction) {
+    reconstruction->InsertCamera(camera.image, camera.P);
+  }
+
+  static void InsertPoint(const ProjectivePoint& point,
+                          ProjectiveReconstruction* reconstruction) {
+    reconstruction->InsertPoint(point.track, point.X);
+  }
+
+  // Project points into the normalized image space of the camera.
+  static void ProjectPoints(const ProjectiveCamera& camera,
+                            const vector<const ProjectivePoint*>& points,
+                            Mat2X* projected) {
+    Mat4X X(4, points.size());
+    for (int i = 0; i < points.size(); ++i) {
+      X.col(i) = points[i]->X;
+    }
+
+    Mat3X x = camera.P * X;
+
+    *projected = x.topRows<2>().array().rowwise() / x.row(2).array();
   }
 };
 
@@ -146,6 +171,171 @@ static void CompleteReconstructionLogProgress(
   }
 }
 
+// Intersect all tracks which are not yet reconstructed but are visible in
+// at least two reconstructed cameras.
+//
+// Intersections within a single pass only depend on the cameras, so they are
+// all run in parallel, reading the cameras from the reconstruction which is
+// not modified until all of them are done. Resulting points are then merged
+// into the reconstruction in the order of tracks, so the result does not
+// depend on the number of threads.
+//
+// Returns number of successfully intersected tracks.
+template <typename PipelineRoutines>
+int InternalIntersectTracks(
+    const Tracks& tracks,
+    typename PipelineRoutines::Reconstruction* reconstruction,
+    ProgressUpdateCallback* update_callback,
+    double progress) {
+  typedef typename PipelineRoutines::Reconstruction Reconstruction;
+  typedef typename PipelineRoutines::Point Point;
+
+  const Reconstruction& const_reconstruction = *reconstruction;
+
+  // Collect all the intersections to be done.
+  vector<int> candidate_tracks;
+  vector<vector<Marker>> candidate_markers;
+  int max_track = tracks.MaxTrack();
+  for (int track = 0; track <= max_track; ++track) {
+    if (const_reconstruction.PointForTrack(track)) {
+      LG << "Skipping point: " << track;
+      continue;
+    }
+    vector<Marker> all_markers = tracks.MarkersForTrack(track);
+    LG << "Got " << all_markers.size() << " markers for track " << track;
+
+    vector<Marker> reconstructed_markers;
+    for (int i = 0; i < all_markers.size(); ++i) {
+      if (const_reconstruction.CameraForImage(all_markers[i].image)) {
+        reconstructed_markers.push_back(all_markers[i]);
+      }
+    }
+    LG << "Got " << reconstructed_markers.size()
+       << " reconstructed markers for track " << track;
+    if (reconstructed_markers.size() >= 2) {
+      candidate_tracks.push_back(track);
+      candidate_markers.push_back(reconstructed_markers);
+    }
+  }
+
+  int num_candidates = candidate_tracks.size();
+  vector<Point> points(num_candidates);
+  vector<char> is_intersected(num_candidates, false);
+
+  CompleteReconstructionLogProgress(update_callback, progress);
+
+#if defined(_OPENMP)
+#  pragma omp parallel for schedule(dynamic)
+#endif
+  for (int i = 0; i < num_candidates; ++i) {
+    is_intersected[i] = PipelineRoutines::Intersect(
+        candidate_markers[i], const_reconstruction, &points[i]);
+  }
+
+  int num_intersects = 0;
+  for (int i = 0; i < num_candidates; ++i) {
+    if (is_intersected[i]) {
+      PipelineRoutines::InsertPoint(points[i], reconstruction);
+      num_intersects++;
+      LG << "Ran Intersect() for track " << candidate_tracks[i];
+    } else {
+      LG << "Failed Intersect() for track " << candidate_tracks[i];
+    }
+  }
+
+  return num_intersects;
+}
+
+// Resect all images which are not yet reconstructed but have at least 5
+// reconstructed tracks.
+//
+// Same as with intersection, resections within a single pass only depend on
+// the points, so they are run in parallel and merged into the reconstruction
+// in the order of images.
+//
+// Progress is reported from the calling thread only, as the callbacks are
+// not required to be thread-safe.
+//
+// Returns number of successfully resected images.
+template <typename PipelineRoutines>
+int InternalResectImages(
+    const Tracks& tracks,
+    typename PipelineRoutines::Reconstruction* reconstruction,
+    bool final_pass,
+    ProgressUpdateCallback* update_callback,
+    int tot_resects) {
+  typedef typename PipelineRoutines::Reconstruction Reconstruction;
+  typedef typename PipelineRoutines::Camera Camera;
+
+  const Reconstruction& const_reconstruction = *reconstruction;
+
+  // Collect all the resections to be done.
+  vector<int> candidate_images;
+  vector<vector<Marker>> candidate_markers;
+  int max_image = tracks.MaxImage();
+  for (int image = 0; image <= max_image; ++image) {
+    if (const_reconstruction.CameraForImage(image)) {
+      LG << "Skipping frame: " << image;
+      continue;
+    }
+    vector<Marker> all_markers = tracks.MarkersInImage(image);
+    LG << "Got " << all_markers.size() << " markers for image " << image;
+
+    vector<Marker> reconstructed_markers;
+    for (int i = 0; i < all_markers.size(); ++i) {
+      if (const_reconstruction.PointForTrack(all_markers[i].track)) {
+        reconstructed_markers.push_back(all_markers[i]);
+      }
+    }
+    LG << "Got " << reconstructed_markers.size()
+       << " reconstructed markers for image " << image;
+    if (reconstructed_markers.size() >= 5) {
+      candidate_images.push_back(image);
+      candidate_markers.push_back(reconstructed_markers);
+    }
+  }
+
+  int num_candidates = candidate_images.size();
+  vector<Camera> cameras(num_candidates);
+  vector<char> is_resected(num_candidates, false);
+  std::atomic<int> num_done(0);
+
+  CompleteReconstructionLogProgress(update_callback,
+                                    (double)tot_resects / max_image);
+
+#if defined(_OPENMP)
+#  pragma omp parallel for schedule(dynamic)
+#endif
+  for (int i = 0; i < num_candidates; ++i) {
+    is_resected[i] = PipelineRoutines::Resect(
+        candidate_markers[i], const_reconstruction, final_pass, &cameras[i]);
+
+    int done = ++num_done;
+#if defined(_OPENMP)
+    if (omp_get_thread_num() == 0)
+#endif
+    {
+      CompleteReconstructionLogProgress(
+          update_callback, (double)(tot_resects + done) / max_image);
+    }
+  }
+
+  int num_resects = 0;
+  for (int i = 0; i < num_candidates; ++i) {
+    if (is_resected[i]) {
+      PipelineRoutines::InsertCamera(cameras[i], reconstruction);
+      num_resects++;
+      LG << "Ran " << (final_pass ? "final " : "") << "Resect() for image "
+         << candidate_images[i];
+    } else {
+      LG << "Failed " << (final_pass ? "final " : "") << "Resect() for image "
+         << candidate_images[i];
+    }
+  }
+
+  return num_resects;
+}
+
 template <typename PipelineRoutines>
 void InternalCompleteReconstruction(
     const Tracks& tracks,
@@ -161,35 +351,11 @@ void InternalCompleteReconstruction(
   LG << "Number of markers: " << tracks.NumMarkers();
   while (num_resects != 0 || num_intersects != 0) {
     // Do all possible intersections.
-    num_intersects = 0;
-    for (int track = 0; track <= max_track; ++track) {
-      if (reconstruction->PointForTrack(track)) {
-        LG << "Skipping point: " << track;
-        continue;
-      }
-      vector<Marker> all_markers = tracks.MarkersForTrack(track);
-      LG << "Got " << all_markers.size() << " markers for track " << track;
-
-      vector<Marker> reconstructed_markers;
-      for (int i = 0; i < all_markers.size(); ++i) {
-        if (reconstruction->CameraForImage(all_markers[i].image)) {
-          reconstructed_markers.push_back(all_markers[i]);
-        }
-      }
-      LG << "Got " << reconstructed_markers.size()
-         << " reconstructed markers for track " << track;
-      if (reconstructed_markers.size() >= 2) {
-        CompleteReconstructionLogProgress(update_callback,
-                                          (double)tot_resects / (max_image));
-        if (PipelineRoutines::Intersect(reconstructed_markers,
-                                        reconstruction)) {
-          num_intersects++;
-          LG << "Ran Intersect() for track " << track;
-        } else {
-          LG << "Failed Intersect() for track " << track;
-        }
-      }
-    }
+    num_intersects = InternalIntersectTracks<PipelineRoutines>(
+        tracks,
+        reconstruction,
+        update_callback,
+        (double)tot_resects / (max_image));
     if (num_intersects) {
       CompleteReconstructionLogProgress(
           update_callback, (double)tot_resects / (max_image), "Bundling...");
@@ -199,36 +365,9 @@ void InternalCompleteReconstruction(
     LG << "Did " << num_intersects << " intersects.";
 
     // Do all possible resections.
-    num_resects = 0;
-    for (int image = 0; image <= max_image; ++image) {
-      if (reconstruction->CameraForImage(image)) {
-        LG << "Skipping frame: " << image;
-        continue;
-      }
-      vector<Marker> all_markers = tracks.MarkersInImage(image);
-      LG << "Got " << all_markers.size() << " markers for image " << image;
-
-      vector<Marker> reconstructed_markers;
-      for (int i = 0; i < all_markers.size(); ++i) {
-        if (reconstruction->PointForTrack(all_markers[i].track)) {
-          reconstructed_markers.push_back(all_markers[i]);
-        }
-      }
-      LG << "Got " << reconstructed_markers.size()
-         << " reconstructed markers for image " << image;
-      if (reconstructed_markers.size() >= 5) {
-        CompleteReconstructionLogProgress(update_callback,
-                                          (double)tot_resects / (max_image));
-        if (PipelineRoutines::Resect(
-                reconstructed_markers, reconstruction, false)) {
-          num_resects++;
-          tot_resects++;
-          LG << "Ran Resect() for image " << image;
-        } else {
-          LG << "Failed Resect() for image " << image;
-        }
-      }
-    }
+    num_resects = InternalResectImages<PipelineRoutines>(
+        tracks, reconstruction, false, update_callback, tot_resects);
+    tot_resects += num_resects;
     if (num_resects) {
       CompleteReconstructionLogProgress(
           update_callback, (double)tot_resects / (max_image), "Bundling...");
@@ -238,32 +377,8 @@ void InternalCompleteReconstruction(
   }
 
   // One last pass...
-  num_resects = 0;
-  for (int image = 0; image <= max_image; ++image) {
-    if (reconstruction->CameraForImage(image)) {
-      LG << "Skipping frame: " << image;
-      continue;
-    }
-    vector<Marker> all_markers = tracks.MarkersInImage(image);
-
-    vector<Marker> reconstructed_markers;
-    for (int i = 0; i < all_markers.size(); ++i) {
-      if (reconstruction->PointForTrack(all_markers[i].track)) {
-        reconstructed_markers.push_back(all_markers[i]);
-      }
-    }
-    if (reconstructed_markers.size() >= 5) {
-      CompleteReconstructionLogProgress(update_callback,
-                                        (double)tot_resects / (max_image));
-      if (PipelineRoutines::Resect(
-              reconstructed_markers, reconstruction, true)) {
-        num_resects++;
-        LG << "Ran final Resect() for image " << image;
-      } else {
-        LG << "Failed final Resect() for image " << image;
-      }
-    }
-  }
+  num_resects = InternalResectImages<PipelineRoutines>(
+      tracks, reconstruction, true, update_callback, tot_resects);
   if (num_resects) {
     CompleteReconstructionLogProgress(
         update_callback, (double)tot_resects / (max_image), "Bundling...");
@@ -271,74 +386,132 @@ void InternalCompleteReconstruction(
   }
 }
 
+static void AccumulateReprojectionError(
+    double error, ReprojectionErrorStatistics* statistics) {
+  statistics->num_markers++;
+  statistics->total_error += error;
+  statistics->max_error = std::max(statistics->max_error, error);
+}
+
 template <typename PipelineRoutines>
-double InternalReprojectionError(
+void InternalReprojectionErrorReport(
     const Tracks& image_tracks,
     const typename PipelineRoutines::Reconstruction& reconstruction,
-    const CameraIntrinsics& intrinsics) {
-  int num_skipped = 0;
-  int num_reprojected = 0;
-  double total_error = 0.0;
+    const CameraIntrinsics& intrinsics,
+    ReprojectionErrorReport* report) {
+  typedef typename PipelineRoutines::Camera Camera;
+  typedef typename PipelineRoutines::Point Point;
+
+  int max_image = image_tracks.MaxImage();
+  int max_track = image_tracks.MaxTrack();
+
+  *report = ReprojectionErrorReport();
+  report->images.resize(max_image + 1);
+  report->tracks.resize(max_track + 1);
+
+  // Bucket markers by image, skipping the ones which can not be reprojected.
+  vector<vector<Marker>> markers_in_image(max_image + 1);
   vector<Marker> markers = image_tracks.AllMarkers();
   for (int i = 0; i < markers.size(); ++i) {
-    double weight = markers[i].weight;
-    const typename PipelineRoutines::Camera* camera =
-        reconstruction.CameraForImage(markers[i].image);
-    const typename PipelineRoutines::Point* point =
-        reconstruction.PointForTrack(markers[i].track);
-    if (!camera || !point || weight == 0.0) {
-      num_skipped++;
+    const Marker& marker = markers[i];
+    if (marker.weight == 0.0 || !reconstruction.CameraForImage(marker.image) ||
+        !reconstruction.PointForTrack(marker.track)) {
+      report->num_skipped++;
       continue;
     }
-    num_reprojected++;
-
-    Marker reprojected_marker =
-        PipelineRoutines::ProjectMarker(*point, *camera, intrinsics);
-    double ex = (reprojected_marker.x - markers[i].x) * weight;
-    double ey = (reprojected_marker.y - markers[i].y) * weight;
-
-    const int N = 100;
-    char line[N];
-    snprintf(line,
-             N,
-             "image %-3d track %-3d "
-             "x %7.1f y %7.1f "
-             "rx %7.1f ry %7.1f "
-             "ex %7.1f ey %7.1f"
-             "    e %7.1f",
-             markers[i].image,
-             markers[i].track,
-             markers[i].x,
-             markers[i].y,
-             reprojected_marker.x,
-             reprojected_marker.y,
-             ex,
-             ey,
-             sqrt(ex * ex + ey * ey));
-    VLOG(1) << line;
-
-    total_error += sqrt(ex * ex + ey * ey);
+    markers_in_image[marker.image].push_back(marker);
+  }
+
+  // Errors of every marker, in the same order as markers_in_image.
+  vector<Vec> errors_in_image(max_image + 1);
+
+#if defined(_OPENMP)
+#  pragma omp parallel for schedule(dynamic)
+#endif
+  for (int image = 0; image <= max_image; ++image) {
+    const vector<Marker>& image_markers = markers_in_image[image];
+    if (image_markers.empty()) {
+      continue;
+    }
+
+    const Camera& camera = *reconstruction.CameraForImage(image);
+    vector<const Point*> points(image_markers.size());
+    for (int i = 0; i < image_markers.size(); ++i) {
+      points[i] = reconstruction.PointForTrack(image_markers[i].track);
+    }
+
+    Mat2X projected;
+    PipelineRoutines::ProjectPoints(camera, points, &projected);
+
+    Vec& errors = errors_in_image[image];
+    errors.resize(image_markers.size());
+    for (int i = 0; i < image_markers.size(); ++i) {
+      const Marker& marker = image_markers[i];
+      double reprojected_x, reprojected_y;
+      intrinsics.ApplyIntrinsics(
+          projected(0, i), projected(1, i), &reprojected_x, &reprojected_y);
+
+      double ex = (reprojected_x - marker.x) * marker.weight;
+      double ey = (reprojected_y - marker.y) * marker.weight;
+      errors(i) = sqrt(ex * ex + ey * ey);
+    }
+  }
+
+  // Merge in the order of images, so the result does not depend on the
+  // number of threads.
+  for (int image = 0; image <= max_image; ++image) {
+    const vector<Marker>& image_markers = markers_in_image[image];
+    const Vec& errors = errors_in_image[image];
+    for (int i = 0; i < image_markers.size(); ++i) {
+      AccumulateReprojectionError(errors(i), &report->images[image]);
+      AccumulateReprojectionError(errors(i),
+                                  &report->tracks[image_markers[i].track]);
+      AccumulateReprojectionError(errors(i), &report->total);
+    }
   }
-  LG << "Skipped " << num_skipped << " markers.";
-  LG << "Reprojected " << num_reprojected << " markers.";
-  LG << "Total error: " << total_error << " px";
-  LG << "Average error: " << (total_error / num_reprojected) << " px";
-  return total_error / num_reprojected;
+
+  LG << "Skipped " << report->num_skipped << " markers.";
+  LG << "Reprojected " << report->total.num_markers << " markers.";
+  LG << "Total error: " << report->total.total_error << " px";
+  LG << "Average error: " << report->total.AverageError() << " px";
+  LG << "Maximal error: " << report->total.max_error << " px";
+}
+
+void EuclideanReprojectionErrorReport(
+    const Tracks& image_tracks,
+    const EuclideanReconstruction& reconstruction,
+    const CameraIntrinsics& intrinsics,
+    ReprojectionErrorReport* report) {
+  InternalReprojectionErrorReport<EuclideanPipelineRoutines>(
+      image_tracks, reconstruction, intrinsics, report);
+}
+
+void ProjectiveReprojectionErrorReport(
+    const Tracks& image_tracks,
+    const ProjectiveReconstruction& reconstruction,
+    const CameraIntrinsics& intrinsics,
+    ReprojectionErrorReport* report) {
+  InternalReprojectionErrorReport<ProjectivePipelineRoutines>(
+      image_tracks, reconstruction, intrinsics, report);
 }
 
 double EuclideanReprojectionError(const Tracks& image_tracks,
                                   const EuclideanReconstruction& reconstruction,
                                   const CameraIntrinsics& intrinsics) {
-  return InternalReprojectionError<EuclideanPipelineRoutines>(
-      image_tracks, reconstruction, intrinsics);
+  ReprojectionErrorReport report;
+  EuclideanReprojectionErrorReport(
+      image_tracks, reconstruction, intrinsics, &report);
+  return report.total.total_error / report.total.num_markers;
 }
 
 double ProjectiveReprojectionError(
     const Tracks& image_tracks,
     const ProjectiveReconstruction& reconstruction,
     const CameraIntrinsics& intrinsics) {
-  return InternalReprojectionError<ProjectivePipelineRoutines>(
-      image_tracks, reconstruction, intrinsics);
+  ReprojectionErrorReport report;
+  ProjectiveReprojectionErrorReport(
+      image_tracks, reconstruction, intrinsics, &report);
+  return report.total.total_error / report.total.num_markers;
 }
 
 void EuclideanCompleteReconstruction(const Tracks& tracks,
@@ -79,6 +79,64 @@ class CameraIntrinsics;
 // TODO(keir): Decide if we want these in the public API, and if so, what the
 // appropriate include file is.
 
+// Accumulated reprojection error of a set of markers.
+struct ReprojectionErrorStatistics {
+  ReprojectionErrorStatistics()
+      : num_markers(0), total_error(0.0), max_error(0.0) {}
+
+  double AverageError() const {
+    return num_markers ? total_error / num_markers : 0.0;
+  }
+
+  // Number of markers which were reprojected.
+  int num_markers;
+
+  // Sum and maximum of weighted reprojection errors of the markers, in pixels.
+  double total_error;
+  double max_error;
+};
+
+// Reprojection error of all the markers of the reconstruction, also broken
+// down per image and per track.
+struct ReprojectionErrorReport {
+  ReprojectionErrorReport() : num_skipped(0) {}
+
+  // Number of markers which were not reprojected because they have zero
+  // weight or their camera or point is not reconstructed.
+  int num_skipped;
+
+  // Statistics of all the reprojected markers.
+  ReprojectionErrorStatistics total;
+
+  // Statistics of markers, indexed by image and by track respectively.
+  // Images and tracks which have no reprojected markers have empty
+  // statistics.
+  vector<ReprojectionErrorStatistics> images;
+  vector<ReprojectionErrorStatistics> tracks;
+};
+
+/*!
+    Compute reprojection error of all markers in \a image_tracks.
+
+    Markers of every image are projected at once and images are processed in
+    parallel. Only summary is written to the log, the detailed statistics are
+    stored in \a report.
+*/
+void EuclideanReprojectionErrorReport(
+    const Tracks& image_tracks,
+    const EuclideanReconstruction& reconstruction,
+    const CameraIntrinsics& intrinsics,
+    ReprojectionErrorReport* report);
+
+void ProjectiveReprojectionErrorReport(
+    const Tracks& image_tracks,
+    const ProjectiveReconstruction& reconstruction,
+    const CameraIntrinsics& intrinsics,
+    ReprojectionErrorReport* report);
+
+// Average reprojection error of all markers, in pixels. Unlike
+// ReprojectionErrorStatistics::AverageError(), this is NaN when no marker
+// could be reprojected.
 double EuclideanReprojectionError(const Tracks& image_tracks,
                                   const EuclideanReconstruction& reconstruction,
                                   const CameraIntrinsics& intrinsics);
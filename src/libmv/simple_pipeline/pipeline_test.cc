@@ -0,0 +1,231 @@
+// Copyright (c) 2020 libmv authors.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#include "libmv/simple_pipeline/pipeline.h"
+
+#include <cmath>
+
+#if defined(_OPENMP)
+#  include <omp.h>
+#endif
+
+#include "libmv/logging/logging.h"
+#include "libmv/multiview/projection.h"
+#include "libmv/simple_pipeline/camera_intrinsics.h"
+#include "libmv/simple_pipeline/reconstruction.h"
+#include "libmv/simple_pipeline/tracks.h"
+#include "testing/testing.h"
+
+namespace libmv {
+
+namespace {
+
+// Cameras moving sideways along a cloud of points, every point is visible in
+// a window of consecutive cameras. Markers are in normalized coordinates.
+void CreateSyntheticSequence(int num_cameras,
+                             int num_points,
+                             int cameras_per_point,
+                             Tracks* tracks,
+                             EuclideanReconstruction* ground_truth) {
+  Mat3X X(3, num_points);
+  X.setRandom();
+  X.row(0) *= 2.0;
+
+  for (int i = 0; i < num_cameras; ++i) {
+    Mat3 R = RotationAroundY(0.02 * i);
+    Vec3 t(-0.25 * i, 0.05 * i, 4.0);
+    ground_truth->InsertCamera(i, R, t);
+
+    for (int j = 0; j < num_points; ++j) {
+      int first_camera = j % (num_cameras - cameras_per_point + 1);
+      if (i < first_camera || i >= first_camera + cameras_per_point) {
+        continue;
+      }
+      Vec3 x = R * X.col(j) + t;
+      tracks->Insert(i, j, x(0) / x(2), x(1) / x(2));
+    }
+  }
+
+  for (int j = 0; j < num_points; ++j) {
+    ground_truth->InsertPoint(j, X.col(j));
+  }
+}
+
+void SetNumThreads(int num_threads) {
+#if defined(_OPENMP)
+  omp_set_num_threads(num_threads);
+#else
+  (void)num_threads;
+#endif
+}
+
+}  // namespace
+
+TEST(Pipeline, ParallelCompletionMatchesSerialCompletion) {
+  const int num_cameras = 8, num_points = 60;
+  Tracks tracks;
+  EuclideanReconstruction ground_truth;
+  CreateSyntheticSequence(num_cameras, num_points, 4, &tracks, &ground_truth);
+
+  // Start from the first two cameras, everything else has to be intersected
+  // and resected in several passes.
+  EuclideanReconstruction initial;
+  for (int i = 0; i < 2; ++i) {
+    const EuclideanCamera& camera = *ground_truth.CameraForImage(i);
+    initial.InsertCamera(i, camera.R, camera.t);
+  }
+
+#if defined(_OPENMP)
+  const int default_num_threads = omp_get_max_threads();
+#endif
+
+  SetNumThreads(1);
+  EuclideanReconstruction serial = initial;
+  EuclideanCompleteReconstruction(tracks, &serial);
+
+  SetNumThreads(4);
+  EuclideanReconstruction parallel = initial;
+  EuclideanCompleteReconstruction(tracks, &parallel);
+
+#if defined(_OPENMP)
+  SetNumThreads(default_num_threads);
+#endif
+
+  ASSERT_EQ(num_cameras, serial.AllCameras().size());
+  ASSERT_EQ(num_points, serial.AllPoints().size());
+  ASSERT_EQ(num_cameras, parallel.AllCameras().size());
+  ASSERT_EQ(num_points, parallel.AllPoints().size());
+
+  for (int i = 0; i < num_cameras; ++i) {
+    const EuclideanCamera& expected = *ground_truth.CameraForImage(i);
+    const EuclideanCamera* serial_camera = serial.CameraForImage(i);
+    const EuclideanCamera* parallel_camera = parallel.CameraForImage(i);
+    ASSERT_TRUE(serial_camera != NULL);
+    ASSERT_TRUE(parallel_camera != NULL);
+    EXPECT_MATRIX_NEAR(serial_camera->R, parallel_camera->R, 1e-12);
+    EXPECT_MATRIX_NEAR(serial_camera->t, parallel_camera->t, 1e-12);
+    EXPECT_MATRIX_NEAR(expected.R, serial_camera->R, 1e-6);
+    EXPECT_MATRIX_NEAR(expected.t, serial_camera->t, 1e-6);
+  }
+  for (int i = 0; i < num_points; ++i) {
+    const EuclideanPoint* serial_point = serial.PointForTrack(i);
+    const EuclideanPoint* parallel_point = parallel.PointForTrack(i);
+    ASSERT_TRUE(serial_point != NULL);
+    ASSERT_TRUE(parallel_point != NULL);
+    EXPECT_MATRIX_NEAR(serial_point->X, parallel_point->X, 1e-12);
+    EXPECT_MATRIX_NEAR(ground_truth.PointForTrack(i)->X, serial_point->X, 1e-6);
+  }
+}
+
+TEST(Pipeline, ReprojectionErrorReport) {
+  const int num_cameras = 4, num_points = 10;
+  Tracks normalized_tracks;
+  EuclideanReconstruction reconstruction;
+  CreateSyntheticSequence(num_cameras,
+                          num_points,
+                          num_cameras,
+                          &normalized_tracks,
+                          &reconstruction);
+
+  PolynomialCameraIntrinsics intrinsics;
+  intrinsics.SetFocalLength(500.0, 500.0);
+  intrinsics.SetPrincipalPoint(320.0, 240.0);
+
+  // Move every marker by a known offset in pixels, with half weight for
+  // the markers of odd tracks. Then the error of a marker is the length of
+  // its offset times its weight. The first marker has zero weight, so it is
+  // skipped.
+  Tracks tracks;
+  Mat expected_errors = Mat::Zero(num_cameras, num_points);
+  vector<Marker> markers = normalized_tracks.AllMarkers();
+  for (int i = 0; i < markers.size(); ++i) {
+    const Marker& marker = markers[i];
+    double x, y;
+    intrinsics.ApplyIntrinsics(marker.x, marker.y, &x, &y);
+    double dx = 0.5 * marker.image, dy = 0.25 * marker.track;
+    double weight = marker.track % 2 ? 0.5 : 1.0;
+    if (marker.image == 0 && marker.track == 0) {
+      weight = 0.0;
+    }
+    tracks.Insert(marker.image, marker.track, x + dx, y + dy, weight);
+    expected_errors(marker.image, marker.track) =
+        weight * std::sqrt(dx * dx + dy * dy);
+  }
+
+  // Markers of an image and a track which are not reconstructed are skipped
+  // too.
+  tracks.Insert(num_cameras, 1, 100.0, 100.0);
+  tracks.Insert(2, num_points, 100.0, 100.0);
+
+  ReprojectionErrorReport report;
+  EuclideanReprojectionErrorReport(tracks, reconstruction, intrinsics, &report);
+
+  EXPECT_EQ(3, report.num_skipped);
+  ASSERT_EQ(num_cameras + 1, report.images.size());
+  ASSERT_EQ(num_points + 1, report.tracks.size());
+
+  for (int i = 0; i < num_cameras; ++i) {
+    const ReprojectionErrorStatistics& statistics = report.images[i];
+    int expected_num_markers = i == 0 ? num_points - 1 : num_points;
+    EXPECT_EQ(expected_num_markers, statistics.num_markers);
+    EXPECT_NEAR(expected_errors.row(i).sum(), statistics.total_error, 1e-6);
+    EXPECT_NEAR(expected_errors.row(i).maxCoeff(), statistics.max_error, 1e-6);
+    EXPECT_NEAR(statistics.total_error / statistics.num_markers,
+                statistics.AverageError(),
+                1e-12);
+  }
+  for (int j = 0; j < num_points; ++j) {
+    EXPECT_NEAR(
+        expected_errors.col(j).sum(), report.tracks[j].total_error, 1e-6);
+  }
+  EXPECT_EQ(0, report.images[num_cameras].num_markers);
+  EXPECT_EQ(0, report.tracks[num_points].num_markers);
+
+  int num_markers = num_cameras * num_points - 1;
+  EXPECT_EQ(num_markers, report.total.num_markers);
+  EXPECT_NEAR(expected_errors.sum(), report.total.total_error, 1e-6);
+  EXPECT_NEAR(expected_errors.maxCoeff(), report.total.max_error, 1e-6);
+
+  // The scalar error is the average over all the reprojected markers.
+  EXPECT_NEAR(expected_errors.sum() / num_markers,
+              EuclideanReprojectionError(tracks, reconstruction, intrinsics),
+              1e-6);
+}
+
+TEST(Pipeline, ReprojectionErrorReportWithoutReconstructedMarkers) {
+  Tracks tracks;
+  tracks.Insert(0, 0, 10.0, 20.0);
+  tracks.Insert(1, 0, 30.0, 40.0);
+  EuclideanReconstruction reconstruction;
+  PolynomialCameraIntrinsics intrinsics;
+
+  ReprojectionErrorReport report;
+  EuclideanReprojectionErrorReport(tracks, reconstruction, intrinsics, &report);
+  EXPECT_EQ(2, report.num_skipped);
+  EXPECT_EQ(0, report.total.num_markers);
+  EXPECT_EQ(0.0, report.total.total_error);
+  EXPECT_EQ(0.0, report.total.AverageError());
+
+  // As before the report, the scalar error of no markers is undefined.
+  EXPECT_TRUE(std::isnan(
+      EuclideanReprojectionError(tracks, reconstruction, intrinsics)));
+}
+
+}  // namespace libmv
@@ -55,6 +55,17 @@ bool EuclideanResect(const vector<Marker>& markers,
                      EuclideanReconstruction* reconstruction,
                      bool final_pass);
 
+/*!
+    Same as above, but the points are only read from \a reconstruction and
+    the resected camera is returned in \a camera instead of being inserted.
+    This allows resecting many images against the same reconstruction in
+    parallel.
+*/
+bool EuclideanResect(const vector<Marker>& markers,
+                     const EuclideanReconstruction& reconstruction,
+                     bool final_pass,
+                     EuclideanCamera* camera);
+
 /*!
     Estimate the projective pose of a camera from 2D to 3D correspondences.
 
@@ -82,6 +93,14 @@ bool EuclideanResect(const vector<Marker>& markers,
 bool ProjectiveResect(const vector<Marker>& markers,
                       ProjectiveReconstruction* reconstruction);
 
+/*!
+    Same as above, but the points are only read from \a reconstruction and
+    the resected camera is returned in \a camera instead of being inserted.
+*/
+bool ProjectiveResect(const vector<Marker>& markers,
+                      const ProjectiveReconstruction& reconstruction,
+                      ProjectiveCamera* camera);
+
 }  // namespace libmv
 
 #endif  // LIBMV_SIMPLE_PIPELINE_RESECT_H
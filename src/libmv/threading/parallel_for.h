@@ -0,0 +1,66 @@
+// Copyright (c) 2020 libmv authors.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#ifndef LIBMV_THREADING_PARALLEL_FOR_H_
+#define LIBMV_THREADING_PARALLEL_FOR_H_
+
+#include <algorithm>
+
+#if defined(_OPENMP)
+#  include <omp.h>
+#endif
+
+namespace libmv {
+
+// Call function(begin, end) for consecutive ranges of [0, size), each of at
+// most grain_size elements. The ranges are processed in parallel by the
+// OpenMP threads, which are shared by all of libmv.
+//
+// When called from a parallel region already, for example by a tracker which
+// runs for many markers in parallel, all ranges are processed on the calling
+// thread, so the number of threads does not multiply. A single range is also
+// processed on the calling thread.
+template <typename Function>
+void ParallelForRanges(int size, int grain_size, const Function& function) {
+  const int num_ranges = (size + grain_size - 1) / grain_size;
+#if defined(_OPENMP)
+#  pragma omp parallel for schedule(dynamic) \
+      if (num_ranges > 1 && !omp_in_parallel())
+#endif
+  for (int i = 0; i < num_ranges; ++i) {
+    const int begin = i * grain_size;
+    function(begin, std::min(size, begin + grain_size));
+  }
+}
+
+// Number of threads which ParallelForRanges() uses when it is called from
+// the calling thread, for the algorithms which only split the work when it
+// is processed in parallel.
+inline int NumParallelThreads() {
+#if defined(_OPENMP)
+  return omp_in_parallel() ? 1 : omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+}  // namespace libmv
+
+#endif  // LIBMV_THREADING_PARALLEL_FOR_H_
@@ -20,44 +20,41 @@
 
 #include "libmv/tracking/pyramid_region_tracker.h"
 
-#include <vector>
-
-#include "libmv/image/convolve.h"
+#include "libmv/base/scoped_ptr.h"
 #include "libmv/image/image.h"
-#include "libmv/image/sample.h"
 #include "libmv/logging/logging.h"
 
 namespace libmv {
 
-static void MakePyramid(const FloatImage& image,
-                        int num_levels,
-                        std::vector<FloatImage>* pyramid) {
-  pyramid->resize(num_levels);
-  (*pyramid)[0] = image;
-  for (int i = 1; i < num_levels; ++i) {
-    DownsampleChannelsBy2((*pyramid)[i - 1], &(*pyramid)[i]);
-  }
-}
-
 bool PyramidRegionTracker::Track(const FloatImage& image1,
                                  const FloatImage& image2,
                                  double x1,
                                  double y1,
                                  double* x2,
                                  double* y2) const {
+  // Only the downsampled images of the pyramids are used, so the blurred
+  // levels are never computed and the sigma does not matter.
+  scoped_ptr<ImagePyramid> pyramid1(
+      MakeImagePyramid(image1, num_levels_, 0.9));
+  scoped_ptr<ImagePyramid> pyramid2(
+      MakeImagePyramid(image2, num_levels_, 0.9));
+  return Track(pyramid1.get(), pyramid2.get(), x1, y1, x2, y2);
+}
+
+bool PyramidRegionTracker::Track(ImagePyramid* pyramid1,
+                                 ImagePyramid* pyramid2,
+                                 double x1,
+                                 double y1,
+                                 double* x2,
+                                 double* y2) const {
+  assert(pyramid1->NumLevels() >= num_levels_);
+  assert(pyramid2->NumLevels() >= num_levels_);
+
   // Shrink the guessed x and y location to match the coarsest level + 1 (which
   // when gets corrected in the loop).
   *x2 /= pow(2., num_levels_);
   *y2 /= pow(2., num_levels_);
 
-  // Create all the levels of the pyramid, since tracking has to happen from
-  // the coarsest to finest levels, which means holding on to all levels of the
-  // pyraid at once.
-  std::vector<FloatImage> pyramid1(num_levels_);
-  std::vector<FloatImage> pyramid2(num_levels_);
-  MakePyramid(image1, num_levels_, &pyramid1);
-  MakePyramid(image2, num_levels_, &pyramid2);
-
   for (int i = num_levels_ - 1; i >= 0; --i) {
     // Position in the first image at pyramid level i.
     double xx = x1 / pow(2., i);
@@ -75,7 +72,12 @@ bool PyramidRegionTracker::Track(const FloatImage& image1,
     // Track the point on this level with the base tracker.
     LG << "Tracking on level " << i;
     bool succeeded =
-        tracker_->Track(pyramid1[i], pyramid2[i], xx, yy, &x2_new, &y2_new);
+        tracker_->Track(pyramid1->DownsampledImage(i),
+                        pyramid2->DownsampledImage(i),
+                        xx,
+                        yy,
+                        &x2_new,
+                        &y2_new);
 
     if (!succeeded) {
       if (i == 0) {
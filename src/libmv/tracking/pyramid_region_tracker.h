@@ -23,6 +23,7 @@
 
 #include "libmv/base/scoped_ptr.h"
 #include "libmv/image/image.h"
+#include "libmv/image/image_pyramid.h"
 #include "libmv/tracking/region_tracker.h"
 
 namespace libmv {
@@ -39,6 +40,19 @@ class PyramidRegionTracker : public RegionTracker {
                      double* x2,
                      double* y2) const;
 
+  // Track using the downsampled images of pyramids, which need to have at
+  // least num_levels levels. The image overload wraps its images in lazy
+  // pyramids and calls this one. Callers which track several markers on a
+  // frame can pass the same pyramids for all of them, for example those of
+  // PyramidSequence::Pyramid(), instead of downsampling the frame for every
+  // marker.
+  bool Track(ImagePyramid* pyramid1,
+             ImagePyramid* pyramid2,
+             double x1,
+             double y1,
+             double* x2,
+             double* y2) const;
+
  private:
   scoped_ptr<RegionTracker> tracker_;
   int num_levels_;
@@ -72,6 +72,25 @@ TEST(PyramidKltRegionTracker, Track) {
     EXPECT_NEAR(x2_actual, x2, 0.001);
     EXPECT_NEAR(y2_actual, y2, 0.001);
   }
+
+  // Same with pyramids shared between the tracks.
+  {
+    scoped_ptr<ImagePyramid> pyramid1(MakeImagePyramid(image1, 3, 0.9));
+    scoped_ptr<ImagePyramid> pyramid2(MakeImagePyramid(image2, 3, 0.9));
+
+    KltRegionTracker* klt_tracker = new KltRegionTracker;
+    klt_tracker->half_window_size = half_window_size;
+    PyramidRegionTracker tracker(klt_tracker, 3);
+
+    for (int i = 0; i < 2; ++i) {
+      double x2_actual = x1;
+      double y2_actual = y1;
+      EXPECT_TRUE(tracker.Track(
+          pyramid1.get(), pyramid2.get(), x1, y1, &x2_actual, &y2_actual));
+      EXPECT_NEAR(x2_actual, x2, 0.001);
+      EXPECT_NEAR(y2_actual, y2, 0.001);
+    }
+  }
 }
 
 }  // namespace
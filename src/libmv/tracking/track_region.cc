@@ -30,6 +30,7 @@
 #include <Eigen/QR>
 #include <Eigen/SVD>
 #include <iostream>
+#include <vector>
 #include "ceres/ceres.h"
 #include "libmv/image/convolve.h"
 #include "libmv/image/image.h"
@@ -1584,16 +1585,21 @@ bool SamplePlanarPatch(const FloatImage& image,
       ComputeCanonicalHomography(xs, ys, num_samples_x, num_samples_y);
 
   // Walk over the coordinates in the canonical space, sampling from the image
-  // in the original space and copying the result into the patch.
+  // in the original space and copying the result into the patch. The rows of
+  // the patch are sampled in one batch.
+  std::vector<float> image_xs(num_samples_x), image_ys(num_samples_x);
   for (int r = 0; r < num_samples_y; ++r) {
     for (int c = 0; c < num_samples_x; ++c) {
       Vec3 image_position = canonical_homography * Vec3(c, r, 1);
       image_position /= image_position(2);
-      SampleLinear(
-          image, image_position(1), image_position(0), &(*patch)(r, c, 0));
-      if (mask) {
-        float mask_value =
-            SampleLinear(*mask, image_position(1), image_position(0), 0);
+      image_xs[c] = image_position(0);
+      image_ys[c] = image_position(1);
+    }
+    SampleLinear(
+        image, num_samples_x, &image_ys[0], &image_xs[0], &(*patch)(r, 0, 0));
+    if (mask) {
+      for (int c = 0; c < num_samples_x; ++c) {
+        float mask_value = SampleLinear(*mask, image_ys[c], image_xs[c], 0);
 
         for (int d = 0; d < image.Depth(); d++)
           (*patch)(r, c, d) *= mask_value;
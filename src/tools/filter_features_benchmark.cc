@@ -0,0 +1,77 @@
+// Copyright (c) 2014 libmv authors.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+// Benchmark of filtering detected features by distance, for growing number of
+// randomly placed candidates.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "libmv/simple_pipeline/detect.h"
+#include "libmv/tools/tool.h"
+
+DEFINE_int32(width, 6144, "Width of the image the features are placed in.");
+DEFINE_int32(height, 3160, "Height of the image the features are placed in.");
+DEFINE_int32(min_distance, 10, "Minimal distance between features.");
+DEFINE_int32(max_candidates, 1000000, "Maximal number of candidates.");
+DEFINE_int32(repetitions, 3, "Number of runs for every number of candidates.");
+
+using namespace libmv;
+
+int main(int argc, char** argv) {
+  libmv::Init("Benchmark filtering of features by distance.", &argc, &argv);
+
+  srand(0);
+
+  printf("%12s %12s %12s\n", "candidates", "accepted", "time [ms]");
+  for (int num_candidates = 1000; num_candidates <= FLAGS_max_candidates;
+       num_candidates *= 10) {
+    vector<Feature> candidates;
+    for (int i = 0; i < num_candidates; ++i) {
+      candidates.push_back(Feature(rand() % FLAGS_width,
+                                   rand() % FLAGS_height,
+                                   (float)rand() / RAND_MAX,
+                                   5.0f));
+    }
+
+    // Report the best of the runs.
+    double best_time = 0.0;
+    int num_accepted = 0;
+    for (int i = 0; i < FLAGS_repetitions; ++i) {
+      vector<Feature> detected_features;
+      auto start = std::chrono::steady_clock::now();
+      FilterFeaturesByDistance(
+          candidates, FLAGS_min_distance, &detected_features);
+      auto end = std::chrono::steady_clock::now();
+
+      double time = std::chrono::duration<double, std::milli>(end - start)
+                        .count();
+      if (i == 0 || time < best_time) {
+        best_time = time;
+      }
+      num_accepted = detected_features.size();
+    }
+
+    printf("%12d %12d %12.3f\n", num_candidates, num_accepted, best_time);
+  }
+
+  return 0;
+}
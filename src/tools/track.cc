@@ -37,6 +37,9 @@
 DEFINE_bool(debug_images, true, "Output debug images.");
 DEFINE_double(sigma, 0.9, "Blur filter strength.");
 DEFINE_int32(pyramid_levels, 4, "Number of levels in the image pyramid.");
+DEFINE_bool(decode_coarse_levels, false,
+            "Decode the coarse pyramid levels from the files at reduced size, "
+            "which is faster for JPEG files, instead of downsampling.");
 
 using namespace libmv;
 
@@ -61,20 +64,22 @@ int main(int argc, char **argv) {
   }
 
   ImageCache cache;
-  scoped_ptr<ImageSequence> source(ImageSequenceFromFiles(files, &cache));
-  PyramidSequence *pyramid_sequence =
-      MakePyramidSequence(source.get(), FLAGS_pyramid_levels, FLAGS_sigma);
+  // Frames are tracked in order, so the next ones are decoded while the
+  // current one is tracked.
+  PyramidSequence *pyramid_sequence = MakePyramidSequenceFromFiles(
+      files, &cache, FLAGS_pyramid_levels, FLAGS_sigma,
+      FLAGS_decode_coarse_levels);
 
   KLTContext klt;
   Matches matches;
 
-  scoped_ptr<ImagePyramid> pyramid(pyramid_sequence->Pyramid(0));
+  ImagePyramid *pyramid = pyramid_sequence->Pyramid(0);
   KLTContext::FeatureList features;
   klt.DetectGoodFeatures(pyramid->Level(0), &features);
   int i = 0;
   for (KLTContext::FeatureList::iterator it = features.begin();
        it != features.end(); ++it, ++i) {
-    matches.Insert(0, i, *it);
+    matches.Insert(0, i, &*it);
   }
 
   for (size_t i = 1; i < files.size(); ++i) {
@@ -97,6 +102,8 @@ int main(int argc, char **argv) {
   // XXX
   //
   printf( "\n %2d tracks found\n", (int)matches.NumTracks());
+
+  delete pyramid_sequence;
   return 0;
 }
 